@@ -244,6 +244,32 @@ bridge_table_lookup(unsigned int vrf_id, struct vr_route_req *rt)
     return rt->rtr_nh;
 }
 
+/*
+ * bridge lookup of the datapath, which unlike vr_bridge_lookup does not
+ * need a vr_route_req. the label is valid only if the flags say so
+ */
+struct vr_nexthop *
+vr_bridge_lookup_mac(unsigned int vrf_id, unsigned char *mac,
+        unsigned int *label, unsigned short *label_flags)
+{
+    struct vr_bridge_entry *be;
+    struct vr_bridge_entry_key key;
+
+    VR_MAC_COPY(key.be_mac, mac);
+    key.be_vrf_id = vrf_id;
+
+    be = vr_find_bridge_entry(&key);
+    if (!be) {
+        *label_flags = 0;
+        return NULL;
+    }
+
+    *label_flags = be->be_flags;
+    *label = be->be_label;
+
+    return be->be_nh;
+}
+
 
 unsigned short
 vr_bridge_route_flags(unsigned int vrf_id, unsigned char *mac)
@@ -301,16 +327,51 @@ bridge_entry_req_destroy(struct vr_route_req *resp)
         vr_free(resp->rtr_req.rtr_mac);
 }
 
+/*
+ * entries are dumped in the order of their index, and a dump response
+ * carries the index of the entry in rtr_index. a request that sends the
+ * index of the marker back resumes right after it, instead of searching
+ * the table from the start for the marker, provided that the entry at the
+ * index is still the marker
+ */
+static unsigned int
+bridge_table_dump_cursor(struct vr_message_dumper *dumper)
+{
+    int index;
+    struct vr_route_req *req = (struct vr_route_req *)(dumper->dump_req);
+    struct vr_bridge_entry *be;
+
+    index = req->rtr_req.rtr_index;
+    if ((index < 0) ||
+            ((unsigned int)index >= (vr_bridge_entries + vr_bridge_oentries)))
+        return 0;
+
+    be = (struct vr_bridge_entry *)vr_get_hentry_by_index(vn_rtable, index);
+    if (!be || !(be->be_flags & VR_BE_VALID_FLAG))
+        return 0;
+
+    if ((be->be_key.be_vrf_id != req->rtr_req.rtr_vrf_id) ||
+            !VR_MAC_CMP(be->be_key.be_mac, req->rtr_req.rtr_mac))
+        return 0;
+
+    dumper->dump_been_to_marker = 1;
+
+    return index + 1;
+}
+
 static int
 __bridge_table_dump(struct vr_message_dumper *dumper)
 {
     struct vr_route_req *req = (struct vr_route_req *)(dumper->dump_req);
     struct vr_route_req resp;
     int ret;
-    unsigned int i;
+    unsigned int i = 0;
     struct vr_bridge_entry *be;
 
-    for(i = 0; i < (vr_bridge_entries + vr_bridge_oentries); i++) {
+    if (!dumper->dump_been_to_marker)
+        i = bridge_table_dump_cursor(dumper);
+
+    for(; i < (vr_bridge_entries + vr_bridge_oentries); i++) {
         be = (struct vr_bridge_entry *) vr_get_hentry_by_index(vn_rtable, i);
         if (!be) 
             continue;
@@ -415,24 +476,22 @@ unsigned int
 vr_bridge_input(struct vrouter *router, struct vr_packet *pkt,
                 struct vr_forwarding_md *fmd)
 {
-    struct vr_route_req rt;
     struct vr_forwarding_md cmd;
     struct vr_nexthop *nh = NULL;
+    unsigned char *mac;
+    unsigned int rt_label = 0;
+    unsigned short rt_flags = 0;
     unsigned short pull_len, overlay_len = VROUTER_OVERLAY_LEN;
     int reason, handled;
 
     /* Do the bridge lookup for the packets not meant for "me" */
     if (!fmd->fmd_to_me) {
-        rt.rtr_req.rtr_label_flags = 0;
-        rt.rtr_req.rtr_index = VR_BE_INVALID_INDEX;
-        rt.rtr_req.rtr_mac_size = VR_ETHER_ALEN;
-        rt.rtr_req.rtr_mac =(int8_t *) pkt_data(pkt);
+        mac = pkt_data(pkt);
         /* If multicast L2 packet, use broadcast composite nexthop */
-        if (IS_MAC_BMCAST(rt.rtr_req.rtr_mac))
-            rt.rtr_req.rtr_mac = (int8_t *)vr_bcast_mac;
-        rt.rtr_req.rtr_vrf_id = fmd->fmd_dvrf;
+        if (IS_MAC_BMCAST(mac))
+            mac = (unsigned char *)vr_bcast_mac;
 
-        nh = vr_bridge_lookup(fmd->fmd_dvrf, &rt);
+        nh = vr_bridge_lookup_mac(fmd->fmd_dvrf, mac, &rt_label, &rt_flags);
         if (!nh) {
             vr_pfree(pkt, VP_DROP_L2_NO_ROUTE);
             return 0;
@@ -479,12 +538,12 @@ vr_bridge_input(struct vrouter *router, struct vr_packet *pkt,
      * If there is a label attached to this bridge entry add the
      * label
      */
-    if (rt.rtr_req.rtr_label_flags & VR_BE_LABEL_VALID_FLAG) {
+    if (rt_flags & VR_BE_LABEL_VALID_FLAG) {
         if (!fmd) {
             vr_init_forwarding_md(&cmd);
             fmd = &cmd;
         }
-        fmd->fmd_label = rt.rtr_req.rtr_label;
+        fmd->fmd_label = rt_label;
     }
 
     nh_output(pkt, nh, fmd);
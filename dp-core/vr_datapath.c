@@ -492,39 +492,251 @@ vr_virtual_input(unsigned short vrf, struct vr_interface *vif,
 
 }
 
+/*
+ * parse the l2 header of a packet received on the fabric and, for ip and
+ * arp, position the data at the network header. returns -1 if the packet
+ * was consumed here and should not be looked at anymore.
+ */
+static int
+vr_fabric_parse(struct vr_interface *vif, struct vr_packet *pkt,
+                struct vr_forwarding_md *fmd, unsigned short vlan_id,
+                unsigned short *pull_len)
+{
+    vr_init_forwarding_md(fmd);
+    fmd->fmd_vlan = vlan_id;
+    fmd->fmd_dvrf = vif->vif_vrf;
+
+    if (vr_pkt_type(pkt, 0, fmd) < 0) {
+        vif_drop_pkt(vif, pkt, 1);
+        return -1;
+    }
+
+    *pull_len = 0;
+    if (pkt->vp_type == VP_TYPE_IP6)
+        return 0;
+
+    *pull_len = pkt_get_network_header_off(pkt) - pkt_head_space(pkt);
+    pkt_pull(pkt, *pull_len);
+
+    return 0;
+}
+
+static int
+vr_fabric_l3_input(struct vr_interface *vif, struct vr_packet *pkt,
+                   struct vr_forwarding_md *fmd, unsigned short pull_len)
+{
+    int handled = 0;
+
+    if (pkt->vp_type == VP_TYPE_IP6)
+        return vif_xconnect(vif, pkt, fmd);
+
+    if (pkt->vp_type == VP_TYPE_IP)
+        handled = vr_l3_input(pkt, fmd);
+    else if (pkt->vp_type == VP_TYPE_ARP)
+        handled = vr_arp_input(pkt, fmd);
+
+    if (!handled) {
+        pkt_push(pkt, pull_len);
+        return vif_xconnect(vif, pkt, fmd);
+    }
+
+    return 0;
+}
+
 unsigned int
 vr_fabric_input(struct vr_interface *vif, struct vr_packet *pkt,
                 unsigned short vlan_id)
 {
-    int handled = 0;
     unsigned short pull_len;
     struct vr_forwarding_md fmd;
 
-    vr_init_forwarding_md(&fmd);
-    fmd.fmd_vlan = vlan_id;
-    fmd.fmd_dvrf = vif->vif_vrf;
+    if (vr_fabric_parse(vif, pkt, &fmd, vlan_id, &pull_len) < 0)
+        return 0;
 
-    if (vr_pkt_type(pkt, 0, &fmd) < 0) {
-        vif_drop_pkt(vif, pkt, 1);
+    return vr_fabric_l3_input(vif, pkt, &fmd, pull_len);
+}
+
+/*
+ * burst processing
+ *
+ * vr_fabric_input_burst() takes a vector of packets through the input
+ * stages one stage at a time, instead of taking each packet all the way
+ * to the output interface before looking at the next one. the l2 parse
+ * stage runs over the whole burst first, followed by the l3 stage, which
+ * does the tunnel decap and the label/vnid lookup. packets that get
+ * decapsulated are not handed to nh_output immediately. instead, they are
+ * parked in the per cpu burst context (vr_burst_defer) and once the l3
+ * stage is done for the whole burst, they are sorted by nexthop type and
+ * nexthop and dispatched back to back.
+ *
+ * the work per packet is the same as that of vr_fabric_input. only the
+ * order of the stages changes: the label and vnid lookups are still done
+ * one packet at a time, from the decap paths. only the user space host
+ * receives in bursts. linux hands the packets to the rx handler one at a
+ * time, and takes the per packet path.
+ */
+static inline struct vr_burst *
+vr_burst_get(struct vrouter *router)
+{
+    unsigned int cpu;
+
+    if (!router->vr_rx_bursts)
+        return NULL;
+
+    cpu = vr_get_cpu();
+    if (cpu >= vr_num_cpus)
+        return NULL;
+
+    return &router->vr_rx_bursts[cpu];
+}
+
+/*
+ * called from the decap paths (mpls, vxlan) once the nexthop for the
+ * packet is known. returns true if the packet was queued for the burst
+ * dispatch, in which case the caller should not touch the packet anymore.
+ */
+bool
+vr_burst_defer(struct vrouter *router, struct vr_packet *pkt,
+               struct vr_nexthop *nh, struct vr_forwarding_md *fmd)
+{
+    struct vr_burst *burst;
+    struct vr_burst_entry *entry;
+
+    burst = vr_burst_get(router);
+    if (!burst || !burst->vb_active)
+        return false;
+
+    if (burst->vb_count >= VR_RX_BURST_MAX)
+        return false;
+
+    entry = &burst->vb_entry[burst->vb_count++];
+    entry->vbe_pkt = pkt;
+    entry->vbe_nh = nh;
+    memcpy(&entry->vbe_fmd, fmd, sizeof(*fmd));
+
+    return true;
+}
+
+static inline bool
+vr_burst_entry_after(struct vr_burst_entry *a, struct vr_burst_entry *b)
+{
+    if (a->vbe_nh->nh_type != b->vbe_nh->nh_type)
+        return a->vbe_nh->nh_type > b->vbe_nh->nh_type;
+
+    return a->vbe_nh > b->vbe_nh;
+}
+
+static void
+vr_burst_flush(struct vr_burst *burst)
+{
+    unsigned int i, j, count;
+    unsigned char order[VR_RX_BURST_MAX], tmp;
+    struct vr_burst_entry *entry;
+
+    /*
+     * nh_output can very well lead us back to the decap path (for e.g.:
+     * loopback through a vhost or agent interface), and hence no more
+     * deferrals from here on
+     */
+    burst->vb_active = false;
+    count = burst->vb_count;
+    burst->vb_count = 0;
+
+    /*
+     * stable insertion sort of the indices, so that packets of the same
+     * nexthop (and hence of the same flow) stay in the order they came in
+     */
+    for (i = 0; i < count; i++) {
+        tmp = i;
+        for (j = i; j > 0; j--) {
+            if (!vr_burst_entry_after(&burst->vb_entry[order[j - 1]],
+                        &burst->vb_entry[tmp]))
+                break;
+            order[j] = order[j - 1];
+        }
+        order[j] = tmp;
+    }
+
+    for (i = 0; i < count; i++) {
+        entry = &burst->vb_entry[order[i]];
+        nh_output(entry->vbe_pkt, entry->vbe_nh, &entry->vbe_fmd);
+    }
+
+    return;
+}
+
+unsigned int
+vr_fabric_input_burst(struct vr_interface *vif, struct vr_packet **pkts,
+                      unsigned int count, unsigned short vlan_id)
+{
+    unsigned int i, base, num;
+    unsigned short pull_len[VR_RX_BURST_MAX];
+    struct vr_packet *stage[VR_RX_BURST_MAX];
+    struct vr_burst *burst;
+
+    burst = vr_burst_get(vif->vif_router);
+    if (!burst || burst->vb_active) {
+        for (i = 0; i < count; i++)
+            vr_fabric_input(vif, pkts[i], vlan_id);
         return 0;
     }
 
-    if (pkt->vp_type == VP_TYPE_IP6)
-        return vif_xconnect(vif, pkt, &fmd);
+    for (base = 0; base < count; base += num) {
+        num = count - base;
+        if (num > VR_RX_BURST_MAX)
+            num = VR_RX_BURST_MAX;
+
+        /* stage 1: l2 */
+        for (i = 0; i < num; i++) {
+            stage[i] = pkts[base + i];
+            if (vr_fabric_parse(vif, stage[i], &burst->vb_rx_fmd[i],
+                        vlan_id, &pull_len[i]) < 0)
+                stage[i] = NULL;
+        }
 
-    pull_len = pkt_get_network_header_off(pkt) - pkt_head_space(pkt);
-    pkt_pull(pkt, pull_len);
+        /* stage 2: l3, tunnel decap and label/vnid lookups */
+        burst->vb_active = true;
+        for (i = 0; i < num; i++) {
+            if (!stage[i])
+                continue;
+            vr_fabric_l3_input(vif, stage[i], &burst->vb_rx_fmd[i],
+                    pull_len[i]);
+        }
 
-    if (pkt->vp_type == VP_TYPE_IP || pkt->vp_type == VP_TYPE_IP6)
-        handled = vr_l3_input(pkt, &fmd);
-    else if (pkt->vp_type == VP_TYPE_ARP)
-        handled = vr_arp_input(pkt, &fmd);
+        /* stage 3: nexthop dispatch */
+        vr_burst_flush(burst);
+    }
 
-    if (!handled) {
-        pkt_push(pkt, pull_len);
-        return vif_xconnect(vif, pkt, &fmd);
+    return 0;
+}
+
+void
+vr_datapath_exit(struct vrouter *router, bool soft_reset)
+{
+    if (soft_reset)
+        return;
+
+    if (router->vr_rx_bursts) {
+        vr_free(router->vr_rx_bursts);
+        router->vr_rx_bursts = NULL;
     }
 
+    return;
+}
+
+int
+vr_datapath_init(struct vrouter *router)
+{
+    unsigned int size;
+
+    if (router->vr_rx_bursts)
+        return 0;
+
+    size = vr_num_cpus * sizeof(struct vr_burst);
+    router->vr_rx_bursts = vr_zalloc(size);
+    if (!router->vr_rx_bursts)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+
     return 0;
 }
 
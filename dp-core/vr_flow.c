@@ -30,11 +30,42 @@
 
 #define VR_FLOW_ENTRIES_PER_BUCKET  4U
 
+/*
+ * every flow entry (in the main as well as the overflow table) has a 16
+ * bit tag: the top bits of the flow hash and a valid bit. tags of a
+ * bucket are kept together in a separate 64 bit word (hence 4 entries per
+ * bucket), so that a lookup can compare the whole bucket at once and touch
+ * a flow entry only when its tag matches
+ */
+#define VR_FLOW_TAG_VALID           0x8000U
+#define VR_FLOW_TAG(hash)           ((uint16_t)(((hash) >> 17) | \
+            VR_FLOW_TAG_VALID))
+#define VR_FLOW_TAG_LANES           0x0001000100010001ULL
+#define VR_FLOW_TAG_LANE_MSBS       0x8000800080008000ULL
+
+/*
+ * a flow that does not fit in its bucket in the main table can go to one
+ * of these many buckets of the overflow table, each picked by a different
+ * hash. entries are never moved once they are claimed (agent refers to
+ * flows by index), so a new flow goes to the least loaded of the buckets.
+ * lookups and misses hence probe a bounded number of entries
+ */
+#define VR_OFLOW_BUCKET_CHOICES     2U
+/*
+ * when all the choices are full, the flow goes to the first bucket with
+ * room among these many that follow the first choice, so that a table
+ * that still has free entries does not turn flows away just because two
+ * of its buckets are full. lookups walk the same window
+ */
+#define VR_OFLOW_PROBE_BUCKETS      8U
+
 #define VR_MAX_FLOW_TABLE_HOLD_COUNT \
                                     4096
 
 unsigned int vr_flow_entries = VR_DEF_FLOW_ENTRIES;
 unsigned int vr_oflow_entries = VR_DEF_OFLOW_ENTRIES;
+/* idle time, in seconds, after which a flow is aged out. 0 disables ageing */
+unsigned int vr_flow_age_timeout = 0;
 
 #if defined(__linux__) && defined(__KERNEL__)
 extern unsigned short vr_flow_major;
@@ -49,32 +80,12 @@ static void vr_flush_flow_queue(struct vrouter *, struct vr_flow_entry *,
         struct vr_forwarding_md *, struct vr_flow_queue *);
 
 struct vr_flow_entry *vr_find_flow(struct vrouter *, struct vr_flow *,
-        uint8_t, unsigned int *);
+        uint8_t, struct vr_inet6_flow_addr *, unsigned int *);
 unsigned int vr_trap_flow(struct vrouter *, struct vr_flow_entry *,
         struct vr_packet *, unsigned int);
 
 void get_random_bytes(void *buf, int nbytes);
 
-#ifdef __FreeBSD__
-uint32_t
-jhash(void *key, uint32_t length, uint32_t interval);
-#endif
-
-#ifdef __FreeBSD__
-uint32_t
-jhash(void *key, uint32_t length, uint32_t interval)
-{
-  uint32_t ret = 0;
-  int i;
-  unsigned char *data = (unsigned char *)key;
-
-  for (i = 0; i < length; i ++)
-    ret += data[i];
-
-  return ret;
-}
-#endif
-
 
 bool
 vr_valid_link_local_port(struct vrouter *router, int family,
@@ -186,10 +197,187 @@ vr_init_flow_entry(struct vr_flow_entry *fe)
 }
 
 
+static inline uint16_t *
+vr_flow_tag_get(struct vrouter *router, unsigned int index)
+{
+    uint16_t *tags;
+
+    if (!router->vr_flow_tags ||
+            index >= vr_flow_entries + vr_oflow_entries)
+        return NULL;
+
+    tags = (uint16_t *)vr_btable_get(router->vr_flow_tags,
+            index / VR_FLOW_ENTRIES_PER_BUCKET);
+    if (!tags)
+        return NULL;
+
+    return &tags[index % VR_FLOW_ENTRIES_PER_BUCKET];
+}
+
+/* for when a nexthop, that any entry could be holding, goes away */
+void
+vr_flow_cache_invalidate(struct vrouter *router)
+{
+    (void)__sync_add_and_fetch(&router->vr_flow_cache_gen, 1);
+    return;
+}
+
+static inline unsigned int
+vr_flow_cache_gen(struct vrouter *router)
+{
+    return *(volatile unsigned int *)&router->vr_flow_cache_gen;
+}
+
+static inline unsigned int *
+vr_flow_gen_get(struct vrouter *router, unsigned int index)
+{
+    if (!router->vr_flow_gens)
+        return NULL;
+
+    return (unsigned int *)vr_btable_get(router->vr_flow_gens, index);
+}
+
+/* stales only the entries that point to the flow at index */
+static void
+vr_flow_cache_invalidate_flow(struct vrouter *router, unsigned int index)
+{
+    unsigned int *gen;
+
+    gen = vr_flow_gen_get(router, index);
+    if (gen)
+        (void)__sync_add_and_fetch(gen, 1);
+
+    return;
+}
+
+static bool
+vr_flow_cache_get(struct vrouter *router, struct vr_flow_cache_entry *fce,
+        unsigned int gen, struct vr_flow *key, unsigned int *index,
+        struct vr_nexthop **src_nh)
+{
+    unsigned int seq, *flow_gen;
+
+    seq = *(volatile unsigned int *)&fce->fce_seq;
+    vr_compiler_barrier();
+    if ((seq & 1) || (fce->fce_gen != gen) ||
+            (fce->fce_key.key_len != key->key_len) ||
+            memcmp(&fce->fce_key, key, key->key_len))
+        return false;
+
+    *index = fce->fce_index;
+    *src_nh = fce->fce_src_nh;
+    flow_gen = vr_flow_gen_get(router, *index);
+    if (!flow_gen ||
+            (*(volatile unsigned int *)flow_gen != fce->fce_flow_gen))
+        return false;
+
+    vr_compiler_barrier();
+    if (*(volatile unsigned int *)&fce->fce_seq != seq)
+        return false;
+
+    return true;
+}
+
+static void
+vr_flow_cache_fill(struct vrouter *router, struct vr_flow_cache_entry *fce,
+        unsigned int gen, struct vr_flow *key, struct vr_flow_entry *fe,
+        unsigned int index, struct vr_nexthop **src_nh)
+{
+    unsigned int flow_gen, *flow_genp;
+    struct vr_nexthop *nh;
+
+    flow_genp = vr_flow_gen_get(router, index);
+    if (!flow_genp)
+        return;
+
+    /*
+     * the flow's generation is read before the flow is checked again.
+     * a reset clears the flow before it bumps the generation, and hence
+     * either the check fails or the entry is stale already
+     */
+    flow_gen = *(volatile unsigned int *)flow_genp;
+    __sync_synchronize();
+    if (!(fe->fe_flags & VR_FLOW_FLAG_ACTIVE) ||
+            (fe->fe_action == VR_FLOW_ACTION_HOLD) ||
+            (fe->fe_key.key_len != key->key_len) ||
+            memcmp(&fe->fe_key, key, key->key_len))
+        return;
+
+    nh = __vrouter_get_nexthop(router, fe->fe_src_nh_index);
+    if (!nh)
+        return;
+    *src_nh = nh;
+
+    /* we interrupted a fill of the same entry. leave it to that one */
+    if (*(volatile unsigned int *)&fce->fce_seq & 1)
+        return;
+
+    fce->fce_seq++;
+    vr_compiler_barrier();
+    memcpy(&fce->fce_key, key, sizeof(*key));
+    fce->fce_src_nh = nh;
+    fce->fce_index = index;
+    fce->fce_gen = gen;
+    fce->fce_flow_gen = flow_gen;
+    vr_compiler_barrier();
+    fce->fce_seq++;
+
+    return;
+}
+
+/*
+ * the cache is indexed with a cheap fold of the key rather than with the
+ * flow hash, so that a hit does not pay for vr_hash
+ */
+static inline struct vr_flow_cache_entry *
+vr_flow_cache_slot(struct vrouter *router, struct vr_flow *key)
+{
+    unsigned int cpu, slot;
+
+    if (!router->vr_flow_caches)
+        return NULL;
+
+    cpu = vr_get_cpu();
+    if (cpu >= vr_num_cpus)
+        return NULL;
+
+    slot = key->flow4_sip ^ key->flow4_dip ^
+        ((key->flow4_sport << 16) | key->flow4_dport) ^
+        ((key->flow4_nh_id << 8) | key->flow4_proto);
+    slot = (slot * 0x9e3779b1U) >> (32 - VR_FLOW_CACHE_SHIFT);
+
+    return &router->vr_flow_caches[cpu]->fc_entries[slot];
+}
+
+static inline struct vr_flow_age_info *
+vr_flow_age_info_get(struct vrouter *router, unsigned int index)
+{
+    if (!router->vr_flow_age_table)
+        return NULL;
+
+    return (struct vr_flow_age_info *)
+        vr_btable_get(router->vr_flow_age_table, index);
+}
+
 static void
 vr_reset_flow_entry(struct vrouter *router, struct vr_flow_entry *fe,
         unsigned int index)
 {
+    uint16_t *tag;
+    struct vr_flow_age_info *ai;
+
+    /* clear the tag first, so that lookups stop looking at the entry */
+    tag = vr_flow_tag_get(router, index);
+    if (tag)
+        *tag = 0;
+    /* and stop the cached lookups too */
+    vr_flow_cache_invalidate_flow(router, index);
+
+    /* whoever takes the entry next starts with a fresh idle time */
+    ai = vr_flow_age_info_get(router, index);
+    if (ai)
+        ai->fai_time = 0;
+
     memset(&fe->fe_stats, 0, sizeof(fe->fe_stats));
     memset(&fe->fe_hold_list, 0, sizeof(fe->fe_hold_list));;
     fe->fe_key.key_len = 0;
@@ -204,6 +392,10 @@ vr_reset_flow_entry(struct vrouter *router, struct vr_flow_entry *fe,
     fe->fe_flags = 0;
     fe->fe_udp_src_port = 0;
 
+    /* a fill that raced with the reset saw a flow that is gone by now */
+    __sync_synchronize();
+    vr_flow_cache_invalidate_flow(router, index);
+
     return;
 }
 
@@ -215,18 +407,6 @@ vr_set_flow_active(struct vr_flow_entry *fe)
             fe->fe_flags & ~VR_FLOW_FLAG_ACTIVE, VR_FLOW_FLAG_ACTIVE);
 }
 
-static inline struct vr_flow_entry *
-vr_flow_table_entry_get(struct vrouter *router, unsigned int i)
-{
-    return (struct vr_flow_entry *)vr_btable_get(router->vr_flow_table, i);
-}
-
-static inline struct vr_flow_entry *
-vr_oflow_table_entry_get(struct vrouter *router, unsigned int i)
-{
-    return (struct vr_flow_entry *)vr_btable_get(router->vr_oflow_table, i);
-}
-
 unsigned int
 vr_flow_table_size(struct vrouter *router)
 {
@@ -245,15 +425,32 @@ vr_oflow_table_size(struct vrouter *router)
  * an offset into that large memory, we should return the correct
  * virtual address
  */
+unsigned int
+vr_flow_miss_ring_size(struct vrouter *router)
+{
+    if (!router->vr_flow_miss_ring)
+        return 0;
+
+    return vr_btable_size(router->vr_flow_miss_ring);
+}
+
 void *
 vr_flow_get_va(struct vrouter *router, uint64_t offset)
 {
     struct vr_btable *table = router->vr_flow_table;
     unsigned int size = vr_flow_table_size(router);
 
-    if (offset >= vr_flow_table_size(router)) {
+    if (offset >= size) {
         table = router->vr_oflow_table;
         offset -= size;
+        size = vr_oflow_table_size(router);
+        /* the flow miss rings follow the overflow table */
+        if (offset >= size) {
+            table = router->vr_flow_miss_ring;
+            offset -= size;
+            if (!table)
+                return NULL;
+        }
     }
 
     return vr_btable_get_address(table, offset);
@@ -279,6 +476,16 @@ vr_get_flow_entry(struct vrouter *router, int index)
     return (struct vr_flow_entry *)vr_btable_get(table, index);
 }
 
+struct vr_inet6_flow_addr *
+vr_flow6_get_addr(struct vrouter *router, unsigned int index)
+{
+    if (!router->vr_flow6_addr_table)
+        return NULL;
+
+    return (struct vr_inet6_flow_addr *)
+        vr_btable_get(router->vr_flow6_addr_table, index);
+}
+
 static void
 vr_flow_queue_free(struct vrouter *router, void *arg)
 {
@@ -316,50 +523,168 @@ vr_flow_queue_free_defer(struct vr_flow_md *flmd, struct vr_flow_queue *vfq)
     return;
 }
 
-static struct vr_flow_entry *
-vr_find_free_entry(struct vrouter *router, struct vr_flow *key, uint8_t type,
-        bool need_hold, unsigned int *fe_index)
+/*
+ * buckets are numbered in the flow index space, i.e. the buckets of the
+ * overflow table follow those of the main table
+ */
+static inline unsigned int
+vr_flow_bucket(unsigned int hash)
+{
+    return (hash % vr_flow_entries) / VR_FLOW_ENTRIES_PER_BUCKET;
+}
+
+static inline unsigned int
+vr_oflow_bucket(unsigned int hash, unsigned int choice)
 {
-    unsigned int i, index, hash;
-    struct vr_flow_entry *tmp_fe, *fe = NULL;
+    return (vr_flow_entries / VR_FLOW_ENTRIES_PER_BUCKET) +
+        (vr_hash_1word(hash, choice + 1) %
+         (vr_oflow_entries / VR_FLOW_ENTRIES_PER_BUCKET));
+}
 
-    *fe_index = 0;
+static inline unsigned int
+vr_oflow_probe_buckets(void)
+{
+    unsigned int buckets = vr_oflow_entries / VR_FLOW_ENTRIES_PER_BUCKET;
+
+    if (buckets <= VR_OFLOW_PROBE_BUCKETS)
+        return buckets - 1;
+
+    return VR_OFLOW_PROBE_BUCKETS;
+}
 
-    hash = vr_hash(key, key->key_len, 0);
+/* the 'probe'th bucket of the window that follows the first choice */
+static inline unsigned int
+vr_oflow_probe_bucket(unsigned int hash, unsigned int probe)
+{
+    unsigned int first, buckets;
+
+    first = vr_flow_entries / VR_FLOW_ENTRIES_PER_BUCKET;
+    buckets = vr_oflow_entries / VR_FLOW_ENTRIES_PER_BUCKET;
+
+    return first + ((vr_oflow_bucket(hash, 0) - first + probe + 1) % buckets);
+}
+
+static inline uint64_t
+vr_flow_bucket_tags(struct vrouter *router, unsigned int bucket)
+{
+    uint64_t *tags;
+
+    tags = (uint64_t *)vr_btable_get(router->vr_flow_tags, bucket);
+    if (!tags)
+        return 0;
+
+    return *(volatile uint64_t *)tags;
+}
+
+static unsigned int
+vr_flow_bucket_used(uint64_t tags)
+{
+    unsigned int used = 0;
+
+    tags &= VR_FLOW_TAG_LANE_MSBS;
+    while (tags) {
+        tags &= tags - 1;
+        used++;
+    }
+
+    return used;
+}
+
+static struct vr_flow_entry *
+vr_flow_bucket_claim(struct vrouter *router, unsigned int bucket,
+        unsigned int *fe_index)
+{
+    unsigned int i, index;
+    struct vr_flow_entry *fe;
 
-    index = (hash % vr_flow_entries) & ~(VR_FLOW_ENTRIES_PER_BUCKET - 1);
-    for (i = 0; i < VR_FLOW_ENTRIES_PER_BUCKET; i++) {
-        tmp_fe = vr_flow_table_entry_get(router, index);
-        if (tmp_fe && !(tmp_fe->fe_flags & VR_FLOW_FLAG_ACTIVE)) {
-            if (vr_set_flow_active(tmp_fe)) {
-                vr_init_flow_entry(tmp_fe);
-                fe = tmp_fe;
-                break;
+    index = bucket * VR_FLOW_ENTRIES_PER_BUCKET;
+    for (i = 0; i < VR_FLOW_ENTRIES_PER_BUCKET; i++, index++) {
+        fe = vr_get_flow_entry(router, index);
+        if (fe && !(fe->fe_flags & VR_FLOW_FLAG_ACTIVE)) {
+            if (vr_set_flow_active(fe)) {
+                vr_init_flow_entry(fe);
+                *fe_index = index;
+                return fe;
             }
         }
-        index++;
     }
-        
-    if (!fe) {
-        index = hash % vr_oflow_entries;
-        for (i = 0; i < vr_oflow_entries; i++) {
-            tmp_fe = vr_oflow_table_entry_get(router, index);
-            if (tmp_fe && !(tmp_fe->fe_flags & VR_FLOW_FLAG_ACTIVE)) {
-                if (vr_set_flow_active(tmp_fe)) {
-                    vr_init_flow_entry(tmp_fe);
-                    fe = tmp_fe;
-                    break;
-                }
-            }
-            index = (index + 1) % vr_oflow_entries;
+
+    return NULL;
+}
+
+static struct vr_flow_entry *
+vr_oflow_claim(struct vrouter *router, unsigned int hash,
+        unsigned int *fe_index)
+{
+    unsigned int i, j, min;
+    unsigned int bucket[VR_OFLOW_BUCKET_CHOICES];
+    unsigned int used[VR_OFLOW_BUCKET_CHOICES];
+    struct vr_flow_entry *fe;
+
+    for (i = 0; i < VR_OFLOW_BUCKET_CHOICES; i++) {
+        bucket[i] = vr_oflow_bucket(hash, i);
+        used[i] = vr_flow_bucket_used(vr_flow_bucket_tags(router, bucket[i]));
+    }
+
+    /* try the buckets in the increasing order of their load */
+    for (i = 0; i < VR_OFLOW_BUCKET_CHOICES; i++) {
+        min = 0;
+        for (j = 1; j < VR_OFLOW_BUCKET_CHOICES; j++) {
+            if (used[j] < used[min])
+                min = j;
         }
 
+        fe = vr_flow_bucket_claim(router, bucket[min], fe_index);
+        if (fe)
+            return fe;
+
+        /* tried, and full */
+        used[min] = VR_FLOW_ENTRIES_PER_BUCKET + 1;
+    }
+
+    for (i = 0; i < vr_oflow_probe_buckets(); i++) {
+        j = vr_oflow_probe_bucket(hash, i);
+        if (vr_flow_bucket_used(vr_flow_bucket_tags(router, j)) >=
+                VR_FLOW_ENTRIES_PER_BUCKET)
+            continue;
+
+        fe = vr_flow_bucket_claim(router, j, fe_index);
         if (fe)
-            *fe_index += vr_flow_entries;
+            return fe;
+    }
+
+    return NULL;
+}
+
+static struct vr_flow_entry *
+vr_find_free_entry(struct vrouter *router, struct vr_flow *key, uint8_t type,
+        struct vr_inet6_flow_addr *addr6, bool need_hold,
+        unsigned int *fe_index)
+{
+    unsigned int hash;
+    uint16_t *tag;
+    struct vr_inet6_flow_addr *fe_addr6;
+    struct vr_flow_entry *fe = NULL;
+
+    *fe_index = 0;
+
+    hash = vr_hash_key(&router->vr_flow_hash, key, key->key_len);
+
+    fe = vr_flow_bucket_claim(router, vr_flow_bucket(hash), fe_index);
+    if (!fe)
+        fe = vr_oflow_claim(router, hash, fe_index);
+
+    if (fe && addr6) {
+        fe_addr6 = vr_flow6_get_addr(router, *fe_index);
+        if (!fe_addr6) {
+            vr_reset_flow_entry(router, fe, *fe_index);
+            fe = NULL;
+        } else {
+            memcpy(fe_addr6, addr6, sizeof(*addr6));
+        }
     }
 
     if (fe) {
-        *fe_index += index;
         if (need_hold) {
             fe->fe_hold_list = vr_zalloc(sizeof(struct vr_flow_queue));
             if (!fe->fe_hold_list) {
@@ -374,36 +699,70 @@ vr_find_free_entry(struct vrouter *router, struct vr_flow *key, uint8_t type,
             fe->fe_type = type;
             fe->fe_key.key_len = key->key_len;
             memcpy(&fe->fe_key, key, key->key_len);
+
+            tag = vr_flow_tag_get(router, *fe_index);
+            if (tag) {
+                /* the key has to be visible before the tag is */
+                __sync_synchronize();
+                *tag = VR_FLOW_TAG(hash);
+            }
         }
     }
 
     return fe;
 }
 
+/*
+ * compares the four tags of a bucket with 'tag' in one go. xor-ing with
+ * the broadcasted tag zeroes the matching 16 bit lanes, and the usual
+ * 'has zero' trick sets the msb of those lanes. a borrow can produce a
+ * false positive in a lane above a matching one, which is fine since the
+ * caller compares the key anyway
+ */
+static inline uint64_t
+vr_flow_tag_match(uint64_t tags, uint16_t tag)
+{
+    uint64_t x;
+
+    x = tags ^ (VR_FLOW_TAG_LANES * tag);
+    return (x - VR_FLOW_TAG_LANES) & ~x & VR_FLOW_TAG_LANE_MSBS;
+}
+
+static inline bool
+vr_flow6_addr_match(struct vrouter *router, unsigned int index,
+        struct vr_inet6_flow_addr *addr6)
+{
+    struct vr_inet6_flow_addr *fe_addr6;
+
+    fe_addr6 = vr_flow6_get_addr(router, index);
+    if (!fe_addr6)
+        return false;
+
+    return !memcmp(fe_addr6, addr6, sizeof(*addr6));
+}
+
 static inline struct vr_flow_entry *
-vr_flow_table_lookup(struct vr_flow *key, uint16_t type,
-        struct vr_btable *table, unsigned int table_size,
-        unsigned int bucket_size, unsigned int hash, unsigned int *fe_index)
+vr_flow_bucket_lookup(struct vrouter *router, struct vr_flow *key,
+        uint8_t type, struct vr_inet6_flow_addr *addr6, unsigned int bucket,
+        uint16_t tag, unsigned int *fe_index)
 {
-    unsigned int i;
+    unsigned int i, index;
+    uint64_t match;
     struct vr_flow_entry *flow_e;
 
-    hash %= table_size;
-
-    if (!bucket_size) {
-        bucket_size = table_size;
-    } else {
-        hash &= ~(bucket_size - 1);
-    }
+    match = vr_flow_tag_match(vr_flow_bucket_tags(router, bucket), tag);
+    for (i = 0; match; i++, match >>= 16) {
+        if (!(match & VR_FLOW_TAG_VALID))
+            continue;
 
-    for (i = 0; i < bucket_size; i++) {
-        flow_e = (struct vr_flow_entry *)vr_btable_get(table,
-                (hash + i) % table_size);
+        index = bucket * VR_FLOW_ENTRIES_PER_BUCKET + i;
+        flow_e = vr_get_flow_entry(router, index);
         if (flow_e &&
                 (flow_e->fe_flags & VR_FLOW_FLAG_ACTIVE) &&
                 (flow_e->fe_type == type)) {
-            if (!memcmp(&flow_e->fe_key, key, key->key_len)) {
-                *fe_index = (hash + i) % table_size;
+            if (!memcmp(&flow_e->fe_key, key, key->key_len) &&
+                    (!addr6 || vr_flow6_addr_match(router, index, addr6))) {
+                *fe_index = index;
                 return flow_e;
             }
         }
@@ -412,29 +771,93 @@ vr_flow_table_lookup(struct vr_flow *key, uint16_t type,
     return NULL;
 }
 
-
 struct vr_flow_entry *
 vr_find_flow(struct vrouter *router, struct vr_flow *key,
-        uint8_t type, unsigned int *fe_index)
+        uint8_t type, struct vr_inet6_flow_addr *addr6, unsigned int *fe_index)
 {
-    unsigned int hash;
+    unsigned int i, hash;
+    uint16_t tag;
     struct vr_flow_entry *flow_e;
 
-    hash = vr_hash(key, key->key_len, 0);
+    hash = vr_hash_key(&router->vr_flow_hash, key, key->key_len);
+    tag = VR_FLOW_TAG(hash);
 
     /* first look in the regular flow table */
-    flow_e = vr_flow_table_lookup(key, type, router->vr_flow_table,
-            vr_flow_entries, VR_FLOW_ENTRIES_PER_BUCKET, hash, fe_index);
-    /* if not in the regular flow table, lookup in the overflow flow table */
-    if (!flow_e) {
-        flow_e = vr_flow_table_lookup(key, type, router->vr_oflow_table,
-                vr_oflow_entries, 0, hash, fe_index);
-        *fe_index += vr_flow_entries;
-    }
+    flow_e = vr_flow_bucket_lookup(router, key, type, addr6,
+            vr_flow_bucket(hash), tag, fe_index);
+    /* if not in the regular flow table, look in the overflow buckets */
+    for (i = 0; !flow_e && (i < VR_OFLOW_BUCKET_CHOICES); i++)
+        flow_e = vr_flow_bucket_lookup(router, key, type, addr6,
+                vr_oflow_bucket(hash, i), tag, fe_index);
+    /* and last, in the window that takes what the choices could not */
+    for (i = 0; !flow_e && (i < vr_oflow_probe_buckets()); i++)
+        flow_e = vr_flow_bucket_lookup(router, key, type, addr6,
+                vr_oflow_probe_bucket(hash, i), tag, fe_index);
 
     return flow_e;
 }
 
+static int
+vr_flow_miss_post(struct vrouter *router, struct vr_flow_entry *fe,
+        struct vr_packet *pkt, unsigned int index)
+{
+    unsigned int cpu, base, head;
+    struct vr_btable *ring = router->vr_flow_miss_ring;
+    volatile struct vr_flow_miss_prod *prod;
+    volatile struct vr_flow_miss_cons *cons;
+    struct vr_flow_miss *fm;
+    struct vr_inet6_flow_addr *addr6 = NULL;
+
+    if (!ring)
+        return -ENOENT;
+
+    /* traps of these kinds carry information only the packet has */
+    if (fe->fe_flags & VR_FLOW_FLAG_TRAP_MASK)
+        return -EINVAL;
+
+    if (fe->fe_type == VP_TYPE_IP6) {
+        addr6 = vr_flow6_get_addr(router, index);
+        if (!addr6)
+            return -EINVAL;
+    } else if (fe->fe_type != VP_TYPE_IP) {
+        return -EINVAL;
+    }
+
+    cpu = vr_get_cpu();
+    if (cpu >= vr_num_cpus)
+        return -ENOENT;
+
+    base = cpu * VR_FLOW_MISS_RING_STRIDE;
+    prod = (struct vr_flow_miss_prod *)vr_btable_get(ring, base);
+    cons = (struct vr_flow_miss_cons *)vr_btable_get(ring, base + 1);
+    if (!prod || !cons || !cons->fmc_enabled)
+        return -ENOENT;
+
+    do {
+        head = prod->fmp_head;
+        if (head - cons->fmc_tail >= VR_FLOW_MISS_RING_ENTRIES)
+            return -ENOSPC;
+    } while (!__sync_bool_compare_and_swap(&prod->fmp_head, head, head + 1));
+
+    fm = (struct vr_flow_miss *)vr_btable_get(ring, base +
+            VR_FLOW_MISS_CTL_SLOTS + (head & (VR_FLOW_MISS_RING_ENTRIES - 1)));
+    fm->fm_index = index;
+    fm->fm_if_index = pkt->vp_if->vif_idx;
+    fm->fm_vrf = fe->fe_vrf;
+    fm->fm_type = fe->fe_type;
+    memcpy(&fm->fm_key, &fe->fe_key, sizeof(fm->fm_key));
+    if (addr6) {
+        memcpy(fm->fm_sip6, addr6->ip6_sip, sizeof(fm->fm_sip6));
+        memcpy(fm->fm_dip6, addr6->ip6_dip, sizeof(fm->fm_dip6));
+    }
+
+    /* publish the descriptor only after it is complete */
+    __sync_synchronize();
+    fm->fm_seq = head + 1;
+
+    return 0;
+}
+
 static int
 vr_enqueue_flow(struct vrouter *router, struct vr_flow_entry *fe,
         struct vr_packet *pkt, unsigned int index,
@@ -482,8 +905,11 @@ vr_enqueue_flow(struct vrouter *router, struct vr_flow_entry *fe,
     __sync_synchronize();
     pnode->pl_packet = pkt;
 
-    if (!i)
-        vr_trap_flow(router, fe, pkt, index);
+    if (!i) {
+        /* agent does not need the packet itself to set up the flow */
+        if (vr_flow_miss_post(router, fe, pkt, index))
+            vr_trap_flow(router, fe, pkt, index);
+    }
 
     return 0;
 drop:
@@ -498,6 +924,9 @@ vr_flow_nat(struct vr_flow_entry *fe,
     if (pkt->vp_type == VP_TYPE_IP)
         return vr_inet_flow_nat(fe, pkt, fmd);
 
+    if (pkt->vp_type == VP_TYPE_IP6)
+        return vr_inet6_flow_nat(fe, pkt, fmd);
+
     vr_pfree(pkt, VP_DROP_FLOW_ACTION_INVALID);
     return FLOW_CONSUMED;
 }
@@ -522,15 +951,14 @@ vr_flow_set_forwarding_md(struct vrouter *router, struct vr_flow_entry *fe,
 
 static flow_result_t
 vr_flow_action(struct vrouter *router, struct vr_flow_entry *fe, 
-        unsigned int index, struct vr_packet *pkt,
-        struct vr_forwarding_md *fmd)
+        unsigned int index, struct vr_nexthop *src_nh,
+        struct vr_packet *pkt, struct vr_forwarding_md *fmd)
 {
     int valid_src;
 
     flow_result_t result;
 
     struct vr_forwarding_md mirror_fmd;
-    struct vr_nexthop *src_nh;
     struct vr_packet *pkt_clone;
 
     fmd->fmd_dvrf = fe->fe_vrf;
@@ -540,7 +968,8 @@ vr_flow_action(struct vrouter *router, struct vr_flow_entry *fe,
      */
 
     vr_flow_set_forwarding_md(router, fe, index, fmd);
-    src_nh = __vrouter_get_nexthop(router, fe->fe_src_nh_index);
+    if (!src_nh)
+        src_nh = __vrouter_get_nexthop(router, fe->fe_src_nh_index);
     if (!src_nh) {
         vr_pfree(pkt, VP_DROP_INVALID_NH);
         return FLOW_CONSUMED;
@@ -633,6 +1062,8 @@ vr_trap_flow(struct vrouter *router, struct vr_flow_entry *fe,
         ta.vfta_index = index;
         if (fe->fe_type == VP_TYPE_IP)
             ta.vfta_nh_index = fe->fe_key.flow4_nh_id;
+        else if (fe->fe_type == VP_TYPE_IP6)
+            ta.vfta_nh_index = fe->fe_key.flow6_nh_id;
         break;
     }
 
@@ -640,39 +1071,204 @@ vr_trap_flow(struct vrouter *router, struct vr_flow_entry *fe,
     return vr_trap(npkt, fe->fe_vrf, trap_reason, &ta);
 }
 
-static flow_result_t
-vr_do_flow_action(struct vrouter *router, struct vr_flow_entry *fe,
-        unsigned int index, struct vr_packet *pkt,
-        struct vr_forwarding_md *fmd)
+static void
+vr_flow_stats_update(struct vr_flow_entry *fe, uint64_t bytes,
+        uint64_t packets)
 {
     uint32_t new_stats;
+    unsigned int oflow;
+
+    if (bytes) {
+        oflow = bytes >> 32;
+        new_stats = __sync_add_and_fetch(&fe->fe_stats.flow_bytes,
+                (uint32_t)bytes);
+        if (new_stats < (uint32_t)bytes)
+            oflow++;
+        if (oflow)
+            fe->fe_stats.flow_bytes_oflow += oflow;
+    }
 
-    new_stats = __sync_add_and_fetch(&fe->fe_stats.flow_bytes, pkt_len(pkt));
-    if (new_stats < pkt_len(pkt))
-        fe->fe_stats.flow_bytes_oflow++;
-
-    new_stats = __sync_add_and_fetch(&fe->fe_stats.flow_packets, 1);
-    if (!new_stats) 
-        fe->fe_stats.flow_packets_oflow++;
-
-    if (fe->fe_action == VR_FLOW_ACTION_HOLD) {
-        vr_enqueue_flow(router, fe, pkt, index, fmd);
-        return FLOW_HELD;
+    if (packets) {
+        oflow = packets >> 32;
+        new_stats = __sync_add_and_fetch(&fe->fe_stats.flow_packets,
+                (uint32_t)packets);
+        if (new_stats < (uint32_t)packets)
+            oflow++;
+        if (oflow)
+            fe->fe_stats.flow_packets_oflow += oflow;
     }
 
-    return vr_flow_action(router, fe, index, pkt, fmd);
+    return;
 }
 
-static unsigned int
-vr_flow_table_hold_count(struct vrouter *router)
+static inline bool
+vr_flow_stats_slot_trylock(struct vr_flow_stats_slot *slot)
 {
-    unsigned int i, num_cpus;
-    uint64_t hcount = 0, act_count;
-    struct vr_flow_table_info *infop = router->vr_flow_table_info;
+    return !__sync_lock_test_and_set(&slot->fss_busy, 1);
+}
 
-    num_cpus = vr_num_cpus;
-    for (i = 0; i < num_cpus; i++)
-        hcount += infop->vfti_hold_count[i];
+static inline void
+vr_flow_stats_slot_unlock(struct vr_flow_stats_slot *slot)
+{
+    __sync_lock_release(&slot->fss_busy);
+    return;
+}
+
+/* has to be called with the slot locked */
+static void
+vr_flow_stats_slot_flush(struct vrouter *router,
+        struct vr_flow_stats_slot *slot)
+{
+    uint64_t bytes, packets;
+    struct vr_flow_entry *fe;
+
+    bytes = *(volatile uint64_t *)&slot->fss_bytes;
+    packets = *(volatile uint64_t *)&slot->fss_packets;
+
+    if (slot->fss_index >= 0) {
+        fe = vr_get_flow_entry(router, slot->fss_index);
+        if (fe)
+            vr_flow_stats_update(fe, bytes - slot->fss_flushed_bytes,
+                    packets - slot->fss_flushed_packets);
+    }
+
+    slot->fss_flushed_bytes = bytes;
+    slot->fss_flushed_packets = packets;
+
+    return;
+}
+
+static void
+vr_flow_stats_add(struct vrouter *router, struct vr_flow_entry *fe,
+        unsigned int index, unsigned int len)
+{
+    unsigned int cpu;
+    struct vr_flow_stats_slot *slot;
+
+    cpu = vr_get_cpu();
+    if (!router->vr_flow_pcpu_stats || (cpu >= vr_num_cpus))
+        goto shared_update;
+
+    slot = &router->vr_flow_pcpu_stats[cpu]->fps_slots[index &
+        (VR_FLOW_STATS_SLOTS - 1)];
+    if (slot->fss_index != (int)index) {
+        /*
+         * the slot is with some other flow. hand its counts over to that
+         * flow and take the slot. never spin here, since the holder of the
+         * lock could be the context this packet interrupted
+         */
+        if (!vr_flow_stats_slot_trylock(slot))
+            goto shared_update;
+
+        vr_flow_stats_slot_flush(router, slot);
+        slot->fss_index = index;
+        vr_flow_stats_slot_unlock(slot);
+    }
+
+    slot->fss_bytes += len;
+    slot->fss_packets++;
+
+    return;
+
+shared_update:
+    vr_flow_stats_update(fe, len, 1);
+    return;
+}
+
+/*
+ * moves the counts that cpus have accumulated for the flow to the flow
+ * entry, and, if 'forget' is set, releases the slots so that counts of a
+ * flow that is going away do not leak into the next user of the index.
+ * can spin and hence not to be called from the datapath
+ */
+static void
+vr_flow_stats_sync(struct vrouter *router, unsigned int index, bool forget)
+{
+    unsigned int cpu;
+    struct vr_flow_stats_slot *slot;
+
+    if (!router->vr_flow_pcpu_stats)
+        return;
+
+    for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+        slot = &router->vr_flow_pcpu_stats[cpu]->fps_slots[index &
+            (VR_FLOW_STATS_SLOTS - 1)];
+        if (slot->fss_index != (int)index)
+            continue;
+
+        while (!vr_flow_stats_slot_trylock(slot))
+            ;
+
+        if (slot->fss_index == (int)index) {
+            if (forget) {
+                slot->fss_flushed_bytes = slot->fss_bytes;
+                slot->fss_flushed_packets = slot->fss_packets;
+                slot->fss_index = -1;
+            } else {
+                vr_flow_stats_slot_flush(router, slot);
+            }
+        }
+
+        vr_flow_stats_slot_unlock(slot);
+    }
+
+    return;
+}
+
+static void
+vr_flow_stats_flush_timer(void *arg)
+{
+    unsigned int cpu, i;
+    struct vrouter *router = (struct vrouter *)arg;
+    struct vr_flow_stats_slot *slot;
+
+    if (!router->vr_flow_pcpu_stats)
+        return;
+
+    for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+        for (i = 0; i < VR_FLOW_STATS_SLOTS; i++) {
+            slot = &router->vr_flow_pcpu_stats[cpu]->fps_slots[i];
+            if ((slot->fss_index < 0) ||
+                    (slot->fss_packets == slot->fss_flushed_packets))
+                continue;
+
+            /* busy slots will be taken care of in the next run */
+            if (!vr_flow_stats_slot_trylock(slot))
+                continue;
+
+            vr_flow_stats_slot_flush(router, slot);
+            vr_flow_stats_slot_unlock(slot);
+        }
+    }
+
+    return;
+}
+
+static flow_result_t
+vr_do_flow_action(struct vrouter *router, struct vr_flow_entry *fe,
+        unsigned int index, struct vr_nexthop *src_nh,
+        struct vr_packet *pkt, struct vr_forwarding_md *fmd)
+{
+    vr_flow_stats_add(router, fe, index, pkt_len(pkt));
+
+    if (fe->fe_action == VR_FLOW_ACTION_HOLD) {
+        vr_enqueue_flow(router, fe, pkt, index, fmd);
+        return FLOW_HELD;
+    }
+
+    return vr_flow_action(router, fe, index, src_nh, pkt, fmd);
+}
+
+static unsigned int
+vr_flow_table_hold_count(struct vrouter *router)
+{
+    unsigned int i, num_cpus;
+    uint64_t hcount = 0, act_count;
+    struct vr_flow_table_info *infop = router->vr_flow_table_info;
+
+    num_cpus = vr_num_cpus;
+    for (i = 0; i < num_cpus; i++)
+        hcount += infop->vfti_hold_count[i];
 
     act_count = infop->vfti_action_count;
     if (hcount >= act_count)
@@ -691,6 +1287,12 @@ vr_flow_entry_set_hold(struct vrouter *router, struct vr_flow_entry *flow_e)
     cpu = vr_get_cpu();
     flow_e->fe_action = VR_FLOW_ACTION_HOLD;
 
+    /* threads that are not a datapath cpu share the first count */
+    if (cpu >= vr_num_cpus) {
+        (void)__sync_add_and_fetch(&infop->vfti_hold_count[0], 1);
+        return;
+    }
+
     if (infop->vfti_hold_count[cpu] + 1 < infop->vfti_hold_count[cpu]) {
         act_count = infop->vfti_action_count;
         if (act_count > infop->vfti_hold_count[cpu]) {
@@ -709,16 +1311,34 @@ vr_flow_entry_set_hold(struct vrouter *router, struct vr_flow_entry *flow_e)
     return;
 }
 
-flow_result_t
-vr_flow_lookup(struct vrouter *router, struct vr_flow *key,
-               struct vr_packet *pkt, struct vr_forwarding_md *fmd)
+static flow_result_t
+__vr_flow_lookup(struct vrouter *router, struct vr_flow *key,
+        struct vr_inet6_flow_addr *addr6, struct vr_packet *pkt,
+        struct vr_forwarding_md *fmd)
 {
-    unsigned int fe_index;
+    unsigned int fe_index, gen = 0;
     struct vr_flow_entry *flow_e;
+    struct vr_flow_cache_entry *fce = NULL;
+    struct vr_nexthop *src_nh = NULL;
 
     pkt->vp_flags |= VP_FLAG_FLOW_SET;
 
-    flow_e = vr_find_flow(router, key, pkt->vp_type,  &fe_index);
+    if (!addr6 && (fce = vr_flow_cache_slot(router, key))) {
+        /* read the generation before looking at anything else */
+        gen = vr_flow_cache_gen(router);
+        if (vr_flow_cache_get(router, fce, gen, key, &fe_index, &src_nh)) {
+            flow_e = vr_get_flow_entry(router, fe_index);
+            if (flow_e)
+                return vr_do_flow_action(router, flow_e, fe_index,
+                        src_nh, pkt, fmd);
+        }
+        src_nh = NULL;
+    }
+
+    flow_e = vr_find_flow(router, key, pkt->vp_type, addr6, &fe_index);
+    if (flow_e && fce)
+        vr_flow_cache_fill(router, fce, gen, key, flow_e, fe_index, &src_nh);
+
     if (!flow_e) {
         if (pkt->vp_nh &&
             (pkt->vp_nh->nh_flags & NH_FLAG_RELAXED_POLICY))
@@ -729,7 +1349,7 @@ vr_flow_lookup(struct vrouter *router, struct vr_flow *key,
             return FLOW_CONSUMED;
         }
 
-        flow_e = vr_find_free_entry(router, key, pkt->vp_type,
+        flow_e = vr_find_free_entry(router, key, pkt->vp_type, addr6,
                 true, &fe_index);
         if (!flow_e) {
             vr_pfree(pkt, VP_DROP_FLOW_TABLE_FULL);
@@ -741,7 +1361,22 @@ vr_flow_lookup(struct vrouter *router, struct vr_flow *key,
         vr_flow_entry_set_hold(router, flow_e);
     } 
     
-    return vr_do_flow_action(router, flow_e, fe_index, pkt, fmd);
+    return vr_do_flow_action(router, flow_e, fe_index, src_nh, pkt, fmd);
+}
+
+flow_result_t
+vr_flow_lookup(struct vrouter *router, struct vr_flow *key,
+               struct vr_packet *pkt, struct vr_forwarding_md *fmd)
+{
+    return __vr_flow_lookup(router, key, NULL, pkt, fmd);
+}
+
+flow_result_t
+vr_flow6_lookup(struct vrouter *router, struct vr_flow *key,
+        struct vr_inet6_flow_addr *addr6, struct vr_packet *pkt,
+        struct vr_forwarding_md *fmd)
+{
+    return __vr_flow_lookup(router, key, addr6, pkt, fmd);
 }
 
 static bool
@@ -779,9 +1414,13 @@ vr_flow_forward(struct vrouter *router, struct vr_packet *pkt,
     flow_result_t result;
 
     /* Flow processig is only for untagged unicast IP packets */
-    if ((pkt->vp_type == VP_TYPE_IP) && (!(pkt->vp_flags & VP_FLAG_MULTICAST))
-        && ((fmd->fmd_vlan == VLAN_ID_INVALID) || vif_is_service(pkt->vp_if)))
+    if ((pkt->vp_flags & VP_FLAG_MULTICAST) ||
+        ((fmd->fmd_vlan != VLAN_ID_INVALID) && !vif_is_service(pkt->vp_if)))
+        result = FLOW_FORWARD;
+    else if (pkt->vp_type == VP_TYPE_IP)
         result = vr_inet_flow_lookup(router, pkt, fmd);
+    else if (pkt->vp_type == VP_TYPE_IP6)
+        result = vr_inet6_flow_lookup(router, pkt, fmd);
     else
         result = FLOW_FORWARD;
 
@@ -835,7 +1474,7 @@ vr_flush_flow_queue(struct vrouter *router, struct vr_flow_entry *fe,
             }
         }
 
-        result = vr_flow_action(router, fe, vfq->vfq_index, pkt, fmd);
+        result = vr_flow_action(router, fe, vfq->vfq_index, NULL, pkt, fmd);
         forward = __vr_flow_forward(result, pkt, fmd);
         if (forward)
             vr_reinject_packet(pkt, fmd);
@@ -885,6 +1524,7 @@ vr_flow_flush(void *arg)
     vr_flush_entry(router, fe, flmd, &fmd);
 
     if (!(flmd->flmd_flags & VR_FLOW_FLAG_ACTIVE)) {
+        vr_flow_stats_sync(router, flmd->flmd_index, true);
         vr_reset_flow_entry(router, fe, flmd->flmd_index);
     } 
 
@@ -949,37 +1589,61 @@ vr_flow_set_mirror(struct vrouter *router, vr_flow_req *req,
 
 static struct vr_flow_entry *
 vr_add_flow(unsigned int rid, struct vr_flow *key, uint8_t type,
-        bool need_hold_queue, unsigned int *fe_index)
+        struct vr_inet6_flow_addr *addr6, bool need_hold_queue,
+        unsigned int *fe_index)
 {
     struct vr_flow_entry *flow_e;
     struct vrouter *router = vrouter_get(rid);
 
-    flow_e = vr_find_flow(router, key, type, fe_index);
+    flow_e = vr_find_flow(router, key, type, addr6, fe_index);
     if (!flow_e)
-        flow_e = vr_find_free_entry(router, key, type,
+        flow_e = vr_find_free_entry(router, key, type, addr6,
                 need_hold_queue, fe_index);
 
     return flow_e;
 }
 
+static bool
+vr_flow_req_is_inet6(vr_flow_req *req)
+{
+    if ((req->fr_flow_sip6_size == VR_IP6_ADDRESS_LEN) &&
+            (req->fr_flow_dip6_size == VR_IP6_ADDRESS_LEN) &&
+            req->fr_flow_sip6 && req->fr_flow_dip6)
+        return true;
+
+    return false;
+}
+
 static struct vr_flow_entry *
-vr_add_flow_req(vr_flow_req *req, unsigned int *fe_index)
+vr_add_flow_req(struct vrouter *router, vr_flow_req *req,
+        unsigned int *fe_index)
 {
     uint8_t type;
     bool need_hold_queue = false;
 
     struct vr_flow key;
+    struct vr_inet6_flow_addr addr6, *addr6_p = NULL;
     struct vr_flow_entry *fe;
 
-    vr_inet_fill_flow(&key, req->fr_flow_nh_id, req->fr_flow_sip,
-            req->fr_flow_dip, req->fr_flow_proto,
-            req->fr_flow_sport, req->fr_flow_dport);
-    type = VP_TYPE_IP;
+    if (vr_flow_req_is_inet6(req)) {
+        vr_inet6_fill_flow(router, &key, &addr6, req->fr_flow_nh_id,
+                (unsigned char *)req->fr_flow_sip6,
+                (unsigned char *)req->fr_flow_dip6, req->fr_flow_proto,
+                req->fr_flow_sport, req->fr_flow_dport);
+        addr6_p = &addr6;
+        type = VP_TYPE_IP6;
+    } else {
+        vr_inet_fill_flow(&key, req->fr_flow_nh_id, req->fr_flow_sip,
+                req->fr_flow_dip, req->fr_flow_proto,
+                req->fr_flow_sport, req->fr_flow_dport);
+        type = VP_TYPE_IP;
+    }
 
     if (req->fr_action == VR_FLOW_ACTION_HOLD)
         need_hold_queue = true;
 
-    fe = vr_add_flow(req->fr_rid, &key, type, need_hold_queue, fe_index);
+    fe = vr_add_flow(req->fr_rid, &key, type, addr6_p,
+            need_hold_queue, fe_index);
     if (fe)
         req->fr_index = *fe_index;
 
@@ -995,9 +1659,26 @@ vr_flow_req_is_invalid(struct vrouter *router, vr_flow_req *req,
         struct vr_flow_entry *fe)
 {
     struct vr_flow_entry *rfe;
+    struct vr_inet6_flow_addr *addr6;
 
     if (fe) {
-        if (fe->fe_type == VP_TYPE_IP) {
+        if (fe->fe_type == VP_TYPE_IP6) {
+            if (!vr_flow_req_is_inet6(req))
+                return -EBADF;
+
+            addr6 = vr_flow6_get_addr(router, req->fr_index);
+            if (!addr6 ||
+                    memcmp(addr6->ip6_sip, req->fr_flow_sip6,
+                        VR_IP6_ADDRESS_LEN) ||
+                    memcmp(addr6->ip6_dip, req->fr_flow_dip6,
+                        VR_IP6_ADDRESS_LEN) ||
+                    (unsigned short)req->fr_flow_sport != fe->fe_key.flow6_sport ||
+                    (unsigned short)req->fr_flow_dport != fe->fe_key.flow6_dport||
+                    (unsigned short)req->fr_flow_nh_id != fe->fe_key.flow6_nh_id ||
+                    (unsigned char)req->fr_flow_proto != fe->fe_key.flow6_proto) {
+                return -EBADF;
+            }
+        } else if (fe->fe_type == VP_TYPE_IP) {
             if ((unsigned int)req->fr_flow_sip != fe->fe_key.flow4_sip ||
                     (unsigned int)req->fr_flow_dip != fe->fe_key.flow4_dip ||
                     (unsigned short)req->fr_flow_sport != fe->fe_key.flow4_sport ||
@@ -1044,6 +1725,9 @@ vr_flow_schedule_transition(struct vrouter *router, vr_flow_req *req,
     struct vr_flow_md *flmd;
     struct vr_defer_data *defer = NULL;
 
+    /* the flow has changed. cached lookups of it are stale now */
+    vr_flow_cache_invalidate_flow(router, req->fr_index);
+
     flmd = (struct vr_flow_md *)vr_malloc(sizeof(*flmd));
     if (!flmd)
         return -ENOMEM;
@@ -1060,7 +1744,13 @@ vr_flow_schedule_transition(struct vrouter *router, vr_flow_req *req,
     }
     flmd->flmd_defer_data = defer;
 
-    vr_schedule_work(vr_get_cpu(), vr_flow_flush, (void *)flmd);
+    if (vr_schedule_work(vr_get_cpu(), vr_flow_flush, (void *)flmd)) {
+        if (defer)
+            vr_put_defer_data(defer);
+        vr_free(flmd);
+        return -ENOMEM;
+    }
+
     return 0;
 }
 
@@ -1074,10 +1764,202 @@ vr_flow_delete(struct vrouter *router, vr_flow_req *req,
 
     fe->fe_action = VR_FLOW_ACTION_DROP;
     vr_flow_reset_mirror(router, fe, req->fr_index);
+    /* let agent see the final counts of the flow */
+    vr_flow_stats_sync(router, req->fr_index, false);
 
     return vr_flow_schedule_transition(router, req, fe);
 }
 
+static unsigned int
+vr_flow_aged_ring_free(struct vr_flow_ageing *fa)
+{
+    return VR_FLOW_AGED_RING_SIZE - (fa->fa_ring_head - fa->fa_ring_tail);
+}
+
+static void
+vr_flow_aged_ring_put(struct vr_flow_ageing *fa, unsigned int index)
+{
+    fa->fa_ring[fa->fa_ring_head & (VR_FLOW_AGED_RING_SIZE - 1)] = index;
+    /* make the index visible before the slot is handed to the consumer */
+    __sync_synchronize();
+    fa->fa_ring_head++;
+
+    return;
+}
+
+static bool
+vr_flow_is_idle(struct vr_flow_entry *fe, struct vr_flow_age_info *ai)
+{
+    if (!(fe->fe_flags & VR_FLOW_FLAG_ACTIVE) ||
+            (fe->fe_action == VR_FLOW_ACTION_HOLD))
+        return false;
+
+    return ai->fai_time && (ai->fai_packets == fe->fe_stats.flow_packets);
+}
+
+/*
+ * runs in process context, and outside of the datapath's read side, since
+ * the request lock sleeps and taking a flow down can end up waiting for
+ * the datapath (mirror release, for eg.)
+ */
+static void
+vr_flow_age_evict(void *arg)
+{
+    unsigned int i, index;
+    struct vr_flow_age_batch *fab = (struct vr_flow_age_batch *)arg;
+    struct vrouter *router = fab->fab_router;
+    struct vr_flow_ageing *fa = router->vr_flow_ageing;
+    struct vr_flow_entry *fe;
+    struct vr_flow_age_info *ai;
+    vr_flow_req req;
+
+    if (!fa)
+        goto exit_evict;
+
+    /* agent could be changing the same flows over a request */
+    vr_message_lock();
+    for (i = 0; i < fab->fab_count; i++) {
+        index = fab->fab_index[i];
+        fe = vr_get_flow_entry(router, index);
+        ai = vr_flow_age_info_get(router, index);
+        if (!fe || !ai)
+            continue;
+
+        /* traffic might have resumed or agent might have changed the flow */
+        if (!vr_flow_is_idle(fe, ai))
+            continue;
+
+        memset(&req, 0, sizeof(req));
+        req.fr_op = FLOW_OP_FLOW_SET;
+        req.fr_index = index;
+        req.fr_rindex = fe->fe_rflow;
+        if (vr_flow_delete(router, &req, fe))
+            continue;
+
+        /* the scanner made sure that there is room for the whole batch */
+        vr_flow_aged_ring_put(fa, index);
+    }
+    vr_message_unlock();
+
+    __sync_synchronize();
+    fa->fa_evict_pending = 0;
+
+exit_evict:
+    vr_free(fab);
+    return;
+}
+
+static void
+vr_flow_age_scan(void *arg)
+{
+    unsigned int sec, nsec;
+    unsigned int i, index, total, room;
+    struct vrouter *router = (struct vrouter *)arg;
+    struct vr_flow_ageing *fa = router->vr_flow_ageing;
+    struct vr_flow_age_batch *fab = NULL;
+    struct vr_flow_entry *fe;
+    struct vr_flow_age_info *ai;
+
+    /* let the previous batch get evicted before we pick the next one */
+    if (!fa || fa->fa_evict_pending)
+        return;
+
+    room = vr_flow_aged_ring_free(fa);
+    if (room > VR_FLOW_AGE_BATCH)
+        room = VR_FLOW_AGE_BATCH;
+
+    vr_get_mono_time(&sec, &nsec);
+    /* 0 is reserved for 'not seen yet' */
+    if (!sec)
+        sec = 1;
+
+    total = vr_flow_entries + vr_oflow_entries;
+    for (i = 0; i < VR_FLOW_AGE_ENTRIES_PER_SCAN; i++) {
+        index = fa->fa_next_index;
+        if (++fa->fa_next_index >= total)
+            fa->fa_next_index = 0;
+
+        fe = vr_get_flow_entry(router, index);
+        if (!fe || !(fe->fe_flags & VR_FLOW_FLAG_ACTIVE) ||
+                (fe->fe_action == VR_FLOW_ACTION_HOLD))
+            continue;
+
+        ai = vr_flow_age_info_get(router, index);
+        if (!ai)
+            continue;
+
+        if (!vr_flow_is_idle(fe, ai)) {
+            ai->fai_packets = fe->fe_stats.flow_packets;
+            ai->fai_time = sec;
+            continue;
+        }
+
+        if ((sec - ai->fai_time) < vr_flow_age_timeout)
+            continue;
+
+        /* no room to tell agent about it. try again in the next sweep */
+        if (!room)
+            continue;
+
+        if (!fab) {
+            fab = vr_zalloc(sizeof(*fab));
+            if (!fab)
+                return;
+            fab->fab_router = router;
+        }
+
+        fab->fab_index[fab->fab_count++] = index;
+        if (fab->fab_count == room)
+            break;
+    }
+
+    if (fab) {
+        fa->fa_evict_pending = 1;
+        /* if the work can not be had, the flows wait for the next sweep */
+        if (vr_schedule_process_work(vr_get_cpu(), vr_flow_age_evict,
+                    (void *)fab)) {
+            fa->fa_evict_pending = 0;
+            vr_free(fab);
+        }
+    }
+
+    return;
+}
+
+/* agent drains the indices of the flows that were aged out */
+static int
+vr_flow_aged_get(struct vrouter *router, vr_flow_req *req)
+{
+    unsigned int i, count;
+    struct vr_flow_ageing *fa = router->vr_flow_ageing;
+
+    if (!fa)
+        return -EOPNOTSUPP;
+
+    count = fa->fa_ring_head - fa->fa_ring_tail;
+    if (count > VR_FLOW_AGE_BATCH)
+        count = VR_FLOW_AGE_BATCH;
+    if (!count)
+        return 0;
+
+    /* read the slots only after we have seen the producer's head */
+    __sync_synchronize();
+    req->fr_aged_index = vr_zalloc(count * sizeof(int));
+    if (!req->fr_aged_index)
+        return -ENOMEM;
+
+    for (i = 0; i < count; i++) {
+        req->fr_aged_index[i] = fa->fa_ring[(fa->fa_ring_tail + i) &
+            (VR_FLOW_AGED_RING_SIZE - 1)];
+    }
+    req->fr_aged_index_size = count;
+
+    __sync_synchronize();
+    fa->fa_ring_tail += count;
+
+    return 0;
+}
+
 static void
 vr_flow_udp_src_port (struct vrouter *router, struct vr_flow_entry *fe)
 {
@@ -1092,13 +1974,20 @@ vr_flow_udp_src_port (struct vrouter *router, struct vr_flow_entry *fe)
         hashrnd_inited = 1;
     }
 
-    hash_key[0] = fe->fe_key.flow4_sip;
-    hash_key[1] = fe->fe_key.flow4_dip;
+    if (fe->fe_type == VP_TYPE_IP6) {
+        hash_key[0] = fe->fe_key.flow6_addr_hash;
+        hash_key[1] = 0;
+        hash_key[3] = fe->fe_key.flow6_sport;
+        hash_key[4] = fe->fe_key.flow6_dport;
+    } else {
+        hash_key[0] = fe->fe_key.flow4_sip;
+        hash_key[1] = fe->fe_key.flow4_dip;
+        hash_key[3] = fe->fe_key.flow4_sport;
+        hash_key[4] = fe->fe_key.flow4_dport;
+    }
     hash_key[2] = fe->fe_vrf;
-    hash_key[3] = fe->fe_key.flow4_sport;
-    hash_key[4] = fe->fe_key.flow4_dport;
 
-    hashval = jhash(hash_key, 20, vr_hashrnd);
+    hashval = vr_hash2(hash_key, 5, vr_hashrnd);
     port_range = VR_MUDP_PORT_RANGE_END - VR_MUDP_PORT_RANGE_START;
     port = (uint16_t ) (((uint64_t ) hashval * port_range) >> 32);
 
@@ -1150,7 +2039,7 @@ vr_flow_set(struct vrouter *router, vr_flow_req *req)
      * new flow entry with the key specified in the request
      */
     if (!fe) {
-        fe = vr_add_flow_req(req, &fe_index);
+        fe = vr_add_flow_req(router, req, &fe_index);
         if (!fe)
             return -ENOSPC;
     }
@@ -1208,6 +2097,8 @@ vr_flow_req_process(void *s_req)
     case FLOW_OP_FLOW_TABLE_GET:
         req->fr_ftable_size = vr_flow_table_size(router) +
             vr_oflow_table_size(router);
+        req->fr_miss_ring_size = vr_flow_miss_ring_size(router);
+        req->fr_miss_ring_entries = VR_FLOW_MISS_RING_ENTRIES;
 #if defined(__linux__) && defined(__KERNEL__)
         req->fr_ftable_dev = vr_flow_major;
 #endif
@@ -1217,11 +2108,155 @@ vr_flow_req_process(void *s_req)
         ret = vr_flow_set(router, req);
         break;
 
+    case FLOW_OP_FLOW_AGED_GET:
+        ret = vr_flow_aged_get(router, req);
+        break;
+
     default:
         ret = -EINVAL;
     }
 
     vr_message_response(VR_FLOW_OBJECT_ID, req, ret);
+    if (req->fr_op == FLOW_OP_FLOW_AGED_GET && req->fr_aged_index) {
+        vr_free(req->fr_aged_index);
+        req->fr_aged_index = NULL;
+        req->fr_aged_index_size = 0;
+    }
+
+    return;
+}
+
+static bool
+vr_flow_bulk_req_is_valid(vr_flow_bulk_req *req, unsigned int count)
+{
+    if ((req->fbr_action_size != count) || (req->fbr_flags_size != count) ||
+            (req->fbr_rindex_size != count) ||
+            (req->fbr_flow_sip_size != count) ||
+            (req->fbr_flow_dip_size != count) ||
+            (req->fbr_flow_sport_size != count) ||
+            (req->fbr_flow_dport_size != count) ||
+            (req->fbr_flow_proto_size != count) ||
+            (req->fbr_flow_nh_id_size != count) ||
+            (req->fbr_flow_vrf_size != count) ||
+            (req->fbr_flow_dvrf_size != count) ||
+            (req->fbr_src_nh_index_size != count) ||
+            (req->fbr_ecmp_nh_index_size != count) ||
+            (req->fbr_drop_reason_size != count))
+        return false;
+
+    /* a batch is either all ipv4 or all ipv6 */
+    if (req->fbr_flow_sip6_size != req->fbr_flow_dip6_size)
+        return false;
+
+    if (req->fbr_flow_sip6_size &&
+            (req->fbr_flow_sip6_size != count * VR_IP6_ADDRESS_LEN))
+        return false;
+
+    return true;
+}
+
+static void
+vr_flow_bulk_req_item(vr_flow_bulk_req *req, unsigned int i,
+        vr_flow_req *item)
+{
+    memset(item, 0, sizeof(*item));
+    item->fr_op = FLOW_OP_FLOW_SET;
+    item->fr_rid = req->fbr_rid;
+    item->fr_index = req->fbr_index[i];
+    item->fr_action = req->fbr_action[i];
+    item->fr_flags = req->fbr_flags[i];
+    item->fr_rindex = req->fbr_rindex[i];
+    item->fr_flow_sip = req->fbr_flow_sip[i];
+    item->fr_flow_dip = req->fbr_flow_dip[i];
+    item->fr_flow_sport = req->fbr_flow_sport[i];
+    item->fr_flow_dport = req->fbr_flow_dport[i];
+    item->fr_flow_proto = req->fbr_flow_proto[i];
+    item->fr_flow_nh_id = req->fbr_flow_nh_id[i];
+    item->fr_flow_vrf = req->fbr_flow_vrf[i];
+    item->fr_flow_dvrf = req->fbr_flow_dvrf[i];
+    item->fr_src_nh_index = req->fbr_src_nh_index[i];
+    item->fr_ecmp_nh_index = req->fbr_ecmp_nh_index[i];
+    item->fr_drop_reason = req->fbr_drop_reason[i];
+
+    if (req->fbr_flow_sip6_size) {
+        item->fr_flow_sip6 = &req->fbr_flow_sip6[i * VR_IP6_ADDRESS_LEN];
+        item->fr_flow_sip6_size = VR_IP6_ADDRESS_LEN;
+        item->fr_flow_dip6 = &req->fbr_flow_dip6[i * VR_IP6_ADDRESS_LEN];
+        item->fr_flow_dip6_size = VR_IP6_ADDRESS_LEN;
+    }
+
+    return;
+}
+
+/*
+ * sandesh handler for vr_flow_bulk_req. every item of the request is a flow
+ * set of its own, and the response carries the result and the (possibly
+ * newly allocated) flow index of every item, in the order of the request.
+ * mirroring needs more than what the bulk request carries, and hence flows
+ * that are to be mirrored have to be set using vr_flow_req
+ */
+void
+vr_flow_bulk_req_process(void *s_req)
+{
+    int ret = 0;
+    unsigned int i, count = 0;
+    int32_t *results = NULL, *indices = NULL;
+    struct vrouter *router;
+    vr_flow_req item;
+    vr_flow_bulk_req resp;
+    vr_flow_bulk_req *req = (vr_flow_bulk_req *)s_req;
+
+    if (req->h_op != SANDESH_OP_ADD) {
+        ret = -EOPNOTSUPP;
+        goto exit_bulk;
+    }
+
+    router = vrouter_get(req->fbr_rid);
+    if (!router) {
+        ret = -EINVAL;
+        goto exit_bulk;
+    }
+
+    count = req->fbr_index_size;
+    if (!count || (count > VR_FLOW_BULK_MAX_ITEMS) ||
+            !vr_flow_bulk_req_is_valid(req, count)) {
+        ret = -EINVAL;
+        goto exit_bulk;
+    }
+
+    results = vr_zalloc(count * sizeof(*results));
+    indices = vr_zalloc(count * sizeof(*indices));
+    if (!results || !indices) {
+        ret = -ENOMEM;
+        goto exit_bulk;
+    }
+
+    for (i = 0; i < count; i++) {
+        vr_flow_bulk_req_item(req, i, &item);
+        if (item.fr_flags & VR_FLOW_FLAG_MIRROR)
+            results[i] = -EOPNOTSUPP;
+        else
+            results[i] = vr_flow_set(router, &item);
+        indices[i] = item.fr_index;
+    }
+
+exit_bulk:
+    memset(&resp, 0, sizeof(resp));
+    if (!ret) {
+        resp.h_op = req->h_op;
+        resp.fbr_rid = req->fbr_rid;
+        resp.fbr_index = indices;
+        resp.fbr_index_size = count;
+        resp.fbr_result = results;
+        resp.fbr_result_size = count;
+    }
+
+    vr_message_response(VR_FLOW_BULK_OBJECT_ID, ret ? NULL : &resp, ret);
+    if (results)
+        vr_free(results);
+    if (indices)
+        vr_free(indices);
+
     return;
 }
 
@@ -1281,6 +2316,16 @@ vr_flow_table_destroy(struct vrouter *router)
         router->vr_oflow_table = NULL;
     }
 
+    if (router->vr_flow_tags) {
+        vr_btable_free(router->vr_flow_tags);
+        router->vr_flow_tags = NULL;
+    }
+
+    if (router->vr_flow6_addr_table) {
+        vr_btable_free(router->vr_flow6_addr_table);
+        router->vr_flow6_addr_table = NULL;
+    }
+
     vr_flow_table_info_destroy(router);
 
     return;
@@ -1314,6 +2359,7 @@ vr_flow_table_reset(struct vrouter *router)
                 flmd.flmd_flags = fe->fe_flags;
                 fe->fe_action = VR_FLOW_ACTION_DROP;
                 vr_flush_entry(router, fe, &flmd, &fmd);
+                vr_flow_stats_sync(router, i, true);
                 vr_reset_flow_entry(router, fe, i);
             }
         }
@@ -1333,6 +2379,8 @@ vr_flow_table_init(struct vrouter *router)
             return vr_module_error(-EINVAL, __FUNCTION__,
                     __LINE__, vr_flow_entries);
 
+        vr_hash_fn_init(&router->vr_flow_hash);
+
         router->vr_flow_table = vr_btable_alloc(vr_flow_entries,
                 sizeof(struct vr_flow_entry));
         if (!router->vr_flow_table) {
@@ -1341,7 +2389,12 @@ vr_flow_table_init(struct vrouter *router)
         }
     }
 
+
     if (!router->vr_oflow_table) {
+        if (vr_oflow_entries % VR_FLOW_ENTRIES_PER_BUCKET)
+            return vr_module_error(-EINVAL, __FUNCTION__,
+                    __LINE__, vr_oflow_entries);
+
         router->vr_oflow_table = vr_btable_alloc(vr_oflow_entries,
                 sizeof(struct vr_flow_entry));
         if (!router->vr_oflow_table) {
@@ -1350,9 +2403,278 @@ vr_flow_table_init(struct vrouter *router)
         }
     }
 
+    if (!router->vr_flow_tags) {
+        router->vr_flow_tags = vr_btable_alloc((vr_flow_entries +
+                    vr_oflow_entries) / VR_FLOW_ENTRIES_PER_BUCKET,
+                sizeof(uint64_t));
+        if (!router->vr_flow_tags) {
+            return vr_module_error(-ENOMEM, __FUNCTION__,
+                    __LINE__, vr_flow_entries + vr_oflow_entries);
+        }
+    }
+
+    if (!router->vr_flow6_addr_table) {
+        router->vr_flow6_addr_table = vr_btable_alloc(vr_flow_entries +
+                vr_oflow_entries, sizeof(struct vr_inet6_flow_addr));
+        if (!router->vr_flow6_addr_table) {
+            return vr_module_error(-ENOMEM, __FUNCTION__,
+                    __LINE__, vr_flow_entries + vr_oflow_entries);
+        }
+    }
+
     return vr_flow_table_info_init(router);
 }
 
+static void
+vr_flow_cache_exit(struct vrouter *router)
+{
+    unsigned int i;
+
+    if (router->vr_flow_gens) {
+        vr_btable_free(router->vr_flow_gens);
+        router->vr_flow_gens = NULL;
+    }
+
+    if (!router->vr_flow_caches)
+        return;
+
+    for (i = 0; i < vr_num_cpus; i++) {
+        if (!router->vr_flow_caches[i])
+            break;
+        vr_free(router->vr_flow_caches[i]);
+        router->vr_flow_caches[i] = NULL;
+    }
+
+    vr_free(router->vr_flow_caches);
+    router->vr_flow_caches = NULL;
+
+    return;
+}
+
+static int
+vr_flow_cache_init(struct vrouter *router)
+{
+    unsigned int i, size;
+
+    if (router->vr_flow_caches)
+        return 0;
+
+    router->vr_flow_gens = vr_btable_alloc(vr_flow_entries +
+            vr_oflow_entries, sizeof(unsigned int));
+    if (!router->vr_flow_gens)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
+                vr_flow_entries + vr_oflow_entries);
+
+    size = sizeof(struct vr_flow_cache *) * vr_num_cpus;
+    router->vr_flow_caches = vr_zalloc(size);
+    if (!router->vr_flow_caches) {
+        vr_flow_cache_exit(router);
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+    }
+
+    size = sizeof(struct vr_flow_cache);
+    for (i = 0; i < vr_num_cpus; i++) {
+        router->vr_flow_caches[i] = vr_zalloc(size);
+        if (!router->vr_flow_caches[i]) {
+            vr_flow_cache_exit(router);
+            return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, i);
+        }
+    }
+
+    return 0;
+}
+
+static void
+vr_flow_stats_exit(struct vrouter *router)
+{
+    unsigned int i;
+
+    if (router->vr_flow_stats_timer) {
+        vr_delete_timer(router->vr_flow_stats_timer);
+        vr_free(router->vr_flow_stats_timer);
+        router->vr_flow_stats_timer = NULL;
+    }
+
+    if (!router->vr_flow_pcpu_stats)
+        return;
+
+    for (i = 0; i < vr_num_cpus; i++) {
+        if (!router->vr_flow_pcpu_stats[i])
+            break;
+        vr_free(router->vr_flow_pcpu_stats[i]);
+        router->vr_flow_pcpu_stats[i] = NULL;
+    }
+
+    vr_free(router->vr_flow_pcpu_stats);
+    router->vr_flow_pcpu_stats = NULL;
+
+    return;
+}
+
+static int
+vr_flow_stats_init(struct vrouter *router)
+{
+    unsigned int i, j, size;
+    struct vr_timer *vtimer;
+
+    if (router->vr_flow_pcpu_stats)
+        return 0;
+
+    size = sizeof(struct vr_flow_pcpu_stats *) * vr_num_cpus;
+    router->vr_flow_pcpu_stats = vr_zalloc(size);
+    if (!router->vr_flow_pcpu_stats)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+
+    size = sizeof(struct vr_flow_pcpu_stats);
+    for (i = 0; i < vr_num_cpus; i++) {
+        router->vr_flow_pcpu_stats[i] = vr_zalloc(size);
+        if (!router->vr_flow_pcpu_stats[i]) {
+            vr_flow_stats_exit(router);
+            return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, i);
+        }
+
+        for (j = 0; j < VR_FLOW_STATS_SLOTS; j++)
+            router->vr_flow_pcpu_stats[i]->fps_slots[j].fss_index = -1;
+    }
+
+    vtimer = vr_zalloc(sizeof(*vtimer));
+    if (!vtimer) {
+        vr_flow_stats_exit(router);
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, 0);
+    }
+
+    vtimer->vt_timer = vr_flow_stats_flush_timer;
+    vtimer->vt_vr_arg = router;
+    vtimer->vt_msecs = VR_FLOW_STATS_FLUSH_MSECS;
+    if (vr_create_timer(vtimer)) {
+        vr_free(vtimer);
+        vr_flow_stats_exit(router);
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, 0);
+    }
+    router->vr_flow_stats_timer = vtimer;
+
+    return 0;
+}
+
+static void
+vr_flow_miss_ring_exit(struct vrouter *router, bool soft_reset)
+{
+    unsigned int i;
+    struct vr_btable *ring = router->vr_flow_miss_ring;
+
+    if (!ring)
+        return;
+
+    if (soft_reset) {
+        /* agent has to enable the rings again once it comes back */
+        for (i = 0; i < vr_btable_entries(ring); i++)
+            memset(vr_btable_get(ring, i), 0, sizeof(struct vr_flow_miss));
+        return;
+    }
+
+    vr_btable_free(router->vr_flow_miss_ring);
+    router->vr_flow_miss_ring = NULL;
+
+    return;
+}
+
+static int
+vr_flow_miss_ring_init(struct vrouter *router)
+{
+    unsigned int entries;
+
+    if (router->vr_flow_miss_ring)
+        return 0;
+
+    entries = vr_num_cpus * VR_FLOW_MISS_RING_STRIDE;
+    router->vr_flow_miss_ring = vr_btable_alloc(entries,
+            sizeof(struct vr_flow_miss));
+    if (!router->vr_flow_miss_ring)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, entries);
+
+    return 0;
+}
+
+static void
+vr_flow_ageing_exit(struct vrouter *router, bool soft_reset)
+{
+    if (soft_reset) {
+        /* the flows are all gone, and so is the agent that wanted to know */
+        if (router->vr_flow_ageing) {
+            router->vr_flow_ageing->fa_ring_tail =
+                router->vr_flow_ageing->fa_ring_head;
+        }
+        return;
+    }
+
+    if (router->vr_flow_age_timer) {
+        vr_delete_timer(router->vr_flow_age_timer);
+        vr_free(router->vr_flow_age_timer);
+        router->vr_flow_age_timer = NULL;
+    }
+
+    /*
+     * with the timer gone, no new batch gets scheduled. the one that was
+     * scheduled before still uses the ageing state and the age table
+     */
+    if (router->vr_flow_ageing) {
+        while (router->vr_flow_ageing->fa_evict_pending)
+            vr_delay_op();
+    }
+
+    if (router->vr_flow_ageing) {
+        vr_free(router->vr_flow_ageing);
+        router->vr_flow_ageing = NULL;
+    }
+
+    if (router->vr_flow_age_table) {
+        vr_btable_free(router->vr_flow_age_table);
+        router->vr_flow_age_table = NULL;
+    }
+
+    return;
+}
+
+static int
+vr_flow_ageing_init(struct vrouter *router)
+{
+    struct vr_timer *vtimer;
+
+    if (!vr_flow_age_timeout || router->vr_flow_ageing)
+        return 0;
+
+    router->vr_flow_age_table = vr_btable_alloc(vr_flow_entries +
+            vr_oflow_entries, sizeof(struct vr_flow_age_info));
+    if (!router->vr_flow_age_table)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__,
+                vr_flow_entries + vr_oflow_entries);
+
+    router->vr_flow_ageing = vr_zalloc(sizeof(struct vr_flow_ageing));
+    if (!router->vr_flow_ageing) {
+        vr_flow_ageing_exit(router, false);
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, 0);
+    }
+    router->vr_flow_ageing->fa_router = router;
+
+    vtimer = vr_zalloc(sizeof(*vtimer));
+    if (!vtimer) {
+        vr_flow_ageing_exit(router, false);
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, 0);
+    }
+
+    vtimer->vt_timer = vr_flow_age_scan;
+    vtimer->vt_vr_arg = router;
+    vtimer->vt_msecs = VR_FLOW_AGE_SCAN_MSECS;
+    if (vr_create_timer(vtimer)) {
+        vr_free(vtimer);
+        vr_flow_ageing_exit(router, false);
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, 0);
+    }
+    router->vr_flow_age_timer = vtimer;
+
+    return 0;
+}
+
 static void
 vr_link_local_ports_reset(struct vrouter *router)
 {
@@ -1401,7 +2723,11 @@ vr_flow_exit(struct vrouter *router, bool soft_reset)
 {
     vr_flow_table_reset(router);
     vr_link_local_ports_reset(router);
+    vr_flow_ageing_exit(router, soft_reset);
+    vr_flow_miss_ring_exit(router, soft_reset);
     if (!soft_reset) {
+        vr_flow_stats_exit(router);
+        vr_flow_cache_exit(router);
         vr_flow_table_destroy(router);
         vr_fragment_table_exit(router);
         vr_link_local_ports_exit(router);
@@ -1421,6 +2747,18 @@ vr_flow_init(struct vrouter *router)
     if ((ret = vr_flow_table_init(router)))
         return ret;
 
+    if ((ret = vr_flow_cache_init(router)))
+        return ret;
+
+    if ((ret = vr_flow_stats_init(router)))
+        return ret;
+
+    if ((ret = vr_flow_ageing_init(router)))
+        return ret;
+
+    if ((ret = vr_flow_miss_ring_init(router)))
+        return ret;
+
     if ((ret = vr_link_local_ports_init(router)))
         return ret;
 
@@ -9,22 +9,11 @@
 #include "vr_btable.h"
 #include "vr_fragment.h"
 #include "vr_hash.h"
+#include "vr_interface.h"
+#include "vr_mpls.h"
 
-#define FRAG_TABLE_ENTRIES  1024
-#define FRAG_TABLE_BUCKETS  4
-#define FRAG_OTABLE_ENTRIES 512
-
-static inline void
-fragment_key(struct vr_fragment_key *key, unsigned short vrf,
-        struct vr_ip *iph)
-{
-    key->fk_sip = iph->ip_saddr;
-    key->fk_dip = iph->ip_daddr;
-    key->fk_id = iph->ip_id;
-    key->fk_vrf = vrf;
-
-    return;
-}
+#define FRAG_PARTITION_BUCKETS  \
+    (VR_FRAG_PARTITION_ENTRIES / VR_FRAG_BUCKET_ENTRIES)
 
 static inline void
 fragment_entry_set(struct vr_fragment *fe, unsigned short vrf, struct vr_ip *iph,
@@ -45,100 +34,191 @@ fragment_entry_set(struct vr_fragment *fe, unsigned short vrf, struct vr_ip *iph
 }
 
 static inline struct vr_fragment *
-fragment_oentry_get(struct vrouter *router, unsigned int index)
+fragment_entry_get(struct vrouter *router, unsigned int partition,
+        unsigned int index)
 {
-    return (struct vr_fragment *)vr_btable_get(router->vr_fragment_otable, index);
+    return (struct vr_fragment *)vr_btable_get(router->vr_fragment_table,
+            (partition * VR_FRAG_PARTITION_ENTRIES) + index);
 }
 
-static inline struct vr_fragment *
-fragment_entry_get(struct vrouter *router, unsigned int index)
+static inline bool
+fragment_entry_valid(struct vr_fragment *fe)
 {
-    return (struct vr_fragment *)vr_btable_get(router->vr_fragment_table, index);
+    return *(volatile unsigned short *)&fe->f_state == VR_FRAG_STATE_VALID;
 }
 
-static inline bool
-fragment_entry_alloc(struct vr_fragment *fe)
+static inline unsigned int
+fragment_local_partition(void)
+{
+    return vr_get_cpu() % vr_num_cpus;
+}
+
+static inline unsigned int
+fragment_bucket(unsigned int hash, unsigned int choice)
 {
-    return __sync_bool_compare_and_swap(&fe->f_dip, 0, 1);
+    if (!choice)
+        return hash % FRAG_PARTITION_BUCKETS;
+
+    return vr_hash_1word(hash, choice) % FRAG_PARTITION_BUCKETS;
+}
+
+static struct vr_fragment *
+fragment_partition_find(struct vrouter *router, unsigned int partition,
+        unsigned int hash, struct vr_fragment_key *key)
+{
+    unsigned int i, j, index;
+    struct vr_fragment *fe;
+
+    for (i = 0; i < VR_FRAG_BUCKET_CHOICES; i++) {
+        index = fragment_bucket(hash, i) * VR_FRAG_BUCKET_ENTRIES;
+        for (j = 0; j < VR_FRAG_BUCKET_ENTRIES; j++) {
+            fe = fragment_entry_get(router, partition, index + j);
+            if (fe && fragment_entry_valid(fe) &&
+                    !memcmp(key, &fe->f_key, sizeof(*key)))
+                return fe;
+        }
+    }
+
+    return NULL;
+}
+
+static unsigned int
+fragment_bucket_used(struct vrouter *router, unsigned int partition,
+        unsigned int bucket)
+{
+    unsigned int i, used = 0;
+    struct vr_fragment *fe;
+
+    for (i = 0; i < VR_FRAG_BUCKET_ENTRIES; i++) {
+        fe = fragment_entry_get(router, partition,
+                (bucket * VR_FRAG_BUCKET_ENTRIES) + i);
+        if (fe && (fe->f_state != VR_FRAG_STATE_FREE))
+            used++;
+    }
+
+    return used;
+}
+
+/*
+ * an entry is claimed by moving it from free to busy, filled, and only
+ * then made valid. the fragment key itself is never used as a lock, and
+ * hence readers never see a half written key as valid
+ */
+static struct vr_fragment *
+fragment_bucket_claim(struct vrouter *router, unsigned int partition,
+        unsigned int bucket)
+{
+    unsigned int i;
+    struct vr_fragment *fe;
+
+    for (i = 0; i < VR_FRAG_BUCKET_ENTRIES; i++) {
+        fe = fragment_entry_get(router, partition,
+                (bucket * VR_FRAG_BUCKET_ENTRIES) + i);
+        if (fe && (fe->f_state == VR_FRAG_STATE_FREE) &&
+                __sync_bool_compare_and_swap(&fe->f_state,
+                    VR_FRAG_STATE_FREE, VR_FRAG_STATE_BUSY)) {
+            (void)__sync_add_and_fetch(
+                    &router->vr_fragment_partitions[partition].fp_used, 1);
+            return fe;
+        }
+    }
+
+    return NULL;
 }
 
 void
-vr_fragment_del(struct vr_fragment *fe)
+vr_fragment_del(struct vrouter *router, struct vr_fragment *fe)
 {
-    fe->f_dip = 0;
+    if (__sync_bool_compare_and_swap(&fe->f_state,
+                VR_FRAG_STATE_VALID, VR_FRAG_STATE_FREE))
+        (void)__sync_sub_and_fetch(
+                &router->vr_fragment_partitions[fe->f_partition].fp_used, 1);
+
+    return;
 }
 
 int
 vr_fragment_add(struct vrouter *router, unsigned short vrf, struct vr_ip *iph,
         unsigned short sport, unsigned short dport)
 {
-    unsigned int hash, index, i;
+    unsigned int hash, partition, i, j, min;
+    unsigned int bucket[VR_FRAG_BUCKET_CHOICES];
+    unsigned int used[VR_FRAG_BUCKET_CHOICES];
     struct vr_fragment_key key;
-    struct vr_fragment *fe;
+    struct vr_fragment *fe = NULL;
+
+    if (!router->vr_fragment_partitions)
+        return -ENOMEM;
 
     fragment_key(&key, vrf, iph);
-    hash = vr_hash(&key, sizeof(key), 0);
-    index = (hash % FRAG_TABLE_ENTRIES) * FRAG_TABLE_BUCKETS;
-    for (i = 0; i < FRAG_TABLE_BUCKETS; i++) {
-        fe = fragment_entry_get(router, index + i);
-        if (fe && !fe->f_dip  && fragment_entry_alloc(fe)) {
-            fragment_entry_set(fe, vrf, iph, sport, dport);
-            break;
-        } else {
-            fe = NULL;
-            continue;
-        }
+    hash = vr_hash_key(&router->vr_fragment_hash, &key, sizeof(key));
+    partition = fragment_local_partition();
+
+    /* a head that comes again only refreshes its entry */
+    fe = fragment_partition_find(router, partition, hash, &key);
+    if (fe) {
+        fe->f_sport = sport;
+        fe->f_dport = dport;
+        return 0;
     }
 
-    if (!fe) {
-        index = (hash % FRAG_OTABLE_ENTRIES);
-        for (i = 0; i < FRAG_OTABLE_ENTRIES; i++) {
-            fe = fragment_oentry_get(router, (index + i) % FRAG_OTABLE_ENTRIES);
-            if (fe && !fe->f_dip && fragment_entry_alloc(fe)) {
-                fragment_entry_set(fe, vrf, iph, sport, dport);
-                break;
-            } else {
-                fe = NULL;
-                continue;
-            }
+    for (i = 0; i < VR_FRAG_BUCKET_CHOICES; i++) {
+        bucket[i] = fragment_bucket(hash, i);
+        used[i] = fragment_bucket_used(router, partition, bucket[i]);
+    }
+
+    /* try the buckets in the increasing order of their load */
+    for (i = 0; i < VR_FRAG_BUCKET_CHOICES; i++) {
+        min = 0;
+        for (j = 1; j < VR_FRAG_BUCKET_CHOICES; j++) {
+            if (used[j] < used[min])
+                min = j;
         }
+
+        fe = fragment_bucket_claim(router, partition, bucket[min]);
+        if (fe)
+            break;
+
+        /* tried, and full */
+        used[min] = VR_FRAG_BUCKET_ENTRIES + 1;
     }
 
     if (!fe)
         return -ENOMEM;
 
+    fragment_entry_set(fe, vrf, iph, sport, dport);
+    __sync_synchronize();
+    fe->f_state = VR_FRAG_STATE_VALID;
+
     return 0;
 }
 
 struct vr_fragment *
 vr_fragment_get(struct vrouter *router, unsigned short vrf, struct vr_ip *iph)
 {   
-    unsigned int hash, index, i;
+    unsigned int hash, partition, i;
     struct vr_fragment_key key;
     struct vr_fragment *fe;
     unsigned int sec, nsec;
 
-    fragment_key(&key, vrf, iph);
-    hash = vr_hash(&key, sizeof(key), 0);
-    index = (hash % FRAG_TABLE_ENTRIES) * FRAG_TABLE_BUCKETS;
-    for (i = 0; i < FRAG_TABLE_BUCKETS; i++) {
-        fe = fragment_entry_get(router, index + i);
-        if (fe && !memcmp((const void *)&key, (const void *)&(fe->f_key),
-                    sizeof(key)))
-            break;
-    }
+    if (!router->vr_fragment_partitions)
+        return NULL;
 
-    if (i == FRAG_TABLE_BUCKETS) {
-        index = (hash % FRAG_OTABLE_ENTRIES);
-        for (i = 0; i < FRAG_OTABLE_ENTRIES; i++) {
-            fe = fragment_oentry_get(router, (index + i) % FRAG_OTABLE_ENTRIES);
-            if (fe && !memcmp((const void *)&key, (const void *)&(fe->f_key),
-                        sizeof(key)))
-                break;
-        }
+    fragment_key(&key, vrf, iph);
+    hash = vr_hash_key(&router->vr_fragment_hash, &key, sizeof(key));
+    partition = fragment_local_partition();
+    fe = fragment_partition_find(router, partition, hash, &key);
+
+    /*
+     * the rest of a datagram can come on another cpu than its head did,
+     * and the other partitions are looked at (in bounded time too) only
+     * then. empty partitions are skipped
+     */
+    for (i = 0; !fe && (i < vr_num_cpus); i++) {
+        if ((i == partition) || !router->vr_fragment_partitions[i].fp_used)
+            continue;
 
-        if (i == FRAG_OTABLE_ENTRIES)
-            fe = NULL;
+        fe = fragment_partition_find(router, i, hash, &key);
     }
 
     if (fe) {
@@ -146,99 +226,352 @@ vr_fragment_get(struct vrouter *router, unsigned short vrf, struct vr_ip *iph)
         fe->f_time = sec;
     }
 
-    return fe;;
+    return fe;
 }
 
-#define ENTRIES_PER_SCAN    64
-
-struct scanner_params {
-    struct vrouter *sp_router;
-    struct vr_btable *sp_fragment_table;
-    unsigned int sp_num_entries;
-    int sp_last_scanned_entry;
-};
-
-static void
-fragment_reap(struct vr_btable *table, int start,
-        unsigned int num_entries)
+static inline uint64_t
+fragment_time_msecs(void)
 {
-    unsigned int i;
-    struct vr_fragment *fe;
     unsigned int sec, nsec;
 
     vr_get_mono_time(&sec, &nsec);
+    return ((uint64_t)sec * 1000) + (nsec / 1000000);
+}
 
-    for (i = 0; i < ENTRIES_PER_SCAN; i++) {
-        fe = vr_btable_get(table, (start + i) % num_entries);
-        if (fe && fe->f_dip) {
-            if (sec > fe->f_time + 1)
-                vr_fragment_del(fe);
+/*
+ * only the cpu that owns a queue puts packets in it, but any cpu (and the
+ * scanner) can take them out. the owner fills a slot completely before it
+ * publishes the packet in it, and can fill it again as soon as the packet
+ * is out. hence, whoever takes a packet copies the slot first, and takes
+ * the packet only if it is still the one that the copy was made with
+ */
+static bool
+fragment_queue_copy(struct vr_fragment_queue_element *fqe,
+        struct vr_fragment_queue_element *copy)
+{
+    struct vr_packet *pkt;
+
+    pkt = *(struct vr_packet * volatile *)&fqe->fqe_pnode.pl_packet;
+    if (!pkt)
+        return false;
+
+    __sync_synchronize();
+    *copy = *fqe;
+    __sync_synchronize();
+    if (*(struct vr_packet * volatile *)&fqe->fqe_pnode.pl_packet != pkt)
+        return false;
+
+    copy->fqe_pnode.pl_packet = pkt;
+    return true;
+}
+
+static bool
+fragment_queue_take(struct vrouter *router, struct vr_fragment_queue *vfq,
+        struct vr_fragment_queue_element *fqe, struct vr_packet *pkt)
+{
+    if (!__sync_bool_compare_and_swap(&fqe->fqe_pnode.pl_packet, pkt, NULL))
+        return false;
+
+    (void)__sync_sub_and_fetch(&vfq->vfq_length, 1);
+    (void)__sync_sub_and_fetch(&router->vr_fragment_queued, 1);
+
+    return true;
+}
+
+static inline unsigned int
+fragment_queue_bucket(struct vrouter *router, struct vr_fragment_key *key)
+{
+    return vr_hash_key(&router->vr_fragment_hash, key, sizeof(*key)) %
+        VR_FRAG_HOLD_BUCKETS;
+}
+
+/*
+ * holds a fragment that came before the head of its datagram. the packet
+ * is consumed, either queued or dropped
+ */
+int
+vr_fragment_enqueue(struct vrouter *router, unsigned short vrf,
+        struct vr_packet *pkt, struct vr_forwarding_md *fmd)
+{
+    unsigned int i, cpu;
+    unsigned short drop_reason = VP_DROP_FRAGMENT_QUEUE_FAIL;
+    struct vr_ip *ip = (struct vr_ip *)pkt_network_header(pkt);
+    struct vr_fragment_queue *vfq;
+    struct vr_fragment_queue_element *fqe = NULL;
+    struct vr_packet_node *pnode;
+
+    cpu = vr_get_cpu();
+    if (!router->vr_fragment_queues || cpu >= vr_num_cpus) {
+        drop_reason = VP_DROP_FRAGMENTS;
+        goto drop;
+    }
+
+    vfq = &router->vr_fragment_queues[cpu];
+    if (vfq->vfq_length >= VR_FRAG_HOLD_ENTRIES)
+        goto drop;
+
+    for (i = 0; i < VR_FRAG_HOLD_ENTRIES; i++) {
+        if (!vfq->vfq_elems[i].fqe_pnode.pl_packet) {
+            fqe = &vfq->vfq_elems[i];
+            break;
         }
     }
 
+    if (!fqe)
+        goto drop;
+
+    fragment_key(&fqe->fqe_key, vrf, ip);
+    /* the slot moves from the bitmap of the key it held to that of ours */
+    vfq->vfq_bucket_map[fqe->fqe_bucket] &= ~(1ULL << i);
+    fqe->fqe_bucket = fragment_queue_bucket(router, &fqe->fqe_key);
+    vfq->vfq_bucket_map[fqe->fqe_bucket] |= (1ULL << i);
+    fqe->fqe_offset = ntohs(ip->ip_frag_off) & VR_IP_FRAG_OFFSET_MASK;
+    fqe->fqe_vlan = fmd ? fmd->fmd_vlan : VLAN_ID_INVALID;
+    fqe->fqe_time = fragment_time_msecs();
+
+    pnode = &fqe->fqe_pnode;
+    pnode->pl_flags = 0;
+    pnode->pl_outer_src_ip = 0;
+    pnode->pl_label = -1;
+    /* see vr_enqueue_flow for why the nexthop is not kept */
+    if (pkt->vp_nh &&
+            (pkt->vp_nh->nh_type == NH_VRF_TRANSLATE) &&
+            (pkt->vp_nh->nh_flags & NH_FLAG_VNID))
+        pnode->pl_flags |= PN_FLAG_LABEL_IS_VNID;
+    pkt->vp_nh = NULL;
+
+    pnode->pl_vif_idx = pkt->vp_if->vif_idx;
+    if (fmd) {
+        pnode->pl_outer_src_ip = fmd->fmd_outer_src_ip;
+        pnode->pl_label = fmd->fmd_label;
+        if (fmd->fmd_to_me)
+            pnode->pl_flags |= PN_FLAG_TO_ME;
+    }
+
+    (void)__sync_add_and_fetch(&vfq->vfq_length, 1);
+    (void)__sync_add_and_fetch(&router->vr_fragment_queued, 1);
+    __sync_synchronize();
+    pnode->pl_packet = pkt;
+
+    return 0;
+
+drop:
+    vr_pfree(pkt, drop_reason);
+    return -ENOSPC;
+}
+
+static void
+fragment_reinject(struct vrouter *router,
+        struct vr_fragment_queue_element *fqe)
+{
+    struct vr_interface *vif;
+    struct vr_forwarding_md fmd;
+    struct vr_packet_node *pnode = &fqe->fqe_pnode;
+    struct vr_packet *pkt = pnode->pl_packet;
+
+    vr_init_forwarding_md(&fmd);
+    fmd.fmd_dvrf = fqe->fqe_key.fk_vrf;
+    fmd.fmd_vlan = fqe->fqe_vlan;
+    fmd.fmd_outer_src_ip = pnode->pl_outer_src_ip;
+    fmd.fmd_label = pnode->pl_label;
+    if (pnode->pl_flags & PN_FLAG_TO_ME)
+        fmd.fmd_to_me = 1;
+
+    vif = __vrouter_get_interface(router, pnode->pl_vif_idx);
+    if (!vif || (pkt->vp_if != vif)) {
+        vr_pfree(pkt, VP_DROP_INVALID_IF);
+        return;
+    }
+
+    if (vif_is_fabric(pkt->vp_if) && (fmd.fmd_label >= 0) &&
+            !(pnode->pl_flags & PN_FLAG_LABEL_IS_VNID))
+        pkt->vp_nh = __vrouter_get_label(router, fmd.fmd_label);
+
+    vr_reinject_packet(pkt, &fmd);
+
+    return;
+}
+
+/*
+ * called once the head of a datagram has left its ports in the fragment
+ * table. the fragments of the datagram that came before the head go back
+ * to the datapath, lowest offset first, so that the tail (which removes
+ * the entry) goes last
+ */
+void
+vr_fragment_release(struct vrouter *router, struct vr_fragment_key *key)
+{
+    unsigned int i, cpu, bucket, matches, budget = 0, released = 0;
+    uint64_t map;
+    struct vr_fragment_queue *vfq, *min_vfq;
+    struct vr_fragment_queue_element *fqe, *min_fqe;
+    struct vr_fragment_queue_element copy, min_copy;
+
+    if (!router->vr_fragment_queues ||
+            !*(volatile unsigned int *)&router->vr_fragment_queued)
+        return;
+
+    bucket = fragment_queue_bucket(router, key);
+
+    /*
+     * a released fragment that still finds no entry (the tail removes it)
+     * is queued again. releasing only as many as were there to start with
+     * keeps us from going around in circles
+     */
+    while (*(volatile unsigned int *)&router->vr_fragment_queued) {
+        matches = 0;
+        min_vfq = NULL;
+        min_fqe = NULL;
+
+        for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+            vfq = &router->vr_fragment_queues[cpu];
+            if (!vfq->vfq_length)
+                continue;
+
+            map = *(volatile uint64_t *)&vfq->vfq_bucket_map[bucket];
+            for (i = 0; map; i++, map >>= 1) {
+                if (!(map & 1))
+                    continue;
+
+                fqe = &vfq->vfq_elems[i];
+                if (!fragment_queue_copy(fqe, &copy) ||
+                        memcmp(&copy.fqe_key, key, sizeof(*key)))
+                    continue;
+
+                matches++;
+                if (!min_fqe || copy.fqe_offset < min_copy.fqe_offset) {
+                    min_vfq = vfq;
+                    min_fqe = fqe;
+                    min_copy = copy;
+                }
+            }
+        }
+
+        if (!released)
+            budget = matches;
+
+        if (!min_fqe || released++ >= budget)
+            break;
+
+        /* the slot is not looked at again once the packet is out */
+        if (fragment_queue_take(router, min_vfq, min_fqe,
+                    min_copy.fqe_pnode.pl_packet))
+            fragment_reinject(router, &min_copy);
+    }
 
     return;
 }
 
+/* fragments whose head did not come in time are dropped */
 static void
-fragment_table_scanner(void *arg)
+fragment_queue_reap(struct vrouter *router)
 {
-    struct scanner_params *sp = (struct scanner_params *)arg;
+    unsigned int i, cpu;
+    uint64_t now;
+    struct vr_fragment_queue *vfq;
+    struct vr_fragment_queue_element copy;
+
+    if (!router->vr_fragment_queues || !router->vr_fragment_queued)
+        return;
+
+    now = fragment_time_msecs();
+    for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+        vfq = &router->vr_fragment_queues[cpu];
+        if (!vfq->vfq_length)
+            continue;
 
-    fragment_reap(sp->sp_fragment_table, sp->sp_last_scanned_entry + 1,
-            sp->sp_num_entries);
+        for (i = 0; i < VR_FRAG_HOLD_ENTRIES; i++) {
+            if (!fragment_queue_copy(&vfq->vfq_elems[i], &copy) ||
+                    (now < copy.fqe_time + VR_FRAG_HOLD_TIMEOUT_MSECS))
+                continue;
 
-    sp->sp_last_scanned_entry += ENTRIES_PER_SCAN;
-    sp->sp_last_scanned_entry %= sp->sp_num_entries;
+            if (fragment_queue_take(router, vfq, &vfq->vfq_elems[i],
+                        copy.fqe_pnode.pl_packet))
+                vr_pfree(copy.fqe_pnode.pl_packet, VP_DROP_FRAGMENTS);
+        }
+    }
 
     return;
 }
 
-static struct vr_timer *
-fragment_table_scanner_init(struct vrouter *router, struct vr_btable *table)
+#define ENTRIES_PER_SCAN    64
+
+/*
+ * the busier a partition, the more of it is scanned in a tick, from
+ * ENTRIES_PER_SCAN when it is nearly empty to all of it when it is full.
+ * a fragment storm is hence reaped at the rate it fills the table, and an
+ * idle table costs nothing
+ */
+static void
+fragment_partition_reap(struct vrouter *router, unsigned int partition,
+        unsigned int sec)
 {
-    unsigned int num_entries;
-    struct vr_timer *vtimer;
-    struct scanner_params *scanner;
+    unsigned int i, index, scan, used;
+    struct vr_fragment *fe;
+    struct vr_fragment_partition *fp;
 
-    if (!table)
-        return NULL;
+    fp = &router->vr_fragment_partitions[partition];
+    used = fp->fp_used;
+    if (!used)
+        return;
 
-    num_entries = vr_btable_entries(table);
+    if (used > VR_FRAG_PARTITION_ENTRIES)
+        used = VR_FRAG_PARTITION_ENTRIES;
 
-    scanner = vr_zalloc(sizeof(*scanner));
-    if (!scanner) {
-        vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, num_entries);
-        return NULL;
+    scan = ENTRIES_PER_SCAN + (((VR_FRAG_PARTITION_ENTRIES -
+                    ENTRIES_PER_SCAN) * used) / VR_FRAG_PARTITION_ENTRIES);
+
+    index = fp->fp_next_scan;
+    for (i = 0; i < scan; i++) {
+        fe = fragment_entry_get(router, partition, index);
+        if (fe && fragment_entry_valid(fe) && (sec > fe->f_time + 1))
+            vr_fragment_del(router, fe);
+
+        index = (index + 1) % VR_FRAG_PARTITION_ENTRIES;
     }
+    fp->fp_next_scan = index;
+
+    return;
+}
+
+static void
+fragment_table_scanner(void *arg)
+{
+    unsigned int cpu, sec, nsec;
+    struct vrouter *router = (struct vrouter *)arg;
+
+    fragment_queue_reap(router);
 
-    scanner->sp_router = router;
-    scanner->sp_fragment_table = table;
-    scanner->sp_num_entries = num_entries;
-    scanner->sp_last_scanned_entry = -1;
+    vr_get_mono_time(&sec, &nsec);
+    for (cpu = 0; cpu < vr_num_cpus; cpu++)
+        fragment_partition_reap(router, cpu, sec);
+
+    return;
+}
+
+static struct vr_timer *
+fragment_table_scanner_init(struct vrouter *router)
+{
+    struct vr_timer *vtimer;
 
     vtimer = vr_malloc(sizeof(*vtimer));
     if (!vtimer) {
-        vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, num_entries);
-        goto fail_init;
+        vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, sizeof(*vtimer));
+        return NULL;
     }
 
     vtimer->vt_timer = fragment_table_scanner;
-    vtimer->vt_vr_arg = scanner;
-    vtimer->vt_msecs = 1000;
+    vtimer->vt_vr_arg = router;
+    /* held fragments have to be reaped well within a second */
+    vtimer->vt_msecs = VR_FRAG_HOLD_TIMEOUT_MSECS / 4;
 
     if (vr_create_timer(vtimer)) {
-        vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, num_entries);
-        goto fail_init;
+        vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, 0);
+        vr_free(vtimer);
+        return NULL;
     }
 
     return vtimer;
-
-fail_init:
-    if (scanner)
-        vr_free(scanner);
-
-    return NULL;
 }
 
 static void
@@ -246,30 +579,71 @@ vr_fragment_table_scanner_exit(struct vrouter *router)
 {
     if (router->vr_fragment_table_scanner) {
         vr_delete_timer(router->vr_fragment_table_scanner);
-        vr_free(router->vr_fragment_table_scanner->vt_vr_arg);
         vr_free(router->vr_fragment_table_scanner);
         router->vr_fragment_table_scanner = NULL;
     }
 
-    if (router->vr_fragment_otable_scanner) {
-        vr_delete_timer(router->vr_fragment_otable_scanner);
-        vr_free(router->vr_fragment_otable_scanner->vt_vr_arg);
-        vr_free(router->vr_fragment_otable_scanner);
-        router->vr_fragment_otable_scanner = NULL;
+    return;
+}
+
+static void
+vr_fragment_queue_exit(struct vrouter *router)
+{
+    unsigned int i, cpu;
+    struct vr_packet *pkt;
+    struct vr_fragment_queue *vfq;
+
+    if (!router->vr_fragment_queues)
+        return;
+
+    for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+        vfq = &router->vr_fragment_queues[cpu];
+        for (i = 0; i < VR_FRAG_HOLD_ENTRIES; i++) {
+            pkt = vfq->vfq_elems[i].fqe_pnode.pl_packet;
+            if (pkt && fragment_queue_take(router, vfq, &vfq->vfq_elems[i],
+                        pkt))
+                vr_pfree(pkt, VP_DROP_FRAGMENTS);
+        }
     }
 
+    vr_free(router->vr_fragment_queues);
+    router->vr_fragment_queues = NULL;
+    router->vr_fragment_queued = 0;
+
     return;
 }
 
+static int
+vr_fragment_queue_init(struct vrouter *router)
+{
+    unsigned int size;
+
+    if (router->vr_fragment_queues)
+        return 0;
+
+    size = vr_num_cpus * sizeof(struct vr_fragment_queue);
+    router->vr_fragment_queues = vr_zalloc(size);
+    if (!router->vr_fragment_queues)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+
+    return 0;
+}
+
 void
 vr_fragment_table_exit(struct vrouter *router)
 {   
     vr_fragment_table_scanner_exit(router);
+    vr_fragment_queue_exit(router);
 
-    if (router->vr_fragment_table)
+    if (router->vr_fragment_table) {
         vr_btable_free(router->vr_fragment_table);
-    if (router->vr_fragment_otable)
-        vr_btable_free(router->vr_fragment_otable);
+        router->vr_fragment_table = NULL;
+    }
+
+    if (router->vr_fragment_partitions) {
+        vr_free(router->vr_fragment_partitions);
+        router->vr_fragment_partitions = NULL;
+    }
 
     return;
 }
@@ -279,18 +653,11 @@ vr_fragment_table_scanner_init(struct vrouter *router)
 {
     if (!router->vr_fragment_table_scanner) {
         router->vr_fragment_table_scanner =
-            fragment_table_scanner_init(router, router->vr_fragment_table);
+            fragment_table_scanner_init(router);
         if (!router->vr_fragment_table_scanner)
             return -ENOMEM;
     }
 
-    if (!router->vr_fragment_otable_scanner) {
-        router->vr_fragment_otable_scanner =
-            fragment_table_scanner_init(router, router->vr_fragment_otable);
-        if (!router->vr_fragment_otable_scanner)
-            return -ENOMEM;
-    }
-
     return 0;
 }
 
@@ -298,28 +665,40 @@ int
 vr_fragment_table_init(struct vrouter *router)
 {
     int num_entries, ret;
+    unsigned int i;
+    struct vr_fragment *fe;
 
     if (!router->vr_fragment_table) {
-        num_entries = FRAG_TABLE_ENTRIES * FRAG_TABLE_BUCKETS;
+        vr_hash_fn_init(&router->vr_fragment_hash);
+        num_entries = vr_num_cpus * VR_FRAG_PARTITION_ENTRIES;
         router->vr_fragment_table = vr_btable_alloc(num_entries,
                 sizeof(struct vr_fragment));
         if (!router->vr_fragment_table)
             return vr_module_error(-ENOMEM, __FUNCTION__,
                     __LINE__, num_entries);
+
+        for (i = 0; i < (unsigned int)num_entries; i++) {
+            fe = (struct vr_fragment *)vr_btable_get(
+                    router->vr_fragment_table, i);
+            if (fe)
+                fe->f_partition = i / VR_FRAG_PARTITION_ENTRIES;
+        }
     }
 
-    if (!router->vr_fragment_otable) {
-        num_entries = FRAG_OTABLE_ENTRIES;
-        router->vr_fragment_otable = vr_btable_alloc(num_entries,
-                sizeof(struct vr_fragment));
-        if (!router->vr_fragment_otable)
+    if (!router->vr_fragment_partitions) {
+        num_entries = vr_num_cpus;
+        router->vr_fragment_partitions = vr_zalloc(num_entries *
+                sizeof(struct vr_fragment_partition));
+        if (!router->vr_fragment_partitions)
             return vr_module_error(-ENOMEM, __FUNCTION__,
                     __LINE__, num_entries);
     }
 
+    if ((ret = vr_fragment_queue_init(router)))
+        return ret;
+
     if ((ret = vr_fragment_table_scanner_init(router)))
         return ret;
 
     return 0;
 }
-
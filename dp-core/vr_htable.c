@@ -8,16 +8,37 @@
 #include <vr_hash.h>
 
 #define VR_HENTRIES_PER_BUCKET 4
+
+void get_random_bytes(void *buf, int nbytes);
+
 struct vr_htable {
     unsigned int hentries;
     unsigned int oentries;
     unsigned int entry_size;
     unsigned int key_size;
+    struct vr_hash_fn hash;
     struct vr_btable *htable;
     struct vr_btable *otable;
     is_hentry_valid is_valid_entry;
 };
 
+/*
+ * the hash of a table can not change once it has entries, and hence the
+ * pick is made when the table is created
+ */
+void
+vr_hash_fn_init(struct vr_hash_fn *hf)
+{
+    hf->hf_algo = VR_HASH_JENKINS;
+#ifdef VR_HASH_HAVE_CRC32C
+    if (vr_hash_crc32c && vr_hash_crc32c_supported)
+        hf->hf_algo = VR_HASH_CRC32C;
+#endif
+    get_random_bytes(&hf->hf_seed, sizeof(hf->hf_seed));
+
+    return;
+}
+
 void 
 vr_htable_trav(vr_htable_t htable, unsigned int marker, htable_trav_cb cb, 
                                                                 void *data)
@@ -58,7 +79,7 @@ vr_find_free_hentry(vr_htable_t htable, void *key, unsigned int *index)
     if (!table || !key)
         return NULL;
 
-    hash = vr_hash(key, table->key_size, 0);
+    hash = vr_hash_key(&table->hash, key, table->key_size);
     tmp_hash = hash % table->hentries;
     tmp_hash &= ~(VR_HENTRIES_PER_BUCKET - 1);
     for(i = 0; i < VR_HENTRIES_PER_BUCKET; i++) {
@@ -112,7 +133,7 @@ vr_find_duplicate_hentry_index(vr_htable_t htable, vr_hentry_t hentry)
     if (!table || !hentry)
         return -1;
 
-    hash = vr_hash(hentry, table->key_size, 0);
+    hash = vr_hash_key(&table->hash, hentry, table->key_size);
 
     /* Look into the hash table from hash, VR_HENTRIES_PER_BUCKET */
     tmp_hash = hash % table->hentries;
@@ -154,7 +175,7 @@ vr_find_hentry(vr_htable_t htable, void *key, unsigned int *index)
     if (!table || !key)
         return NULL;
 
-    hash = vr_hash(key, table->key_size, 0);
+    hash = vr_hash_key(&table->hash, key, table->key_size);
 
     /* Look into the hash table from hash, VR_HENTRIES_PER_BUCKET */
     tmp_hash = hash % table->hentries;
@@ -246,6 +267,7 @@ vr_htable_create(unsigned int entries, unsigned int oentries,
     table->entry_size = entry_size;
     /* Key is assumed to be at the start of the entry of size key_size */
     table->key_size = key_size;
+    vr_hash_fn_init(&table->hash);
     table->is_valid_entry = is_valid_entry;
     return (vr_htable_t)table;
 }
@@ -1028,6 +1028,46 @@ eth_rx(struct vr_interface *vif, struct vr_packet *pkt,
     return vr_fabric_input(vif, pkt, vlan_id);
 }
 
+/*
+ * vif_rx_burst - receive a vector of packets that arrived on the same
+ * interface with the same vlan tag. untagged packets from the fabric are
+ * taken through the burst path of the datapath, while everything else
+ * (sub-interfaces, vms, vhost, agent) falls back to the per packet vif_rx.
+ * the user space host is the only caller
+ */
+unsigned int
+vif_rx_burst(struct vr_interface *vif, struct vr_packet **pkts,
+        unsigned int count, unsigned short vlan_id)
+{
+    unsigned int i;
+    uint64_t bytes = 0;
+    struct vr_interface_stats *stats;
+
+    if (!count)
+        return 0;
+
+    if ((vif->vif_rx != eth_rx) ||
+            (vif->vif_flags & VIF_FLAG_NATIVE_VLAN_TAG) ||
+            (vlan_id != VLAN_ID_INVALID && vlan_id < VLAN_ID_MAX)) {
+        for (i = 0; i < count; i++)
+            vif->vif_rx(vif, pkts[i], vlan_id);
+        return 0;
+    }
+
+    /* see eth_rx for the xconnect handling */
+    for (i = 0; i < count; i++) {
+        bytes += pkt_len(pkts[i]);
+        if (vif_mode_xconnect(vif))
+            pkts[i]->vp_flags |= VP_FLAG_TO_ME;
+    }
+
+    stats = vif_get_stats(vif, pkts[0]->vp_cpu);
+    stats->vis_ibytes += bytes;
+    stats->vis_ipackets += count;
+
+    return vr_fabric_input_burst(vif, pkts, count, vlan_id);
+}
+
 static int
 eth_tx(struct vr_interface *vif, struct vr_packet *pkt,
         struct vr_forwarding_md *fmd)
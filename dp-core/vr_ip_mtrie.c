@@ -19,6 +19,8 @@ static struct vr_vrf_stats **mtrie_vrf_stats;
 static struct vr_vrf_stats *invalid_vrf_stats;
 
 struct vr_nexthop *(*vr_inet_route_lookup)(unsigned int, struct vr_route_req *);
+struct vr_nexthop *(*vr_inet_addr_lookup)(unsigned int, unsigned int,
+        uint8_t *, unsigned int *, unsigned short *);
 struct vr_vrf_stats *(*vr_inet_vrf_stats)(unsigned short, unsigned int);
 
 static struct ip_mtrie *mtrie_alloc_vrf(unsigned int, unsigned int);
@@ -496,7 +498,7 @@ __mtrie_delete(struct vr_route_req *rt, struct ip_bucket_entry *ent,
     return 0;
 }
 
-static int
+int
 mtrie_dumper_route_encode(struct vr_message_dumper *dumper, vr_route_req *resp)
 {
     int len;
@@ -508,7 +510,7 @@ mtrie_dumper_route_encode(struct vr_message_dumper *dumper, vr_route_req *resp)
     return 1;
 }
 
-static void
+void
 mtrie_dumper_make_response(struct vr_message_dumper *dumper, vr_route_req *resp,
         struct ip_bucket_entry *ent, int8_t *prefix, unsigned int prefix_len)
 {
@@ -706,12 +708,13 @@ mtrie_delete(struct vr_rtable * _unused, struct vr_route_req *rt)
     }
 
     __mtrie_delete(rt, &rtable->root, 0);
+    vr_inet_route_cache_invalidate(vrf_id);
     vrouter_put_nexthop(rt->rtr_nh);
 
    return 0;
 }
 
-static inline struct vr_vrf_stats *
+struct vr_vrf_stats *
 mtrie_stats(unsigned short vrf, unsigned int cpu)
 {
     if (vrf >= VR_MAX_VRFS)
@@ -722,7 +725,8 @@ mtrie_stats(unsigned short vrf, unsigned int cpu)
 
     return NULL;
 }
-static int
+
+int
 mtrie_stats_get(vr_vrf_stats_req *req, vr_vrf_stats_req *response)
 {
     unsigned int i;
@@ -781,7 +785,7 @@ mtrie_stats_empty(vr_vrf_stats_req *r)
     return true;
 }
 
-static int
+int
 mtrie_stats_dump(struct vr_rtable *rtable, vr_vrf_stats_req *req)
 {
     int ret = 0, len;
@@ -824,77 +828,99 @@ generate_response:
  * longest prefix match. go down the tree till you encounter a next-hop.
  * if no nexthop, there is something wrong with the tree which was built.
  *
- * returns the nexthop of the LPM route
+ * returns the entry of the LPM route, or NULL if the vrf has no routes
  */
-static struct vr_nexthop *
-mtrie_lookup(unsigned int vrf_id, struct vr_route_req *rt)
+static struct ip_bucket_entry *
+__mtrie_lookup(unsigned int vrf_id, unsigned int family, uint8_t *addr)
 {
-    unsigned int        level, index;
+    unsigned int        level, max_level;
     unsigned long       ptr;
     struct ip_mtrie   *table;
     struct ip_bucket  *bkt;
     struct ip_bucket_entry *ent;
-    struct vr_nexthop *default_nh, *ret_nh;
 
-      default_nh = ip4_default_nh;
+    table = vrfid_to_mtrie(vrf_id, family);
+    if (!table)
+        return NULL;
+
+    ent = &table->root;
+    ptr = ent->entry_long_i;
+    if (!ptr)
+        return NULL;
+
+    max_level = ip_bkt_get_max_level(family);
+    for (level = 0; level < max_level; level++) {
+        if (PTR_IS_NEXTHOP(ptr))
+            return ent;
+
+        bkt = PTR_TO_BUCKET(ptr);
+        if (!bkt)
+            return NULL;
+
+        ent = index_to_entry(bkt, PREFIX_TO_INDEX(addr, level));
+        ptr = ent->entry_long_i;
+    }
+
+    if (PTR_IS_NEXTHOP(ptr))
+        return ent;
+
+    /* no nexthop; assert */
+    ASSERT(0);
+
+    return NULL;
+}
+
+static struct vr_nexthop *
+mtrie_lookup(unsigned int vrf_id, struct vr_route_req *rt)
+{
+    struct ip_bucket_entry *ent;
 
     /* we do not support any thing other than /32 route lookup */
     if ((rt->rtr_req.rtr_family == AF_INET) && 
         (rt->rtr_req.rtr_prefix_len != IP4_PREFIX_LEN))
-        return default_nh;
+        return ip4_default_nh;
 
     if ((rt->rtr_req.rtr_family == AF_INET6) && 
         (rt->rtr_req.rtr_prefix_len != IP6_PREFIX_LEN))
-        return default_nh;
-
-    table = vrfid_to_mtrie(vrf_id, rt->rtr_req.rtr_family);
-    if (!table)
-        return default_nh;
-
-    ent = &table->root;
+        return ip4_default_nh;
 
-    ptr = ent->entry_long_i;
-    if (!ptr) {
-        rt->rtr_nh = default_nh;
-        return default_nh;
+    ent = __mtrie_lookup(vrf_id, rt->rtr_req.rtr_family,
+            rt->rtr_req.rtr_prefix);
+    if (!ent) {
+        rt->rtr_nh = ip4_default_nh;
+        return rt->rtr_nh;
     }
 
-    if (PTR_IS_NEXTHOP(ptr)) {
-        rt->rtr_req.rtr_label_flags = ent->entry_label_flags;
-        rt->rtr_req.rtr_label = ent->entry_label;
-        rt->rtr_req.rtr_prefix_len = ent->entry_prefix_len;
-        rt->rtr_req.rtr_index = ent->entry_bridge_index;
-        ret_nh = PTR_TO_NEXTHOP(ptr);
-        rt->rtr_nh = ret_nh;
-        return ret_nh;
-    }
+    rt->rtr_req.rtr_label_flags = ent->entry_label_flags;
+    rt->rtr_req.rtr_label = ent->entry_label;
+    rt->rtr_req.rtr_prefix_len = ent->entry_prefix_len;
+    rt->rtr_req.rtr_index = ent->entry_bridge_index;
+    rt->rtr_nh = PTR_TO_NEXTHOP(ent->entry_long_i);
 
-    bkt = PTR_TO_BUCKET(ptr);
-    if (!bkt)
-        return default_nh;
+    return rt->rtr_nh;
+}
 
-    for (level = 0; level < ip_bkt_get_max_level(rt->rtr_req.rtr_family); level++) {
-        index = rt_to_index(rt, level);
-        ent = index_to_entry(bkt, index);
-        ptr = ent->entry_long_i;
-        if (PTR_IS_NEXTHOP(ptr)) {
-            rt->rtr_req.rtr_label_flags = ent->entry_label_flags;
-            rt->rtr_req.rtr_label = ent->entry_label;
-            rt->rtr_req.rtr_prefix_len = ent->entry_prefix_len;
-            rt->rtr_req.rtr_index = ent->entry_bridge_index;
-            ret_nh = PTR_TO_NEXTHOP(ptr);
-            rt->rtr_nh = ret_nh;
-            return ret_nh;
-        }
+/*
+ * host route lookup of the datapath. the address is in network byte order
+ * and is as long as the family says
+ */
+static struct vr_nexthop *
+mtrie_addr_lookup(unsigned int vrf_id, unsigned int family, uint8_t *addr,
+        unsigned int *label, unsigned short *label_flags)
+{
+    struct ip_bucket_entry *ent;
 
-        bkt = PTR_TO_BUCKET(ptr);
+    ent = __mtrie_lookup(vrf_id, family, addr);
+    if (!ent) {
+        *label_flags = 0;
+        *label = 0;
+        return ip4_default_nh;
     }
 
-    /* no nexthop; assert */
-    ASSERT(0);
+    *label_flags = ent->entry_label_flags;
+    *label = ent->entry_label;
 
-    rt->rtr_nh = ret_nh;
-    return NULL;
+    return PTR_TO_NEXTHOP(ent->entry_long_i);
 }
 
 /*
@@ -938,6 +964,7 @@ mtrie_add(struct vr_rtable * _unused, struct vr_route_req *rt)
     }
 
     ret = __mtrie_add(mtrie, rt);
+    vr_inet_route_cache_invalidate(vrf_id);
     vrouter_put_nexthop(rt->rtr_nh);
     return ret;
 }
@@ -994,15 +1021,16 @@ mtrie_free_vrf(struct vr_rtable *rtable, unsigned int vrf_id)
         if (!mtrie)
             continue;
     
-        mtrie_free_entry(&mtrie->root, 0);
         vrf_tables[vrf_id] = NULL;
+        vr_inet_route_cache_invalidate(vrf_id);
+        mtrie_free_entry(&mtrie->root, 0);
         vr_free(mtrie);
     }
 
     return;
 }
 
-static void
+void
 mtrie_stats_cleanup(struct vr_rtable *rtable)
 {
     unsigned int i;
@@ -1049,7 +1077,7 @@ mtrie_algo_deinit(struct vr_rtable *rtable, struct rtable_fspec *fs, bool soft_r
 }
 
 
-static int
+int
 mtrie_stats_init(struct vr_rtable *rtable)
 {
     int ret = 0;
@@ -1122,12 +1150,14 @@ mtrie_algo_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
     rtable->algo_add = mtrie_add;
     rtable->algo_del = mtrie_delete;
     rtable->algo_lookup = mtrie_lookup;
+    rtable->algo_addr_lookup = mtrie_addr_lookup;
     rtable->algo_get = mtrie_get;
     rtable->algo_dump = mtrie_dump;
     rtable->algo_stats_get = mtrie_stats_get;
     rtable->algo_stats_dump = mtrie_stats_dump;
 
     vr_inet_route_lookup = mtrie_lookup;
+    vr_inet_addr_lookup = mtrie_addr_lookup;
     vr_inet_vrf_stats = mtrie_stats;
     /* local cache */
     vn_rtable[0] = (struct ip_mtrie **)rtable->algo_data; // V4 table
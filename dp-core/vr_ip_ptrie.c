@@ -0,0 +1,904 @@
+/*
+ * vr_ip_ptrie.c -- VRF route tables with popcount compressed nodes
+ *
+ * Copyright (c) 2014 Juniper Networks, Inc. All rights reserved.
+ */
+#include <vr_os.h>
+#include "vr_sandesh.h"
+#include "vr_message.h"
+#include "vr_packet.h"
+#include "vr_interface.h"
+#include "vr_route.h"
+#include "vr_bridge.h"
+#include "vr_datapath.h"
+#include "vr_ip_ptrie.h"
+
+extern struct vr_nexthop *ip4_default_nh;
+extern struct vr_vrf_stats *(*vr_inet_vrf_stats)(unsigned short,
+        unsigned int);
+
+int ptrie_algo_init(struct vr_rtable *, struct rtable_fspec *);
+void ptrie_algo_deinit(struct vr_rtable *, struct rtable_fspec *, bool);
+
+#define IP4_PTRIE_LEVELS    (IP4_PREFIX_LEN / IPBUCKET_LEVEL_BITS)
+#define IP6_PTRIE_LEVELS    (IP6_PREFIX_LEN / IPBUCKET_LEVEL_BITS)
+
+static struct ip_ptrie **vn_ptrie[2];
+static int ptrie_init_done = 0;
+
+static inline unsigned int
+ptrie_popcount(uint64_t x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+
+    return (unsigned int)((x * 0x0101010101010101ULL) >> 56);
+}
+
+static inline unsigned int
+ptrie_max_level(unsigned int family)
+{
+    if (family == AF_INET6)
+        return IP6_PTRIE_LEVELS;
+
+    return IP4_PTRIE_LEVELS;
+}
+
+static inline struct ip_ptrie *
+vrfid_to_ptrie(unsigned int vrf_id, unsigned int family)
+{
+    if (vrf_id >= VR_MAX_VRFS)
+        return NULL;
+
+    return vn_ptrie[(family == AF_INET6) ? 1 : 0][vrf_id];
+}
+
+static inline bool
+ptrie_slot_is_child(struct ptrie_node *node, unsigned int slot)
+{
+    return node->pn_vector[slot / 64] & (1ULL << (slot % 64));
+}
+
+static inline struct ptrie_node *
+ptrie_slot_child(struct ptrie_node *node, unsigned int slot)
+{
+    unsigned int word = slot / 64;
+    uint64_t below = (1ULL << (slot % 64)) - 1;
+
+    return node->pn_children[node->pn_child_base[word] +
+        ptrie_popcount(node->pn_vector[word] & below)];
+}
+
+static inline struct ip_bucket_entry *
+ptrie_slot_leaf(struct ptrie_node *node, unsigned int slot)
+{
+    unsigned int word = slot / 64;
+    uint64_t upto = (2ULL << (slot % 64)) - 1;
+
+    return &node->pn_leaves[node->pn_leaf_base[word] +
+        ptrie_popcount(node->pn_leafvec[word] & upto) - 1];
+}
+
+static inline bool
+ptrie_leaf_equal(struct ip_bucket_entry *a, struct ip_bucket_entry *b)
+{
+    return (a->entry_long_i == b->entry_long_i) &&
+        (a->entry_prefix_len == b->entry_prefix_len) &&
+        (a->entry_label_flags == b->entry_label_flags) &&
+        (a->entry_label == b->entry_label) &&
+        (a->entry_bridge_index == b->entry_bridge_index);
+}
+
+/*
+ * take a reference on the nexthop of a leaf. if the nexthop is on its way
+ * out, the leaf discards instead (same as what mtrie does)
+ */
+static struct vr_nexthop *
+ptrie_hold_nexthop(struct vr_nexthop *nh)
+{
+    struct vr_nexthop *tmp_nh;
+
+    tmp_nh = vrouter_get_nexthop(nh->nh_rid, nh->nh_id);
+    if (tmp_nh != nh) {
+        if (tmp_nh)
+            vrouter_put_nexthop(tmp_nh);
+        nh = vrouter_get_nexthop(nh->nh_rid, NH_DISCARD_ID);
+    }
+
+    return nh;
+}
+
+static void
+ptrie_node_put_nexthops(struct ptrie_node *node)
+{
+    unsigned int i;
+
+    for (i = 0; i < node->pn_num_leaves; i++) {
+        /*
+         * the pointer stays. the datapath could still be on a replaced
+         * node, and the nexthop itself waits for it before it goes
+         */
+        if (node->pn_leaves[i].entry_nh_p)
+            vrouter_put_nexthop(node->pn_leaves[i].entry_nh_p);
+    }
+
+    return;
+}
+
+static void
+ptrie_node_free(struct ptrie_node *node)
+{
+    ptrie_node_put_nexthops(node);
+    vr_free(node);
+    return;
+}
+
+static void
+ptrie_free_tree(struct ptrie_node *node)
+{
+    unsigned int i;
+
+    for (i = 0; i < node->pn_num_children; i++)
+        ptrie_free_tree(node->pn_children[i]);
+
+    ptrie_node_free(node);
+    return;
+}
+
+static void
+ptrie_journal_add(struct ptrie_journal *pj, struct ptrie_node *node,
+        unsigned int flags)
+{
+    if (!pj)
+        return;
+
+    node->pn_journal_flags = flags;
+    node->pn_journal_next = pj->pj_head;
+    pj->pj_head = node;
+
+    return;
+}
+
+static void
+ptrie_garbage_free(struct vrouter *router, void *arg)
+{
+    struct ptrie_node *node, *next;
+    struct vr_defer_data *defer = (struct vr_defer_data *)arg;
+
+    for (node = (struct ptrie_node *)defer->vdd_data; node; node = next) {
+        next = node->pn_journal_next;
+        vr_free(node);
+    }
+
+    return;
+}
+
+/*
+ * once the change is visible, the nodes that it replaced are garbage. if the
+ * change failed half way, it is the nodes that it created that are.
+ *
+ * the replaced nodes let go of their nexthops right away, but keep pointing
+ * to them (a nexthop that loses its last user waits for the datapath by
+ * itself, and hence a walker on a replaced node still finds it). their
+ * memory is freed after a grace period, without the request waiting for one.
+ * only if that can not be arranged does the request wait
+ */
+static void
+ptrie_journal_release(struct vrouter *router, struct ptrie_journal *pj,
+        bool done)
+{
+    bool fresh;
+    struct ptrie_node *node, *next, *garbage = NULL;
+    struct vr_defer_data *defer = NULL;
+
+    for (node = pj->pj_head; node; node = next) {
+        next = node->pn_journal_next;
+        fresh = node->pn_journal_flags & PTRIE_NODE_FRESH;
+        node->pn_journal_next = NULL;
+        node->pn_journal_flags = 0;
+
+        if (done == fresh)
+            continue;
+
+        if (!done) {
+            ptrie_node_free(node);
+            continue;
+        }
+
+        ptrie_node_put_nexthops(node);
+        node->pn_journal_next = garbage;
+        garbage = node;
+    }
+    pj->pj_head = NULL;
+
+    if (!garbage)
+        return;
+
+    if (router && !vr_not_ready)
+        defer = vr_get_defer_data(sizeof(*defer));
+
+    if (defer) {
+        defer->vdd_data = (void *)garbage;
+        vr_defer(router, ptrie_garbage_free, (void *)defer);
+    } else {
+        if (!vr_not_ready)
+            vr_delay_op();
+        for (node = garbage; node; node = next) {
+            next = node->pn_journal_next;
+            vr_free(node);
+        }
+    }
+
+    return;
+}
+
+static void
+ptrie_node_expand(struct ptrie_node *node, struct ip_bucket_entry *bkt)
+{
+    int leaf = -1;
+    unsigned int i, child = 0;
+
+    for (i = 0; i < IPBUCKET_LEVEL_SIZE; i++) {
+        if (ptrie_slot_is_child(node, i)) {
+            memset(&bkt[i], 0, sizeof(bkt[i]));
+            bkt[i].entry_long_i =
+                (unsigned long)node->pn_children[child++] | 0x1ul;
+            continue;
+        }
+
+        if (node->pn_leafvec[i / 64] & (1ULL << (i % 64)))
+            leaf++;
+        bkt[i] = node->pn_leaves[leaf];
+    }
+
+    return;
+}
+
+static struct ptrie_node *
+ptrie_node_compress(struct ip_bucket_entry *bkt, struct ptrie_journal *pj)
+{
+    unsigned int i, word, bit, size;
+    unsigned int num_children = 0, num_leaves = 0;
+    struct ip_bucket_entry *prev = NULL, *leaf;
+    struct ptrie_node *node;
+
+    for (i = 0; i < IPBUCKET_LEVEL_SIZE; i++) {
+        if (ENTRY_IS_BUCKET(&bkt[i])) {
+            num_children++;
+        } else if (!prev || !ptrie_leaf_equal(prev, &bkt[i])) {
+            num_leaves++;
+            prev = &bkt[i];
+        }
+    }
+
+    size = sizeof(*node) + num_children * sizeof(struct ptrie_node *) +
+        num_leaves * sizeof(struct ip_bucket_entry);
+    node = vr_zalloc(size);
+    if (!node)
+        return NULL;
+
+    node->pn_children = (struct ptrie_node **)(node + 1);
+    node->pn_leaves = (struct ip_bucket_entry *)(node->pn_children +
+            num_children);
+
+    prev = NULL;
+    for (i = 0; i < IPBUCKET_LEVEL_SIZE; i++) {
+        word = i / 64;
+        bit = i % 64;
+        if (!bit) {
+            node->pn_child_base[word] = node->pn_num_children;
+            node->pn_leaf_base[word] = node->pn_num_leaves;
+        }
+
+        if (ENTRY_IS_BUCKET(&bkt[i])) {
+            node->pn_vector[word] |= (1ULL << bit);
+            node->pn_children[node->pn_num_children++] =
+                (struct ptrie_node *)(bkt[i].entry_long_i & ~0x1ul);
+            continue;
+        }
+
+        if (prev && ptrie_leaf_equal(prev, &bkt[i]))
+            continue;
+
+        node->pn_leafvec[word] |= (1ULL << bit);
+        leaf = &node->pn_leaves[node->pn_num_leaves++];
+        *leaf = bkt[i];
+        if (leaf->entry_nh_p)
+            leaf->entry_nh_p = ptrie_hold_nexthop(leaf->entry_nh_p);
+        prev = &bkt[i];
+    }
+
+    ptrie_journal_add(pj, node, PTRIE_NODE_FRESH);
+    return node;
+}
+
+static bool
+ptrie_bkt_is_uniform(struct ip_bucket_entry *bkt)
+{
+    unsigned int i;
+
+    if (ENTRY_IS_BUCKET(&bkt[0]))
+        return false;
+
+    for (i = 1; i < IPBUCKET_LEVEL_SIZE; i++) {
+        if (ENTRY_IS_BUCKET(&bkt[i]) || !ptrie_leaf_equal(&bkt[0], &bkt[i]))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * the slots of a level that a route touches. if the route is longer than
+ * what the level resolves, it is the one slot to descend through
+ */
+static void
+ptrie_route_range(struct vr_route_req *rt, unsigned int level, bool cover,
+        unsigned int *start, unsigned int *end, bool *descend)
+{
+    unsigned int index, pfx_len = (level + 1) * IPBUCKET_LEVEL_BITS;
+    unsigned int plen = rt->rtr_req.rtr_prefix_len;
+
+    *descend = false;
+    if (cover) {
+        *start = 0;
+        *end = IPBUCKET_LEVEL_SIZE;
+        return;
+    }
+
+    /* the prefix is in (signed) bytes. slots are 0 to 255 */
+    index = (uint8_t)rt->rtr_req.rtr_prefix[level];
+    if (plen > pfx_len) {
+        *start = index;
+        *end = index + 1;
+        *descend = true;
+        return;
+    }
+
+    *start = index;
+    *end = index + (1 << (pfx_len - plen));
+    if (*end > IPBUCKET_LEVEL_SIZE)
+        *end = IPBUCKET_LEVEL_SIZE;
+
+    return;
+}
+
+static void
+ptrie_set_leaf(struct ip_bucket_entry *ent, struct vr_route_req *rt,
+        unsigned int prefix_len)
+{
+    ent->entry_nh_p = rt->rtr_nh;
+    ent->entry_prefix_len = prefix_len;
+    ent->entry_label_flags = rt->rtr_req.rtr_label_flags;
+    ent->entry_label = rt->rtr_req.rtr_label;
+    ent->entry_bridge_index = rt->rtr_req.rtr_index;
+
+    return;
+}
+
+/*
+ * apply a route add (or delete) to a node, and return in 'result' what the
+ * parent slot has to hold from now on: the same node if nothing changed, a
+ * new node, or a leaf if all slots of the node ended up the same. a node that
+ * does not exist yet is grown out of the leaf 'parent'. the semantics are
+ * exactly those of the mtrie (__mtrie_add and __mtrie_delete)
+ */
+static int
+ptrie_update(struct ptrie_node *node, struct ip_bucket_entry *parent,
+        unsigned int level, struct vr_route_req *rt, bool add, bool cover,
+        struct ptrie_journal *pj, struct ip_bucket_entry *result)
+{
+    int ret = 0;
+    bool descend;
+    unsigned int i, start, end, changed = 0;
+    unsigned int plen = rt->rtr_req.rtr_prefix_len;
+    struct ip_bucket_entry *bkt, *ent, leaf, child_result;
+    struct ptrie_node *child, *new_node;
+
+    bkt = vr_malloc(IPBUCKET_LEVEL_SIZE * sizeof(*bkt));
+    if (!bkt)
+        return -ENOMEM;
+
+    if (node) {
+        ptrie_node_expand(node, bkt);
+    } else {
+        for (i = 0; i < IPBUCKET_LEVEL_SIZE; i++)
+            bkt[i] = *parent;
+        changed++;
+    }
+
+    ptrie_route_range(rt, level, cover, &start, &end, &descend);
+    for (i = start; i < end; i++) {
+        ent = &bkt[i];
+        if (descend || ENTRY_IS_BUCKET(ent)) {
+            /* nothing to delete below a leaf */
+            if (!add && ENTRY_IS_NEXTHOP(ent))
+                continue;
+
+            if (level + 1 >= ptrie_max_level(rt->rtr_req.rtr_family))
+                continue;
+
+            child = NULL;
+            if (ENTRY_IS_BUCKET(ent))
+                child = (struct ptrie_node *)(ent->entry_long_i & ~0x1ul);
+            leaf = *ent;
+
+            ret = ptrie_update(child, &leaf, level + 1, rt, add, !descend,
+                    pj, &child_result);
+            if (ret)
+                goto exit_update;
+
+            if (memcmp(&child_result, ent, sizeof(*ent))) {
+                *ent = child_result;
+                changed++;
+            }
+
+            continue;
+        }
+
+        if (add && (ent->entry_prefix_len <= plen)) {
+            /* a less specific entry, which needs to be replaced */
+            ptrie_set_leaf(ent, rt, plen);
+            changed++;
+        } else if (!add && (ent->entry_prefix_len == plen)) {
+            ptrie_set_leaf(ent, rt, rt->rtr_req.rtr_replace_plen);
+            changed++;
+        }
+    }
+
+    memset(result, 0, sizeof(*result));
+    if (!changed) {
+        result->entry_long_i = (unsigned long)node | 0x1ul;
+        goto exit_update;
+    }
+
+    /* the root stays a node, whatever it holds */
+    if (level && ptrie_bkt_is_uniform(bkt)) {
+        *result = bkt[0];
+    } else {
+        new_node = ptrie_node_compress(bkt, pj);
+        if (!new_node) {
+            ret = -ENOMEM;
+            goto exit_update;
+        }
+        result->entry_long_i = (unsigned long)new_node | 0x1ul;
+    }
+
+    if (node)
+        ptrie_journal_add(pj, node, 0);
+
+exit_update:
+    vr_free(bkt);
+    return ret;
+}
+
+static int
+ptrie_apply(struct ip_ptrie *ptrie, struct vr_route_req *rt, bool add)
+{
+    int ret;
+    struct ip_bucket_entry result;
+    struct ptrie_journal pj = { NULL };
+    struct vrouter *router = vrouter_get(rt->rtr_req.rtr_rid);
+
+    ret = ptrie_update(ptrie->pt_root, NULL, 0, rt, add, false, &pj, &result);
+    if (ret) {
+        ptrie_journal_release(router, &pj, false);
+        return ret;
+    }
+
+    /* let the new nodes reach memory before the datapath can see them */
+    __sync_synchronize();
+    ptrie->pt_root = (struct ptrie_node *)(result.entry_long_i & ~0x1ul);
+    vr_inet_route_cache_invalidate(rt->rtr_req.rtr_vrf_id);
+    ptrie_journal_release(router, &pj, true);
+
+    return 0;
+}
+
+static struct ip_ptrie *
+ptrie_alloc_vrf(unsigned int vrf_id, unsigned int family)
+{
+    unsigned int i;
+    struct ip_ptrie *ptrie;
+    struct ip_bucket_entry *bkt;
+
+    ptrie = vr_zalloc(sizeof(*ptrie));
+    if (!ptrie)
+        return NULL;
+
+    bkt = vr_zalloc(IPBUCKET_LEVEL_SIZE * sizeof(*bkt));
+    if (!bkt) {
+        vr_free(ptrie);
+        return NULL;
+    }
+
+    bkt[0].entry_nh_p = vrouter_get_nexthop(0, NH_DISCARD_ID);
+    bkt[0].entry_bridge_index = VR_BE_INVALID_INDEX;
+    for (i = 1; i < IPBUCKET_LEVEL_SIZE; i++)
+        bkt[i] = bkt[0];
+
+    ptrie->pt_root = ptrie_node_compress(bkt, NULL);
+    if (bkt[0].entry_nh_p)
+        vrouter_put_nexthop(bkt[0].entry_nh_p);
+    vr_free(bkt);
+
+    if (!ptrie->pt_root) {
+        vr_free(ptrie);
+        return NULL;
+    }
+
+    vn_ptrie[(family == AF_INET6) ? 1 : 0][vrf_id] = ptrie;
+    return ptrie;
+}
+
+static void
+ptrie_free_vrf(unsigned int vrf_id)
+{
+    unsigned int i;
+    struct ip_ptrie *ptrie;
+
+    for (i = 0; i < 2; i++) {
+        ptrie = vn_ptrie[i][vrf_id];
+        if (!ptrie)
+            continue;
+
+        vn_ptrie[i][vrf_id] = NULL;
+        vr_inet_route_cache_invalidate(vrf_id);
+        if (ptrie->pt_root)
+            ptrie_free_tree(ptrie->pt_root);
+        vr_free(ptrie);
+    }
+
+    return;
+}
+
+/*
+ * longest prefix match. one node per 8 bits of the address, till a leaf.
+ * returns NULL if the vrf has no routes
+ */
+static struct ip_bucket_entry *
+__ptrie_lookup(unsigned int vrf_id, unsigned int family, uint8_t *addr)
+{
+    unsigned int level, index, max_level;
+    struct ip_ptrie *table;
+    struct ptrie_node *node;
+
+    table = vrfid_to_ptrie(vrf_id, family);
+    if (!table)
+        return NULL;
+
+    node = table->pt_root;
+    if (!node)
+        return NULL;
+
+    max_level = ptrie_max_level(family);
+    for (level = 0; level < max_level; level++) {
+        index = addr[level];
+        if (ptrie_slot_is_child(node, index)) {
+            node = ptrie_slot_child(node, index);
+            continue;
+        }
+
+        return ptrie_slot_leaf(node, index);
+    }
+
+    /* no leaf; assert */
+    ASSERT(0);
+
+    return NULL;
+}
+
+static struct vr_nexthop *
+ptrie_lookup(unsigned int vrf_id, struct vr_route_req *rt)
+{
+    struct ip_bucket_entry *ent;
+
+    /* we do not support any thing other than host route lookups */
+    if ((rt->rtr_req.rtr_family == AF_INET) &&
+            (rt->rtr_req.rtr_prefix_len != IP4_PREFIX_LEN))
+        return ip4_default_nh;
+
+    if ((rt->rtr_req.rtr_family == AF_INET6) &&
+            (rt->rtr_req.rtr_prefix_len != IP6_PREFIX_LEN))
+        return ip4_default_nh;
+
+    ent = __ptrie_lookup(vrf_id, rt->rtr_req.rtr_family,
+            rt->rtr_req.rtr_prefix);
+    if (!ent) {
+        rt->rtr_nh = ip4_default_nh;
+        return rt->rtr_nh;
+    }
+
+    rt->rtr_req.rtr_label_flags = ent->entry_label_flags;
+    rt->rtr_req.rtr_label = ent->entry_label;
+    rt->rtr_req.rtr_prefix_len = ent->entry_prefix_len;
+    rt->rtr_req.rtr_index = ent->entry_bridge_index;
+    rt->rtr_nh = ent->entry_nh_p;
+
+    return rt->rtr_nh;
+}
+
+/* host route lookup of the datapath, without a request */
+static struct vr_nexthop *
+ptrie_addr_lookup(unsigned int vrf_id, unsigned int family, uint8_t *addr,
+        unsigned int *label, unsigned short *label_flags)
+{
+    struct ip_bucket_entry *ent;
+
+    ent = __ptrie_lookup(vrf_id, family, addr);
+    if (!ent) {
+        *label_flags = 0;
+        *label = 0;
+        return ip4_default_nh;
+    }
+
+    *label_flags = ent->entry_label_flags;
+    *label = ent->entry_label;
+
+    return ent->entry_nh_p;
+}
+
+static int
+ptrie_get(unsigned int vrf_id, struct vr_route_req *rt)
+{
+    struct vr_nexthop *nh;
+
+    nh = ptrie_lookup(vrf_id, rt);
+    if (nh)
+        rt->rtr_req.rtr_nh_id = nh->nh_id;
+    else
+        rt->rtr_req.rtr_nh_id = -1;
+
+    return 0;
+}
+
+static int
+ptrie_bridge_index(struct vr_route_req *rt)
+{
+    struct vr_route_req lreq;
+
+    rt->rtr_req.rtr_index = VR_BE_INVALID_INDEX;
+    if ((rt->rtr_req.rtr_mac_size == VR_ETHER_ALEN) &&
+            (!IS_MAC_ZERO(rt->rtr_req.rtr_mac))) {
+        lreq.rtr_req.rtr_index = rt->rtr_req.rtr_index;
+        lreq.rtr_req.rtr_mac_size = VR_ETHER_ALEN;
+        lreq.rtr_req.rtr_mac = rt->rtr_req.rtr_mac;
+        lreq.rtr_req.rtr_vrf_id = rt->rtr_req.rtr_vrf_id;
+        if (!vr_bridge_lookup(rt->rtr_req.rtr_vrf_id, &lreq))
+            return -ENOENT;
+        rt->rtr_req.rtr_index = lreq.rtr_req.rtr_index;
+    }
+
+    return 0;
+}
+
+static int
+ptrie_add(struct vr_rtable * _unused, struct vr_route_req *rt)
+{
+    int ret;
+    unsigned int vrf_id = rt->rtr_req.rtr_vrf_id;
+    struct ip_ptrie *ptrie = vrfid_to_ptrie(vrf_id, rt->rtr_req.rtr_family);
+
+    ptrie = (ptrie ? : ptrie_alloc_vrf(vrf_id, rt->rtr_req.rtr_family));
+    if (!ptrie)
+        return -ENOMEM;
+
+    rt->rtr_nh = vrouter_get_nexthop(rt->rtr_req.rtr_rid, rt->rtr_req.rtr_nh_id);
+    if (!rt->rtr_nh)
+        return -ENOENT;
+
+    if ((!(rt->rtr_req.rtr_label_flags & VR_RT_LABEL_VALID_FLAG)) &&
+            (rt->rtr_nh->nh_type == NH_TUNNEL)) {
+        ret = -EINVAL;
+        goto exit_add;
+    }
+
+    if ((ret = ptrie_bridge_index(rt)))
+        goto exit_add;
+
+    ret = ptrie_apply(ptrie, rt, true);
+
+exit_add:
+    vrouter_put_nexthop(rt->rtr_nh);
+    return ret;
+}
+
+static int
+ptrie_delete(struct vr_rtable * _unused, struct vr_route_req *rt)
+{
+    int ret;
+    struct ip_ptrie *ptrie;
+
+    ptrie = vrfid_to_ptrie(rt->rtr_req.rtr_vrf_id, rt->rtr_req.rtr_family);
+    if (!ptrie)
+        return -ENOENT;
+
+    rt->rtr_nh = vrouter_get_nexthop(rt->rtr_req.rtr_rid, rt->rtr_req.rtr_nh_id);
+    if (!rt->rtr_nh)
+        return -ENOENT;
+
+    if ((ret = ptrie_bridge_index(rt)))
+        goto exit_delete;
+
+    ret = ptrie_apply(ptrie, rt, false);
+
+exit_delete:
+    vrouter_put_nexthop(rt->rtr_nh);
+    return ret;
+}
+
+/*
+ * where a slot at 'bytes' bytes of prefix stands with respect to the marker
+ * of the dump: < 0 if before, 0 if the marker or a slot that covers it, and
+ * > 0 if after
+ */
+static int
+ptrie_dump_cmp(vr_route_req *req, int8_t *prefix, unsigned int bytes)
+{
+    int ret;
+    unsigned int marker_bytes = req->rtr_marker_plen / IPBUCKET_LEVEL_BITS;
+
+    ret = memcmp(prefix, req->rtr_marker,
+            (bytes < marker_bytes) ? bytes : marker_bytes);
+    if (ret)
+        return ret;
+
+    return (bytes > marker_bytes) ? 1 : 0;
+}
+
+static int
+ptrie_dump_node(struct vr_message_dumper *dumper, struct ptrie_node *node,
+        int8_t *prefix, unsigned int level)
+{
+    int ret;
+    unsigned int i;
+    uint32_t rt_prefix[4];
+    vr_route_req resp, *req = (vr_route_req *)dumper->dump_req;
+    struct ip_bucket_entry *ent;
+
+    for (i = 0; i < IPBUCKET_LEVEL_SIZE; i++) {
+        prefix[level] = i;
+        if (!dumper->dump_been_to_marker &&
+                (ptrie_dump_cmp(req, prefix, level + 1) < 0))
+            continue;
+
+        if (ptrie_slot_is_child(node, i)) {
+            if (ptrie_dump_node(dumper, ptrie_slot_child(node, i),
+                        prefix, level + 1) < 0)
+                return -1;
+            continue;
+        }
+
+        if (!dumper->dump_been_to_marker) {
+            if (ptrie_dump_cmp(req, prefix, level + 1) <= 0)
+                continue;
+            dumper->dump_been_to_marker = 1;
+        }
+
+        ent = ptrie_slot_leaf(node, i);
+        if (!ent->entry_nh_p)
+            continue;
+
+        memset(&resp, 0, sizeof(resp));
+        memset(rt_prefix, 0, sizeof(rt_prefix));
+        resp.rtr_prefix = (uint8_t *)&rt_prefix;
+        mtrie_dumper_make_response(dumper, &resp, ent, prefix,
+                (level + 1) * IPBUCKET_LEVEL_BITS);
+
+        ret = mtrie_dumper_route_encode(dumper, &resp);
+        if (resp.rtr_mac_size)
+            vr_free(resp.rtr_mac);
+        if (ret <= 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+ptrie_dump(struct vr_rtable * __unused, struct vr_route_req *rt)
+{
+    int ret = 0;
+    uint32_t rt_prefix[4];
+    struct ip_ptrie *ptrie;
+    struct vr_message_dumper *dumper;
+    vr_route_req *req;
+
+    dumper = vr_message_dump_init(&rt->rtr_req);
+    if (!dumper) {
+        ret = -ENOMEM;
+        goto generate_response;
+    }
+
+    req = (vr_route_req *)dumper->dump_req;
+    if (req->rtr_marker_size == 0)
+        dumper->dump_been_to_marker = 1;
+
+    ptrie = vrfid_to_ptrie(req->rtr_vrf_id, rt->rtr_req.rtr_family);
+    if (!ptrie) {
+        ret = -EINVAL;
+        goto generate_response;
+    }
+
+    memset(rt_prefix, 0, sizeof(rt_prefix));
+    if (ptrie->pt_root)
+        ret = ptrie_dump_node(dumper, ptrie->pt_root, (int8_t *)&rt_prefix, 0);
+
+generate_response:
+    vr_message_dump_exit(dumper, ret);
+
+    return 0;
+}
+
+void
+ptrie_algo_deinit(struct vr_rtable *rtable, struct rtable_fspec *fs,
+        bool soft_reset)
+{
+    unsigned int i;
+
+    if (!vn_ptrie[0])
+        return;
+
+    mtrie_stats_cleanup(rtable);
+
+    for (i = 0; i < fs->rtb_max_vrfs; i++)
+        ptrie_free_vrf(i);
+
+    vn_ptrie[0] = vn_ptrie[1] = NULL;
+
+    vr_free(rtable->algo_data);
+    rtable->algo_data = NULL;
+
+    ptrie_init_done = 0;
+
+    return;
+}
+
+int
+ptrie_algo_init(struct vr_rtable *rtable, struct rtable_fspec *fs)
+{
+    int ret = 0;
+    unsigned int table_memory;
+
+    if (ptrie_init_done)
+        return 0;
+
+    table_memory = 2 * sizeof(struct ip_ptrie *) * fs->rtb_max_vrfs;
+    rtable->algo_data = vr_zalloc(table_memory);
+    if (!rtable->algo_data)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, table_memory);
+
+    rtable->algo_max_vrfs = fs->rtb_max_vrfs;
+    if ((ret = mtrie_stats_init(rtable))) {
+        vr_module_error(ret, __FUNCTION__, __LINE__, 0);
+        goto init_fail;
+    }
+
+    rtable->algo_add = ptrie_add;
+    rtable->algo_del = ptrie_delete;
+    rtable->algo_lookup = ptrie_lookup;
+    rtable->algo_addr_lookup = ptrie_addr_lookup;
+    rtable->algo_get = ptrie_get;
+    rtable->algo_dump = ptrie_dump;
+    rtable->algo_stats_get = mtrie_stats_get;
+    rtable->algo_stats_dump = mtrie_stats_dump;
+
+    vr_inet_route_lookup = ptrie_lookup;
+    vr_inet_addr_lookup = ptrie_addr_lookup;
+    vr_inet_vrf_stats = mtrie_stats;
+
+    vn_ptrie[0] = (struct ip_ptrie **)rtable->algo_data;
+    vn_ptrie[1] = vn_ptrie[0] + fs->rtb_max_vrfs;
+
+    ptrie_init_done = 1;
+    return 0;
+
+init_fail:
+    if (rtable->algo_data) {
+        vr_free(rtable->algo_data);
+        rtable->algo_data = NULL;
+    }
+
+    return ret;
+}
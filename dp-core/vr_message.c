@@ -219,6 +219,35 @@ vr_send_response(int code)
     return vr_message_response(VR_NULL_OBJECT_ID, NULL, code);
 }
 
+/*
+ * set the full page aside and continue the dump in a new one, as long as
+ * the request has pages left
+ */
+static int
+vr_message_dump_next_page(struct vr_message_dumper *dumper)
+{
+    char *buf;
+    struct vr_mtransport *trans = message_h.vm_trans;
+
+    if (!dumper->dump_offset ||
+            (dumper->dump_num_pages >= VR_MESSAGE_DUMP_MAX_PAGES - 1))
+        return -ENOSPC;
+
+    buf = trans->mtrans_alloc(VR_MESSAGE_PAGE_SIZE);
+    if (!buf)
+        return -ENOMEM;
+
+    dumper->dump_pages[dumper->dump_num_pages] = dumper->dump_buffer;
+    dumper->dump_page_len[dumper->dump_num_pages] = dumper->dump_offset;
+    dumper->dump_num_pages++;
+
+    dumper->dump_buffer = buf;
+    dumper->dump_buf_len = VR_MESSAGE_PAGE_SIZE;
+    dumper->dump_offset = 0;
+
+    return 0;
+}
+
 int
 vr_message_dump_object(void *arg, unsigned int object_type, void *object)
 {
@@ -235,6 +264,12 @@ vr_message_dump_object(void *arg, unsigned int object_type, void *object)
     ret = proto->mproto_encode(dumper->dump_buffer + dumper->dump_offset,
             dumper->dump_buf_len - dumper->dump_offset,
             object_type, object, VR_MESSAGE_TYPE_RESPONSE);
+    if ((ret < 0) && !vr_message_dump_next_page(dumper)) {
+        ret = proto->mproto_encode(dumper->dump_buffer,
+                dumper->dump_buf_len, object_type, object,
+                VR_MESSAGE_TYPE_RESPONSE);
+    }
+
     if (ret < 0) {
         /* we have more to dump, but we have to exit early */
         dumper->dump_num_dumped |= VR_MESSAGE_DUMP_INCOMPLETE;
@@ -249,6 +284,7 @@ vr_message_dump_object(void *arg, unsigned int object_type, void *object)
 void
 vr_message_dump_exit(void *context, int ret)
 {
+    unsigned int i;
     struct vr_mproto *proto;
     struct vr_mtransport *trans;
     struct vr_message_dumper *dumper = (struct vr_message_dumper *)context;
@@ -264,6 +300,13 @@ vr_message_dump_exit(void *context, int ret)
     vr_send_response(ret);
 
     if (dumper) {
+        /* the response goes first, and then the pages in order */
+        for (i = 0; i < dumper->dump_num_pages; i++) {
+            if (vr_message_queue_response(dumper->dump_pages[i],
+                        dumper->dump_page_len[i]))
+                trans->mtrans_free(dumper->dump_pages[i]);
+        }
+
         if (!dumper->dump_offset) {
             if (dumper->dump_buffer)
                 trans->mtrans_free(dumper->dump_buffer);
@@ -333,6 +376,28 @@ vr_message_proto_unregister(struct vr_mproto *proto)
     return;
 }
 
+/*
+ * work that changes what requests change (flow ageing, for eg.) runs under
+ * the same serialization that the requests do
+ */
+void
+vr_message_lock(void)
+{
+    if (message_h.vm_trans && message_h.vm_trans->mtrans_lock)
+        message_h.vm_trans->mtrans_lock();
+
+    return;
+}
+
+void
+vr_message_unlock(void)
+{
+    if (message_h.vm_trans && message_h.vm_trans->mtrans_unlock)
+        message_h.vm_trans->mtrans_unlock();
+
+    return;
+}
+
 int
 vr_message_proto_register(struct vr_mproto *proto)
 {
@@ -337,6 +337,9 @@ vr_mpls_input(struct vrouter *router, struct vr_packet *pkt,
     else
         fmd->fmd_dvrf = pkt->vp_if->vif_vrf;
 
+    if (vr_burst_defer(router, pkt, nh, fmd))
+        return 0;
+
     nh_output(pkt, nh, fmd);
 
     return 0;
@@ -30,6 +30,14 @@ extern l4_pkt_type_t vr_ip_well_known_packet(struct vr_packet *);
 struct vr_nexthop *ip4_default_nh;
 struct vr_nexthop *ip6_default_nh;
 
+static void nh_component_list_release(struct vr_component_list *);
+
+static inline unsigned short
+nh_component_cnt(struct vr_component_list *cl)
+{
+    return cl ? cl->cl_cnt : 0;
+}
+
 struct vr_nexthop *
 __vrouter_get_nexthop(struct vrouter *router, unsigned int index)
 {
@@ -56,8 +64,6 @@ vrouter_get_nexthop(unsigned int rid, unsigned int index)
 void
 vrouter_put_nexthop(struct vr_nexthop *nh)
 {
-    int i;
-
     /* This function might get invoked with zero ref_cnt */
     if (nh->nh_users) {
         nh->nh_users--;
@@ -65,17 +71,15 @@ vrouter_put_nexthop(struct vr_nexthop *nh)
 
     if (!nh->nh_users ) {
 
+        /* the route cache could be holding on to the nexthop */
+        vr_inet_route_cache_flush();
         if (!vr_not_ready)
             vr_delay_op();
 
         /* If composite de-ref the internal nexthops */
         if (nh->nh_type == NH_COMPOSITE) {
-            for (i = 0; i < nh->nh_component_cnt; i++) {
-                if (nh->nh_component_nh[i].cnh)
-                    vrouter_put_nexthop(nh->nh_component_nh[i].cnh);
-            }
-
-            vr_free(nh->nh_component_nh);
+            nh_component_list_release(nh->nh_component_list);
+            nh->nh_component_list = NULL;
         }
         if (nh->nh_dev) {
             vrouter_put_interface(nh->nh_dev);
@@ -118,6 +122,8 @@ nh_del(struct vr_nexthop *nh)
     if (router->vr_nexthops[nh->nh_id]) {
         router->vr_nexthops[nh->nh_id] = NULL;
     }
+    /* flow caches might hold on to the nexthop */
+    vr_flow_cache_invalidate(router);
     vrouter_put_nexthop(nh);
 
     return;
@@ -243,16 +249,11 @@ nh_l3_rcv(struct vr_packet *pkt, struct vr_nexthop *nh,
 }
 
 
-static int
-nh_push_mpls_header(struct vr_packet *pkt, unsigned int label)
+static inline unsigned int
+nh_mpls_header(struct vr_packet *pkt, unsigned int label)
 {
-    unsigned int *lbl;
     unsigned int ttl;
 
-    lbl = (unsigned int *)pkt_push(pkt, sizeof(unsigned int));
-    if (!lbl)
-        return -ENOSPC;
-
     /* Use the ttl from packet. If not ttl, 
      * initialise to some arbitrary value */
     ttl = pkt->vp_ttl;
@@ -260,11 +261,141 @@ nh_push_mpls_header(struct vr_packet *pkt, unsigned int label)
         ttl = 64;
     }
 
-    *lbl = htonl((label << VR_MPLS_LABEL_SHIFT) | VR_MPLS_STACK_BIT | ttl);
+    return htonl((label << VR_MPLS_LABEL_SHIFT) | VR_MPLS_STACK_BIT | ttl);
+}
+
+static int
+nh_push_mpls_header(struct vr_packet *pkt, unsigned int label)
+{
+    unsigned int *lbl;
+
+    lbl = (unsigned int *)pkt_push(pkt, sizeof(unsigned int));
+    if (!lbl)
+        return -ENOSPC;
+
+    *lbl = nh_mpls_header(pkt, label);
 
     return 0;
 }
 
+/*
+ * build the outer header template of a tunnel nexthop (see vr_nexthop.h).
+ * the ip checksum in the template is over a zero id and a zero length,
+ * which are the only ip fields that are written per packet
+ */
+static void
+nh_tunnel_template_build(struct vr_nexthop *nh)
+{
+    unsigned short tmpl_len;
+    unsigned char *tmpl;
+    struct vr_ip *ip;
+    struct vr_gre *gre;
+    struct vr_udp *udp;
+    struct vr_vxlan *vxlanh;
+
+    if (nh->nh_flags & NH_FLAG_TUNNEL_GRE)
+        tmpl = nh->nh_data + NH_TUNNEL_TMPL_OFF(nh->nh_gre_tun_encap_len);
+    else
+        tmpl = nh->nh_data + NH_TUNNEL_TMPL_OFF(nh->nh_udp_tun_encap_len);
+
+    memset(tmpl, 0, NH_TUNNEL_TMPL_MAX);
+
+    ip = (struct vr_ip *)tmpl;
+    ip->ip_version = 4;
+    ip->ip_hl = 5;
+    ip->ip_ttl = 64;
+    tmpl_len = sizeof(struct vr_ip);
+
+    if (nh->nh_flags & NH_FLAG_TUNNEL_GRE) {
+        ip->ip_proto = VR_IP_PROTO_GRE;
+        ip->ip_saddr = nh->nh_gre_tun_sip;
+        ip->ip_daddr = nh->nh_gre_tun_dip;
+
+        gre = (struct vr_gre *)(tmpl + tmpl_len);
+        gre->gre_flags = 0;
+        gre->gre_proto = VR_GRE_PROTO_MPLS_NO;
+        tmpl_len += sizeof(struct vr_gre) + VR_MPLS_HDR_LEN;
+    } else {
+        ip->ip_proto = VR_IP_PROTO_UDP;
+        ip->ip_saddr = nh->nh_udp_tun_sip;
+        ip->ip_daddr = nh->nh_udp_tun_dip;
+
+        udp = (struct vr_udp *)(tmpl + tmpl_len);
+        tmpl_len += sizeof(struct vr_udp);
+        if (nh->nh_flags & NH_FLAG_TUNNEL_UDP) {
+            udp->udp_sport = nh->nh_udp_tun_sport;
+            udp->udp_dport = nh->nh_udp_tun_dport;
+        } else if (nh->nh_flags & NH_FLAG_TUNNEL_UDP_MPLS) {
+            udp->udp_dport = htons(VR_MPLS_OVER_UDP_DST_PORT);
+            tmpl_len += VR_MPLS_HDR_LEN;
+        } else if (nh->nh_flags & NH_FLAG_TUNNEL_VXLAN) {
+            udp->udp_dport = htons(VR_VXLAN_UDP_DST_PORT);
+            vxlanh = (struct vr_vxlan *)(tmpl + tmpl_len);
+            vxlanh->vxlan_flags = htonl(VR_VXLAN_IBIT);
+            tmpl_len += sizeof(struct vr_vxlan);
+        }
+    }
+
+    ip->ip_csum = vr_ip_csum(ip);
+
+    if (nh->nh_flags & NH_FLAG_TUNNEL_GRE)
+        nh->nh_gre_tun_tmpl_len = tmpl_len;
+    else
+        nh->nh_udp_tun_tmpl_len = tmpl_len;
+
+    return;
+}
+
+static inline unsigned char *
+nh_tunnel_template_push(struct vr_packet *pkt, struct vr_nexthop *nh,
+                        unsigned short encap_len, unsigned short tmpl_len)
+{
+    unsigned char *head;
+
+    head = pkt_push(pkt, tmpl_len);
+    if (!head)
+        return NULL;
+
+    memcpy(head, nh->nh_data + NH_TUNNEL_TMPL_OFF(encap_len), tmpl_len);
+    return head;
+}
+
+/*
+ * write the id and the length into the ip header that came from the
+ * template and fix the checksum incrementally (rfc 1624), unless the
+ * checksum is going to be computed later anyway
+ */
+static inline void
+nh_tunnel_ip_fixup(struct vr_packet *pkt, struct vr_ip *ip,
+                   unsigned short id, bool csum)
+{
+    unsigned int sum;
+
+    ip->ip_id = id;
+    ip->ip_len = htons(pkt_len(pkt));
+
+    if (vr_pkt_is_diag(pkt)) {
+        ip->ip_ttl = pkt->vp_ttl;
+        if (csum) {
+            ip->ip_csum = 0;
+            ip->ip_csum = vr_ip_csum(ip);
+        }
+        return;
+    }
+
+    if (!csum)
+        return;
+
+    sum = (unsigned short)~ip->ip_csum;
+    sum += ip->ip_id;
+    sum += ip->ip_len;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    ip->ip_csum = (unsigned short)~sum;
+
+    return;
+}
+
 /*
  * nh_udp_tunnel_helper - helper function to use for UDP tunneling. Used
  * by mirroring and MPLS over UDP. Returns true on success, false otherwise.
@@ -320,11 +451,28 @@ nh_udp_tunnel_helper(struct vr_packet *pkt, unsigned short sport,
     return true;
 }
 
+/*
+ * The UDP source port is a hash of the inner headers. For IPV6
+ * the standard port is used till flow processing is done. Returns 0
+ * if the hash could not be computed
+ */
+static unsigned short
+nh_vxlan_udp_src_port(struct vr_packet *pkt, struct vr_forwarding_md *fmd)
+{
+    if (fmd->fmd_udp_src_port)
+        return fmd->fmd_udp_src_port;
+
+    if ((pkt->vp_type != VP_TYPE_IP6) && vr_get_udp_src_port)
+        return vr_get_udp_src_port(pkt, fmd, fmd->fmd_dvrf);
+
+    return VR_VXLAN_UDP_SRC_PORT;
+}
+
 static bool 
 nh_vxlan_tunnel_helper(struct vr_packet *pkt, struct vr_forwarding_md *fmd,
                        unsigned int sip, unsigned int dip)
 {
-    unsigned short udp_src_port = VR_VXLAN_UDP_SRC_PORT;
+    unsigned short udp_src_port;
     struct vr_vxlan *vxlanh;
     struct vr_packet *tmp_pkt;
 
@@ -336,20 +484,9 @@ nh_vxlan_tunnel_helper(struct vr_packet *pkt, struct vr_forwarding_md *fmd,
         pkt = tmp_pkt;
     }
 
-    if (fmd->fmd_udp_src_port)
-        udp_src_port = fmd->fmd_udp_src_port;
-
-    /*
-     * The UDP source port is a hash of the inner headers. For IPV6
-     * the standard port is used till flow processing is done
-     */
-    if ((!fmd->fmd_udp_src_port) && (pkt->vp_type != VP_TYPE_IP6) &&
-            vr_get_udp_src_port)  {
-        udp_src_port = vr_get_udp_src_port(pkt, fmd, fmd->fmd_dvrf);
-        if (udp_src_port == 0) {
-         return false;
-        }
-    }
+    udp_src_port = nh_vxlan_udp_src_port(pkt, fmd);
+    if (udp_src_port == 0)
+        return false;
 
     /* Add the vxlan header */
     vxlanh = (struct vr_vxlan *)pkt_push(pkt, sizeof(struct vr_vxlan));
@@ -383,18 +520,59 @@ nh_mcast_clone(struct vr_packet *pkt, unsigned short head_room)
     return clone_pkt;
 }
 
+/*
+ * a replica that only gets tunnel headers pushed in front of it does not
+ * need a private copy of the whole packet. clone it (which shares the
+ * data) and chain a new buffer in front, big enough for the replica's
+ * headers. gso packets continue to take a full copy, since segmentation
+ * of a chained buffer is not something that all the platforms do well.
+ * on linux, the chain is a frag list, which the stack linearizes for a
+ * nic that does not do NETIF_F_FRAGLIST, and so vr_mcast_split is off by
+ * default.
+ */
+static struct vr_packet *
+nh_mcast_replica(struct vr_packet *pkt)
+{
+    struct vr_packet *clone_pkt, *head_pkt;
+
+    if (!vr_mcast_split || pkt_is_gso(pkt))
+        return nh_mcast_clone(pkt, 0);
+
+    clone_pkt = vr_pclone(pkt);
+    if (!clone_pkt)
+        return NULL;
+
+    head_pkt = vr_palloc_head(clone_pkt, VR_MCAST_REPLICA_HEAD_SPACE);
+    if (!head_pkt) {
+        vr_pfree(clone_pkt, VP_DROP_MCAST_CLONE_FAIL);
+        return NULL;
+    }
+
+    if (!pkt_reserve_head_space(head_pkt, VR_MCAST_REPLICA_HEAD_SPACE)) {
+        vr_pfree(head_pkt, VP_DROP_MCAST_CLONE_FAIL);
+        return NULL;
+    }
+
+    head_pkt->vp_type = pkt->vp_type;
+    head_pkt->vp_ttl = pkt->vp_ttl;
+
+    return head_pkt;
+}
+
 static int
 nh_composite_ecmp_validate_src(struct vr_packet *pkt, struct vr_nexthop *nh,
                                struct vr_forwarding_md *fmd, void *ret_data)
 {
     int i;
     struct vr_nexthop *cnh;
+    struct vr_component_list *cl = nh->nh_component_list;
 
     /* the first few checks are straight forward */
-    if (!fmd || (uint8_t)fmd->fmd_ecmp_src_nh_index >= nh->nh_component_cnt)
+    if (!fmd ||
+            (uint8_t)fmd->fmd_ecmp_src_nh_index >= nh_component_cnt(cl))
         return NH_SOURCE_INVALID;
 
-    cnh = nh->nh_component_nh[fmd->fmd_ecmp_src_nh_index].cnh;
+    cnh = cl->cl_component[fmd->fmd_ecmp_src_nh_index].cnh;
     if (cnh && !cnh->nh_validate_src)
         return NH_SOURCE_INVALID;
 
@@ -406,11 +584,11 @@ nh_composite_ecmp_validate_src(struct vr_packet *pkt, struct vr_nexthop *nh,
      */
     if (!cnh || (NH_SOURCE_INVALID ==
                  cnh->nh_validate_src(pkt, cnh, fmd, NULL))) {
-        for (i = 0; i < nh->nh_component_cnt; i++) {
+        for (i = 0; i < nh_component_cnt(cl); i++) {
             if (i == fmd->fmd_ecmp_src_nh_index)
                 continue;
 
-            cnh = nh->nh_component_nh[i].cnh;
+            cnh = cl->cl_component[i].cnh;
             /* If direct nexthop is not valid, dont process it */
             if (!cnh || !(cnh->nh_flags & NH_FLAG_VALID) || 
                                             !cnh->nh_validate_src)
@@ -433,31 +611,183 @@ nh_composite_ecmp_validate_src(struct vr_packet *pkt, struct vr_nexthop *nh,
     return NH_SOURCE_VALID;
 }
 
+/*
+ * hash of the addresses, the protocol and the ports (when they are there
+ * to be seen in the first buffer and the packet is not a fragment)
+ */
+static uint32_t
+nh_ecmp_hash(struct vr_packet *pkt, struct vr_forwarding_md *fmd)
+{
+    uint32_t hash, ports = 0;
+    unsigned char proto, *l4 = NULL;
+    struct vr_ip *ip;
+    struct vr_ip6 *ip6;
+
+    if (hashrnd_inited == 0) {
+        get_random_bytes(&vr_hashrnd, sizeof(vr_hashrnd));
+        hashrnd_inited = 1;
+    }
+
+    ip = (struct vr_ip *)pkt_network_header(pkt);
+    if (!ip)
+        return vr_hash_1word(fmd->fmd_dvrf, vr_hashrnd);
+
+    if (vr_ip_is_ip6(ip)) {
+        ip6 = (struct vr_ip6 *)ip;
+        hash = vr_hash(ip6->ip6_src, 2 * VR_IP6_ADDRESS_LEN, vr_hashrnd);
+        proto = ip6->ip6_nxt;
+        l4 = (unsigned char *)(ip6 + 1);
+    } else {
+        hash = vr_hash_2words(ip->ip_saddr, ip->ip_daddr, vr_hashrnd);
+        proto = ip->ip_proto;
+        if (!vr_ip_fragment(ip))
+            l4 = (unsigned char *)ip + (ip->ip_hl * 4);
+    }
+
+    if (l4 && ((proto == VR_IP_PROTO_TCP) || (proto == VR_IP_PROTO_UDP)) &&
+            (pkt->vp_network_h < pkt->vp_end) &&
+            (l4 + sizeof(ports) <= pkt_data(pkt) + pkt_head_len(pkt)))
+        memcpy(&ports, l4, sizeof(ports));
+
+    return vr_hash_3words(hash, ports, (proto << 16) | fmd->fmd_dvrf,
+            vr_hashrnd);
+}
+
+/*
+ * let the agent know of the member that was picked for the flow, as if
+ * it had made the pick itself
+ */
+static void
+nh_ecmp_flow_record(struct vrouter *router, struct vr_forwarding_md *fmd)
+{
+    struct vr_flow_entry *fe;
+
+    if (fmd->fmd_flow_index < 0)
+        return;
+
+    fe = vr_get_flow_entry(router, fmd->fmd_flow_index);
+    if (!fe || !(fe->fe_flags & VR_FLOW_FLAG_ACTIVE))
+        return;
+
+    if (fe->fe_ecmp_nh_index < 0)
+        fe->fe_ecmp_nh_index = fmd->fmd_ecmp_nh_index;
+
+    return;
+}
+
+/*
+ * (re)build the bucket table of an ecmp composite. a bucket that pointed
+ * to a member that is still there (and which does not already have more
+ * than its share of buckets) continues to point to the same member, now
+ * at whatever index it is in the new list. the rest of the buckets go
+ * to the members that have the least buckets. the new list is not yet
+ * visible to the datapath, and its buckets are filled in place
+ */
+static void
+nh_ecmp_buckets_build(struct vr_component_list *cl,
+                      struct vr_component_list *old)
+{
+    unsigned int i, j, live = 0, rank = 0, next = 0;
+    unsigned short load[NH_ECMP_MAX_MEMBERS], quota[NH_ECMP_MAX_MEMBERS];
+    unsigned char *buckets = cl->cl_ecmp_buckets, member;
+    unsigned char *old_buckets = old ? old->cl_ecmp_buckets : NULL;
+    struct vr_nexthop *old_nh;
+
+    if (!buckets)
+        return;
+
+    for (i = 0; i < cl->cl_cnt; i++) {
+        if (cl->cl_component[i].cnh)
+            live++;
+    }
+
+    if (!live) {
+        cl->cl_ecmp_buckets = NULL;
+        return;
+    }
+
+    for (i = 0; i < cl->cl_cnt; i++) {
+        load[i] = quota[i] = 0;
+        if (!cl->cl_component[i].cnh)
+            continue;
+
+        quota[i] = NH_ECMP_BUCKETS / live;
+        if (rank++ < (NH_ECMP_BUCKETS % live))
+            quota[i]++;
+    }
+
+    for (i = 0; i < NH_ECMP_BUCKETS; i++) {
+        buckets[i] = NH_ECMP_BUCKET_NONE;
+        if (!old_buckets || (old_buckets[i] >= old->cl_cnt))
+            continue;
+
+        old_nh = old->cl_component[old_buckets[i]].cnh;
+        for (j = 0; j < cl->cl_cnt; j++) {
+            if (cl->cl_component[j].cnh == old_nh &&
+                    cl->cl_component[j].cnh_label ==
+                    old->cl_component[old_buckets[i]].cnh_label &&
+                    load[j] < quota[j]) {
+                buckets[i] = j;
+                load[j]++;
+                break;
+            }
+        }
+    }
+
+    for (i = 0; i < NH_ECMP_BUCKETS; i++) {
+        if (buckets[i] != NH_ECMP_BUCKET_NONE)
+            continue;
+
+        while (load[next] >= quota[next])
+            next = (next + 1) % cl->cl_cnt;
+
+        member = next;
+        buckets[i] = member;
+        load[member]++;
+    }
+
+    return;
+}
+
 static int
 nh_composite_ecmp(struct vr_packet *pkt, struct vr_nexthop *nh,
                   struct vr_forwarding_md *fmd)
 {
     int ret = 0;
+    unsigned char member;
     struct vr_nexthop *member_nh = NULL;
     struct vr_vrf_stats *stats;
+    /* the buckets and the members below are all from this one list */
+    struct vr_component_list *cl = nh->nh_component_list;
 
     pkt->vp_type = VP_TYPE_IP;
     stats = vr_inet_vrf_stats(fmd->fmd_dvrf, pkt->vp_cpu);
     if (stats)
         stats->vrf_ecmp_composites++;
 
-    if (!fmd || fmd->fmd_ecmp_nh_index >= (short)nh->nh_component_cnt)
+    if (!fmd || fmd->fmd_ecmp_nh_index >= (short)nh_component_cnt(cl))
         goto drop;
 
-    if (fmd->fmd_ecmp_nh_index >= 0)
-        member_nh = nh->nh_component_nh[fmd->fmd_ecmp_nh_index].cnh;
+    if (fmd->fmd_ecmp_nh_index >= 0) {
+        member_nh = cl->cl_component[fmd->fmd_ecmp_nh_index].cnh;
+    } else if (vr_ecmp_hash && cl && cl->cl_ecmp_buckets) {
+        member = cl->cl_ecmp_buckets[nh_ecmp_hash(pkt, fmd) &
+            (NH_ECMP_BUCKETS - 1)];
+        if (member < cl->cl_cnt)
+            member_nh = cl->cl_component[member].cnh;
+        if (member_nh) {
+            fmd->fmd_ecmp_nh_index = member;
+            if (vr_ecmp_flow_record)
+                nh_ecmp_flow_record(nh->nh_router, fmd);
+        }
+    }
 
     if (!member_nh) {
         vr_trap(pkt, fmd->fmd_dvrf, AGENT_TRAP_ECMP_RESOLVE, &fmd->fmd_flow_index);
         return 0;
     }
 
-    fmd->fmd_label = nh->nh_component_nh[fmd->fmd_ecmp_nh_index].cnh_label;
+    fmd->fmd_label = cl->cl_component[fmd->fmd_ecmp_nh_index].cnh_label;
     return nh_output(pkt, member_nh, fmd);
 
 drop:
@@ -473,6 +803,7 @@ nh_composite_validate_fabric_src(struct vr_packet *pkt, struct vr_nexthop *nh,
     int j;
     struct vr_nexthop *tunnel_nh;
     unsigned int tun_dip;
+    struct vr_component_list *cl = nh->nh_component_list;
 
     if (pkt->vp_if->vif_type != VIF_TYPE_PHYSICAL)
         return NH_SOURCE_INVALID;
@@ -480,8 +811,8 @@ nh_composite_validate_fabric_src(struct vr_packet *pkt, struct vr_nexthop *nh,
     if (!fmd->fmd_outer_src_ip)
         return NH_SOURCE_INVALID;
 
-    for(j = 0; j < nh->nh_component_cnt; j++) {
-        tunnel_nh = nh->nh_component_nh[j].cnh;
+    for(j = 0; j < nh_component_cnt(cl); j++) {
+        tunnel_nh = cl->cl_component[j].cnh;
 
         if (!tunnel_nh || !(tunnel_nh->nh_flags & NH_FLAG_VALID))
             continue;
@@ -517,6 +848,7 @@ nh_composite_mcast_validate_src(struct vr_packet *pkt, struct vr_nexthop *nh,
     int i, j;
     struct vr_nexthop *dir_nh, *fabric_nh;
     unsigned int tun_dip;
+    struct vr_component_list *cl = nh->nh_component_list, *fabric_cl;
 
     /*
      * If multicast packet is received on fabric interface, we need to
@@ -532,8 +864,8 @@ nh_composite_mcast_validate_src(struct vr_packet *pkt, struct vr_nexthop *nh,
     if (!fmd->fmd_outer_src_ip)
         return NH_SOURCE_INVALID;
 
-    for(j = 0; j < nh->nh_component_cnt; j++) {
-        fabric_nh = nh->nh_component_nh[j].cnh;
+    for(j = 0; j < nh_component_cnt(cl); j++) {
+        fabric_nh = cl->cl_component[j].cnh;
 
         if (!fabric_nh || !(fabric_nh->nh_flags & NH_FLAG_VALID))
             continue;
@@ -543,8 +875,9 @@ nh_composite_mcast_validate_src(struct vr_packet *pkt, struct vr_nexthop *nh,
               NH_FLAG_COMPOSITE_EVPN | NH_FLAG_COMPOSITE_TOR)))
             continue;
 
-        for (i = 0; i < fabric_nh->nh_component_cnt; i++) {
-            dir_nh = fabric_nh->nh_component_nh[i].cnh;
+        fabric_cl = fabric_nh->nh_component_list;
+        for (i = 0; i < nh_component_cnt(fabric_cl); i++) {
+            dir_nh = fabric_cl->cl_component[i].cnh;
 
             /* If direct nexthop is not valid, dont process it */
             if ((!dir_nh) || !(dir_nh->nh_flags & NH_FLAG_VALID))
@@ -587,6 +920,7 @@ nh_composite_mcast_l2(struct vr_packet *pkt, struct vr_nexthop *nh,
     unsigned short drop_reason, pull_len, label, pkt_vrf, rt_flags;
     unsigned int tun_src, pkt_src, hashval, port_range, handled;
     l4_pkt_type_t l4_type;
+    struct vr_component_list *cl = nh->nh_component_list;
 
     struct vr_eth *eth = NULL;
     struct vr_arp *sarp;
@@ -757,10 +1091,10 @@ nh_composite_mcast_l2(struct vr_packet *pkt, struct vr_nexthop *nh,
     }
 
     label = fmd->fmd_label;
-    for (i = 0; i < nh->nh_component_cnt; i++) {
+    for (i = 0; i < nh_component_cnt(cl); i++) {
 
         clone_size = 0;
-        dir_nh = nh->nh_component_nh[i].cnh;
+        dir_nh = cl->cl_component[i].cnh;
 
         /* We need to copy back the original label from Bridge lookaup
          * as previous iteration would have manipulated that
@@ -860,6 +1194,7 @@ nh_composite_encap(struct vr_packet *pkt, struct vr_nexthop *nh,
     struct vr_nexthop *dir_nh;
     unsigned short drop_reason;
     struct vr_packet *new_pkt;
+    struct vr_component_list *cl = nh->nh_component_list;
 
     drop_reason = VP_DROP_CLONED_ORIGINAL;
     stats = vr_inet_vrf_stats(fmd->fmd_dvrf, pkt->vp_cpu);
@@ -871,8 +1206,8 @@ nh_composite_encap(struct vr_packet *pkt, struct vr_nexthop *nh,
         goto drop;
     }
 
-    for (i = 0; i < nh->nh_component_cnt; i++) {
-       dir_nh = nh->nh_component_nh[i].cnh;
+    for (i = 0; i < nh_component_cnt(cl); i++) {
+       dir_nh = cl->cl_component[i].cnh;
 
         /* If direct nexthop is not valid, dont process it */
         if ((!dir_nh) || !(dir_nh->nh_flags & NH_FLAG_VALID))
@@ -906,6 +1241,7 @@ nh_composite_tor(struct vr_packet *pkt, struct vr_nexthop *nh,
     struct vr_nexthop *dir_nh;
     unsigned short drop_reason;
     struct vr_packet *new_pkt;
+    struct vr_component_list *cl = nh->nh_component_list;
 
     drop_reason = VP_DROP_CLONED_ORIGINAL;
     stats = vr_inet_vrf_stats(fmd->fmd_dvrf, pkt->vp_cpu);
@@ -917,8 +1253,8 @@ nh_composite_tor(struct vr_packet *pkt, struct vr_nexthop *nh,
         goto drop;
     }
 
-    for (i = 0; i < nh->nh_component_cnt; i++) {
-        dir_nh = nh->nh_component_nh[i].cnh;
+    for (i = 0; i < nh_component_cnt(cl); i++) {
+        dir_nh = cl->cl_component[i].cnh;
 
         /* If direct nexthop is not valid, dont process it */
         if ((!dir_nh) || !(dir_nh->nh_flags & NH_FLAG_VALID))
@@ -933,17 +1269,16 @@ nh_composite_tor(struct vr_packet *pkt, struct vr_nexthop *nh,
             continue;
 
         /*
-         * Enough head spaces are created in the previous nexthop
-         * handling. Just cow the packet with zero size to get different
-         * buffer space
+         * the tunnel headers go into a buffer of the replica's own, and
+         * the rest of the packet is shared
          */
-        new_pkt = nh_mcast_clone(pkt, 0);
+        new_pkt = nh_mcast_replica(pkt);
         if (!new_pkt) {
             drop_reason = VP_DROP_MCAST_CLONE_FAIL;
             break;
         }
 
-        fmd->fmd_label = nh->nh_component_nh[i].cnh_label;
+        fmd->fmd_label = cl->cl_component[i].cnh_label;
         fmd->fmd_dvrf = dir_nh->nh_dev->vif_vrf;
         nh_output(new_pkt, dir_nh, fmd);
     }
@@ -963,6 +1298,7 @@ nh_composite_evpn(struct vr_packet *pkt, struct vr_nexthop *nh,
     struct vr_nexthop *dir_nh;
     unsigned short drop_reason;
     struct vr_packet *new_pkt;
+    struct vr_component_list *cl = nh->nh_component_list;
 
     drop_reason = VP_DROP_CLONED_ORIGINAL;
     stats = vr_inet_vrf_stats(fmd->fmd_dvrf, pkt->vp_cpu);
@@ -974,8 +1310,8 @@ nh_composite_evpn(struct vr_packet *pkt, struct vr_nexthop *nh,
         goto drop;
     }
 
-    for (i = 0; i < nh->nh_component_cnt; i++) {
-        dir_nh = nh->nh_component_nh[i].cnh;
+    for (i = 0; i < nh_component_cnt(cl); i++) {
+        dir_nh = cl->cl_component[i].cnh;
 
         /* If direct nexthop is not valid, dont process it */
         if ((!dir_nh) || !(dir_nh->nh_flags & NH_FLAG_VALID))
@@ -985,17 +1321,16 @@ nh_composite_evpn(struct vr_packet *pkt, struct vr_nexthop *nh,
             continue;
 
         /*
-         * Enough head spaces are created in the previous nexthop
-         * handling. Just cow the packet with zero size to get different
-         * buffer space
+         * the tunnel headers go into a buffer of the replica's own, and
+         * the rest of the packet is shared
          */
-        new_pkt = nh_mcast_clone(pkt, 0);
+        new_pkt = nh_mcast_replica(pkt);
         if (!new_pkt) {
             drop_reason = VP_DROP_MCAST_CLONE_FAIL;
             break;
         }
 
-        fmd->fmd_label = nh->nh_component_nh[i].cnh_label;
+        fmd->fmd_label = cl->cl_component[i].cnh_label;
         fmd->fmd_dvrf = dir_nh->nh_dev->vif_vrf;
         nh_output(new_pkt, dir_nh, fmd);
     }
@@ -1038,6 +1373,7 @@ nh_composite_fabric(struct vr_packet *pkt, struct vr_nexthop *nh,
     struct vr_packet *new_pkt;
     unsigned int dip, sip;
     int32_t label;
+    struct vr_component_list *cl = nh->nh_component_list;
 
     drop_reason = VP_DROP_CLONED_ORIGINAL;
     stats = vr_inet_vrf_stats(fmd->fmd_dvrf, pkt->vp_cpu);
@@ -1066,8 +1402,8 @@ nh_composite_fabric(struct vr_packet *pkt, struct vr_nexthop *nh,
 
     label = fmd->fmd_label;
     pkt_vrf = fmd->fmd_dvrf;
-    for (i = 0; i < nh->nh_component_cnt; i++) {
-        dir_nh = nh->nh_component_nh[i].cnh;
+    for (i = 0; i < nh_component_cnt(cl); i++) {
+        dir_nh = cl->cl_component[i].cnh;
         fmd->fmd_dvrf = pkt_vrf;
 
         /* If direct nexthop is not valid, dont process it */
@@ -1098,11 +1434,10 @@ nh_composite_fabric(struct vr_packet *pkt, struct vr_nexthop *nh,
             continue;
 
         /*
-         * Enough head spaces are created in the previous nexthop
-         * handling. Just cow the packet with zero size to get different
-         * buffer space
+         * the vxlan and the tunnel headers go into a buffer of the
+         * replica's own, and the rest of the packet is shared
          */
-        new_pkt = nh_mcast_clone(pkt, 0);
+        new_pkt = nh_mcast_replica(pkt);
         if (!new_pkt) {
             drop_reason = VP_DROP_MCAST_CLONE_FAIL;
             break;
@@ -1137,7 +1472,7 @@ nh_composite_fabric(struct vr_packet *pkt, struct vr_nexthop *nh,
         }
 
         /* MPLS label for outer header encapsulation */
-        fmd->fmd_label = nh->nh_component_nh[i].cnh_label;
+        fmd->fmd_label = cl->cl_component[i].cnh_label;
         fmd->fmd_dvrf = dir_nh->nh_dev->vif_vrf;
         nh_output(new_pkt, dir_nh, fmd);
     }
@@ -1184,11 +1519,14 @@ nh_udp_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
             goto send_fail;
     }
 
-    if (nh_udp_tunnel_helper(pkt, nh->nh_udp_tun_sport,
-                             nh->nh_udp_tun_dport, nh->nh_udp_tun_sip,
-                             nh->nh_udp_tun_dip) == false) {
+    ip = (struct vr_ip *)nh_tunnel_template_push(pkt, nh,
+            nh->nh_udp_tun_encap_len, nh->nh_udp_tun_tmpl_len);
+    if (!ip)
         goto send_fail;
-    }
+
+    udp = (struct vr_udp *)(ip + 1);
+    udp->udp_length = htons(pkt_len(pkt) - sizeof(struct vr_ip));
+    nh_tunnel_ip_fixup(pkt, ip, htons(vr_generate_unique_ip_id()), true);
     pkt_set_network_header(pkt, pkt->vp_data);
 
     if (pkt_len(pkt) > ((1 << sizeof(ip->ip_len) * 8)))
@@ -1226,12 +1564,15 @@ static int
 nh_vxlan_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
                 struct vr_forwarding_md *fmd)
 {
+    struct vr_ip *ip;
+    struct vr_udp *udp;
+    struct vr_vxlan *vxlanh;
     struct vr_interface *vif;
     struct vr_vrf_stats *stats;
     unsigned short reason = VP_DROP_PUSH;
     struct vr_packet *tmp_pkt;
     struct vr_df_trap_arg trap_arg;
-    unsigned short overhead_len;
+    unsigned short overhead_len, udp_src_port;
 
     if (!fmd) {
         reason = VP_DROP_NO_FMD;
@@ -1266,10 +1607,30 @@ nh_vxlan_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
         }
     }
 
-    if (nh_vxlan_tunnel_helper(pkt, fmd, nh->nh_udp_tun_sip,
-                                            nh->nh_udp_tun_dip) == false)
+    if (pkt_head_space(pkt) < nh->nh_udp_tun_tmpl_len) {
+        tmp_pkt = vr_pexpand_head(pkt,
+                nh->nh_udp_tun_tmpl_len - pkt_head_space(pkt));
+        if (!tmp_pkt)
+            goto send_fail;
+        pkt = tmp_pkt;
+    }
+
+    udp_src_port = nh_vxlan_udp_src_port(pkt, fmd);
+    if (udp_src_port == 0)
+        goto send_fail;
+
+    ip = (struct vr_ip *)nh_tunnel_template_push(pkt, nh,
+            nh->nh_udp_tun_encap_len, nh->nh_udp_tun_tmpl_len);
+    if (!ip)
         goto send_fail;
 
+    udp = (struct vr_udp *)(ip + 1);
+    udp->udp_sport = htons(udp_src_port);
+    udp->udp_length = htons(pkt_len(pkt) - sizeof(struct vr_ip));
+    vxlanh = (struct vr_vxlan *)(udp + 1);
+    vxlanh->vxlan_vnid = htonl(fmd->fmd_label << VR_VXLAN_VNID_SHIFT);
+    nh_tunnel_ip_fixup(pkt, ip, htons(vr_generate_unique_ip_id()), true);
+
     /*
      * Change the packet type
      */
@@ -1326,6 +1687,8 @@ nh_mpls_udp_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
                    struct vr_forwarding_md *fmd)
 {
     unsigned char *tun_encap;
+    struct vr_ip *ip;
+    struct vr_udp *udp;
     struct vr_interface *vif;
     struct vr_vrf_stats *stats;
     unsigned int tun_sip, tun_dip, overhead_len, mudp_head_space;
@@ -1401,8 +1764,31 @@ nh_mpls_udp_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
         pkt = tmp_pkt;
     }
 
-    if (nh_push_mpls_header(pkt, fmd->fmd_label) < 0)
-        goto send_fail;
+    /*
+     * the vr_mudp knob sends a gre nexthop out through here, and the
+     * template of such a nexthop is of no use
+     */
+    if (vr_mudp) {
+        if (nh_push_mpls_header(pkt, fmd->fmd_label) < 0)
+            goto send_fail;
+
+        if (nh_udp_tunnel_helper(pkt, htons(udp_src_port),
+                                 htons(VR_MPLS_OVER_UDP_DST_PORT),
+                                 tun_sip, tun_dip) == false) {
+            goto send_fail;
+        }
+    } else {
+        ip = (struct vr_ip *)nh_tunnel_template_push(pkt, nh,
+                tun_encap_len, nh->nh_udp_tun_tmpl_len);
+        if (!ip)
+            goto send_fail;
+
+        udp = (struct vr_udp *)(ip + 1);
+        udp->udp_sport = htons(udp_src_port);
+        udp->udp_length = htons(pkt_len(pkt) - sizeof(struct vr_ip));
+        *(unsigned int *)(udp + 1) = nh_mpls_header(pkt, fmd->fmd_label);
+        nh_tunnel_ip_fixup(pkt, ip, htons(vr_generate_unique_ip_id()), true);
+    }
 
     if (vr_perfs)
         pkt->vp_flags |= VP_FLAG_GSO;
@@ -1418,12 +1804,6 @@ nh_mpls_udp_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
     else
         pkt->vp_type = VP_TYPE_IP;
 
-    if (nh_udp_tunnel_helper(pkt, htons(udp_src_port), 
-                             htons(VR_MPLS_OVER_UDP_DST_PORT),
-                             tun_sip, tun_dip) == false) {
-        goto send_fail;
-    }
-
     pkt_set_network_header(pkt, pkt->vp_data);
 
     /* slap l2 header */
@@ -1461,7 +1841,6 @@ nh_gre_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
     unsigned int id;
     int overhead_len, gre_head_space;
     unsigned short drop_reason = VP_DROP_INVALID_NH;
-    struct vr_gre *gre_hdr;
     struct vr_ip *ip;
     unsigned char *tun_encap;
     struct vr_interface *vif;
@@ -1537,23 +1916,16 @@ nh_gre_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
         pkt = tmp_pkt;
     }
 
-    if (nh_push_mpls_header(pkt, fmd->fmd_label) < 0)
-        goto send_fail;
-
-    gre_hdr = (struct vr_gre *)pkt_push(pkt, sizeof(struct vr_gre));
-    if (!gre_hdr) {
-        drop_reason = VP_DROP_PUSH;
-        goto send_fail;
-    }
-
-    gre_hdr->gre_flags = 0;
-    gre_hdr->gre_proto = VR_GRE_PROTO_MPLS_NO;
-
-    ip = (struct vr_ip *)pkt_push(pkt, sizeof(struct vr_ip));
+    /* ip, gre and the mpls header, from the template */
+    ip = (struct vr_ip *)nh_tunnel_template_push(pkt, nh,
+            nh->nh_gre_tun_encap_len, nh->nh_gre_tun_tmpl_len);
     if (!ip) {
         drop_reason = VP_DROP_PUSH;
         goto send_fail;
     }
+    *(unsigned int *)((unsigned char *)(ip + 1) + sizeof(struct vr_gre)) =
+        nh_mpls_header(pkt, fmd->fmd_label);
+
     pkt_set_network_header(pkt, pkt->vp_data);
     if (pkt->vp_type == VP_TYPE_IP6)
         pkt->vp_type = VP_TYPE_IP6OIP;
@@ -1562,27 +1934,9 @@ nh_gre_tunnel(struct vr_packet *pkt, struct vr_nexthop *nh,
     else
         pkt->vp_type = VP_TYPE_IP;
 
-    ip->ip_version = 4;
-    ip->ip_hl = 5;
-    ip->ip_tos = 0;
-    ip->ip_id = id;
-    ip->ip_frag_off = 0;
-
-    if (vr_pkt_is_diag(pkt)) {
-        ip->ip_ttl = pkt->vp_ttl;
-    } else {
-        ip->ip_ttl = 64;
-    }
-
-    ip->ip_proto = VR_IP_PROTO_GRE;
-    ip->ip_saddr = nh->nh_gre_tun_sip;
-    ip->ip_daddr = nh->nh_gre_tun_dip;
-    ip->ip_len = htons(pkt_len(pkt));
     /* checksum will be calculated for tunneled packet in linux_xmit_segment */
-    if (!vr_pkt_type_is_overlay(pkt->vp_type)) {
-        ip->ip_csum = 0;
-        ip->ip_csum = vr_ip_csum(ip);
-    }
+    nh_tunnel_ip_fixup(pkt, ip, id,
+            !vr_pkt_type_is_overlay(pkt->vp_type));
 
     /* slap l2 header */
     vif = nh->nh_dev;
@@ -1847,7 +2201,8 @@ nh_vrf_translate_add(struct vr_nexthop *nh, vr_nexthop_req *req)
 }
 
 static int
-nh_composite_mcast_validate(struct vr_nexthop *nh, vr_nexthop_req *req)
+nh_composite_mcast_validate(struct vr_component_list *cl,
+        vr_nexthop_req *req)
 {
     unsigned int i;
     struct vr_nexthop *tmp_nh;
@@ -1856,7 +2211,7 @@ nh_composite_mcast_validate(struct vr_nexthop *nh, vr_nexthop_req *req)
     if (req->nhr_flags & (NH_FLAG_COMPOSITE_FABRIC |
                 NH_FLAG_COMPOSITE_EVPN | NH_FLAG_COMPOSITE_TOR)) {
         for (i = 0; i < req->nhr_nh_list_size; i++) {
-            tmp_nh = nh->nh_component_nh[i].cnh;
+            tmp_nh = cl->cl_component[i].cnh;
             if (!tmp_nh)
                 continue;
             if (tmp_nh->nh_type != NH_TUNNEL)
@@ -1877,7 +2232,7 @@ nh_composite_mcast_validate(struct vr_nexthop *nh, vr_nexthop_req *req)
 
         bool l2_seen = false, l3_seen = false;
         for (i = 0; i < req->nhr_nh_list_size; i++) {
-            tmp_nh = nh->nh_component_nh[i].cnh;
+            tmp_nh = cl->cl_component[i].cnh;
             if (!tmp_nh)
                 continue;
 
@@ -1905,7 +2260,7 @@ nh_composite_mcast_validate(struct vr_nexthop *nh, vr_nexthop_req *req)
             return -1;
 
         for (i = 0; i < req->nhr_nh_list_size; i++) {
-            tmp_nh = nh->nh_component_nh[i].cnh;
+            tmp_nh = cl->cl_component[i].cnh;
 
             /* NULL component NH is valid */
             if (!tmp_nh)
@@ -1925,46 +2280,76 @@ nh_composite_mcast_validate(struct vr_nexthop *nh, vr_nexthop_req *req)
     return 0;
 }
 
+static void
+nh_component_list_release(struct vr_component_list *cl)
+{
+    unsigned int i;
+
+    if (!cl)
+        return;
+
+    for (i = 0; i < cl->cl_cnt; i++) {
+        if (cl->cl_component[i].cnh)
+            vrouter_put_nexthop(cl->cl_component[i].cnh);
+    }
+    vr_free(cl);
+
+    return;
+}
+
 static int
 nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
 {
-    unsigned int i;
-    struct vr_nexthop *tmp_nh;
+    int ret = -EINVAL;
+    unsigned int i, size;
+    bool ecmp = false;
+    struct vr_component_list *cl = NULL, *old_cl;
 
     nh->nh_validate_src = NULL;
-    /* Delete the old nexthops first */
-    if (nh->nh_component_cnt && nh->nh_component_nh) {
-        for (i = 0; i < nh->nh_component_cnt; i++) {
-            if (nh->nh_component_nh[i].cnh)
-                vrouter_put_nexthop(nh->nh_component_nh[i].cnh);
-        }
-        vr_free(nh->nh_component_nh);
-        nh->nh_component_nh = NULL;
-        nh->nh_component_cnt = 0;
-    }
+    old_cl = nh->nh_component_list;
 
     if (req->nhr_nh_list_size != req->nhr_label_list_size)
-        return -EINVAL;
+        goto exit_add;
 
     /* Nh list of size 0 is valid */
-    if (req->nhr_nh_list_size == 0)
-        return 0;
+    if (req->nhr_nh_list_size == 0) {
+        ret = 0;
+        goto exit_add;
+    }
 
-    nh->nh_component_nh = vr_zalloc(req->nhr_nh_list_size *
-            sizeof(struct vr_component_nh)); 
-    if (!nh->nh_component_nh) {
-        return -ENOMEM;
+    /*
+     * the new list (and the buckets, which are built from the old ones)
+     * is put together off to the side, and replaces the old one in one go
+     */
+    size = sizeof(*cl) +
+        (req->nhr_nh_list_size * sizeof(struct vr_component_nh));
+    if ((req->nhr_flags & NH_FLAG_COMPOSITE_ECMP) &&
+            (req->nhr_nh_list_size <= NH_ECMP_MAX_MEMBERS)) {
+        ecmp = true;
+        size += NH_ECMP_BUCKETS;
     }
+
+    cl = vr_zalloc(size);
+    if (!cl) {
+        ret = -ENOMEM;
+        goto exit_add;
+    }
+
     for (i = 0; i < req->nhr_nh_list_size; i++) {
-        nh->nh_component_nh[i].cnh = vrouter_get_nexthop(req->nhr_rid, 
+        cl->cl_component[i].cnh = vrouter_get_nexthop(req->nhr_rid, 
                                                     req->nhr_nh_list[i]);
-        nh->nh_component_nh[i].cnh_label = req->nhr_label_list[i];
+        cl->cl_component[i].cnh_label = req->nhr_label_list[i];
     }
-    nh->nh_component_cnt = req->nhr_nh_list_size;
+    cl->cl_cnt = req->nhr_nh_list_size;
 
-    if (nh_composite_mcast_validate(nh, req))
+    if (nh_composite_mcast_validate(cl, req))
         goto error;
 
+    if (ecmp) {
+        cl->cl_ecmp_buckets = (unsigned char *)&cl->cl_component[cl->cl_cnt];
+        nh_ecmp_buckets_build(cl, old_cl);
+    }
+
     /* This needs to be the last */
     if (req->nhr_flags & NH_FLAG_COMPOSITE_L2) {
         nh->nh_reach_nh = nh_composite_mcast_l2;
@@ -1983,21 +2368,24 @@ nh_composite_add(struct vr_nexthop *nh, vr_nexthop_req *req)
         nh->nh_reach_nh = nh_composite_tor;
     }
 
-    return 0;
+    ret = 0;
+    goto exit_add;
 
 error:
-    if (nh->nh_component_nh) {
-        for (i = 0; i < req->nhr_nh_list_size; i++) {
-             tmp_nh = nh->nh_component_nh[i].cnh;
-             if (tmp_nh)
-                vrouter_put_nexthop(tmp_nh);
-        }
-
-        vr_free(nh->nh_component_nh);
-        nh->nh_component_nh = NULL;
-        nh->nh_component_cnt = 0;
+    nh_component_list_release(cl);
+    cl = NULL;
+
+exit_add:
+    __sync_synchronize();
+    nh->nh_component_list = cl;
+    if (old_cl) {
+        /* the datapath could still be looking at the old list */
+        if (!vr_not_ready)
+            vr_delay_op();
+        nh_component_list_release(old_cl);
     }
-    return -EINVAL;
+
+    return ret;
 }
 
 static int
@@ -2053,6 +2441,7 @@ nh_tunnel_add(struct vr_nexthop *nh, vr_nexthop_req *req)
     }
 
     memcpy(nh->nh_data, req->nhr_encap, req->nhr_encap_size);
+    nh_tunnel_template_build(nh);
     if (old_vif)
         vrouter_put_interface(old_vif);
 
@@ -2129,7 +2518,12 @@ vr_nexthop_size(vr_nexthop_req *req)
 {
     unsigned int size = sizeof(struct vr_nexthop);
 
-    if ((req->nhr_type == NH_ENCAP) || (req->nhr_type == NH_TUNNEL))
+    /* the l2 rewrite, followed by the outer header template */
+    if (req->nhr_type == NH_TUNNEL)
+        return size + NH_TUNNEL_TMPL_OFF(req->nhr_encap_size) +
+            NH_TUNNEL_TMPL_MAX;
+
+    if (req->nhr_type == NH_ENCAP)
         if (req->nhr_encap)
             size += req->nhr_encap_size;
 
@@ -2145,9 +2539,14 @@ vr_nexthop_valid_change(vr_nexthop_req *req, struct vr_nexthop *nh)
     if (req->nhr_type != nh->nh_type)
         return false;
 
-    if (req->nhr_encap_size &&
-            req->nhr_encap_size != nh->nh_data_size)
+    if (req->nhr_type == NH_TUNNEL) {
+        if (req->nhr_encap_size && (vr_nexthop_size(req) !=
+                    sizeof(struct vr_nexthop) + nh->nh_data_size))
+            return false;
+    } else if (req->nhr_encap_size &&
+            req->nhr_encap_size != nh->nh_data_size) {
         return false;
+    }
 
     return true;
 }
@@ -2291,6 +2690,7 @@ vr_nexthop_make_req(vr_nexthop_req *req, struct vr_nexthop *nh)
 {
     unsigned char *encap = NULL;
     unsigned int i;
+    struct vr_component_list *cl;
 
     req->nhr_type = nh->nh_type;
     req->nhr_family = nh->nh_family;
@@ -2323,25 +2723,26 @@ vr_nexthop_make_req(vr_nexthop_req *req, struct vr_nexthop *nh)
         break;
 
     case NH_COMPOSITE:
-        req->nhr_nh_list_size = nh->nh_component_cnt;
-        if (nh->nh_component_cnt) {
+        cl = nh->nh_component_list;
+        req->nhr_nh_list_size = nh_component_cnt(cl);
+        if (req->nhr_nh_list_size) {
             req->nhr_nh_list = vr_zalloc(req->nhr_nh_list_size * sizeof(unsigned int));
             if (!req->nhr_nh_list)
                 return -ENOMEM;
 
-            req->nhr_label_list_size = nh->nh_component_cnt;
+            req->nhr_label_list_size = req->nhr_nh_list_size;
             req->nhr_label_list = vr_zalloc(req->nhr_nh_list_size * sizeof(unsigned int));
             /* don't bother about freeing. we will free it in req_destroy */
             if (!req->nhr_label_list)
                 return -ENOMEM;
 
             for (i = 0; i < req->nhr_nh_list_size; i++) {
-                if (nh->nh_component_nh[i].cnh)
-                    req->nhr_nh_list[i] = nh->nh_component_nh[i].cnh->nh_id;
+                if (cl->cl_component[i].cnh)
+                    req->nhr_nh_list[i] = cl->cl_component[i].cnh->nh_id;
                 else
                     req->nhr_nh_list[i] = -1;
 
-                req->nhr_label_list[i] = nh->nh_component_nh[i].cnh_label;
+                req->nhr_label_list[i] = cl->cl_component[i].cnh_label;
             }
         }
 
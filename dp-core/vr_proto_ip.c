@@ -32,39 +32,19 @@ vr_generate_unique_ip_id()
 struct vr_nexthop *
 vr_inet6_sip_lookup(unsigned short vrf, uint8_t *sip6)
 {
-    uint32_t rt_prefix[4];
+    unsigned int label;
+    unsigned short label_flags;
 
-    struct vr_route_req rt;
-
-    rt.rtr_req.rtr_vrf_id = vrf;
-    rt.rtr_req.rtr_prefix = (uint8_t*)&rt_prefix;
-    memcpy(rt.rtr_req.rtr_prefix, sip6, 16);
-    rt.rtr_req.rtr_prefix_size = 16;
-    rt.rtr_req.rtr_prefix_len = IP6_PREFIX_LEN;
-    rt.rtr_req.rtr_family = AF_INET6;
-    rt.rtr_req.rtr_marker_size = 0;
-    rt.rtr_req.rtr_nh_id = 0;
-
-    return vr_inet_route_lookup(vrf, &rt);
+    return vr_inet6_lookup(vrf, sip6, &label, &label_flags);
 }
 
 struct vr_nexthop *
 vr_inet_sip_lookup(unsigned short vrf, uint32_t sip)
 {
-    uint32_t rt_prefix;
-
-    struct vr_route_req rt;
-
-    rt.rtr_req.rtr_vrf_id = vrf;
-    rt.rtr_req.rtr_prefix = (uint8_t *)&rt_prefix;
-    *(uint32_t*)rt.rtr_req.rtr_prefix = sip;
-    rt.rtr_req.rtr_prefix_size = 4;
-    rt.rtr_req.rtr_prefix_len = IP4_PREFIX_LEN;
-    rt.rtr_req.rtr_family = AF_INET;
-    rt.rtr_req.rtr_marker_size = 0;
-    rt.rtr_req.rtr_nh_id = 0;
+    unsigned int label;
+    unsigned short label_flags;
 
-    return vr_inet_route_lookup(vrf, &rt);
+    return vr_inet4_lookup(vrf, sip, &label, &label_flags);
 }
 
 struct vr_nexthop *
@@ -208,7 +188,6 @@ int
 vr_forward(struct vrouter *router, struct vr_packet *pkt,
            struct vr_forwarding_md *fmd)
 {
-    struct vr_route_req rt;
     struct vr_nexthop *nh;
     struct vr_ip *ip;
     struct vr_ip6 *ip6, *outer_ip6;
@@ -216,9 +195,10 @@ vr_forward(struct vrouter *router, struct vr_packet *pkt,
     struct vr_forwarding_md rt_fmd;
     struct vr_interface *vif;
     int family, status, encap_len = 0;
+    unsigned int rt_label;
+    unsigned short rt_flags;
     unsigned char ttl;
     short plen;
-    uint32_t rt_prefix[4];
 
     ip6 = NULL;
     ip = (struct vr_ip *)pkt_data(pkt);
@@ -241,29 +221,16 @@ vr_forward(struct vrouter *router, struct vr_packet *pkt,
  
     pkt->vp_ttl = ttl;
 
-    rt.rtr_req.rtr_vrf_id = fmd->fmd_dvrf;
-    rt.rtr_req.rtr_family = family;
-    if (family == AF_INET) {
-        rt.rtr_req.rtr_prefix = (uint8_t*)&rt_prefix;
-        *(uint32_t*)rt.rtr_req.rtr_prefix = (ip->ip_daddr);
-        rt.rtr_req.rtr_prefix_size = 4;
-        rt.rtr_req.rtr_prefix_len = IP4_PREFIX_LEN;
-    } else {
-        rt.rtr_req.rtr_prefix = (uint8_t*)&rt_prefix;
-        rt.rtr_req.rtr_prefix_size = 16;
-        memcpy(rt.rtr_req.rtr_prefix, ip6->ip6_dst, 16);
-        rt.rtr_req.rtr_prefix_len = IP6_PREFIX_LEN;
-    }
-    rt.rtr_req.rtr_nh_id = 0;
-    rt.rtr_req.rtr_marker_size = 0;
-
-    nh = vr_inet_route_lookup(fmd->fmd_dvrf, &rt);
-    if (rt.rtr_req.rtr_label_flags & VR_RT_LABEL_VALID_FLAG) {
+    if (family == AF_INET)
+        nh = vr_inet4_lookup(fmd->fmd_dvrf, ip->ip_daddr, &rt_label, &rt_flags);
+    else
+        nh = vr_inet6_lookup(fmd->fmd_dvrf, ip6->ip6_dst, &rt_label, &rt_flags);
+    if (rt_flags & VR_RT_LABEL_VALID_FLAG) {
         if (!fmd) {
             vr_init_forwarding_md(&rt_fmd);
             fmd = &rt_fmd;
         }
-        fmd->fmd_label = rt.rtr_req.rtr_label;
+        fmd->fmd_label = rt_label;
     } 
     
     vif = nh->nh_dev;
@@ -315,8 +282,8 @@ vr_forward(struct vrouter *router, struct vr_packet *pkt,
                /* Update packet pointers, perform route lookup and forward */
                pkt_set_network_header(pkt, pkt->vp_data);
 
-               memcpy(rt.rtr_req.rtr_prefix, outer_ip6->ip6_dst, 16);
-               nh = vr_inet_route_lookup(fmd->fmd_dvrf, &rt);
+               nh = vr_inet6_lookup(fmd->fmd_dvrf, outer_ip6->ip6_dst,
+                       &rt_label, &rt_flags);
            }
        }
     }
@@ -829,7 +796,7 @@ vr_inet_fragment_flow(struct vrouter *router, unsigned short vrf,
     sport = frag->f_sport;
     dport = frag->f_dport;
     if (vr_ip_fragment_tail(ip))
-        vr_fragment_del(frag);
+        vr_fragment_del(router, frag);
 
     nh_id = vr_inet_flow_nexthop(pkt, vlan);
     vr_inet_fill_flow(flow_p, nh_id, ip->ip_saddr, ip->ip_daddr,
@@ -889,8 +856,6 @@ vr_inet_form_flow(struct vrouter *router, unsigned short vrf,
         ret = vr_inet_proto_flow(router, vrf, pkt, vlan, ip, flow_p);
     } else {
         ret = vr_inet_fragment_flow(router, vrf, pkt, vlan, flow_p);
-        if (ret < 0)
-            vr_pfree(pkt, VP_DROP_FRAGMENTS);
     }
 
     return ret;
@@ -925,7 +890,9 @@ vr_inet_flow_lookup(struct vrouter *router, struct vr_packet *pkt,
 {
     int ret;
     bool lookup = false;
+    flow_result_t result;
     struct vr_flow flow, *flow_p = &flow;
+    struct vr_fragment_key frag_key;
     struct vr_ip *ip = (struct vr_ip *)pkt_network_header(pkt);
 
     /*
@@ -935,9 +902,28 @@ vr_inet_flow_lookup(struct vrouter *router, struct vr_packet *pkt,
     if (pkt->vp_flags & VP_FLAG_FLOW_SET)
         return FLOW_FORWARD;
 
+    /*
+     * if the interface is policy enabled, or if somebody else (eg:nexthop)
+     * has requested for a policy lookup, packet has to go through a lookup
+     */
+    if ((pkt->vp_if->vif_flags & VIF_FLAG_POLICY_ENABLED) ||
+            (pkt->vp_flags & VP_FLAG_FLOW_GET)) {
+        lookup = true;
+    }
+
     ret = vr_inet_form_flow(router, fmd->fmd_dvrf, pkt, fmd->fmd_vlan, flow_p);
-    if (ret < 0)
+    if (ret < 0) {
+        /*
+         * a fragment that came before the head of its datagram waits for
+         * the head, which is what leaves the ports behind. without a
+         * lookup, the head never does
+         */
+        if (lookup)
+            vr_fragment_enqueue(router, fmd->fmd_dvrf, pkt, fmd);
+        else
+            vr_pfree(pkt, VP_DROP_FRAGMENTS);
         return FLOW_CONSUMED;
+    }
 
     /* no flow lookup for multicast or broadcast ip */
     if (IS_BMCAST_IP(ip->ip_daddr)) {
@@ -948,22 +934,21 @@ vr_inet_flow_lookup(struct vrouter *router, struct vr_packet *pkt,
         return FLOW_FORWARD;
     }
 
-    /*
-     * if the interface is policy enabled, or if somebody else (eg:nexthop)
-     * has requested for a policy lookup, packet has to go through a lookup
-     */
-    if ((pkt->vp_if->vif_flags & VIF_FLAG_POLICY_ENABLED) ||
-            (pkt->vp_flags & VP_FLAG_FLOW_GET)) {
-        lookup = true;
-    }
-
     if (lookup) {
-        if (vr_ip_fragment_head(ip)) {
-            vr_fragment_add(router, fmd->fmd_dvrf, ip, flow_p->flow4_sport,
-                    flow_p->flow4_dport);
-        }
+        if (!vr_ip_fragment_head(ip) ||
+                vr_fragment_add(router, fmd->fmd_dvrf, ip,
+                    flow_p->flow4_sport, flow_p->flow4_dport))
+            return vr_flow_lookup(router, flow_p, pkt, fmd);
+
+        /*
+         * the head goes first, and then the fragments that came before
+         * it. the packet may be gone after the lookup, and hence the key
+         */
+        fragment_key(&frag_key, fmd->fmd_dvrf, ip);
+        result = vr_flow_lookup(router, flow_p, pkt, fmd);
+        vr_fragment_release(router, &frag_key);
 
-        return vr_flow_lookup(router, flow_p, pkt, fmd);
+        return result;
     }
 
     return FLOW_FORWARD;
@@ -12,6 +12,8 @@
 #include <vr_datapath.h>
 #include <vr_ip_mtrie.h>
 #include <vr_bridge.h>
+#include <vr_flow.h>
+#include <vr_hash.h>
 
 static int
 vr_v6_prefix_is_ll(uint8_t prefix[])
@@ -136,9 +138,480 @@ vr_ip6_input(struct vrouter *router, struct vr_packet *pkt,
         return 0;
     }
 
+    if (!vr_flow_forward(router, pkt, fmd))
+        return 0;
+
     return vr_forward(router, pkt, fmd);
 }
 
+/*
+ * the addresses are in the key only as their hash, which is seeded like
+ * the flow table's, so that colliding addresses can not be picked offline
+ */
+void
+vr_inet6_fill_flow(struct vrouter *router, struct vr_flow *flow_p,
+        struct vr_inet6_flow_addr *addr6, unsigned short nh_id,
+        unsigned char *sip, unsigned char *dip, uint8_t proto,
+        uint16_t sport, uint16_t dport)
+{
+    memcpy(addr6->ip6_sip, sip, VR_IP6_ADDRESS_LEN);
+    memcpy(addr6->ip6_dip, dip, VR_IP6_ADDRESS_LEN);
+
+    flow_p->flow6_addr_hash = vr_hash_key(&router->vr_flow_hash, addr6,
+            sizeof(*addr6));
+    flow_p->flow6_proto = proto;
+    flow_p->flow6_nh_id = nh_id;
+    flow_p->flow6_sport = sport;
+    flow_p->flow6_dport = dport;
+
+    flow_p->key_len = sizeof(struct vr_inet6_flow);
+
+    return;
+}
+
+static unsigned short
+vr_inet6_flow_nexthop(struct vr_packet *pkt, unsigned short vlan)
+{
+    unsigned short nh_id;
+
+    if (vif_is_fabric(pkt->vp_if) && pkt->vp_nh) {
+        if ((pkt->vp_nh->nh_type == NH_ENCAP)) {
+            nh_id = pkt->vp_nh->nh_dev->vif_nh_id;
+        } else {
+            nh_id = pkt->vp_nh->nh_id;
+        }
+    } else if (vif_is_service(pkt->vp_if)) {
+        nh_id = vif_vrf_table_get_nh(pkt->vp_if, vlan);
+    } else {
+        nh_id = pkt->vp_if->vif_nh_id;
+    }
+
+    return nh_id;
+}
+
+/* that many extension headers are walked, at the most */
+#define VR_IP6_MAX_EXT_HDRS     4
+
+/*
+ * offset, from the network header, of the upper layer header of the ipv6
+ * header at 'offset', with its protocol in 'proto'. hop-by-hop, routing
+ * and destination option headers are walked past, and so is the fragment
+ * header of a first fragment. whatever else ends the walk (a fragment
+ * that is not the first, ah, esp, too many extension headers) is what is
+ * returned as the protocol, so that such a packet is handled the same way
+ * a non tcp/udp/icmp packet is
+ */
+static int
+vr_inet6_upper_layer(struct vr_packet *pkt, unsigned int offset,
+        uint8_t *proto)
+{
+    unsigned int i, nh_off, len;
+    uint8_t nxt;
+
+    struct vr_ip6 *ip6;
+    struct vr_ip6_ext *ext;
+    struct vr_ip6_frag *frag;
+
+    nh_off = pkt_network_header(pkt) - pkt_data(pkt);
+    if (vr_pkt_may_pull(pkt, nh_off + offset + sizeof(*ip6)))
+        return -1;
+
+    ip6 = (struct vr_ip6 *)(pkt_network_header(pkt) + offset);
+    nxt = ip6->ip6_nxt;
+    offset += sizeof(*ip6);
+
+    for (i = 0; (i < VR_IP6_MAX_EXT_HDRS) && vr_ip6_ext_hdr(nxt); i++) {
+        /* every extension header is at least 8 octets long */
+        if (vr_pkt_may_pull(pkt, nh_off + offset + sizeof(*frag)))
+            return -1;
+
+        if (nxt == VR_IP6_PROTO_FRAG) {
+            frag = (struct vr_ip6_frag *)(pkt_network_header(pkt) + offset);
+            if (ntohs(frag->ip6_frag_off) & VR_IP6_FRAG_OFFSET_MASK)
+                break;
+
+            nxt = frag->ip6_frag_nxt;
+            len = sizeof(*frag);
+        } else {
+            ext = (struct vr_ip6_ext *)(pkt_network_header(pkt) + offset);
+            nxt = ext->ip6_ext_nxt;
+            len = (ext->ip6_ext_len + 1) * 8;
+        }
+
+        offset += len;
+    }
+
+    *proto = nxt;
+    return offset;
+}
+
+static void
+vr_inet6_flow_swap(struct vrouter *router, struct vr_flow *flow_p,
+        struct vr_inet6_flow_addr *addr6)
+{
+    unsigned short port;
+    unsigned char ip6_addr[VR_IP6_ADDRESS_LEN];
+
+    port = flow_p->flow6_sport;
+    flow_p->flow6_sport = flow_p->flow6_dport;
+    flow_p->flow6_dport = port;
+
+    memcpy(ip6_addr, addr6->ip6_sip, VR_IP6_ADDRESS_LEN);
+    memcpy(addr6->ip6_sip, addr6->ip6_dip, VR_IP6_ADDRESS_LEN);
+    memcpy(addr6->ip6_dip, ip6_addr, VR_IP6_ADDRESS_LEN);
+
+    flow_p->flow6_addr_hash = vr_hash_key(&router->vr_flow_hash, addr6,
+            sizeof(*addr6));
+
+    return;
+}
+
+/*
+ * forms the flow of the ipv6 header at 'offset' from the network header.
+ * returns 1 for packets that do not go through flows, and -1 for those
+ * whose headers are not all there
+ */
+static int
+vr_inet6_proto_flow(struct vrouter *router, struct vr_packet *pkt,
+        uint16_t vlan, unsigned int offset, struct vr_flow *flow_p,
+        struct vr_inet6_flow_addr *addr6)
+{
+    int l4_off;
+    uint8_t proto, type;
+    unsigned int nh_off;
+    unsigned short *t_hdr, sport = 0, dport = 0;
+
+    struct vr_ip6 *ip6;
+    struct vr_icmp *icmph;
+
+    l4_off = vr_inet6_upper_layer(pkt, offset, &proto);
+    if (l4_off < 0)
+        return -1;
+
+    nh_off = pkt_network_header(pkt) - pkt_data(pkt);
+
+    switch (proto) {
+    case VR_IP_PROTO_TCP:
+    case VR_IP_PROTO_UDP:
+        if (vr_pkt_may_pull(pkt, nh_off + l4_off + 2 * sizeof(*t_hdr)))
+            return -1;
+
+        t_hdr = (unsigned short *)(pkt_network_header(pkt) + l4_off);
+        sport = *t_hdr;
+        dport = *(t_hdr + 1);
+        break;
+
+    case VR_IP_PROTO_ICMP6:
+        if (vr_pkt_may_pull(pkt, nh_off + l4_off + sizeof(*icmph)))
+            return -1;
+
+        icmph = (struct vr_icmp *)(pkt_network_header(pkt) + l4_off);
+        type = icmph->icmp_type;
+        if (vr_icmp6_echo(icmph)) {
+            sport = icmph->icmp_eid;
+            dport = VR_ICMP6_TYPE_ECHO_REPLY;
+            break;
+        }
+
+        /* like arp for ipv4, neighbor discovery does not go through flows */
+        if (!offset && vr_icmp6_nd(icmph))
+            return 1;
+
+        /*
+         * an error goes with the flow of the packet that it is about, as
+         * it does for ipv4. an error whose packet is cut short goes with
+         * a flow of its own
+         */
+        if (!offset && vr_icmp6_error(icmph) &&
+                !vr_inet6_proto_flow(router, pkt, vlan,
+                    l4_off + sizeof(*icmph), flow_p, addr6)) {
+            vr_inet6_flow_swap(router, flow_p, addr6);
+            return 0;
+        }
+
+        dport = type;
+        break;
+
+    default:
+        break;
+    }
+
+    ip6 = (struct vr_ip6 *)(pkt_network_header(pkt) + offset);
+    vr_inet6_fill_flow(router, flow_p, addr6,
+            vr_inet6_flow_nexthop(pkt, vlan), ip6->ip6_src, ip6->ip6_dst,
+            proto, sport, dport);
+
+    return 0;
+}
+
+flow_result_t
+vr_inet6_flow_lookup(struct vrouter *router, struct vr_packet *pkt,
+                     struct vr_forwarding_md *fmd)
+{
+    int ret;
+    struct vr_flow flow;
+    struct vr_inet6_flow_addr addr6;
+    struct vr_ip6 *ip6 = (struct vr_ip6 *)pkt_network_header(pkt);
+
+    if (pkt->vp_flags & VP_FLAG_FLOW_SET)
+        return FLOW_FORWARD;
+
+    /* no flow lookup for multicast */
+    if (ip6->ip6_dst[0] == 0xFF)
+        return FLOW_FORWARD;
+
+    if (!(pkt->vp_if->vif_flags & VIF_FLAG_POLICY_ENABLED) &&
+            !(pkt->vp_flags & VP_FLAG_FLOW_GET))
+        return FLOW_FORWARD;
+
+    ret = vr_inet6_proto_flow(router, pkt, fmd->fmd_vlan, 0, &flow, &addr6);
+    if (ret < 0) {
+        vr_pfree(pkt, VP_DROP_INVALID_PACKET);
+        return FLOW_CONSUMED;
+    } else if (ret) {
+        return FLOW_FORWARD;
+    }
+
+    return vr_flow6_lookup(router, &flow, &addr6, pkt, fmd);
+}
+
+static void
+vr_inet6_nat_address(unsigned char *addr, unsigned char *new_addr,
+        unsigned int *inc)
+{
+    unsigned int i, old_word, new_word;
+
+    for (i = 0; i < VR_IP6_ADDRESS_LEN; i += sizeof(unsigned int)) {
+        memcpy(&old_word, addr + i, sizeof(old_word));
+        memcpy(&new_word, new_addr + i, sizeof(new_word));
+        vr_incremental_diff(old_word, new_word, inc);
+    }
+
+    memcpy(addr, new_addr, VR_IP6_ADDRESS_LEN);
+    return;
+}
+
+static void
+vr_inet6_update_csum(struct vr_packet *pkt, unsigned short *csump,
+        unsigned int addr_inc, unsigned int inc)
+{
+    unsigned int csum;
+
+    /*
+     * for partial checksums, the actual value (of the pseudo header) is
+     * stored rather than the complement
+     */
+    if (pkt->vp_flags & VP_FLAG_CSUM_PARTIAL) {
+        csum = (*csump) & 0xffff;
+        inc = addr_inc;
+    } else {
+        csum = ~(*csump) & 0xffff;
+    }
+
+    csum += inc;
+    if (csum < inc)
+        csum += 1;
+
+    csum = (csum & 0xffff) + (csum >> 16);
+    if (csum >> 16)
+        csum = (csum & 0xffff) + 1;
+
+    if (pkt->vp_flags & VP_FLAG_CSUM_PARTIAL) {
+        *csump = csum & 0xffff;
+    } else {
+        *csump = ~(csum) & 0xffff;
+    }
+
+    return;
+}
+
+flow_result_t
+vr_inet6_flow_nat(struct vr_flow_entry *fe, struct vr_packet *pkt,
+        struct vr_forwarding_md *fmd)
+{
+    int l4_off, inner_off = -1, inner_l4_off = -1;
+    uint8_t proto, inner_proto;
+    unsigned int nh_off, l4_len, addr_inc, inc = 0;
+    unsigned short *t_sport, *t_dport, *csump = NULL;
+
+    struct vrouter *router = pkt->vp_if->vif_router;
+    struct vr_flow_entry *rfe;
+    struct vr_inet6_flow_addr *addr6, *raddr6;
+    struct vr_ip6 *ip6, *inner_ip6;
+    struct vr_tcp *tcp;
+    struct vr_udp *udp;
+    struct vr_icmp *icmph;
+
+    if (fe->fe_rflow < 0)
+        goto drop;
+
+    rfe = vr_get_flow_entry(router, fe->fe_rflow);
+    if (!rfe || (rfe->fe_type != VP_TYPE_IP6))
+        goto drop;
+
+    addr6 = vr_flow6_get_addr(router, fmd->fmd_flow_index);
+    raddr6 = vr_flow6_get_addr(router, fe->fe_rflow);
+    if (!addr6 || !raddr6)
+        goto drop;
+
+    /*
+     * all of the headers that are rewritten, and their checksums, have to
+     * be in the linear part of the packet before any of them is touched
+     */
+    l4_off = vr_inet6_upper_layer(pkt, 0, &proto);
+    if (l4_off < 0)
+        goto pull_fail;
+
+    switch (proto) {
+    case VR_IP_PROTO_TCP:
+        l4_len = sizeof(*tcp);
+        break;
+
+    case VR_IP_PROTO_UDP:
+        l4_len = sizeof(*udp);
+        break;
+
+    case VR_IP_PROTO_ICMP6:
+        l4_len = sizeof(*icmph);
+        break;
+
+    default:
+        l4_len = 0;
+        break;
+    }
+
+    nh_off = pkt_network_header(pkt) - pkt_data(pkt);
+    if (vr_pkt_may_pull(pkt, nh_off + l4_off + l4_len))
+        goto pull_fail;
+
+    if (proto == VR_IP_PROTO_ICMP6) {
+        icmph = (struct vr_icmp *)(pkt_network_header(pkt) + l4_off);
+        if (vr_icmp6_error(icmph)) {
+            /* what of the packet in error is there gets rewritten */
+            inner_off = l4_off + sizeof(*icmph);
+            inner_l4_off = vr_inet6_upper_layer(pkt, inner_off, &inner_proto);
+            if (inner_l4_off < 0) {
+                inner_off = -1;
+            } else if (((inner_proto != VR_IP_PROTO_TCP) &&
+                        (inner_proto != VR_IP_PROTO_UDP)) ||
+                    vr_pkt_may_pull(pkt, nh_off + inner_l4_off +
+                        2 * sizeof(*t_sport))) {
+                inner_l4_off = -1;
+            }
+        }
+    }
+
+    ip6 = (struct vr_ip6 *)pkt_network_header(pkt);
+    if ((fe->fe_flags & VR_FLOW_FLAG_SNAT) &&
+            !memcmp(ip6->ip6_src, addr6->ip6_sip, VR_IP6_ADDRESS_LEN))
+        vr_inet6_nat_address(ip6->ip6_src, raddr6->ip6_dip, &inc);
+
+    if (fe->fe_flags & VR_FLOW_FLAG_DNAT)
+        vr_inet6_nat_address(ip6->ip6_dst, raddr6->ip6_sip, &inc);
+
+    addr_inc = inc;
+
+    switch (proto) {
+    case VR_IP_PROTO_TCP:
+    case VR_IP_PROTO_UDP:
+        if (proto == VR_IP_PROTO_TCP) {
+            tcp = (struct vr_tcp *)((unsigned char *)ip6 + l4_off);
+            csump = &tcp->tcp_csum;
+        } else {
+            udp = (struct vr_udp *)((unsigned char *)ip6 + l4_off);
+            csump = &udp->udp_csum;
+        }
+
+        t_sport = (unsigned short *)((unsigned char *)ip6 + l4_off);
+        t_dport = t_sport + 1;
+
+        if (fe->fe_flags & VR_FLOW_FLAG_SPAT) {
+            vr_incremental_diff(*t_sport, rfe->fe_key.flow6_dport, &inc);
+            *t_sport = rfe->fe_key.flow6_dport;
+        }
+
+        if (fe->fe_flags & VR_FLOW_FLAG_DPAT) {
+            vr_incremental_diff(*t_dport, rfe->fe_key.flow6_sport, &inc);
+            *t_dport = rfe->fe_key.flow6_sport;
+        }
+        break;
+
+    case VR_IP_PROTO_ICMP6:
+        /* unlike that of icmp, the checksum covers the pseudo header */
+        icmph = (struct vr_icmp *)((unsigned char *)ip6 + l4_off);
+        csump = &icmph->icmp_csum;
+
+        /*
+         * the packet in error is of the reverse direction, and is
+         * translated the other way around. the icmp checksum covers it
+         * too, and hence has all of its changes
+         */
+        if (inner_off >= 0) {
+            inner_ip6 = (struct vr_ip6 *)((unsigned char *)ip6 + inner_off);
+            if (fe->fe_flags & VR_FLOW_FLAG_SNAT)
+                vr_inet6_nat_address(inner_ip6->ip6_dst, raddr6->ip6_dip,
+                        &inc);
+
+            if (fe->fe_flags & VR_FLOW_FLAG_DNAT)
+                vr_inet6_nat_address(inner_ip6->ip6_src, raddr6->ip6_sip,
+                        &inc);
+
+            if (inner_l4_off >= 0) {
+                t_sport = (unsigned short *)((unsigned char *)ip6 +
+                        inner_l4_off);
+                t_dport = t_sport + 1;
+
+                if (fe->fe_flags & VR_FLOW_FLAG_SPAT) {
+                    vr_incremental_diff(*t_dport, rfe->fe_key.flow6_dport,
+                            &inc);
+                    *t_dport = rfe->fe_key.flow6_dport;
+                }
+
+                if (fe->fe_flags & VR_FLOW_FLAG_DPAT) {
+                    vr_incremental_diff(*t_sport, rfe->fe_key.flow6_sport,
+                            &inc);
+                    *t_sport = rfe->fe_key.flow6_sport;
+                }
+            }
+            break;
+        }
+
+        /*
+         * both echo request and reply are keyed with the echo id as the
+         * source port. the id that this side is translated to is hence
+         * the source port of the reverse flow
+         */
+        if (vr_icmp6_echo(icmph) &&
+                (fe->fe_flags & (VR_FLOW_FLAG_SPAT | VR_FLOW_FLAG_DPAT))) {
+            vr_incremental_diff(icmph->icmp_eid, rfe->fe_key.flow6_sport,
+                    &inc);
+            icmph->icmp_eid = rfe->fe_key.flow6_sport;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    if (csump && !vr_pkt_is_diag(pkt))
+        vr_inet6_update_csum(pkt, csump, addr_inc, inc);
+
+    if ((fe->fe_flags & VR_FLOW_FLAG_VRFT) &&
+            pkt->vp_nh && pkt->vp_nh->nh_vrf != fmd->fmd_dvrf) {
+        pkt->vp_nh = NULL;
+    }
+
+    return FLOW_FORWARD;
+
+pull_fail:
+    vr_pfree(pkt, VP_DROP_PULL);
+    return FLOW_CONSUMED;
+
+drop:
+    vr_pfree(pkt, VP_DROP_FLOW_NAT_NO_RFLOW);
+    return FLOW_CONSUMED;
+}
+
 void
 vr_neighbor_proxy(struct vr_packet *pkt, struct vr_forwarding_md *fmd,
         unsigned char *dmac)
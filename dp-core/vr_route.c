@@ -7,22 +7,74 @@
 #include <vr_types.h>
 #include <vr_packet.h>
 #include <vr_route.h>
+#include "vr_hash.h"
+#include "vr_btable.h"
 #include "vr_message.h"
 #include "vr_sandesh.h"
 
 static struct rtable_fspec rtable_families[];
 extern int mtrie_algo_init(struct vr_rtable *, struct rtable_fspec *);
 extern void mtrie_algo_deinit(struct vr_rtable *, struct rtable_fspec *, bool);
+extern int ptrie_algo_init(struct vr_rtable *, struct rtable_fspec *);
+extern void ptrie_algo_deinit(struct vr_rtable *, struct rtable_fspec *, bool);
 extern int bridge_table_init(struct vr_rtable *, struct rtable_fspec *);
 extern void bridge_table_deinit(struct vr_rtable *, struct rtable_fspec *, bool);
 
 int vr_route_delete(vr_route_req *);
 int vr_route_get(vr_route_req *);
 int vr_route_dump(vr_route_req *);
+/*
+ * algorithm of the inet (and inet6) route tables. ptrie trades a little
+ * lookup latency for a lot less memory
+ */
+unsigned int vr_inet_rtable_algo = VR_INET_RTABLE_ALGO_MTRIE;
+
 int inet_route_add(struct rtable_fspec *, struct vr_route_req *);
 int inet_route_del(struct rtable_fspec *, struct vr_route_req *);
 int bridge_entry_add(struct rtable_fspec *, struct vr_route_req *);
 int bridge_entry_del(struct rtable_fspec *, struct vr_route_req *);
+static void vr_route_export_update(vr_route_req *, bool);
+
+/*
+ * per cpu cache of the results of the inet (and inet6) host route
+ * lookups of the datapath, keyed on the vrf and the address. an entry is
+ * good only as long as the generation of its vrf is what it was when the
+ * entry was filled. the route table algorithms bump the generation of a
+ * vrf (vr_inet_route_cache_invalidate) once a change to its table is in
+ * place. since a change can free nexthops even before it is complete,
+ * there is also a generation for the whole cache, which is bumped
+ * (vr_inet_route_cache_flush) before a nexthop is freed.
+ *
+ * lookups come from process context too (reinjected packets, for eg.),
+ * which the same cpu's softirq can interrupt in the middle of a fill. an
+ * entry hence has a sequence that is odd while it is being written, and
+ * a lookup uses the entry only if the sequence was even and did not
+ * change while the entry was read
+ */
+#define VR_ROUTE_CACHE_ENTRIES      1024
+
+struct vr_route_cache_entry {
+    uint32_t rce_seq;
+    uint32_t rce_gen;
+    uint32_t rce_cache_gen;
+    uint16_t rce_vrf;
+    uint16_t rce_family;
+    uint32_t rce_label_flags;
+    uint32_t rce_label;
+    uint32_t rce_addr[4];
+    struct vr_nexthop *rce_nh;
+};
+
+static struct vr_route_cache_entry *vr_route_caches;
+static uint32_t *vr_route_gens;
+static unsigned int vr_route_gens_size;
+static uint32_t vr_route_cache_gen;
+
+/* slots of the route export (see vr_route.h). 0 disables the export */
+unsigned int vr_route_export_entries = VR_DEF_ROUTE_EXPORT_ENTRIES;
+/* mmap maps whole pages, so the export is a multiple of this */
+#define VR_ROUTE_EXPORT_ALIGN       4096
+static struct vr_hash_fn vr_route_export_hash;
 
 
 static struct rtable_fspec *
@@ -74,6 +126,8 @@ vr_route_delete(vr_route_req *req)
         }
         vr_req.rtr_req.rtr_marker_size = 0;
         ret = fs->route_del(fs, &vr_req);
+        if (!ret)
+            vr_route_export_update(&vr_req.rtr_req, true);
     }
 
 error:
@@ -105,6 +159,8 @@ vr_route_add(vr_route_req *req)
         }
 
         ret = fs->route_add(fs, &vr_req);
+        if (!ret)
+            vr_route_export_update(&vr_req.rtr_req, false);
     }
 
     vr_send_response(ret);
@@ -562,6 +618,457 @@ static struct rtable_fspec rtable_families[] = {
     }
 };
 
+void
+vr_inet_route_cache_invalidate(unsigned int vrf)
+{
+    uint32_t gen;
+
+    if (!vr_route_gens || vrf >= vr_route_gens_size)
+        return;
+
+    /* 0 is never a valid generation, which is what a free entry has */
+    gen = vr_route_gens[vrf] + 1;
+    if (!gen)
+        gen = 1;
+    vr_route_gens[vrf] = gen;
+    __sync_synchronize();
+
+    return;
+}
+
+void
+vr_inet_route_cache_flush(void)
+{
+    (void)__sync_add_and_fetch(&vr_route_cache_gen, 1);
+    return;
+}
+
+static inline unsigned int
+vr_route_cache_index(unsigned int vrf, uint32_t *addr, unsigned int words)
+{
+    uint32_t key = addr[0];
+
+    if (words > 1)
+        key ^= addr[1] ^ addr[2] ^ addr[3];
+
+    return vr_hash_2words(key, vrf, 0) & (VR_ROUTE_CACHE_ENTRIES - 1);
+}
+
+/*
+ * the host route lookup of the datapath, which unlike vr_inet_route_lookup
+ * does not need a vr_route_req. the address is in network byte order and
+ * is always four words long. label and flags are what the route has, with
+ * the label valid only if the flags say so
+ */
+static struct vr_nexthop *
+vr_inet_lookup(unsigned int vrf, unsigned int family, uint32_t *addr,
+        unsigned int *label, unsigned short *label_flags)
+{
+    unsigned int cpu, index, c_label;
+    unsigned short c_label_flags;
+    uint32_t seq, gen, cache_gen;
+    struct vr_nexthop *nh;
+    struct vr_route_cache_entry *ent;
+
+    if (!vr_route_caches || vrf >= vr_route_gens_size)
+        return vr_inet_addr_lookup(vrf, family, (uint8_t *)addr,
+                label, label_flags);
+
+    cpu = vr_get_cpu();
+    if (cpu >= vr_num_cpus)
+        return vr_inet_addr_lookup(vrf, family, (uint8_t *)addr,
+                label, label_flags);
+
+    index = vr_route_cache_index(vrf, addr, (family == AF_INET6) ? 4 : 1);
+    ent = &vr_route_caches[(cpu * VR_ROUTE_CACHE_ENTRIES) + index];
+
+    cache_gen = *(volatile uint32_t *)&vr_route_cache_gen;
+    gen = *(volatile uint32_t *)&vr_route_gens[vrf];
+    seq = *(volatile uint32_t *)&ent->rce_seq;
+    vr_compiler_barrier();
+    if (!(seq & 1) && ent->rce_gen == gen &&
+            ent->rce_cache_gen == cache_gen &&
+            ent->rce_vrf == vrf && ent->rce_family == family &&
+            !memcmp(ent->rce_addr, addr, sizeof(ent->rce_addr))) {
+        c_label_flags = ent->rce_label_flags;
+        c_label = ent->rce_label;
+        nh = ent->rce_nh;
+        vr_compiler_barrier();
+        if (*(volatile uint32_t *)&ent->rce_seq == seq) {
+            *label_flags = c_label_flags;
+            *label = c_label;
+            return nh;
+        }
+    }
+
+    /*
+     * the generations are read before the lookup, so that a change that
+     * races with the lookup leaves behind an entry that is already stale
+     */
+    nh = vr_inet_addr_lookup(vrf, family, (uint8_t *)addr,
+            label, label_flags);
+    if (!nh)
+        return nh;
+
+    /* we interrupted a fill of the same entry. leave it to that one */
+    if (*(volatile uint32_t *)&ent->rce_seq & 1)
+        return nh;
+
+    ent->rce_seq++;
+    vr_compiler_barrier();
+    ent->rce_gen = gen;
+    ent->rce_cache_gen = cache_gen;
+    ent->rce_vrf = vrf;
+    ent->rce_family = family;
+    ent->rce_label_flags = *label_flags;
+    ent->rce_label = *label;
+    memcpy(ent->rce_addr, addr, sizeof(ent->rce_addr));
+    ent->rce_nh = nh;
+    vr_compiler_barrier();
+    ent->rce_seq++;
+
+    return nh;
+}
+
+struct vr_nexthop *
+vr_inet4_lookup(unsigned int vrf, uint32_t addr, unsigned int *label,
+        unsigned short *label_flags)
+{
+    uint32_t key[4];
+
+    key[0] = addr;
+    key[1] = key[2] = key[3] = 0;
+
+    return vr_inet_lookup(vrf, AF_INET, key, label, label_flags);
+}
+
+struct vr_nexthop *
+vr_inet6_lookup(unsigned int vrf, uint8_t *addr, unsigned int *label,
+        unsigned short *label_flags)
+{
+    uint32_t key[4];
+
+    memcpy(key, addr, sizeof(key));
+
+    return vr_inet_lookup(vrf, AF_INET6, key, label, label_flags);
+}
+
+static void
+vr_route_cache_exit(void)
+{
+    if (vr_route_caches) {
+        vr_free(vr_route_caches);
+        vr_route_caches = NULL;
+    }
+
+    if (vr_route_gens) {
+        vr_free(vr_route_gens);
+        vr_route_gens = NULL;
+    }
+    vr_route_gens_size = 0;
+
+    return;
+}
+
+static int
+vr_route_cache_init(void)
+{
+    unsigned int i, size;
+
+    if (vr_route_caches)
+        return 0;
+
+    size = VR_MAX_VRFS * sizeof(uint32_t);
+    vr_route_gens = vr_zalloc(size);
+    if (!vr_route_gens)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+
+    for (i = 0; i < VR_MAX_VRFS; i++)
+        vr_route_gens[i] = 1;
+
+    size = vr_num_cpus * VR_ROUTE_CACHE_ENTRIES *
+        sizeof(struct vr_route_cache_entry);
+    vr_route_caches = vr_zalloc(size);
+    if (!vr_route_caches) {
+        vr_free(vr_route_gens);
+        vr_route_gens = NULL;
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, size);
+    }
+
+    vr_route_gens_size = VR_MAX_VRFS;
+
+    return 0;
+}
+
+unsigned int
+vr_route_export_size(struct vrouter *router)
+{
+    if (!router->vr_route_export)
+        return 0;
+
+    return vr_btable_size(router->vr_route_export);
+}
+
+void *
+vr_route_export_get_va(struct vrouter *router, uint64_t offset)
+{
+    if (!router->vr_route_export ||
+            offset >= vr_route_export_size(router))
+        return NULL;
+
+    return vr_btable_get_address(router->vr_route_export, offset);
+}
+
+static inline struct vr_route_export_header *
+vr_route_export_header(struct vr_btable *table)
+{
+    return (struct vr_route_export_header *)vr_btable_get(table, 0);
+}
+
+static void
+vr_route_export_key(struct vr_route_export_entry *key,
+        vr_route_req *req)
+{
+    unsigned int i, size, plen;
+
+    memset(key, 0, sizeof(*key));
+    key->re_vrf = req->rtr_vrf_id;
+    key->re_family = req->rtr_family;
+
+    if (req->rtr_family == AF_BRIDGE) {
+        memcpy(key->re_prefix, req->rtr_mac, VR_ETHER_ALEN);
+        return;
+    }
+
+    /* the bits past the prefix length do not make a different route */
+    size = RT_IP_ADDR_SIZE(req->rtr_family);
+    plen = req->rtr_prefix_len;
+    key->re_prefix_len = plen;
+    memcpy(key->re_prefix, req->rtr_prefix, size);
+    for (i = plen / 8; i < size; i++) {
+        if (i == plen / 8 && (plen % 8))
+            key->re_prefix[i] &= (0xff << (8 - (plen % 8)));
+        else
+            key->re_prefix[i] = 0;
+    }
+
+    return;
+}
+
+/*
+ * the slot that has the route, or if there is none and alloc is set, the
+ * first slot in the probe sequence that does not have a route
+ */
+static struct vr_route_export_entry *
+vr_route_export_find(struct vr_btable *table,
+        struct vr_route_export_entry *key, bool alloc)
+{
+    unsigned int i, index, entries;
+    struct vr_route_export_entry *ent, *free_ent = NULL;
+
+    entries = vr_btable_entries(table) - 1;
+    index = vr_hash_key(&vr_route_export_hash, key,
+            VR_ROUTE_EXPORT_KEY_SIZE) % entries;
+
+    for (i = 0; i < VR_ROUTE_EXPORT_PROBES && i < entries; i++) {
+        ent = (struct vr_route_export_entry *)vr_btable_get(table,
+                1 + ((index + i) % entries));
+        if (ent->re_family == VR_ROUTE_EXPORT_FREE) {
+            if (!free_ent)
+                free_ent = ent;
+            break;
+        }
+
+        if (ent->re_family == VR_ROUTE_EXPORT_DELETED) {
+            if (!free_ent)
+                free_ent = ent;
+            continue;
+        }
+
+        if (!memcmp(ent, key, VR_ROUTE_EXPORT_KEY_SIZE))
+            return ent;
+    }
+
+    return alloc ? free_ent : NULL;
+}
+
+static void
+vr_route_export_write(struct vr_route_export_entry *ent,
+        struct vr_route_export_entry *val)
+{
+    uint16_t seq = ent->re_seq;
+
+    ent->re_seq = ++seq;
+    __sync_synchronize();
+
+    memcpy(ent, val, VR_ROUTE_EXPORT_KEY_SIZE);
+    ent->re_nh_id = val->re_nh_id;
+    ent->re_label = val->re_label;
+    ent->re_label_flags = val->re_label_flags;
+
+    __sync_synchronize();
+    ent->re_seq = ++seq;
+
+    return;
+}
+
+/*
+ * called once a route add or delete is through. route changes come one
+ * at a time from the message channel, so there is only one writer
+ */
+static void
+vr_route_export_update(vr_route_req *req, bool del)
+{
+    struct vrouter *router;
+    struct vr_btable *table;
+    struct vr_route_export_header *hdr;
+    struct vr_route_export_entry key, *ent;
+
+    router = vrouter_get(req->rtr_rid);
+    if (!router || !(table = router->vr_route_export))
+        return;
+
+    if (req->rtr_family == AF_BRIDGE) {
+        if (!req->rtr_mac || req->rtr_mac_size != VR_ETHER_ALEN)
+            return;
+    } else if (!req->rtr_prefix || !req->rtr_prefix_size) {
+        return;
+    }
+
+    vr_route_export_key(&key, req);
+    key.re_nh_id = req->rtr_nh_id;
+    key.re_label = req->rtr_label;
+    key.re_label_flags = req->rtr_label_flags;
+
+    hdr = vr_route_export_header(table);
+    hdr->reh_gen++;
+    __sync_synchronize();
+
+    ent = vr_route_export_find(table, &key, !del);
+    if (del) {
+        if (ent) {
+            key.re_family = VR_ROUTE_EXPORT_DELETED;
+            vr_route_export_write(ent, &key);
+        }
+    } else if (ent) {
+        vr_route_export_write(ent, &key);
+    } else {
+        hdr->reh_overflows++;
+    }
+
+    __sync_synchronize();
+    hdr->reh_gen++;
+
+    return;
+}
+
+static void
+vr_route_export_reset(struct vrouter *router)
+{
+    unsigned int i;
+    struct vr_btable *table = router->vr_route_export;
+    struct vr_route_export_header *hdr;
+    struct vr_route_export_entry *ent;
+
+    if (!table)
+        return;
+
+    hdr = vr_route_export_header(table);
+    hdr->reh_gen++;
+    __sync_synchronize();
+
+    for (i = 1; i < vr_btable_entries(table); i++) {
+        ent = (struct vr_route_export_entry *)vr_btable_get(table, i);
+        if (ent->re_family == VR_ROUTE_EXPORT_FREE)
+            continue;
+
+        ent->re_seq++;
+        __sync_synchronize();
+        memset(ent, 0, VR_ROUTE_EXPORT_KEY_SIZE);
+        __sync_synchronize();
+        ent->re_seq++;
+    }
+    hdr->reh_overflows = 0;
+
+    __sync_synchronize();
+    hdr->reh_gen++;
+
+    return;
+}
+
+static void
+vr_route_export_exit(struct vrouter *router)
+{
+    if (router->vr_route_export) {
+        vr_btable_free(router->vr_route_export);
+        router->vr_route_export = NULL;
+    }
+
+    return;
+}
+
+static int
+vr_route_export_init(struct vrouter *router)
+{
+    unsigned int entries, per_page;
+    struct vr_route_export_header *hdr;
+
+    if (router->vr_route_export || !vr_route_export_entries)
+        return 0;
+
+    /* the header takes a slot, and mmap can not map a partial page */
+    per_page = VR_ROUTE_EXPORT_ALIGN / sizeof(struct vr_route_export_entry);
+    entries = vr_route_export_entries + 1;
+    entries = ((entries + per_page - 1) / per_page) * per_page;
+
+    router->vr_route_export = vr_btable_alloc(entries,
+            sizeof(struct vr_route_export_entry));
+    if (!router->vr_route_export)
+        return vr_module_error(-ENOMEM, __FUNCTION__, __LINE__, entries);
+
+    vr_hash_fn_init(&vr_route_export_hash);
+
+    hdr = vr_route_export_header(router->vr_route_export);
+    hdr->reh_entry_size = sizeof(struct vr_route_export_entry);
+    hdr->reh_entries = entries - 1;
+    hdr->reh_version = VR_ROUTE_EXPORT_VERSION;
+    __sync_synchronize();
+    hdr->reh_magic = VR_ROUTE_EXPORT_MAGIC;
+
+    return 0;
+}
+
+/*
+ * inet and inet6 share the route table and hence the algorithm, which is
+ * chosen at load time
+ */
+static void
+vr_inet_rtable_algo_select(void)
+{
+    unsigned int i;
+    struct rtable_fspec *fs;
+
+    for (i = 0; i < ARRAYSIZE(rtable_families); i++) {
+        fs = &rtable_families[i];
+        if ((fs->rtb_family != AF_INET) && (fs->rtb_family != AF_INET6))
+            continue;
+
+        switch (vr_inet_rtable_algo) {
+        case VR_INET_RTABLE_ALGO_PTRIE:
+            fs->algo_init = ptrie_algo_init;
+            fs->algo_deinit = ptrie_algo_deinit;
+            break;
+
+        default:
+            fs->algo_init = mtrie_algo_init;
+            fs->algo_deinit = mtrie_algo_deinit;
+            break;
+        }
+    }
+
+    return;
+}
+
 void
 vr_fib_exit(struct vrouter *router, bool soft_reset)
 {
@@ -573,6 +1080,13 @@ vr_fib_exit(struct vrouter *router, bool soft_reset)
         fs->rtb_family_deinit(fs, router, soft_reset);
     }
 
+    if (!soft_reset) {
+        vr_route_cache_exit();
+        vr_route_export_exit(router);
+    } else {
+        vr_route_export_reset(router);
+    }
+
     return;
 }
 
@@ -584,6 +1098,18 @@ vr_fib_init(struct vrouter *router)
     int size;
     struct rtable_fspec *fs;
 
+    vr_inet_rtable_algo_select();
+
+    ret = vr_route_cache_init();
+    if (ret)
+        return ret;
+
+    ret = vr_route_export_init(router);
+    if (ret) {
+        vr_route_cache_exit();
+        return ret;
+    }
+
     size = (int)ARRAYSIZE(rtable_families);
     for (i = 0; i < size; i++) {
         fs = &rtable_families[i];
@@ -604,6 +1130,9 @@ exit_init:
         fs->rtb_family_deinit(fs, router, false);
     }
 
+    vr_route_cache_exit();
+    vr_route_export_exit(router);
+
     return ret;
 }
 
@@ -7,6 +7,7 @@
 #include "vr_types.h"
 #include "vr_message.h"
 #include "vr_sandesh.h"
+#include "vr_flow.h"
 
 struct sandesh_object_md sandesh_md[] = {
     [VR_NULL_OBJECT_ID]         =   {
@@ -57,6 +58,13 @@ struct sandesh_object_md sandesh_md[] = {
         .obj_len                =       4 * sizeof(vr_vxlan_req),
         .obj_type_string        =       "vr_vxlan_req",
     },
+    [VR_FLOW_BULK_OBJECT_ID]     =   {
+        /* room for the per item index and result lists */
+        .obj_len                =       4 * sizeof(vr_flow_bulk_req) +
+                                        4 * VR_FLOW_BULK_MAX_ITEMS *
+                                        sizeof(int32_t),
+        .obj_type_string        =       "vr_flow_bulk_req",
+    },
 };
 
 static unsigned int
@@ -65,6 +65,8 @@ vr_drop_stats_fill_response(vr_drop_stats_req *response,
     response->vds_arp_no_route = stats->vds_arp_no_route;
     response->vds_l2_no_route = stats->vds_l2_no_route;
     response->vds_arp_reply_no_route = stats->vds_arp_reply_no_route;
+    response->vds_fragment_queue_fail = stats->vds_fragment_queue_fail;
+    response->vds_pkt_pool_exhausted = stats->vds_pkt_pool_exhausted;
 
     return;
 }
@@ -142,6 +144,10 @@ vr_drop_stats_get(void)
         stats->vds_l2_no_route += stats_block->vds_l2_no_route;
         stats->vds_arp_reply_no_route +=
             stats_block->vds_arp_reply_no_route;
+        stats->vds_fragment_queue_fail +=
+            stats_block->vds_fragment_queue_fail;
+        stats->vds_pkt_pool_exhausted +=
+            stats_block->vds_pkt_pool_exhausted;
     }
 
 
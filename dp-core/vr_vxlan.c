@@ -65,6 +65,9 @@ vr_vxlan_input(struct vrouter *router, struct vr_packet *pkt,
         fmd->fmd_dvrf = pkt->vp_if->vif_vrf;
     }
 
+    if (vr_burst_defer(router, pkt, nh, fmd))
+        return 0;
+
     return nh_output(pkt, nh, fmd);
 
 fail:
@@ -21,6 +21,7 @@
 #include <vr_packet.h>
 #include <vr_mirror.h>
 #include <vr_vxlan.h>
+#include <vr_datapath.h>
 
 static struct vrouter router;
 struct host_os *vrouter_host;
@@ -51,6 +52,11 @@ static struct vr_module modules[] = {
         .init           =       vr_stats_init,
         .exit           =       vr_stats_exit,
     },
+    {
+        .mod_name       =       "Datapath",
+        .init           =       vr_datapath_init,
+        .exit           =       vr_datapath_exit,
+    },
     {
         .mod_name       =       "Interface",
         .init           =       vr_interface_init,
@@ -112,6 +118,32 @@ int vr_perfs = 0;    /* segmentation in software */
  */
 int vr_mudp = 0;
 
+/*
+ * tunnel replicas of multicast share the packet data with the original.
+ * the shared data hangs off a new head as a frag list on linux, which a
+ * nic without NETIF_F_FRAGLIST has linearized (copied) at transmit, and
+ * hence this is off unless the nics are known to take frag lists
+ */
+int vr_mcast_split = 0;
+
+/*
+ * pick the ecmp member in the datapath, by a hash of the packet, when
+ * the agent has not picked one for the flow. the pick is written to the
+ * flow entry if vr_ecmp_flow_record is set
+ */
+int vr_ecmp_hash = 1;
+int vr_ecmp_flow_record = 0;
+
+/*
+ * flow, bridge and fragment tables hash with crc32-c when the cpu has it
+ * (which the platform finds out at load time) and vr_hash_crc32c is set
+ * at the time the table is created. it is not set by default, since the
+ * keys of these tables come from the VMs, and which keys collide under
+ * crc32-c does not depend on the seed
+ */
+unsigned int vr_hash_crc32c_supported = 0;
+int vr_hash_crc32c = 0;
+
 /*
  * TCP MSS adjust settings
  */
@@ -188,6 +220,13 @@ int vr_perfq3 = 0;   /* CPU to send packets to if vr_perfr3 is 1 */
 /* Should NIC perform checksum offload for outer UDP header? */
 int vr_udp_coff = 0;
 
+/*
+ * should tunneled gso packets be handed to the NIC (or to the gso of the
+ * stack) with the inner packet still to be segmented, instead of being
+ * segmented (or fragmented) by vrouter?
+ */
+int vr_tunnel_gso = 1;
+
 int
 vr_module_error(int error, const char *func,
         int line, int mod_specific)
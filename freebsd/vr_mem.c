@@ -56,11 +56,23 @@ int flowmmap(struct cdev *kdev, vm_ooffset_t offset, vm_paddr_t *paddr,
     int prot, vm_memattr_t *memattr)
 {
 	struct vrouter *router;
+	void *va;
 
 	/* Support only for one vrouter */
 	router = (struct vrouter *)vrouter_get(0);
 
-	*paddr = vtophys(vr_flow_get_va(router, offset));
+	if (offset >= VR_ROUTE_EXPORT_MMAP_OFFSET) {
+		/* the route export is for reading alone */
+		if (prot & VM_PROT_WRITE)
+			return (EACCES);
+		va = vr_route_export_get_va(router,
+		    offset - VR_ROUTE_EXPORT_MMAP_OFFSET);
+	} else
+		va = vr_flow_get_va(router, offset);
+	if (va == NULL)
+		return (EINVAL);
+
+	*paddr = vtophys(va);
 	return (0);
 }
 
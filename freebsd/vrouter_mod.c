@@ -331,11 +331,12 @@ fh_get_cpu(void)
 	return (cpuid);
 }
 
-static void
+static int
 fh_schedule_work(unsigned int cpu, void (*fn)(void *), void *arg)
 {
 
 	vr_log(VR_ERR, "%s: not implemented\n", __func__);
+	return (-1);
 }
 
 static void
@@ -666,6 +667,7 @@ struct host_os freebsd_host = {
 
 	.hos_get_cpu			= fh_get_cpu,
 	.hos_schedule_work		= fh_schedule_work,
+	.hos_schedule_process_work	= fh_schedule_work,
 	.hos_delay_op			= fh_delay_op,
 	.hos_defer			= fh_defer,
 	.hos_get_defer_data		= fh_get_defer_data,
@@ -3,7 +3,17 @@
  *
  * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
 
 #include "vr_os.h"
 #include "vr_packet.h"
@@ -39,15 +49,27 @@ struct hif_interface_md {
     },
 };
 
+/* per worker list of interfaces that have packets waiting for transmit */
+static struct vr_hinterface *hif_tx_pending[VR_HOST_IO_MAX_WORKERS];
+
 static void
-vr_netif_rx(struct vr_hinterface *hif, struct vr_hpacket *hpkt)
+vr_netif_rx(struct vr_hinterface *hif, struct vr_hpacket **hpkts,
+        unsigned int count)
 {
+    unsigned int i;
     struct vr_interface *vif = hif->hif_vif;
+    struct vr_packet *pkts[HIF_RX_BATCH];
 
-    if (vif)
-        vif->vif_rx(vif, &hpkt->hp_packet, VLAN_ID_INVALID);
-    else
-        vr_hpacket_pool_free(hpkt);
+    if (!vif) {
+        for (i = 0; i < count; i++)
+            vr_hpacket_free(hpkts[i]);
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+        pkts[i] = &hpkts[i]->hp_packet;
+
+    vif_rx_burst(vif, pkts, count, VLAN_ID_INVALID);
 
     return;
 }
@@ -55,53 +77,566 @@ vr_netif_rx(struct vr_hinterface *hif, struct vr_hpacket *hpkt)
 static int
 hif_udp_rx(void *arg)
 {
-    int ret = 0;
+    int ret;
+    unsigned int i, cpu, count = 0;
     struct vr_hinterface *hif = (struct vr_hinterface *)arg;
+    struct vr_hif_rxq *rxq = &hif->hif_rxq;
     struct vr_hpacket *hpkt;
     struct vr_packet *pkt;
 
-    hpkt = vr_hpacket_pool_alloc(hif->hif_pkt_pool);
-    if (!hpkt)
-        assert(!hpkt);
+    /*
+     * post as many buffers as the pool can give, upto a batch. whatever
+     * the datapath holds on to comes back to the pool later, and hence
+     * a short pool just means a smaller batch this time. a dry one would
+     * leave the socket readable and the worker spinning on it, and the
+     * packet at the head is hence dropped (and counted as such)
+     */
+    count = vr_hpacket_pool_alloc_bulk(hif->hif_pkt_pool, rxq->hrq_pkts,
+            HIF_RX_BATCH);
+    if (!count) {
+        if (recv(hif->hif_fd, NULL, 0, MSG_DONTWAIT | MSG_TRUNC) >= 0)
+            vr_hpacket_pool_exhausted(1);
+        return -ENOMEM;
+    }
 
-    ret = read(hif->hif_fd, hpkt_data(hpkt), hpkt_size(hpkt));
-    if (ret > 0) {
-        hpkt->hp_tail += ret;
+    for (i = 0; i < count; i++) {
+        hpkt = rxq->hrq_pkts[i];
+        rxq->hrq_iov[i].iov_base = hpkt_data(hpkt);
+        rxq->hrq_iov[i].iov_len = hpkt_size(hpkt) - hpkt->hp_data;
+        rxq->hrq_msgs[i].msg_hdr.msg_iov = &rxq->hrq_iov[i];
+        rxq->hrq_msgs[i].msg_hdr.msg_iovlen = 1;
+        rxq->hrq_msgs[i].msg_len = 0;
+    }
+
+    ret = recvmmsg(hif->hif_fd, rxq->hrq_msgs, count, MSG_DONTWAIT, NULL);
+    if (ret < 0)
+        ret = 0;
+
+    cpu = vr_get_cpu();
+    for (i = 0; i < (unsigned int)ret; i++) {
+        hpkt = rxq->hrq_pkts[i];
+        hpkt->hp_tail = hpkt->hp_data + rxq->hrq_msgs[i].msg_len;
         pkt = &hpkt->hp_packet;
-        pkt->vp_len = ret;
+        pkt->vp_len = rxq->hrq_msgs[i].msg_len;
         pkt->vp_tail = hpkt->hp_tail;
         pkt->vp_if = hif->hif_vif;
-        vr_netif_rx(hif, hpkt);
-    } else {
-        vr_hpacket_pool_free(hpkt);
+        pkt->vp_cpu = cpu;
     }
 
+    /* return the buffers that did not get filled */
+    vr_hpacket_pool_free_bulk(&rxq->hrq_pkts[ret], count - ret);
+
+    if (ret)
+        vr_netif_rx(hif, rxq->hrq_pkts, ret);
+
     return ret;
 }
 
+static void
+hif_tx_pend(struct vr_hinterface *hif, struct vr_hif_txq *txq,
+        unsigned int cpu)
+{
+    if (txq->htq_pending)
+        return;
+
+    txq->htq_pending = true;
+    txq->htq_next = hif_tx_pending[cpu];
+    hif_tx_pending[cpu] = hif;
+
+    return;
+}
+
+static void
+hif_udp_tx_flush(struct vr_hinterface *hif, struct vr_hif_txq *txq)
+{
+    int ret;
+    unsigned int i, sent = 0;
+
+    /* udp does not do partial datagrams. what could not be sent is lost */
+    while (sent < txq->htq_count) {
+        ret = sendmmsg(hif->hif_fd, &txq->htq_msgs[sent],
+                txq->htq_count - sent, 0);
+        if (ret <= 0)
+            break;
+        sent += ret;
+    }
+
+    for (i = 0; i < txq->htq_count; i++) {
+        vr_hpacket_free(txq->htq_pkts[i]);
+        txq->htq_pkts[i] = NULL;
+    }
+    txq->htq_count = 0;
+
+    return;
+}
+
+/* threads that are not workers have no queue, and send right away */
 static unsigned int
-hif_udp_tx(struct vr_hinterface *hif, struct vr_hpacket *hpkt)
+hif_udp_tx_now(struct vr_hinterface *hif, struct vr_hpacket *hpkt)
 {
-    int i = 0;
+    unsigned int i = 0;
+    struct vr_hpacket *hpkt_tmp;
+    struct vr_packet *pkt;
+    struct iovec msg_iov[HIF_TX_MAX_SEGS];
     struct msghdr msg;
-    struct vr_hpacket *hpkt_tmp = hpkt;
-    struct iovec msg_iov[64];
+
+    for (hpkt_tmp = hpkt; hpkt_tmp && i < HIF_TX_MAX_SEGS;
+            hpkt_tmp = hpkt_tmp->hp_next) {
+        pkt = &hpkt_tmp->hp_packet;
+        msg_iov[i].iov_base = pkt_data(pkt);
+        msg_iov[i].iov_len = pkt_head_len(pkt);
+        i++;
+    }
 
     bzero(&msg, sizeof(msg));
     msg.msg_iov = msg_iov;
-    while (hpkt_tmp && i < 64) {
-        msg_iov[i].iov_base = hpkt_data(hpkt);
-        msg_iov[i].iov_len = hpkt->hp_packet.vp_len;
+    msg.msg_iovlen = i;
+    (void)sendmsg(hif->hif_fd, &msg, 0);
+    vr_hpacket_free(hpkt);
+
+    return 0;
+}
+
+static unsigned int
+hif_udp_tx(struct vr_hinterface *hif, struct vr_hpacket *hpkt)
+{
+    unsigned int i = 0, cpu = vr_get_cpu();
+    struct vr_hif_txq *txq;
+    struct vr_hpacket *hpkt_tmp = hpkt;
+    struct vr_packet *pkt;
+    struct iovec *msg_iov;
+    struct msghdr *msg;
+
+    if (cpu >= vr_num_cpus)
+        return hif_udp_tx_now(hif, hpkt);
+
+    txq = &hif->hif_txq[cpu];
+    msg_iov = &txq->htq_iov[txq->htq_count * HIF_TX_MAX_SEGS];
+    while (hpkt_tmp && i < HIF_TX_MAX_SEGS) {
+        pkt = &hpkt_tmp->hp_packet;
+        msg_iov[i].iov_base = pkt_data(pkt);
+        msg_iov[i].iov_len = pkt_head_len(pkt);
         i++;
         hpkt_tmp = hpkt_tmp->hp_next;
     }
 
-    msg.msg_iovlen = i;
-    sendmsg(hif->hif_fd, &msg, 0);
+    msg = &txq->htq_msgs[txq->htq_count].msg_hdr;
+    bzero(msg, sizeof(*msg));
+    msg->msg_iov = msg_iov;
+    msg->msg_iovlen = i;
+    txq->htq_pkts[txq->htq_count++] = hpkt;
+
+    if (txq->htq_count == HIF_TX_BATCH)
+        hif_udp_tx_flush(hif, txq);
+    else
+        hif_tx_pend(hif, txq, cpu);
+
+    return 0;
+}
+
+/*
+ * HIF_TYPE_PACKET
+ *
+ * received packets are not copied. the vr_hpacket points into the frame
+ * of the rx block in which the kernel put the packet, and the block goes
+ * back to the kernel once the last of its packets is freed. transmit
+ * copies into a frame of the tx ring (af_packet rings are not shared
+ * between rx and tx) and the kernel is kicked once per batch
+ */
+#define HIF_RING_HDR_LEN    TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+
+/* users count first, so that the atomics on it are aligned */
+struct hif_ring_desc {
+    struct vr_hpacket_tail rd_tail;
+    unsigned int rd_block;
+    struct vr_hpacket rd_hpkt;
+};
+
+struct vr_hif_ring {
+    /* one for the interface, and one for every packet in the datapath */
+    int hr_refs;
+    unsigned char *hr_map;
+    size_t hr_map_size;
+
+    unsigned char *hr_rx_ring;
+    /* packets in the datapath + 1 while the block is being walked */
+    int hr_block_refs[HIF_RING_RX_BLOCKS];
+    unsigned int hr_rx_block;
+    unsigned int hr_rx_pkt;
+    struct tpacket3_hdr *hr_rx_next;
+    struct vr_hpacket_pool hr_desc_pool;
+    struct hif_ring_desc *hr_descs;
+
+    pthread_mutex_t hr_tx_lock;
+    unsigned char *hr_tx_ring;
+    unsigned int hr_tx_frames;
+    unsigned int hr_tx_head;
+};
+
+static void
+hif_ring_free(struct vr_hif_ring *ring)
+{
+    if (ring->hr_map)
+        munmap(ring->hr_map, ring->hr_map_size);
+    if (ring->hr_descs)
+        free(ring->hr_descs);
+    vr_hpacket_pool_fini(&ring->hr_desc_pool);
+    free(ring);
+
+    return;
+}
+
+static void
+hif_ring_put(struct vr_hif_ring *ring)
+{
+    if (!__sync_sub_and_fetch(&ring->hr_refs, 1))
+        hif_ring_free(ring);
+
+    return;
+}
+
+static struct tpacket_block_desc *
+hif_ring_block(struct vr_hif_ring *ring, unsigned int block)
+{
+    return (struct tpacket_block_desc *)(ring->hr_rx_ring +
+            (block * HIF_RING_BLOCK_SIZE));
+}
+
+static void
+hif_ring_block_put(struct vr_hif_ring *ring, unsigned int block)
+{
+    struct tpacket_block_desc *bd;
+
+    if (__sync_sub_and_fetch(&ring->hr_block_refs[block], 1))
+        return;
+
+    bd = hif_ring_block(ring, block);
+    __sync_synchronize();
+    bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+    return;
+}
+
+/* pool_release of the descriptor pool */
+static void
+hif_ring_release(struct vr_hpacket *hpkt)
+{
+    unsigned int block;
+    unsigned char *tail;
+    struct vr_hpacket_pool *pool = hpkt->hp_pool;
+    struct vr_hif_ring *ring;
+    struct hif_ring_desc *desc;
+
+    ring = CONTAINER_OF(hr_desc_pool, struct vr_hif_ring, pool);
+    /*
+     * a clone can be the last user, and hence the lookup by the tail. the
+     * tail is packed, and is hence walked back from as a plain address
+     */
+    tail = (unsigned char *)hpkt_get_tail(hpkt);
+    desc = (struct hif_ring_desc *)(tail -
+            offsetof(struct hif_ring_desc, rd_tail));
+    block = desc->rd_block;
+
+    desc->rd_tail.hp_users = 1;
+    desc->rd_hpkt.hp_next = NULL;
+    desc->rd_hpkt.hp_flags = VR_HPACKET_FLAGS_RING;
+    vr_hpacket_pool_free(&desc->rd_hpkt);
+
+    hif_ring_block_put(ring, block);
+    hif_ring_put(ring);
+
+    return;
+}
+
+static int
+hif_ring_rx(void *arg)
+{
+    int received = 0;
+    unsigned int cpu, count = 0, data_off;
+    struct vr_hinterface *hif = (struct vr_hinterface *)arg;
+    struct vr_hif_ring *ring = hif->hif_ring;
+    struct vr_hpacket *hpkts[HIF_RX_BATCH], *hpkt;
+    struct vr_packet *pkt;
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *ph;
+    struct sockaddr_ll *sll;
+
+    cpu = vr_get_cpu();
+    while (true) {
+        bd = hif_ring_block(ring, ring->hr_rx_block);
+        if (!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+            break;
+        __sync_synchronize();
+
+        if (!ring->hr_rx_next) {
+            ring->hr_block_refs[ring->hr_rx_block] = 1;
+            ring->hr_rx_pkt = 0;
+            ring->hr_rx_next = (struct tpacket3_hdr *)((unsigned char *)bd +
+                    bd->hdr.bh1.offset_to_first_pkt);
+        }
+
+        while (ring->hr_rx_pkt < bd->hdr.bh1.num_pkts) {
+            ph = ring->hr_rx_next;
+            sll = (struct sockaddr_ll *)((unsigned char *)ph +
+                    HIF_RING_HDR_LEN);
+            if (sll->sll_pkttype != PACKET_OUTGOING) {
+                /* out of descriptors. continue from here the next time */
+                hpkt = vr_hpacket_pool_alloc(&ring->hr_desc_pool);
+                if (!hpkt)
+                    goto flush;
+
+                data_off = ph->tp_mac - HIF_RING_HDR_LEN;
+                hpkt->hp_head = (unsigned char *)ph + HIF_RING_HDR_LEN;
+                hpkt->hp_data = data_off;
+                hpkt->hp_tail = hpkt->hp_end = data_off + ph->tp_snaplen;
+                hpkt->hp_len = ph->tp_snaplen;
+                CONTAINER_OF(rd_hpkt, struct hif_ring_desc, hpkt)->rd_block =
+                    ring->hr_rx_block;
+
+                pkt = &hpkt->hp_packet;
+                pkt->vp_head = hpkt->hp_head;
+                pkt->vp_data = hpkt->hp_data;
+                pkt->vp_tail = hpkt->hp_tail;
+                pkt->vp_end = hpkt->hp_end;
+                pkt->vp_len = ph->tp_snaplen;
+                pkt->vp_flags = 0;
+                pkt->vp_if = hif->hif_vif;
+                pkt->vp_cpu = cpu;
+
+                __sync_add_and_fetch(&ring->hr_block_refs[ring->hr_rx_block], 1);
+                __sync_add_and_fetch(&ring->hr_refs, 1);
+
+                hpkts[count++] = hpkt;
+                received++;
+                if (count == HIF_RX_BATCH) {
+                    vr_netif_rx(hif, hpkts, count);
+                    count = 0;
+                }
+            }
+
+            ring->hr_rx_pkt++;
+            ring->hr_rx_next = (struct tpacket3_hdr *)((unsigned char *)ph +
+                    ph->tp_next_offset);
+        }
+
+        /* done with the block. it is for the packets to give it back now */
+        ring->hr_rx_next = NULL;
+        hif_ring_block_put(ring, ring->hr_rx_block);
+        ring->hr_rx_block = (ring->hr_rx_block + 1) % HIF_RING_RX_BLOCKS;
+    }
+
+flush:
+    if (count)
+        vr_netif_rx(hif, hpkts, count);
+
+    return received;
+}
+
+static void
+hif_ring_tx_kick(struct vr_hinterface *hif, struct vr_hif_txq *txq)
+{
+    send(hif->hif_fd, NULL, 0, MSG_DONTWAIT);
+    if (txq)
+        txq->htq_count = 0;
+
+    return;
+}
+
+static unsigned int
+hif_ring_tx(struct vr_hinterface *hif, struct vr_hpacket *hpkt)
+{
+    bool drop = true;
+    unsigned int len = 0, seg_len, cpu = vr_get_cpu();
+    unsigned char *data;
+    struct vr_hif_ring *ring = hif->hif_ring;
+    struct vr_hif_txq *txq = NULL;
+    struct vr_hpacket *hpkt_tmp;
+    struct vr_packet *pkt;
+    struct tpacket3_hdr *ph;
+
+    /* threads that are not workers kick the kernel for every frame */
+    if (cpu < vr_num_cpus)
+        txq = &hif->hif_txq[cpu];
+
+    pthread_mutex_lock(&ring->hr_tx_lock);
+    ph = (struct tpacket3_hdr *)(ring->hr_tx_ring +
+            (ring->hr_tx_head * HIF_RING_FRAME_SIZE));
+    /*
+     * ring is full. the kernel has not caught up with what we posted, and
+     * it is not going to unless it is told about the frames that are still
+     * waiting for the end of the round
+     */
+    if (ph->tp_status != TP_STATUS_AVAILABLE) {
+        hif_ring_tx_kick(hif, txq);
+        goto exit_tx;
+    }
+
+    data = (unsigned char *)ph + HIF_RING_HDR_LEN;
+    for (hpkt_tmp = hpkt; hpkt_tmp; hpkt_tmp = hpkt_tmp->hp_next) {
+        pkt = &hpkt_tmp->hp_packet;
+        seg_len = pkt_head_len(pkt);
+        /* does not fit in a frame */
+        if (len + seg_len > HIF_RING_FRAME_SIZE - HIF_RING_HDR_LEN)
+            goto exit_tx;
+
+        memcpy(data + len, pkt_data(pkt), seg_len);
+        len += seg_len;
+    }
+
+    ph->tp_len = ph->tp_snaplen = len;
+    ph->tp_next_offset = 0;
+    __sync_synchronize();
+    ph->tp_status = TP_STATUS_SEND_REQUEST;
+    ring->hr_tx_head = (ring->hr_tx_head + 1) % ring->hr_tx_frames;
+    drop = false;
+
+    if (!txq || (++txq->htq_count == HIF_TX_BATCH))
+        hif_ring_tx_kick(hif, txq);
+    else
+        hif_tx_pend(hif, txq, cpu);
+
+exit_tx:
+    pthread_mutex_unlock(&ring->hr_tx_lock);
+    if (drop && hif->hif_vif) {
+        vif_drop_pkt(hif->hif_vif, &hpkt->hp_packet, false);
+        return 0;
+    }
+
     vr_hpacket_free(hpkt);
+
     return 0;
 }
 
+static void
+hif_tx_flush(struct vr_hinterface *hif, struct vr_hif_txq *txq)
+{
+    if (hif->hif_type == HIF_TYPE_PACKET)
+        hif_ring_tx_kick(hif, txq);
+    else
+        hif_udp_tx_flush(hif, txq);
+
+    return;
+}
+
+/*
+ * called by a worker at the end of every round of its io loop, so that
+ * packets do not sit in the transmit queues for longer than one round
+ */
+void
+vr_hinterface_tx_flush(void)
+{
+    unsigned int cpu = vr_get_cpu();
+    struct vr_hinterface *hif;
+    struct vr_hif_txq *txq;
+
+    while ((hif = hif_tx_pending[cpu])) {
+        txq = &hif->hif_txq[cpu];
+        hif_tx_pending[cpu] = txq->htq_next;
+        txq->htq_next = NULL;
+        txq->htq_pending = false;
+        if (txq->htq_count)
+            hif_tx_flush(hif, txq);
+    }
+
+    return;
+}
+
+/*
+ * only the interface owner tears it down, after the io workers have
+ * let go of it. whatever is still queued on behalf of the other workers
+ * is sent from here
+ */
+static void
+hif_queues_destroy(struct vr_hinterface *hif)
+{
+    unsigned int cpu;
+    struct vr_hinterface **prev;
+    struct vr_hif_txq *txq;
+
+    if (hif->hif_txq) {
+        for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+            txq = &hif->hif_txq[cpu];
+            if (txq->htq_pending) {
+                for (prev = &hif_tx_pending[cpu]; *prev;
+                        prev = &(*prev)->hif_txq[cpu].htq_next) {
+                    if (*prev == hif) {
+                        *prev = txq->htq_next;
+                        break;
+                    }
+                }
+                txq->htq_pending = false;
+            }
+
+            if (txq->htq_count)
+                hif_tx_flush(hif, txq);
+
+            if (txq->htq_msgs)
+                free(txq->htq_msgs);
+            if (txq->htq_iov)
+                free(txq->htq_iov);
+        }
+
+        free(hif->hif_txq);
+        hif->hif_txq = NULL;
+    }
+
+    if (hif->hif_rxq.hrq_msgs) {
+        free(hif->hif_rxq.hrq_msgs);
+        hif->hif_rxq.hrq_msgs = NULL;
+    }
+
+    if (hif->hif_rxq.hrq_iov) {
+        free(hif->hif_rxq.hrq_iov);
+        hif->hif_rxq.hrq_iov = NULL;
+    }
+
+    return;
+}
+
+/*
+ * queues of ring interfaces need only the pending state, since the
+ * packets go straight into the tx ring
+ */
+static int
+hif_queues_init(struct vr_hinterface *hif, bool mmsg)
+{
+    unsigned int cpu;
+    struct vr_hif_txq *txq;
+
+    hif->hif_txq = calloc(vr_num_cpus, sizeof(struct vr_hif_txq));
+    if (!hif->hif_txq)
+        goto cleanup;
+
+    if (!mmsg)
+        return 0;
+
+    hif->hif_rxq.hrq_msgs = calloc(HIF_RX_BATCH, sizeof(struct mmsghdr));
+    if (!hif->hif_rxq.hrq_msgs)
+        goto cleanup;
+
+    hif->hif_rxq.hrq_iov = calloc(HIF_RX_BATCH, sizeof(struct iovec));
+    if (!hif->hif_rxq.hrq_iov)
+        goto cleanup;
+
+    for (cpu = 0; cpu < vr_num_cpus; cpu++) {
+        txq = &hif->hif_txq[cpu];
+        txq->htq_msgs = calloc(HIF_TX_BATCH, sizeof(struct mmsghdr));
+        if (!txq->htq_msgs)
+            goto cleanup;
+
+        txq->htq_iov = calloc(HIF_TX_BATCH * HIF_TX_MAX_SEGS,
+                sizeof(struct iovec));
+        if (!txq->htq_iov)
+            goto cleanup;
+    }
+
+    return 0;
+
+cleanup:
+    hif_queues_destroy(hif);
+    return -ENOMEM;
+}
+
 int
 vr_hif_udp_create(struct vr_hinterface *hif, unsigned int vif_type)
 {
@@ -137,12 +672,18 @@ vr_hif_udp_create(struct vr_hinterface *hif, unsigned int vif_type)
         goto cleanup;
 
     hif_info->hif_num_ports++;
+    hif->hif_type = HIF_TYPE_UDP;
     hif->hif_vif_type = vif_type;
     hif->hif_fd = sock;
     hif->hif_tx = hif_udp_tx;
     hif->hif_rx = hif_udp_rx;
-    hif->hif_pkt_pool = vr_hpacket_pool_create(100, 2000);
-    if (!hif->hif_pkt_pool)
+    hif->hif_pkt_pool = vr_hpacket_pool_create(HIF_PKT_POOL_SIZE,
+            HIF_PKT_SIZE);
+    if (!hif->hif_pkt_pool && (ret = -ENOMEM))
+        goto cleanup;
+
+    ret = hif_queues_init(hif, true);
+    if (ret)
         goto cleanup;
 
     ret = vr_host_io_register(hif->hif_fd, hif_udp_rx, hif);
@@ -154,9 +695,12 @@ cleanup:
     if (sock >= 0)
         close(sock);
 
-    if (hif && hif->hif_pkt_pool) {
-        vr_hpacket_pool_destroy(hif->hif_pkt_pool);
-        hif->hif_pkt_pool = NULL;
+    if (hif) {
+        hif_queues_destroy(hif);
+        if (hif->hif_pkt_pool) {
+            vr_hpacket_pool_destroy(hif->hif_pkt_pool);
+            hif->hif_pkt_pool = NULL;
+        }
     }
 
     return ret;
@@ -168,6 +712,7 @@ vr_hif_udp_destroy(struct vr_hinterface *hif)
     struct hif_interface_md *hif_info;
 
     vr_host_io_unregister(hif->hif_fd);
+    hif_queues_destroy(hif);
 
     hif_info = &hif_interface_info[hif->hif_vif_type];
     hif_info->hif_num_ports--;
@@ -178,9 +723,170 @@ vr_hif_udp_destroy(struct vr_hinterface *hif)
     return;
 }
 
+static int
+hif_ring_setup(int sock, struct vr_hif_ring *ring)
+{
+    int ret, val;
+    unsigned int i, descs;
+    struct tpacket_req3 req;
+
+    val = TPACKET_V3;
+    ret = setsockopt(sock, SOL_PACKET, PACKET_VERSION, &val, sizeof(val));
+    if (ret < 0)
+        return -errno;
+
+    /* head room for the headers that the datapath pushes */
+    val = VR_HPACKET_HEAD_SPACE;
+    ret = setsockopt(sock, SOL_PACKET, PACKET_RESERVE, &val, sizeof(val));
+    if (ret < 0)
+        return -errno;
+
+#ifdef PACKET_QDISC_BYPASS
+    val = 1;
+    setsockopt(sock, SOL_PACKET, PACKET_QDISC_BYPASS, &val, sizeof(val));
+#endif
+
+    bzero(&req, sizeof(req));
+    req.tp_block_size = HIF_RING_BLOCK_SIZE;
+    req.tp_block_nr = HIF_RING_RX_BLOCKS;
+    req.tp_frame_size = HIF_RING_FRAME_SIZE;
+    req.tp_frame_nr = (HIF_RING_BLOCK_SIZE / HIF_RING_FRAME_SIZE) *
+        HIF_RING_RX_BLOCKS;
+    req.tp_retire_blk_tov = HIF_RING_BLOCK_TIMEOUT;
+    ret = setsockopt(sock, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+    if (ret < 0)
+        return -errno;
+
+    req.tp_block_nr = HIF_RING_TX_BLOCKS;
+    req.tp_frame_nr = (HIF_RING_BLOCK_SIZE / HIF_RING_FRAME_SIZE) *
+        HIF_RING_TX_BLOCKS;
+    req.tp_retire_blk_tov = 0;
+    ret = setsockopt(sock, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req));
+    if (ret < 0)
+        return -errno;
+
+    /* the tx ring follows the rx ring in the mapping */
+    ring->hr_map_size = (HIF_RING_RX_BLOCKS + HIF_RING_TX_BLOCKS) *
+        HIF_RING_BLOCK_SIZE;
+    ring->hr_map = mmap(NULL, ring->hr_map_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, sock, 0);
+    if (ring->hr_map == MAP_FAILED) {
+        ring->hr_map = NULL;
+        return -errno;
+    }
+
+    ring->hr_rx_ring = ring->hr_map;
+    ring->hr_tx_ring = ring->hr_map +
+        (HIF_RING_RX_BLOCKS * HIF_RING_BLOCK_SIZE);
+    ring->hr_tx_frames = req.tp_frame_nr;
+
+    descs = vr_hpacket_pool_size(HIF_RING_RX_DESCS);
+    ring->hr_descs = calloc(descs, sizeof(struct hif_ring_desc));
+    if (!ring->hr_descs)
+        return -ENOMEM;
+
+    ret = vr_hpacket_pool_init(&ring->hr_desc_pool, descs);
+    if (ret)
+        return ret;
+
+    ring->hr_desc_pool.pool_release = hif_ring_release;
+    for (i = 0; i < descs; i++) {
+        ring->hr_descs[i].rd_hpkt.hp_flags = VR_HPACKET_FLAGS_RING;
+        ring->hr_descs[i].rd_hpkt.hp_ring_tail = &ring->hr_descs[i].rd_tail;
+        ring->hr_descs[i].rd_hpkt.hp_pool = &ring->hr_desc_pool;
+        vr_hpacket_pool_free(&ring->hr_descs[i].rd_hpkt);
+    }
+
+    return 0;
+}
+
+static int
+vr_hif_ring_create(struct vr_hinterface *hif, unsigned int vif_type,
+        const char *dev)
+{
+    int sock = -1, ret;
+    unsigned int ifindex;
+    struct vr_hif_ring *ring = NULL;
+    struct sockaddr_ll sll;
+
+    if (vif_type >= VIF_TYPE_MAX)
+        return -EINVAL;
+
+    if (!dev)
+        return -EINVAL;
+
+    ifindex = if_nametoindex(dev);
+    if (!ifindex)
+        return -ENODEV;
+
+    ring = calloc(sizeof(*ring), 1);
+    if (!ring)
+        return -ENOMEM;
+    ring->hr_refs = 1;
+    pthread_mutex_init(&ring->hr_tx_lock, NULL);
+
+    sock = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (sock < 0 && (ret = -errno))
+        goto cleanup;
+
+    ret = hif_ring_setup(sock, ring);
+    if (ret)
+        goto cleanup;
+
+    bzero(&sll, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ifindex;
+    ret = bind(sock, (const struct sockaddr *)&sll, sizeof(sll));
+    if (ret < 0 && (ret = -errno))
+        goto cleanup;
+
+    hif->hif_type = HIF_TYPE_PACKET;
+    hif->hif_vif_type = vif_type;
+    hif->hif_fd = sock;
+    hif->hif_ring = ring;
+    hif->hif_tx = hif_ring_tx;
+    hif->hif_rx = hif_ring_rx;
+
+    ret = hif_queues_init(hif, false);
+    if (ret)
+        goto cleanup;
+
+    ret = vr_host_io_register(hif->hif_fd, hif_ring_rx, hif);
+    if (ret < 0)
+        goto cleanup;
+
+    return 0;
+
+cleanup:
+    hif_queues_destroy(hif);
+    hif->hif_ring = NULL;
+
+    if (sock >= 0)
+        close(sock);
+
+    hif_ring_free(ring);
+
+    return ret;
+}
+
+static void
+vr_hif_ring_destroy(struct vr_hinterface *hif)
+{
+    vr_host_io_unregister(hif->hif_fd);
+    hif_queues_destroy(hif);
+
+    /* packets still in the datapath keep the ring mapped */
+    close(hif->hif_fd);
+    hif_ring_put(hif->hif_ring);
+    free(hif);
+
+    return;
+}
+
 struct vr_hinterface *
-vr_hinterface_create(unsigned int index, unsigned int hif_type,
-        unsigned int vif_type)
+vr_hinterface_create_dev(unsigned int index, unsigned int hif_type,
+        unsigned int vif_type, const char *dev)
 {
     int ret;
     struct vr_hinterface *hif;
@@ -203,6 +909,13 @@ vr_hinterface_create(unsigned int index, unsigned int hif_type,
 
         break;
 
+    case HIF_TYPE_PACKET:
+        ret = vr_hif_ring_create(hif, vif_type, dev);
+        if (ret)
+            goto cleanup;
+
+        break;
+
     default:
         goto cleanup;
     }
@@ -220,6 +933,13 @@ cleanup:
     return NULL;
 }
 
+struct vr_hinterface *
+vr_hinterface_create(unsigned int index, unsigned int hif_type,
+        unsigned int vif_type)
+{
+    return vr_hinterface_create_dev(index, hif_type, vif_type, NULL);
+}
+
 void
 vr_hinterface_destroy(struct vr_hinterface *hif)
 {
@@ -228,6 +948,10 @@ vr_hinterface_destroy(struct vr_hinterface *hif)
         vr_hif_udp_destroy(hif);
         break;
 
+    case HIF_TYPE_PACKET:
+        vr_hif_ring_destroy(hif);
+        break;
+
     default:
         assert(0);
         break;
@@ -1,24 +1,63 @@
 /*
- * vr_host_io.c -- simplistic io scheduler
+ * vr_host_io.c -- io scheduler
  *
  * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
  */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <string.h>
-#include <poll.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
 
-#define VR_MAX_IO_CBS      256
+#include "host/vr_host.h"
 
+void vr_hinterface_tx_flush(void);
+
+extern unsigned int vr_num_cpus;
+
+#define VR_MAX_IO_CBS               256
+#define VR_IO_MAX_EVENTS            64
+
+/*
+ * every worker is a thread with an epoll set of its own. an fd is owned
+ * by exactly one worker, which is the only one that runs its callback.
+ * the worker id is what the datapath sees as the cpu
+ */
 struct vr_io_cb {
     int io_fd;
+    unsigned int io_worker;
     int (*io_process)(void *);
     void *io_arg;
 } vr_io_cbs[VR_MAX_IO_CBS];
 
-unsigned int pollfd_to_cb[VR_MAX_IO_CBS];
-struct pollfd vr_io_pollfds[VR_MAX_IO_CBS];
-unsigned int vr_io_n_pollfds;
+struct vr_io_worker {
+    int vw_epoll_fd;
+    unsigned int vw_id;
+    unsigned int vw_num_fds;
+    /* for vr_host_io_quiesce */
+    volatile unsigned long vw_rounds;
+    volatile bool vw_waiting;
+    pthread_t vw_thread;
+};
+
+unsigned int vr_host_io_num_workers = 1;
+static struct vr_io_worker vr_io_workers[VR_HOST_IO_MAX_WORKERS];
+/* workers that vr_host_io_init set up. none, when the library is used alone */
+static unsigned int vr_io_workers_ready;
+static pthread_mutex_t vr_io_lock = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * threads that are not workers (the agent channel, timers, the caller of
+ * vr_host_io_init before it turns worker) have no per cpu state of their
+ * own, and go by an id that no worker has
+ */
+static __thread unsigned int vr_io_worker_id = VR_HOST_IO_MAX_WORKERS;
+/* the worker that the thread is, if it is one */
+static __thread struct vr_io_worker *vr_io_self;
 
 void
 vhost_remove_xconnect(void)
@@ -26,29 +65,42 @@ vhost_remove_xconnect(void)
     return;
 }
 
+unsigned int
+vr_host_io_worker_id(void)
+{
+    /* without workers, the thread that uses the library is the datapath */
+    if (!vr_io_workers_ready)
+        return 0;
+
+    return vr_io_worker_id;
+}
+
 void
-vr_host_io_unregister(int fd)
+vr_host_io_unregister(unsigned int fd)
 {
     int i;
-    struct pollfd *pfd;
+    struct vr_io_cb *io_cb;
+    struct vr_io_worker *worker;
 
+    pthread_mutex_lock(&vr_io_lock);
     for (i = 0; i < VR_MAX_IO_CBS; i++) {
-        pfd = &vr_io_pollfds[i];
-        if (pfd->fd == fd) {
-            memcpy((char *)pfd, (char *)(pfd + 1),
-                    (vr_io_n_pollfds - (i + 1)) * sizeof(struct pollfd));
-            memcpy((char *)&pollfd_to_cb[i], (char *)&pollfd_to_cb[i + 1],
-                        (vr_io_n_pollfds - (i + 1)) * sizeof(unsigned int));
-
-            vr_io_n_pollfds--;
-
-            bzero((char *)&pollfd_to_cb[vr_io_n_pollfds],
-                    (VR_MAX_IO_CBS - vr_io_n_pollfds) * sizeof(unsigned int));
-            bzero((char *)&vr_io_pollfds[vr_io_n_pollfds],
-                    (VR_MAX_IO_CBS - vr_io_n_pollfds) * sizeof(struct pollfd));
+        io_cb = &vr_io_cbs[i];
+        if (io_cb->io_fd == (int)fd) {
+            worker = &vr_io_workers[io_cb->io_worker];
+            epoll_ctl(worker->vw_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            worker->vw_num_fds--;
+            io_cb->io_fd = -1;
             break;
         }
     }
+    pthread_mutex_unlock(&vr_io_lock);
+
+    /*
+     * the owner could be in the middle of processing events that it got
+     * for the fd. make sure it is done before the caller frees the arg
+     */
+    if (i < VR_MAX_IO_CBS)
+        vr_host_io_quiesce();
 
     return;
 }
@@ -56,74 +108,219 @@ vr_host_io_unregister(int fd)
 int
 vr_host_io_register(unsigned int fd, int (*cb)(void *), void *arg)
 {
-    int i;
-    struct vr_io_cb *io_cb;
-    struct pollfd *pfd;
-
-    if (vr_io_n_pollfds >= VR_MAX_IO_CBS)
-        return -ENOSPC;
+    int i, ret;
+    unsigned int w, owner = 0;
+    struct vr_io_cb *io_cb = NULL;
+    struct vr_io_worker *worker;
+    struct epoll_event event;
 
+    pthread_mutex_lock(&vr_io_lock);
     for (i = 0; i < VR_MAX_IO_CBS; i++) {
-        io_cb = &vr_io_cbs[i];
-        if (io_cb->io_fd < 0) {
-            io_cb->io_fd = fd;
-            io_cb->io_process = cb;
-            io_cb->io_arg = arg;
-            pollfd_to_cb[vr_io_n_pollfds] = i;
+        if (vr_io_cbs[i].io_fd < 0) {
+            io_cb = &vr_io_cbs[i];
             break;
         }
     }
 
-    if (i == VR_MAX_IO_CBS)
-        return -ENOSPC;
+    if (!io_cb && (ret = -ENOSPC))
+        goto exit_register;
 
-    /* setup the pollfd */
-    pfd = &vr_io_pollfds[vr_io_n_pollfds++];
-    pfd->fd = fd;
-    pfd->events = POLLIN;
-    pfd->revents = 0;
+    /* the least loaded worker gets the fd */
+    for (w = 1; w < vr_host_io_num_workers; w++) {
+        if (vr_io_workers[w].vw_num_fds < vr_io_workers[owner].vw_num_fds)
+            owner = w;
+    }
+    worker = &vr_io_workers[owner];
 
-    return 0;
+    io_cb->io_worker = owner;
+    io_cb->io_process = cb;
+    io_cb->io_arg = arg;
+
+    bzero(&event, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = io_cb;
+    ret = epoll_ctl(worker->vw_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    if (ret < 0 && (ret = -errno))
+        goto exit_register;
+
+    io_cb->io_fd = fd;
+    worker->vw_num_fds++;
+
+exit_register:
+    pthread_mutex_unlock(&vr_io_lock);
+    return ret;
+}
+
+/*
+ * wait till every other worker has either finished the round that it
+ * was in, or is blocked waiting for events. after this, no worker holds
+ * a reference to anything that was unlinked before the call.
+ *
+ * the caller holds no such references either, and is hence as good as
+ * waiting while it is in here. were it not, two workers that quiesce at
+ * the same time would wait for each other forever. without an io loop
+ * (vr_host_io_init not called) there is no one to wait for
+ */
+void
+vr_host_io_quiesce(void)
+{
+    unsigned int i;
+    unsigned long rounds[VR_HOST_IO_MAX_WORKERS];
+    struct vr_io_worker *worker, *self = vr_io_self;
+
+    if (self) {
+        self->vw_waiting = true;
+        __sync_synchronize();
+    }
+
+    for (i = 0; i < vr_io_workers_ready; i++)
+        rounds[i] = vr_io_workers[i].vw_rounds;
+
+    for (i = 0; i < vr_io_workers_ready; i++) {
+        worker = &vr_io_workers[i];
+        if (worker == self)
+            continue;
+
+        while (!worker->vw_waiting && worker->vw_rounds == rounds[i])
+            sched_yield();
+    }
+
+    if (self) {
+        self->vw_waiting = false;
+        __sync_synchronize();
+    }
+
+    return;
+}
+
+static void
+vr_host_io_worker_pin(struct vr_io_worker *worker)
+{
+    long ncpus;
+    cpu_set_t cpus;
+
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus <= 0)
+        return;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->vw_id % ncpus, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    return;
+}
+
+static void *
+vr_host_io_worker(void *arg)
+{
+    int i, ret;
+    struct vr_io_worker *worker = (struct vr_io_worker *)arg;
+    struct vr_io_cb *io_cb;
+    struct epoll_event events[VR_IO_MAX_EVENTS];
+
+    vr_io_worker_id = worker->vw_id;
+    vr_io_self = worker;
+    vr_host_io_worker_pin(worker);
+
+    /*
+     * a worker can be cancelled only while it waits for events, and never
+     * in the middle of a callback
+     */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    while (true) {
+        worker->vw_waiting = true;
+        __sync_synchronize();
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        ret = epoll_wait(worker->vw_epoll_fd, events, VR_IO_MAX_EVENTS, -1);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        worker->vw_waiting = false;
+        __sync_synchronize();
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (i = 0; i < ret; i++) {
+            io_cb = (struct vr_io_cb *)events[i].data.ptr;
+            if (io_cb->io_fd < 0)
+                continue;
+
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                io_cb->io_process(io_cb->io_arg);
+        }
+
+        /* whatever the callbacks queued for transmit goes out now */
+        vr_hinterface_tx_flush();
+        worker->vw_rounds++;
+    }
+
+    return NULL;
 }
 
 int
 vr_host_io_init(void)
 {
-    int i;
-    struct vr_io_cb *io_cb;
+    int ret;
+    unsigned int i;
+    struct vr_io_worker *worker;
 
-    for (i = 0; i < VR_MAX_IO_CBS; i++) {
-        io_cb = &vr_io_cbs[i];
-        io_cb->io_fd  = -1;
+    if (!vr_host_io_num_workers)
+        vr_host_io_num_workers = 1;
+    if (vr_host_io_num_workers > VR_HOST_IO_MAX_WORKERS)
+        vr_host_io_num_workers = VR_HOST_IO_MAX_WORKERS;
+
+    for (i = 0; i < VR_MAX_IO_CBS; i++)
+        vr_io_cbs[i].io_fd = -1;
+
+    for (i = 0; i < vr_host_io_num_workers; i++) {
+        worker = &vr_io_workers[i];
+        worker->vw_id = i;
+        /* till it starts, a worker has nothing that it can hold on to */
+        worker->vw_waiting = true;
+        worker->vw_epoll_fd = epoll_create1(0);
+        if (worker->vw_epoll_fd < 0 && (ret = -errno))
+            goto cleanup;
     }
 
+    /* per cpu structures of the datapath are per worker */
+    vr_num_cpus = vr_host_io_num_workers;
+    vr_io_workers_ready = vr_host_io_num_workers;
+
     return 0;
+
+cleanup:
+    while (i--)
+        close(vr_io_workers[i].vw_epoll_fd);
+
+    return ret;
 }
 
 int
 vr_host_io(void)
 {
-    int ret, processed = 0;
+    int ret;
     unsigned int i;
-    struct pollfd *p_pfd;
-    struct vr_io_cb *io_cb;
-
-    while (true) {
-        ret = poll(vr_io_pollfds, vr_io_n_pollfds, -1);
-        if (ret < 0)
-            return ret;
-
-        for (i = 0; i < vr_io_n_pollfds; i++) {
-            p_pfd = &vr_io_pollfds[i];
-            if (p_pfd->revents & POLLIN) {
-                io_cb = &vr_io_cbs[pollfd_to_cb[i]];
-                io_cb->io_process(io_cb->io_arg);
-            }
 
-            if (++processed == ret)
-                break;
-        }
+    for (i = 1; i < vr_host_io_num_workers; i++) {
+        ret = pthread_create(&vr_io_workers[i].vw_thread, NULL,
+                vr_host_io_worker, &vr_io_workers[i]);
+        if (ret)
+            goto cleanup;
     }
 
+    /* the calling thread is worker 0 */
+    vr_io_workers[0].vw_thread = pthread_self();
+    vr_host_io_worker(&vr_io_workers[0]);
+
     return 0;
+
+cleanup:
+    /* stop the workers that did start, which are waiting for events */
+    while (--i) {
+        pthread_cancel(vr_io_workers[i].vw_thread);
+        pthread_join(vr_io_workers[i].vw_thread, NULL);
+    }
+
+    return -ret;
 }
@@ -42,6 +42,7 @@ int diet_interface_object_copy(char *, unsigned int, void *);
 int diet_nexthop_object_copy(char *, unsigned int, void *);
 int diet_mpls_object_copy(char *, unsigned int, void *);
 int diet_route_object_copy(char *, unsigned int, void *);
+int diet_flow_object_copy(char *, unsigned int, void *);
 int diet_response_object_copy(char *, unsigned int, void *);
 int diet_object_response(struct diet_message *, void *,
         int (*)(void *, unsigned int, void *), void *);
@@ -79,6 +80,12 @@ struct diet_object_md diet_md[] = {
         .obj_request            =       vr_route_req_process,
         .obj_response           =       diet_object_response,
     },
+    [VR_FLOW_OBJECT_ID]    =   {
+        .obj_len                =       sizeof(vr_flow_req),
+        .obj_copy               =       diet_flow_object_copy,
+        .obj_request            =       vr_flow_req_process,
+        .obj_response           =       diet_object_response,
+    },
     [VR_RESPONSE_OBJECT_ID]    =   {
         .obj_len                =       sizeof(vr_response),
         .obj_copy               =       diet_response_object_copy,
@@ -115,6 +122,18 @@ diet_route_object_copy(char *dst, unsigned int buf_len, void *object)
     return sizeof(*src);
 }
 
+int
+diet_flow_object_copy(char *dst, unsigned int buf_len, void *object)
+{
+    vr_flow_req *src = (vr_flow_req *)object;
+
+    if (buf_len < diet_md[VR_FLOW_OBJECT_ID].obj_len)
+        return -ENOSPC;
+
+    memcpy(dst, src, sizeof(*src));
+    return sizeof(*src);
+}
+
 int
 diet_mpls_object_copy(char *dst, unsigned int buf_len, void *object)
 {
@@ -3,6 +3,9 @@
  *
  * Copyright (c) 2013 Juniper Networks, Inc. All rights reserved.
  */
+#include <sched.h>
+#include <sys/mman.h>
+
 #include "vr_os.h"
 #include "vr_packet.h"
 #include "vr_proto.h"
@@ -44,6 +47,49 @@ vr_hpacket_copy(unsigned char *dst, struct vr_hpacket *hpkt_src,
 }
 
 
+static void
+vr_hpacket_buffer_put(struct vr_hpacket *hpkt)
+{
+    unsigned int index;
+    struct vr_hpacket_pool *pool = hpkt->hp_pool;
+
+    if (hpkt->hp_flags & VR_HPACKET_FLAGS_RING) {
+        pool->pool_release(hpkt);
+        return;
+    }
+
+    if (!pool) {
+        free(hpkt->hp_head);
+        if (!(hpkt->hp_flags & VR_HPACKET_FLAGS_CLONED))
+            free(hpkt);
+        return;
+    }
+
+    /* the last user could be a clone. the buffer knows its descriptor */
+    if (hpkt->hp_flags & VR_HPACKET_FLAGS_CLONED) {
+        index = (hpkt->hp_head - pool->pool_arena) / pool->pool_buf_size;
+        hpkt = &pool->pool_pkts[index];
+    }
+
+    vr_hpacket_pool_free(hpkt);
+    return;
+}
+
+static void
+vr_hpacket_clone_put(struct vr_hpacket *hpkt)
+{
+    struct vr_hpacket_pool *pool = hpkt->hp_pool;
+
+    if (hpkt->hp_flags & VR_HPACKET_FLAGS_POOL_CLONE) {
+        hpkt->hp_pool = pool->pool_clones;
+        vr_hpacket_pool_free(hpkt);
+    } else {
+        free(hpkt);
+    }
+
+    return;
+}
+
 void
 vr_hpacket_free(struct vr_hpacket *hpkt)
 {
@@ -52,26 +98,21 @@ vr_hpacket_free(struct vr_hpacket *hpkt)
 
     while (hpkt) {
         hpkt_next = hpkt->hp_next;
-        hpkt_tail = (struct vr_hpacket_tail *)hpkt_end(hpkt);
-        hpkt_tail->hp_users--;
-        if (hpkt->hp_flags & VR_HPACKET_FLAGS_CLONED) {
-            if (!hpkt_tail->hp_users)
-                free(hpkt->hp_head);
+        hpkt_tail = hpkt_get_tail(hpkt);
+
+        /*
+         * the buffer goes with its last user. till then, a pool packet
+         * stays out of the pool, since its buffer is not free
+         */
+        if (!__sync_sub_and_fetch(&hpkt_tail->hp_users, 1))
+            vr_hpacket_buffer_put(hpkt);
+        else if (!hpkt->hp_pool && !(hpkt->hp_flags & VR_HPACKET_FLAGS_CLONED))
             free(hpkt);
-            return;
-        }
 
-        if (hpkt->hp_pool) {
-            if (hpkt_tail->hp_users) {
-                hpkt->hp_head = malloc(hpkt->hp_end +
-                        sizeof(struct vr_hpacket_tail));
-                hpkt_tail = (struct vr_hpacket_tail *)hpkt_end(hpkt);
-                hpkt_tail->hp_users = 1;
-            }
-            vr_hpacket_pool_free(hpkt);
-        } else {
-            free(hpkt->hp_head);
-            free(hpkt);
+        /* a clone shares the rest of the chain with the original */
+        if (hpkt->hp_flags & VR_HPACKET_FLAGS_CLONED) {
+            vr_hpacket_clone_put(hpkt);
+            return;
         }
 
         hpkt = hpkt_next;
@@ -98,6 +139,10 @@ vr_hpacket_alloc(unsigned int size)
         return NULL;
     }
 
+    hpkt->hp_next = NULL;
+    hpkt->hp_flags = 0;
+    hpkt->hp_pool = NULL;
+    hpkt->hp_ring_tail = NULL;
     hpkt->hp_data = hpkt->hp_tail = VR_HPACKET_HEAD_SPACE;
     hpkt->hp_end = size - 1;
     hpkt_tail = (struct vr_hpacket_tail *)hpkt_end(hpkt);
@@ -115,104 +160,418 @@ vr_hpacket_alloc(unsigned int size)
 struct vr_hpacket *
 vr_hpacket_clone(struct vr_hpacket *hpkt)
 {
-    struct vr_hpacket *hpkt_c;
-    struct vr_hpacket_tail *hpkt_tail;
+    unsigned int flags = VR_HPACKET_FLAGS_CLONED;
+    struct vr_hpacket *hpkt_c = NULL;
+    struct vr_hpacket_pool *pool = hpkt->hp_pool;
 
-    hpkt_c = (struct vr_hpacket *)malloc(sizeof(struct vr_hpacket));
-    if (!hpkt_c)
-        return NULL;
+    if (pool && pool->pool_clones) {
+        hpkt_c = vr_hpacket_pool_alloc(pool->pool_clones);
+        if (hpkt_c)
+            flags |= VR_HPACKET_FLAGS_POOL_CLONE;
+    }
+
+    if (!hpkt_c) {
+        hpkt_c = (struct vr_hpacket *)malloc(sizeof(struct vr_hpacket));
+        if (!hpkt_c)
+            return NULL;
+    }
 
     memcpy(hpkt_c, hpkt, sizeof(*hpkt));
 
     /* increase the reference count for the buffer */
-    hpkt_tail = (struct vr_hpacket_tail *)hpkt_end(hpkt);
-    hpkt_tail->hp_users++;
+    __sync_add_and_fetch(&hpkt_get_tail(hpkt)->hp_users, 1);
 
-    hpkt_c->hp_flags |= VR_HPACKET_FLAGS_CLONED;
+    hpkt_c->hp_flags &= ~VR_HPACKET_FLAGS_POOL_CLONE;
+    hpkt_c->hp_flags |= flags;
     return hpkt_c;
 }
 
+/*
+ * the ring has a slot for every packet of the pool, and hence is never
+ * full. a slot that is not ready yet is one that a consumer has claimed
+ * and is still emptying, and not one that holds a packet
+ */
+static void
+vr_hpacket_ring_enqueue(struct vr_hpacket_ring *ring, struct vr_hpacket *hpkt)
+{
+    long diff;
+    unsigned long pos;
+    struct vr_hpacket_ring_slot *slot;
+
+    pos = ring->vpr_enq;
+    while (true) {
+        slot = &ring->vpr_slots[pos & ring->vpr_mask];
+        diff = (long)(slot->vprs_seq - pos);
+        if (!diff) {
+            if (__sync_bool_compare_and_swap(&ring->vpr_enq, pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            /* giving up here would lose the packet for good */
+            sched_yield();
+        }
+        pos = ring->vpr_enq;
+    }
+
+    slot->vprs_hpkt = hpkt;
+    __sync_synchronize();
+    slot->vprs_seq = pos + 1;
+
+    return;
+}
+
+static struct vr_hpacket *
+vr_hpacket_ring_dequeue(struct vr_hpacket_ring *ring)
+{
+    long diff;
+    unsigned long pos;
+    struct vr_hpacket *hpkt;
+    struct vr_hpacket_ring_slot *slot;
+
+    pos = ring->vpr_deq;
+    while (true) {
+        slot = &ring->vpr_slots[pos & ring->vpr_mask];
+        diff = (long)(slot->vprs_seq - (pos + 1));
+        if (!diff) {
+            if (__sync_bool_compare_and_swap(&ring->vpr_deq, pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            return NULL;
+        }
+        pos = ring->vpr_deq;
+    }
+
+    hpkt = slot->vprs_hpkt;
+    __sync_synchronize();
+    slot->vprs_seq = pos + ring->vpr_mask + 1;
+
+    return hpkt;
+}
+
+/*
+ * a failed allocation is not a drop by itself (a smaller receive batch,
+ * or a clone that comes from the heap instead). callers that do drop a
+ * packet for the want of a buffer account it here, for 'dropstats'
+ */
+void
+vr_hpacket_pool_exhausted(unsigned int count)
+{
+    unsigned int cpu = vr_get_cpu();
+    struct vrouter *router = vrouter_get(0);
+    uint64_t *stats;
+
+    if (!router || !router->vr_pdrop_stats)
+        return;
+
+    /* threads that are not workers share the first block */
+    if (cpu >= vr_num_cpus) {
+        stats = router->vr_pdrop_stats[0];
+        __sync_add_and_fetch(&stats[VP_DROP_PKT_POOL_EXHAUSTED], count);
+        return;
+    }
+
+    router->vr_pdrop_stats[cpu][VP_DROP_PKT_POOL_EXHAUSTED] += count;
+    return;
+}
+
+static struct vr_hpacket_cache *
+vr_hpacket_pool_cache(struct vr_hpacket_pool *pool)
+{
+    unsigned int cpu = vr_get_cpu();
+
+    if (cpu >= pool->pool_num_caches)
+        return NULL;
+
+    return &pool->pool_caches[cpu];
+}
+
+unsigned int
+vr_hpacket_pool_alloc_bulk(struct vr_hpacket_pool *pool,
+        struct vr_hpacket **hpkts, unsigned int count)
+{
+    unsigned int i, allocated = 0;
+    struct vr_hpacket *hpkt;
+    struct vr_hpacket_cache *cache;
+
+    cache = vr_hpacket_pool_cache(pool);
+    while (allocated < count) {
+        if (cache && !cache->vpc_count) {
+            /* refill in bulk, to keep away from the ring for a while */
+            for (i = 0; i < VR_HPACKET_CACHE_BULK; i++) {
+                hpkt = vr_hpacket_ring_dequeue(&pool->pool_ring);
+                if (!hpkt)
+                    break;
+                cache->vpc_pkts[cache->vpc_count++] = hpkt;
+            }
+        }
+
+        if (cache && cache->vpc_count)
+            hpkt = cache->vpc_pkts[--cache->vpc_count];
+        else if (cache)
+            hpkt = NULL;
+        else
+            hpkt = vr_hpacket_ring_dequeue(&pool->pool_ring);
+
+        /* a partial batch. what the caller does with that is its call */
+        if (!hpkt)
+            break;
+
+        hpkt->hp_next = NULL;
+        hpkt->hp_packet.vp_data = hpkt->hp_data;
+        hpkts[allocated++] = hpkt;
+    }
+
+    return allocated;
+}
+
 struct vr_hpacket *
 vr_hpacket_pool_alloc(struct vr_hpacket_pool *pool)
 {
     struct vr_hpacket *hpkt;
-    struct vr_packet *pkt;
 
-    hpkt = pool->pool_head;
-    pool->pool_head = hpkt->hp_next;
-    hpkt->hp_next = NULL;
-    pkt = &hpkt->hp_packet;
-    pkt->vp_data = hpkt->hp_data;
+    if (!vr_hpacket_pool_alloc_bulk(pool, &hpkt, 1))
+        return NULL;
+
     return hpkt;
 }
 
 void
 vr_hpacket_pool_free(struct vr_hpacket *hpkt)
 {
+    unsigned int i;
     struct vr_hpacket_pool *pool = hpkt->hp_pool;
+    struct vr_hpacket_cache *cache;
     struct vr_packet *pkt;
 
-    hpkt->hp_next = pool->pool_head;
-    pool->pool_head = hpkt;
     pkt = &hpkt->hp_packet;
     pkt->vp_data = hpkt->hp_data;
     pkt->vp_len = 0;
     pkt->vp_if = NULL;
+    hpkt->hp_next = NULL;
+    if (!(hpkt->hp_flags & VR_HPACKET_FLAGS_CLONED))
+        hpkt_get_tail(hpkt)->hp_users = 1;
+
+    cache = vr_hpacket_pool_cache(pool);
+    if (!cache) {
+        vr_hpacket_ring_enqueue(&pool->pool_ring, hpkt);
+        return;
+    }
+
+    if (cache->vpc_count == VR_HPACKET_CACHE_SIZE) {
+        /* the ring has room for every packet of the pool */
+        for (i = 0; i < VR_HPACKET_CACHE_BULK; i++)
+            vr_hpacket_ring_enqueue(&pool->pool_ring,
+                    cache->vpc_pkts[--cache->vpc_count]);
+    }
 
+    cache->vpc_pkts[cache->vpc_count++] = hpkt;
     return;
 }
 
 void
-vr_hpacket_pool_destroy(struct vr_hpacket_pool *pool)
+vr_hpacket_pool_free_bulk(struct vr_hpacket **hpkts, unsigned int count)
 {
-    struct vr_hpacket *hpkt, *n_hpkt;
+    unsigned int i;
 
-    hpkt = pool->pool_head;
-    while (hpkt) {
-        n_hpkt = hpkt->hp_next;
-        hpkt->hp_next = NULL;
-        hpkt->hp_pool = NULL;
-        vr_hpacket_free(hpkt);
-        hpkt = n_hpkt;
+    for (i = 0; i < count; i++)
+        vr_hpacket_pool_free(hpkts[i]);
+
+    return;
+}
+
+void
+vr_hpacket_pool_fini(struct vr_hpacket_pool *pool)
+{
+    if (pool->pool_ring.vpr_slots) {
+        free(pool->pool_ring.vpr_slots);
+        pool->pool_ring.vpr_slots = NULL;
+    }
+
+    if (pool->pool_caches) {
+        free(pool->pool_caches);
+        pool->pool_caches = NULL;
+    }
+
+    return;
+}
+
+/*
+ * every worker may hold up to VR_HPACKET_CACHE_SIZE packets of a pool in
+ * its cache, where no other worker can get at them. a pool that has to
+ * give out 'size' packets at any time hence needs that many packets more
+ * per worker
+ */
+unsigned int
+vr_hpacket_pool_size(unsigned int size)
+{
+    return size + (vr_num_cpus * VR_HPACKET_CACHE_SIZE);
+}
+
+/*
+ * sets up an empty pool of 'size' packets, which the caller then fills
+ * with vr_hpacket_pool_free
+ */
+int
+vr_hpacket_pool_init(struct vr_hpacket_pool *pool, unsigned int size)
+{
+    unsigned int i, slots = 1;
+
+    while (slots < size)
+        slots <<= 1;
+
+    pool->pool_size = size;
+    pool->pool_ring.vpr_mask = slots - 1;
+    pool->pool_ring.vpr_enq = pool->pool_ring.vpr_deq = 0;
+    pool->pool_ring.vpr_slots = calloc(slots,
+            sizeof(struct vr_hpacket_ring_slot));
+    if (!pool->pool_ring.vpr_slots)
+        goto cleanup;
+
+    for (i = 0; i < slots; i++)
+        pool->pool_ring.vpr_slots[i].vprs_seq = i;
+
+    pool->pool_num_caches = vr_num_cpus;
+    if (posix_memalign((void **)&pool->pool_caches, VR_HPACKET_ARENA_ALIGN,
+                vr_num_cpus * sizeof(struct vr_hpacket_cache))) {
+        pool->pool_caches = NULL;
+        goto cleanup;
     }
+    memset(pool->pool_caches, 0, vr_num_cpus * sizeof(struct vr_hpacket_cache));
+
+    return 0;
+
+cleanup:
+    vr_hpacket_pool_fini(pool);
+    return -ENOMEM;
+}
+
+static unsigned char *
+vr_hpacket_arena_alloc(size_t size)
+{
+    void *arena = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    arena = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    /* no huge pages configured. regular pages it is */
+    if (arena == MAP_FAILED)
+        arena = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (arena == MAP_FAILED)
+        return NULL;
+
+    return arena;
+}
+
+void
+vr_hpacket_pool_destroy(struct vr_hpacket_pool *pool)
+{
+    if (pool->pool_clones) {
+        if (pool->pool_clones->pool_pkts)
+            free(pool->pool_clones->pool_pkts);
+        vr_hpacket_pool_fini(pool->pool_clones);
+        vr_free(pool->pool_clones);
+        pool->pool_clones = NULL;
+    }
+
+    if (pool->pool_arena)
+        munmap(pool->pool_arena, pool->pool_arena_size);
+
+    if (pool->pool_pkts)
+        free(pool->pool_pkts);
+
+    vr_hpacket_pool_fini(pool);
+    vr_free(pool);
 
     return;
 }
 
+static int
+vr_hpacket_pool_clones_init(struct vr_hpacket_pool *pool)
+{
+    unsigned int i, size;
+    struct vr_hpacket_pool *clones;
+
+    size = vr_hpacket_pool_size(pool->pool_size >> VR_HPACKET_CLONE_SHIFT);
+
+    clones = vr_zalloc(sizeof(*clones));
+    if (!clones)
+        return -ENOMEM;
+    pool->pool_clones = clones;
+
+    if (vr_hpacket_pool_init(clones, size))
+        return -ENOMEM;
+
+    clones->pool_pkts = calloc(size, sizeof(struct vr_hpacket));
+    if (!clones->pool_pkts)
+        return -ENOMEM;
+
+    for (i = 0; i < size; i++) {
+        clones->pool_pkts[i].hp_pool = clones;
+        clones->pool_pkts[i].hp_flags = VR_HPACKET_FLAGS_CLONED;
+        vr_hpacket_pool_free(&clones->pool_pkts[i]);
+    }
+
+    return 0;
+}
+
 struct vr_hpacket_pool *
 vr_hpacket_pool_create(unsigned int pool_size, unsigned int psize)
 {
     unsigned int i;
     struct vr_hpacket_pool *pool;
     struct vr_hpacket *hpkt;
+    struct vr_packet *pkt;
 
     if (!pool_size)
         return NULL;
+    pool_size = vr_hpacket_pool_size(pool_size);
 
     pool = vr_zalloc(sizeof(*pool));
     if (!pool)
+        return NULL;
+
+    if (vr_hpacket_pool_init(pool, pool_size))
         goto cleanup;
 
-    for (i = 0; i < pool_size; i++) {
-        hpkt = vr_hpacket_alloc(psize);
-        if (!hpkt)
-            goto cleanup;
+    /* same buffer geometry as vr_hpacket_alloc */
+    pool->pool_buf_size = psize + VR_HPACKET_HEAD_SPACE +
+        sizeof(struct vr_hpacket_tail);
+    pool->pool_buf_size = (pool->pool_buf_size + VR_HPACKET_ARENA_ALIGN - 1) &
+        ~(VR_HPACKET_ARENA_ALIGN - 1);
+    pool->pool_arena_size = (size_t)pool_size * pool->pool_buf_size;
+    pool->pool_arena_size = (pool->pool_arena_size +
+            VR_HPACKET_HUGE_PAGE_SIZE - 1) & ~(VR_HPACKET_HUGE_PAGE_SIZE - 1);
+    pool->pool_arena = vr_hpacket_arena_alloc(pool->pool_arena_size);
+    if (!pool->pool_arena)
+        goto cleanup;
 
-        if (!pool->pool_head)
-            pool->pool_head = hpkt;
-        else {
-            hpkt->hp_next = pool->pool_head->hp_next;
-            pool->pool_head->hp_next = hpkt;
-        }
+    pool->pool_pkts = calloc(pool_size, sizeof(struct vr_hpacket));
+    if (!pool->pool_pkts)
+        goto cleanup;
+
+    if (vr_hpacket_pool_clones_init(pool))
+        goto cleanup;
+
+    for (i = 0; i < pool_size; i++) {
+        hpkt = &pool->pool_pkts[i];
+        hpkt->hp_head = pool->pool_arena + ((size_t)i * pool->pool_buf_size);
+        hpkt->hp_data = hpkt->hp_tail = VR_HPACKET_HEAD_SPACE;
+        hpkt->hp_end = psize - 1;
         hpkt->hp_pool = pool;
+
+        pkt = &hpkt->hp_packet;
+        pkt->vp_head = hpkt->hp_head;
+        pkt->vp_data = hpkt->hp_data;
+        pkt->vp_end = hpkt->hp_end;
+
+        vr_hpacket_pool_free(hpkt);
     }
 
     return pool;
 
 cleanup:
-    if (pool)
-        vr_hpacket_pool_destroy(pool);
-
+    vr_hpacket_pool_destroy(pool);
     return NULL;
 }
-
@@ -8,8 +8,10 @@
 #include "vr_proto.h"
 #include "vrouter.h"
 #include <sys/time.h>
+#include <time.h>
 #include "vr_message.h"
 #include "vr_sandesh.h"
+#include "host/vr_host.h"
 #include "host/vr_host_packet.h"
 #include "ulinux.h"
 
@@ -53,7 +55,8 @@ vr_lib_delete_timer(struct vr_timer *vtimer)
 static void *
 vr_lib_page_alloc(unsigned int size)
 {
-	return malloc(PAGE_SIZE);
+	/* btables expect what the kernel gives: zeroed memory of the size asked */
+	return calloc(1, size);
 }
 
 static void
@@ -124,6 +127,10 @@ vr_lib_palloc_head(struct vr_packet *pkt, unsigned int size)
     hpkt_head->hp_len = hpkt->hp_len;
     hpkt_head->hp_next = hpkt;
 
+    hpkt_head->hp_packet.vp_if = pkt->vp_if;
+    hpkt_head->hp_packet.vp_ttl = pkt->vp_ttl;
+    hpkt_head->hp_packet.vp_flags = pkt->vp_flags;
+
     return &hpkt_head->hp_packet;
 }
 
@@ -157,8 +164,12 @@ vr_lib_preset(struct vr_packet *pkt)
 static void
 vr_lib_pfree(struct vr_packet *pkt, unsigned short reason)
 {
+    struct vrouter *router = vrouter_get(0);
     struct vr_hpacket *hpkt;
 
+    if (router && router->vr_pdrop_stats && (pkt->vp_cpu < vr_num_cpus))
+        ((uint64_t *)(router->vr_pdrop_stats[pkt->vp_cpu]))[reason]++;
+
     hpkt = VR_PACKET_TO_HPACKET(pkt);
     vr_hpacket_free(hpkt);
     return;
@@ -186,6 +197,16 @@ vr_lib_pfrag_len(struct vr_packet *pkt)
     return hpkt->hp_next->hp_len;
 }
 
+/* the headers of a host packet are all in its head, or not there at all */
+static int
+vr_lib_pkt_may_pull(struct vr_packet *pkt, unsigned int len)
+{
+    if (len > pkt_head_len(pkt))
+        return -1;
+
+    return 0;
+}
+
 static void
 vr_lib_get_time(unsigned int *sec, unsigned int *nsec)
 {
@@ -201,21 +222,70 @@ vr_lib_get_time(unsigned int *sec, unsigned int *nsec)
     return;
 }
 
+static void
+vr_lib_get_mono_time(unsigned int *sec, unsigned int *nsec)
+{
+    struct timespec ts;
+
+    *sec = *nsec = 0;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return;
+
+    *sec = ts.tv_sec;
+    *nsec = ts.tv_nsec;
+
+    return;
+}
+
 static unsigned int
 vr_lib_get_cpu(void)
 {
+    return vr_host_io_worker_id();
+}
+
+/*
+ * there is no atomic context here to get out of. work is scheduled either
+ * from a request, that is serialized already, or from a timer, and work
+ * that races with requests (flow ageing) takes the message lock itself
+ */
+static int
+vr_lib_schedule_work(unsigned int cpu, void (*fn)(void *), void *arg)
+{
+    fn(arg);
     return 0;
 }
 
 static void
-vr_lib_schedule_work(unsigned int cpu, void (*fn)(void *), void *arg)
+vr_lib_delay_op(void)
 {
+    vr_host_io_quiesce();
     return;
 }
 
+/* there is no rcu here. the callback runs once the other workers are done */
 static void
-vr_lib_delay_op(void)
+vr_lib_defer(struct vrouter *router, vr_defer_cb user_cb, void *data)
 {
+    vr_host_io_quiesce();
+    user_cb(router, data);
+    vr_lib_free(data);
+
+    return;
+}
+
+static void *
+vr_lib_get_defer_data(unsigned int len)
+{
+    if (!len)
+        return NULL;
+
+    return vr_lib_malloc(len);
+}
+
+static void
+vr_lib_put_defer_data(void *data)
+{
+    vr_lib_free(data);
     return;
 }
 
@@ -231,11 +301,17 @@ struct host_os vr_lib_host = {
     .hos_pclone             =       vr_lib_pclone,
     .hos_pcopy              =       vr_lib_pcopy,
     .hos_pfrag_len          =       vr_lib_pfrag_len,
+    .hos_pkt_may_pull       =       vr_lib_pkt_may_pull,
 
     .hos_get_cpu            =       vr_lib_get_cpu,
     .hos_schedule_work      =       vr_lib_schedule_work,
+    .hos_schedule_process_work  =   vr_lib_schedule_work,
     .hos_delay_op           =       vr_lib_delay_op,
+    .hos_defer              =       vr_lib_defer,
+    .hos_get_defer_data     =       vr_lib_get_defer_data,
+    .hos_put_defer_data     =       vr_lib_put_defer_data,
     .hos_get_time           =       vr_lib_get_time,
+    .hos_get_mono_time      =       vr_lib_get_mono_time,
 	.hos_page_alloc			=		vr_lib_page_alloc,
 	.hos_page_free			=		vr_lib_page_free,
 	.hos_create_timer		=		vr_lib_create_timer,
@@ -310,6 +386,10 @@ vrouter_host_init(unsigned int message_proto)
     if (vr_host_inited)
         return 0;
 
+#if defined(__x86_64__)
+    vr_hash_crc32c_supported = __builtin_cpu_supports("sse4.2");
+#endif
+
     ret = vrouter_init();
     if (ret)
         return ret;
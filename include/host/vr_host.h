@@ -9,9 +9,16 @@
 int vr_send(unsigned int, void *, unsigned int);
 void *vr_recv(void);
 void vr_free_req(void *);
+/* maximum number of io worker threads, each of which is a datapath cpu */
+#define VR_HOST_IO_MAX_WORKERS  64
+
+extern unsigned int vr_host_io_num_workers;
+
 void vr_host_io_unregister(unsigned int);
-void vr_host_io_init(void);
+int vr_host_io_init(void);
 int vr_host_io_register(unsigned int, int (*)(void *), void *);
 int vr_host_io(void);
+unsigned int vr_host_io_worker_id(void);
+void vr_host_io_quiesce(void);
 
 #endif /* __VR_HOST_H__ */
@@ -33,10 +33,65 @@
 #define HIF_DESTINATION_UDP_PORT_START      60000
 
 #define HIF_TYPE_UDP                        1
+/* AF_PACKET socket with TPACKET_V3 rx and tx rings, bound to a device */
+#define HIF_TYPE_PACKET                     2
+
+/*
+ * packets are moved between the sockets and the datapath in batches of
+ * these many packets, one recvmmsg/sendmmsg per batch. rx batch should
+ * not exceed the datapath burst size (VR_RX_BURST_MAX)
+ */
+#define HIF_RX_BATCH                        32
+#define HIF_TX_BATCH                        32
+/* maximum number of buffers that a transmitted packet can span */
+#define HIF_TX_MAX_SEGS                     8
+
+/* packets of a pool that are not in the caches of the workers */
+#define HIF_PKT_POOL_SIZE                   256
+#define HIF_PKT_SIZE                        2000
+
+/* geometry of the rings of HIF_TYPE_PACKET interfaces */
+#define HIF_RING_BLOCK_SIZE                 (1 << 16)
+#define HIF_RING_RX_BLOCKS                  64
+#define HIF_RING_TX_BLOCKS                  32
+#define HIF_RING_FRAME_SIZE                 2048
+/* msecs after which the kernel hands over a partially filled rx block */
+#define HIF_RING_BLOCK_TIMEOUT              1
+/*
+ * rx packets point into the ring and need a descriptor each. the number
+ * of descriptors assumes an average packet (with headers) of 256 bytes
+ */
+#define HIF_RING_RX_DESCS                   \
+    (HIF_RING_RX_BLOCKS * (HIF_RING_BLOCK_SIZE / 256))
 
 struct vr_hpacket;
 struct vr_hpacket_pool;
 struct vr_interface;
+struct mmsghdr;
+struct iovec;
+struct vr_hif_ring;
+
+/* per interface batch of packets received in one go */
+struct vr_hif_rxq {
+    struct vr_hpacket *hrq_pkts[HIF_RX_BATCH];
+    struct mmsghdr *hrq_msgs;
+    struct iovec *hrq_iov;
+};
+
+/*
+ * per destination queue of packets waiting to be sent. all packets on
+ * an udp host interface go to the peer the socket is connected to, and
+ * hence every interface is a destination of its own. any io worker can
+ * transmit on any interface, and hence there is one queue per worker
+ */
+struct vr_hif_txq {
+    unsigned int htq_count;
+    bool htq_pending;
+    struct vr_hinterface *htq_next;
+    struct vr_hpacket *htq_pkts[HIF_TX_BATCH];
+    struct mmsghdr *htq_msgs;
+    struct iovec *htq_iov;
+};
 
 struct vr_hinterface {
     int hif_index;
@@ -48,15 +103,21 @@ struct vr_hinterface {
     struct vr_hpacket_pool *hif_pkt_pool;
     unsigned int (*hif_tx)(struct vr_hinterface *, struct vr_hpacket *);
     int (*hif_rx)(void *);
+    struct vr_hif_rxq hif_rxq;
+    struct vr_hif_txq *hif_txq;
+    struct vr_hif_ring *hif_ring;
 };
 
 struct vr_hinterface *hif_table[HIF_MAX_INTERFACES];
 
 struct vr_hinterface *vr_hinterface_create(unsigned int, unsigned int,
                 unsigned int);
+struct vr_hinterface *vr_hinterface_create_dev(unsigned int, unsigned int,
+                unsigned int, const char *);
 struct vr_hinterface *vr_hinterface_get(unsigned int);
 void vr_hinterface_put(struct vr_hinterface *);
 void vr_hinterface_delete(struct vr_hinterface *);
+void vr_hinterface_tx_flush(void);
 
 
 
@@ -6,17 +6,81 @@
 #ifndef __VR_HOST_PACKET_H__
 #define __VR_HOST_PACKET_H__
 
+#include <stdint.h>
+#include <stdbool.h>
+
 /*
  * invariably, VR will push headers and it makes sense to have
  * a reasonable header space
  */
 #define VR_HPACKET_HEAD_SPACE       64
 
+/* packets that a worker keeps for itself, and moves to/from the ring */
+#define VR_HPACKET_CACHE_SIZE       64
+#define VR_HPACKET_CACHE_BULK       32
+/* clone descriptors of a pool, as a fraction of the pool size */
+#define VR_HPACKET_CLONE_SHIFT      2
+
+#define VR_HPACKET_ARENA_ALIGN      64
+#define VR_HPACKET_HUGE_PAGE_SIZE   (2 * 1024 * 1024)
+
+/*
+ * bounded multi producer, multi consumer ring of free packets. every slot
+ * has a sequence number that tells whether it is ready to be filled or
+ * emptied for a given position, and hence producers and consumers need
+ * only a compare and swap on the position
+ */
+struct vr_hpacket_ring_slot {
+    volatile unsigned long vprs_seq;
+    struct vr_hpacket *vprs_hpkt;
+};
+
+struct vr_hpacket_ring {
+    unsigned int vpr_mask;
+    struct vr_hpacket_ring_slot *vpr_slots;
+    volatile unsigned long vpr_enq __attribute__((aligned(64)));
+    volatile unsigned long vpr_deq __attribute__((aligned(64)));
+};
+
+/* per worker cache, touched only by the worker */
+struct vr_hpacket_cache {
+    unsigned int vpc_count;
+    struct vr_hpacket *vpc_pkts[VR_HPACKET_CACHE_SIZE];
+} __attribute__((aligned(64)));
+
+/*
+ * packets that one io worker allocates can be freed by any other worker
+ * (the one that transmits them). allocation and free go to the cache of
+ * the calling worker, which moves packets to and from the shared ring in
+ * bulk when it runs dry or full.
+ *
+ * buffers of a pool are one contiguous arena (in huge pages, if the
+ * system has them), and buffer i belongs to descriptor i. a descriptor
+ * hence goes back to the pool only with the last user of its buffer
+ */
 struct vr_hpacket_pool {
-    struct vr_hpacket *pool_head;
+    struct vr_hpacket_ring pool_ring;
+    struct vr_hpacket_cache *pool_caches;
+    unsigned int pool_num_caches;
+    unsigned int pool_size;
+    unsigned int pool_buf_size;
+    unsigned char *pool_arena;
+    size_t pool_arena_size;
+    struct vr_hpacket *pool_pkts;
+    /* descriptors (with no buffer) for clones of packets of this pool */
+    struct vr_hpacket_pool *pool_clones;
+    /*
+     * for pools of packets whose buffers are not their own (ring frames),
+     * called when the last user of the buffer lets go of it
+     */
+    void (*pool_release)(struct vr_hpacket *);
 };
 
 #define VR_HPACKET_FLAGS_CLONED     0x1
+/* buffer is a frame of a mmaped ring, and the users count is not in it */
+#define VR_HPACKET_FLAGS_RING       0x2
+/* clone descriptor that came from the clone pool of the buffer's pool */
+#define VR_HPACKET_FLAGS_POOL_CLONE 0x4
 
 /* host packet representation */
 struct vr_hpacket {
@@ -40,6 +104,8 @@ struct vr_hpacket {
     unsigned int hp_flags;
     /* pool from where this packet came from */
     void *hp_pool;
+    /* users count of a ring buffer (VR_HPACKET_FLAGS_RING) */
+    struct vr_hpacket_tail *hp_ring_tail;
 } __attribute__((packed));
 
 static inline unsigned char *
@@ -82,13 +148,29 @@ struct vr_hpacket_tail {
     unsigned int hp_users;
 } __attribute__((packed));
 
+static inline struct vr_hpacket_tail *
+hpkt_get_tail(struct vr_hpacket *hpkt)
+{
+    if (hpkt->hp_flags & VR_HPACKET_FLAGS_RING)
+        return hpkt->hp_ring_tail;
+
+    return (struct vr_hpacket_tail *)hpkt_end(hpkt);
+}
+
 int vr_hpacket_copy(unsigned char *, struct vr_hpacket *,
         unsigned int, unsigned int);
 void vr_hpacket_free(struct vr_hpacket *);
 struct vr_hpacket *vr_hpacket_alloc(unsigned int);
 struct vr_hpacket *vr_hpacket_clone(struct vr_hpacket *);
 struct vr_hpacket *vr_hpacket_pool_alloc(struct vr_hpacket_pool *);
+unsigned int vr_hpacket_pool_alloc_bulk(struct vr_hpacket_pool *,
+        struct vr_hpacket **, unsigned int);
 void vr_hpacket_pool_free(struct vr_hpacket *);
+void vr_hpacket_pool_free_bulk(struct vr_hpacket **, unsigned int);
+void vr_hpacket_pool_exhausted(unsigned int);
+unsigned int vr_hpacket_pool_size(unsigned int);
+int vr_hpacket_pool_init(struct vr_hpacket_pool *, unsigned int);
+void vr_hpacket_pool_fini(struct vr_hpacket_pool *);
 struct vr_hpacket_pool *vr_hpacket_pool_create(unsigned int, unsigned int);
 void vr_hpacket_pool_destroy(struct vr_hpacket_pool *);
 
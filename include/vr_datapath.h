@@ -8,6 +8,25 @@
 
 #include "vr_packet.h"
 
+/*
+ * maximum number of packets that are processed together in one burst.
+ * the burst context is per cpu and is sized for this many packets
+ */
+#define VR_RX_BURST_MAX         32
+
+struct vr_burst_entry {
+    struct vr_packet *vbe_pkt;
+    struct vr_nexthop *vbe_nh;
+    struct vr_forwarding_md vbe_fmd;
+};
+
+struct vr_burst {
+    bool vb_active;
+    unsigned int vb_count;
+    struct vr_forwarding_md vb_rx_fmd[VR_RX_BURST_MAX];
+    struct vr_burst_entry vb_entry[VR_RX_BURST_MAX];
+};
+
 static inline bool
 well_known_mac(unsigned char *dmac)
 {
@@ -24,6 +43,12 @@ unsigned int vr_virtual_input(unsigned short, struct vr_interface *,
                               struct vr_packet *, unsigned short);
 unsigned int vr_fabric_input(struct vr_interface *, struct vr_packet *,
                              unsigned short);
+unsigned int vr_fabric_input_burst(struct vr_interface *, struct vr_packet **,
+                                   unsigned int, unsigned short);
+bool vr_burst_defer(struct vrouter *, struct vr_packet *,
+                    struct vr_nexthop *, struct vr_forwarding_md *);
+int vr_datapath_init(struct vrouter *);
+void vr_datapath_exit(struct vrouter *, bool);
 
 int vr_l3_input(struct vr_packet *, struct vr_forwarding_md *);
 int vr_l2_input(struct vr_packet *, struct vr_forwarding_md *);
@@ -48,6 +73,8 @@ vr_bridge_input(struct vrouter *, struct vr_packet *,
                                     struct vr_forwarding_md *);
 extern struct vr_nexthop *(*vr_bridge_lookup)(unsigned int,
                 struct vr_route_req *);
+extern struct vr_nexthop *vr_bridge_lookup_mac(unsigned int, unsigned char *,
+                unsigned int *, unsigned short *);
 extern unsigned short vr_bridge_route_flags(unsigned int, unsigned char *);
 
 mac_response_t vr_get_proxy_mac(struct vr_packet *, struct vr_forwarding_md *,
@@ -73,9 +73,29 @@ struct vr_inet_flow {
     unsigned char ip4_proto;
 } __attribute__((packed));
 
+/*
+ * an ipv6 flow does not fit in the (64 byte) flow entry. the entry carries
+ * the ports, the protocol, the nexthop and a hash of the addresses, while
+ * the addresses themselves are kept in a separate table that is indexed
+ * by the flow index (see vr_flow6_get_addr)
+ */
+struct vr_inet6_flow {
+    unsigned short ip6_sport;
+    unsigned short ip6_dport;
+    unsigned short ip6_nh_id;
+    unsigned char ip6_proto;
+    uint32_t ip6_addr_hash;
+} __attribute__((packed));
+
+struct vr_inet6_flow_addr {
+    unsigned char ip6_sip[16];
+    unsigned char ip6_dip[16];
+};
+
 struct vr_flow {
     union {
         struct vr_inet_flow ip4_key;
+        struct vr_inet6_flow ip6_key;
     } key_u;
 
     uint8_t key_len;
@@ -88,6 +108,12 @@ struct vr_flow {
 #define flow4_nh_id     key_u.ip4_key.ip4_nh_id
 #define flow4_proto     key_u.ip4_key.ip4_proto
 
+#define flow6_sport     key_u.ip6_key.ip6_sport
+#define flow6_dport     key_u.ip6_key.ip6_dport
+#define flow6_nh_id     key_u.ip6_key.ip6_nh_id
+#define flow6_proto     key_u.ip6_key.ip6_proto
+#define flow6_addr_hash key_u.ip6_key.ip6_addr_hash
+
 /* 
  * Limit the number of outstanding flows in hold state. The flow rate can
  * be much more than what agent can handle. In such cases, to make sure that
@@ -139,6 +165,111 @@ struct vr_flow_stats {
     uint8_t  flow_packets_oflow;
 } __attribute__((packed));
 
+/*
+ * datapath does not update the (shared) flow statistics for every packet.
+ * each cpu accumulates the counts in a direct mapped table of slots keyed
+ * by the flow index, and the counts are moved to the flow entry when a
+ * slot is taken over by another flow, periodically from a timer, and
+ * before a flow is deleted. counts in a slot are written only by the
+ * owning cpu, while the flushed counts are written only with fss_busy
+ * held, so that nothing is lost or added twice
+ */
+#define VR_FLOW_STATS_SHIFT         8
+#define VR_FLOW_STATS_SLOTS         (1U << VR_FLOW_STATS_SHIFT)
+#define VR_FLOW_STATS_FLUSH_MSECS   1000
+
+struct vr_flow_stats_slot {
+    int fss_index;
+    unsigned int fss_busy;
+    uint64_t fss_bytes;
+    uint64_t fss_packets;
+    uint64_t fss_flushed_bytes;
+    uint64_t fss_flushed_packets;
+};
+
+struct vr_flow_pcpu_stats {
+    struct vr_flow_stats_slot fps_slots[VR_FLOW_STATS_SLOTS];
+};
+
+/*
+ * flow ageing. a timer sweeps a slice of the flow table every run and
+ * compares the packet count of every active flow with what it saw in the
+ * previous sweep. a flow that has not moved for vr_flow_age_timeout
+ * seconds is evicted (in process context, since deleting a flow can sleep)
+ * and its index is queued to the aged ring, from which agent drains it
+ * with FLOW_AGED_GET. the datapath itself does not write anything for
+ * ageing to happen.
+ */
+#define VR_FLOW_AGE_SCAN_MSECS          100
+#define VR_FLOW_AGE_ENTRIES_PER_SCAN    4096
+#define VR_FLOW_AGE_BATCH               256
+#define VR_FLOW_AGED_RING_SIZE          4096
+
+struct vr_flow_age_info {
+    uint32_t fai_packets;
+    uint32_t fai_time;
+};
+
+struct vr_flow_age_batch {
+    struct vrouter *fab_router;
+    unsigned int fab_count;
+    unsigned int fab_index[VR_FLOW_AGE_BATCH];
+};
+
+struct vr_flow_ageing {
+    struct vrouter *fa_router;
+    unsigned int fa_next_index;
+    unsigned int fa_evict_pending;
+    /* single producer (the eviction work), single consumer (agent) */
+    unsigned int fa_ring_head;
+    unsigned int fa_ring_tail;
+    unsigned int fa_ring[VR_FLOW_AGED_RING_SIZE];
+};
+
+/*
+ * flow miss ring. instead of trapping (a clone of) the first packet of a new
+ * flow to agent, the datapath posts a compact descriptor of the miss into a
+ * per-cpu ring that lives in the flow memory, right after the overflow
+ * table, and agent picks the descriptors from there in batches. every cpu
+ * gets a page of control (producer and consumer words in separate cache
+ * lines), followed by VR_FLOW_MISS_RING_ENTRIES descriptors.
+ *
+ * a producer reserves a slot by moving fmp_head, fills the slot and then
+ * writes fm_seq (position + 1) to publish it. agent consumes the slot at
+ * fmc_tail once fm_seq reads fmc_tail + 1, and then moves fmc_tail. the
+ * datapath uses the ring only after agent has set fmc_enabled, and falls
+ * back to the packet trap if the ring is full.
+ */
+#define VR_FLOW_MISS_RING_ENTRIES   1024U
+#define VR_FLOW_MISS_CTL_SLOTS      64U
+#define VR_FLOW_MISS_RING_STRIDE    (VR_FLOW_MISS_CTL_SLOTS + \
+        VR_FLOW_MISS_RING_ENTRIES)
+
+struct vr_flow_miss {
+    uint32_t fm_seq;
+    uint32_t fm_index;
+    uint32_t fm_if_index;
+    uint16_t fm_vrf;
+    uint8_t fm_type;
+    uint8_t fm_rsvd;
+    struct vr_flow fm_key;
+    /* valid only for ipv6 flows */
+    uint8_t fm_sip6[16];
+    uint8_t fm_dip6[16];
+};
+
+struct vr_flow_miss_prod {
+    uint32_t fmp_head;
+};
+
+struct vr_flow_miss_cons {
+    uint32_t fmc_tail;
+    uint32_t fmc_enabled;
+};
+
+/* most flows that a vr_flow_bulk_req can carry */
+#define VR_FLOW_BULK_MAX_ITEMS      256U
+
 #define VR_MAX_FLOW_QUEUE_ENTRIES   3U
 
 #define PN_FLAG_LABEL_IS_VNID       0x1
@@ -210,6 +341,34 @@ struct vr_flow_entry {
 
 #define VR_DNS_SERVER_PORT  htons(53)
 
+/*
+ * a small, direct mapped, per-cpu cache of flow lookups. an entry is
+ * valid only as long as the generation of the flow that it points to is
+ * what it was when the entry was filled. the generation of a flow is
+ * bumped whenever agent changes the flow or the flow is reset. the router
+ * has a generation for the whole cache too, which is bumped only when a
+ * nexthop goes away. like the route cache, an entry has a sequence that
+ * is odd while it is being written, since a fill from process context can
+ * be interrupted by the same cpu's softirq. only ipv4 flows are cached
+ */
+#define VR_FLOW_CACHE_SHIFT         8
+#define VR_FLOW_CACHE_ENTRIES       (1U << VR_FLOW_CACHE_SHIFT)
+
+struct vr_nexthop;
+
+struct vr_flow_cache_entry {
+    struct vr_flow fce_key;
+    struct vr_nexthop *fce_src_nh;
+    unsigned int fce_seq;
+    unsigned int fce_gen;
+    unsigned int fce_flow_gen;
+    unsigned int fce_index;
+};
+
+struct vr_flow_cache {
+    struct vr_flow_cache_entry fc_entries[VR_FLOW_CACHE_ENTRIES];
+};
+
 struct vr_flow_md {
     struct vrouter *flmd_router;
     struct vr_defer_data *flmd_defer_data;
@@ -235,11 +394,18 @@ void *vr_flow_get_va(struct vrouter *, uint64_t);
 
 unsigned int vr_flow_table_size(struct vrouter *);
 unsigned int vr_oflow_table_size(struct vrouter *);
+unsigned int vr_flow_miss_ring_size(struct vrouter *);
 
 struct vr_flow_entry *vr_get_flow_entry(struct vrouter *, int);
+void vr_flow_cache_invalidate(struct vrouter *);
 flow_result_t vr_flow_lookup(struct vrouter *, struct vr_flow *,
                              struct vr_packet *, struct vr_forwarding_md *);
 
+flow_result_t vr_flow6_lookup(struct vrouter *, struct vr_flow *,
+        struct vr_inet6_flow_addr *, struct vr_packet *,
+        struct vr_forwarding_md *);
+struct vr_inet6_flow_addr *vr_flow6_get_addr(struct vrouter *, unsigned int);
+
 flow_result_t vr_inet_flow_lookup(struct vrouter *, struct vr_packet *,
                                   struct vr_forwarding_md *);
 extern flow_result_t vr_inet_flow_nat(struct vr_flow_entry *,
@@ -247,6 +413,14 @@ extern flow_result_t vr_inet_flow_nat(struct vr_flow_entry *,
 extern void vr_inet_fill_flow(struct vr_flow *, unsigned short,
                 uint32_t, uint32_t, uint8_t, uint16_t, uint16_t);
 
+flow_result_t vr_inet6_flow_lookup(struct vrouter *, struct vr_packet *,
+                                   struct vr_forwarding_md *);
+extern flow_result_t vr_inet6_flow_nat(struct vr_flow_entry *,
+        struct vr_packet *, struct vr_forwarding_md *);
+extern void vr_inet6_fill_flow(struct vrouter *, struct vr_flow *,
+        struct vr_inet6_flow_addr *, unsigned short, unsigned char *,
+        unsigned char *, uint8_t, uint16_t, uint16_t);
+
 extern unsigned int vr_reinject_packet(struct vr_packet *,
         struct vr_forwarding_md *);
 
@@ -14,24 +14,97 @@ struct vr_fragment_key {
     unsigned short fk_vrf;
 } __attribute__((packed));
 
+/* f_state */
+#define VR_FRAG_STATE_FREE          0
+#define VR_FRAG_STATE_BUSY          1
+#define VR_FRAG_STATE_VALID         2
+
 struct vr_fragment {
     struct vr_fragment_key f_key;
     unsigned short f_sport;
     unsigned short f_dport;
-    uint64_t f_time;
-} __attribute__((packed));
+    unsigned short f_state;
+    /* the partition that the entry is in, fixed at table creation */
+    unsigned short f_partition;
+    unsigned int f_time;
+};
 
 #define f_sip f_key.fk_sip
 #define f_dip f_key.fk_dip
 #define f_id  f_key.fk_id
 #define f_vrf f_key.fk_vrf
 
+/*
+ * the fragment table is split into a partition per cpu. a head is added
+ * to the partition of the cpu that it came on, which is where the rest of
+ * its datagram usually comes too (rps hashes on the addresses). within a
+ * partition, an entry lives in one of two buckets of four entries, and
+ * hence a lookup probes a bounded number of entries, however full the
+ * table is
+ */
+#define VR_FRAG_PARTITION_ENTRIES   1024
+#define VR_FRAG_BUCKET_ENTRIES      4
+#define VR_FRAG_BUCKET_CHOICES      2
+
+struct vr_fragment_partition {
+    unsigned int fp_used;
+    unsigned int fp_next_scan;
+};
+
+/*
+ * fragments that come before the head of their datagram do not have the
+ * ports that flow lookup needs. they wait in a queue of the cpu that they
+ * came on, till the head comes (and leaves its ports in the fragment
+ * table) or till they time out. the queues are bounded, and the fragments
+ * of one datagram are released in the order of their offsets.
+ *
+ * a queue also has a bitmap of its slots for every bucket of the key hash,
+ * with the bit of a slot set in the bitmap of the bucket of the key that
+ * the slot last held. a release hence looks only at the slots that can
+ * hold its key. only the owner writes the bitmaps. a slot that was taken
+ * keeps its bit till the owner fills it again, which costs a release no
+ * more than a look at an empty slot
+ */
+#define VR_FRAG_HOLD_ENTRIES        64
+#define VR_FRAG_HOLD_BUCKETS        64
+#define VR_FRAG_HOLD_TIMEOUT_MSECS  500
+
+struct vr_fragment_queue_element {
+    struct vr_fragment_key fqe_key;
+    unsigned short fqe_offset;
+    unsigned short fqe_vlan;
+    unsigned int fqe_bucket;
+    uint64_t fqe_time;
+    struct vr_packet_node fqe_pnode;
+};
+
+struct vr_fragment_queue {
+    unsigned int vfq_length;
+    uint64_t vfq_bucket_map[VR_FRAG_HOLD_BUCKETS];
+    struct vr_fragment_queue_element vfq_elems[VR_FRAG_HOLD_ENTRIES];
+};
+
+static inline void
+fragment_key(struct vr_fragment_key *key, unsigned short vrf,
+        struct vr_ip *iph)
+{
+    key->fk_sip = iph->ip_saddr;
+    key->fk_dip = iph->ip_daddr;
+    key->fk_id = iph->ip_id;
+    key->fk_vrf = vrf;
+
+    return;
+}
+
 int vr_fragment_table_init(struct vrouter *);
 void vr_fragment_table_exit(struct vrouter *);
 struct vr_fragment *vr_fragment_get(struct vrouter *, unsigned short,
         struct vr_ip *);
 int vr_fragment_add(struct vrouter *, unsigned short, struct vr_ip *,
                 unsigned short, unsigned short);
-void vr_fragment_del(struct vr_fragment *);
+void vr_fragment_del(struct vrouter *, struct vr_fragment *);
+int vr_fragment_enqueue(struct vrouter *, unsigned short, struct vr_packet *,
+        struct vr_forwarding_md *);
+void vr_fragment_release(struct vrouter *, struct vr_fragment_key *);
 
 #endif /* __VR_FRAGMENT_H__ */
@@ -63,19 +63,27 @@
 /* An arbitrary initial parameter */
 #define VR_HASH_INITVAL		0xdeadbeef
 
+struct __unaligned_u16 { uint16_t x; } __attribute__((packed));
 struct __unaligned_u32 { uint32_t x; } __attribute__((packed));
+struct __unaligned_u64 { uint64_t x; } __attribute__((packed));
+
+/*
+ * the packed struct tells the compiler that the word may not be aligned,
+ * which is a single load where the cpu can do unaligned loads
+ */
+static inline uint16_t __get_unaligned_half(const void *p)
+{
+    return ((const struct __unaligned_u16 *)p)->x;
+}
+
 static inline uint32_t __get_unaligned_word(const void *p)
 {
-    union {
-        uint8_t bytes[sizeof(uint32_t)];
-        struct __unaligned_u32 u32;
-    } word;
+    return ((const struct __unaligned_u32 *)p)->x;
+}
 
-    size_t i;
-    for (i = 0; i < sizeof(struct __unaligned_u32); i++) {
-        word.bytes[i] = ((uint8_t *) p)[i];
-    }
-    return word.u32.x;
+static inline uint64_t __get_unaligned_dword(const void *p)
+{
+    return ((const struct __unaligned_u64 *)p)->x;
 }
 
 
@@ -189,4 +197,112 @@ static inline uint32_t vr_hash_1word(uint32_t a, uint32_t initval)
 	return vr_hash_3words(a, 0, 0, initval);
 }
 
+/*
+ * hash of the tables that the datapath looks up for every packet (flow,
+ * bridge and fragment). each table picks the function and a random seed
+ * when it is created, and the keys of a table are all of the same length
+ * (or of a couple of lengths), which is what lets the compiler unroll the
+ * loops below for the key sizes of the callers
+ */
+#define VR_HASH_JENKINS         0
+#define VR_HASH_CRC32C          1
+
+struct vr_hash_fn {
+    unsigned int hf_algo;
+    uint32_t hf_seed;
+};
+
+/* set by the platform, if the cpu has the crc32 instruction */
+extern unsigned int vr_hash_crc32c_supported;
+/* whether tables that are created from now on should use crc32-c. opt in */
+extern int vr_hash_crc32c;
+
+extern void vr_hash_fn_init(struct vr_hash_fn *);
+
+#if defined(__x86_64__)
+#define VR_HASH_HAVE_CRC32C     1
+
+static inline uint32_t __vr_crc32c_u64(uint32_t crc, uint64_t v)
+{
+	uint64_t c = crc;
+
+	__asm__("crc32q %1, %0" : "+r" (c) : "rm" (v));
+	return (uint32_t)c;
+}
+
+static inline uint32_t __vr_crc32c_u32(uint32_t crc, uint32_t v)
+{
+	__asm__("crc32l %1, %0" : "+r" (crc) : "rm" (v));
+	return crc;
+}
+
+static inline uint32_t __vr_crc32c_u16(uint32_t crc, uint16_t v)
+{
+	__asm__("crc32w %1, %0" : "+r" (crc) : "rm" (v));
+	return crc;
+}
+
+static inline uint32_t __vr_crc32c_u8(uint32_t crc, uint8_t v)
+{
+	__asm__("crc32b %1, %0" : "+r" (crc) : "rm" (v));
+	return crc;
+}
+
+/*
+ * crc32-c is linear in the seed, which would leave the low bits (the
+ * ones that pick the bucket) of two keys to collide for every seed if
+ * they do for one. the seed hence goes in again through a multiply and
+ * shift finaliser (from murmur3). that does not help keys whose crcs
+ * collide in full, which, crc being affine in the key, can be made
+ * offline in any number. crc32-c is hence only for tables whose keys can
+ * be trusted, and the seeded jenkins hash is the default
+ */
+static inline uint32_t vr_hash_crc32c_key(const void *key, uint32_t length,
+		uint32_t initval)
+{
+	uint32_t crc = initval;
+	const uint8_t *k = key;
+
+	while (length >= 8) {
+		crc = __vr_crc32c_u64(crc, __get_unaligned_dword(k));
+		length -= 8;
+		k += 8;
+	}
+
+	if (length >= 4) {
+		crc = __vr_crc32c_u32(crc, __get_unaligned_word(k));
+		length -= 4;
+		k += 4;
+	}
+
+	if (length >= 2) {
+		crc = __vr_crc32c_u16(crc, __get_unaligned_half(k));
+		length -= 2;
+		k += 2;
+	}
+
+	if (length)
+		crc = __vr_crc32c_u8(crc, *k);
+
+	crc ^= initval;
+	crc ^= crc >> 16;
+	crc *= 0x85ebca6b;
+	crc ^= crc >> 13;
+	crc *= 0xc2b2ae35;
+	crc ^= crc >> 16;
+
+	return crc;
+}
+#endif
+
+static inline uint32_t vr_hash_key(const struct vr_hash_fn *hf,
+		const void *key, uint32_t length)
+{
+#ifdef VR_HASH_HAVE_CRC32C
+	if (hf->hf_algo == VR_HASH_CRC32C)
+		return vr_hash_crc32c_key(key, length, hf->hf_seed);
+#endif
+	return vr_hash(key, length, hf->hf_seed);
+}
+
 #endif /* _VR_HASH_H */
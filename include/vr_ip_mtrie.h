@@ -72,6 +72,20 @@ struct mtrie_bkt_info {
     unsigned int            bi_size;
 };
 
+/* shared with the other inet route table algorithms */
+struct vr_message_dumper;
+struct vr_rtable;
+
+extern void mtrie_dumper_make_response(struct vr_message_dumper *,
+        vr_route_req *, struct ip_bucket_entry *, int8_t *, unsigned int);
+extern int mtrie_dumper_route_encode(struct vr_message_dumper *,
+        vr_route_req *);
+extern struct vr_vrf_stats *mtrie_stats(unsigned short, unsigned int);
+extern int mtrie_stats_get(vr_vrf_stats_req *, vr_vrf_stats_req *);
+extern int mtrie_stats_dump(struct vr_rtable *, vr_vrf_stats_req *);
+extern int mtrie_stats_init(struct vr_rtable *);
+extern void mtrie_stats_cleanup(struct vr_rtable *);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,74 @@
+/*
+ * vr_ip_ptrie.h -- popcount compressed inet route table
+ *
+ * Copyright (c) 2014 Juniper Networks, Inc. All rights reserved.
+ */
+#ifndef __VR_IP_PTRIE_H__
+#define __VR_IP_PTRIE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "vr_ip_mtrie.h"
+
+/*
+ * IpPtrie
+ *
+ * a node covers the same 8 bits of the address that a mtrie bucket does,
+ * but instead of 256 entries of 16 bytes, it carries two bitmaps of 256 bits
+ *
+ * . pn_vector, where a set bit means that the slot points to a child node
+ * . pn_leafvec, where a set bit means that a new run of identical leaves
+ *   starts at the slot (runs are over the slots that are not children)
+ *
+ * and only as many children and leaves as the bitmaps say. the index of the
+ * child (or the leaf) of a slot is the count of set bits of the respective
+ * vector till the slot, which is a base count for the 64 bit word in which
+ * the slot falls plus a popcount within that word. a node hence needs two
+ * memory accesses, and a table with runs of same routes (which most tables
+ * with thousands of vrfs are) takes a fraction of the mtrie memory.
+ *
+ * nodes are never modified once they are visible to the datapath. changes
+ * build new nodes from the root to the changed slots and the new root is
+ * published with a single store, and the old nodes are freed after a grace
+ * period that the request does not wait for.
+ *
+ * there is no path compression (or level skipping). a lookup walks a node
+ * for every byte of the address that the table resolves, up to 4 for inet
+ * and 16 for inet6, which is as many levels as the mtrie walks, at two
+ * accesses a level instead of one. ptrie hence saves memory, and not
+ * lookup latency
+ */
+#define PTRIE_NODE_WORDS            (IPBUCKET_LEVEL_SIZE / 64)
+
+#define PTRIE_NODE_FRESH            0x1
+
+struct ptrie_node {
+    uint64_t pn_vector[PTRIE_NODE_WORDS];
+    uint64_t pn_leafvec[PTRIE_NODE_WORDS];
+    uint16_t pn_child_base[PTRIE_NODE_WORDS];
+    uint16_t pn_leaf_base[PTRIE_NODE_WORDS];
+    struct ptrie_node **pn_children;
+    struct ip_bucket_entry *pn_leaves;
+
+    /* rest are for the control path alone */
+    unsigned short pn_num_children;
+    unsigned short pn_num_leaves;
+    unsigned int pn_journal_flags;
+    struct ptrie_node *pn_journal_next;
+};
+
+struct ip_ptrie {
+    struct ptrie_node *pt_root;
+};
+
+/* nodes that a route change created and replaced */
+struct ptrie_journal {
+    struct ptrie_node *pj_head;
+};
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __VR_IP_PTRIE_H__ */
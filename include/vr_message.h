@@ -27,8 +27,14 @@
 #define VR_VRF_STATS_OBJECT_ID          9
 #define VR_DROP_STATS_OBJECT_ID         10
 #define VR_VXLAN_OBJECT_ID              11
+#define VR_FLOW_BULK_OBJECT_ID          12
 
 #define VR_MESSAGE_PAGE_SIZE            (4096 - 128)
+/*
+ * a dump fills up to these many pages for a request, each of which goes
+ * out as a message of its own, before it asks for the next request
+ */
+#define VR_MESSAGE_DUMP_MAX_PAGES       16
 
 struct vr_mproto {
     unsigned int mproto_type;
@@ -44,6 +50,9 @@ struct vr_mproto {
 struct vr_mtransport {
     char    *(*mtrans_alloc)(unsigned int);
     void    (*mtrans_free)(char *);
+    /* serializes requests, for work that has to run as one. optional */
+    void    (*mtrans_lock)(void);
+    void    (*mtrans_unlock)(void);
 };
 
 struct vr_message {
@@ -67,6 +76,10 @@ struct vr_message_dumper {
     unsigned int dump_buf_len;
     unsigned int dump_resp_len;
     unsigned int dump_offset;
+    /* pages that are full, in the order of the dump */
+    unsigned int dump_num_pages;
+    char *dump_pages[VR_MESSAGE_DUMP_MAX_PAGES - 1];
+    unsigned int dump_page_len[VR_MESSAGE_DUMP_MAX_PAGES - 1];
 };
 
 
@@ -84,6 +97,8 @@ int vr_message_process_response(int (*)(void *, unsigned int, void *), void *);
 int vr_message_dump_object(void *, unsigned int, void *);
 void *vr_mtrans_alloc(unsigned int);
 void vr_mtrans_free(void *);
+void vr_message_lock(void);
+void vr_message_unlock(void);
 
 struct vr_message *vr_message_dequeue_response(void);
 void vr_message_free(struct vr_message *message);
@@ -57,6 +57,26 @@ enum nexthop_type {
 #define NH_SOURCE_VALID                     1
 #define NH_SOURCE_MISMATCH                  2
 
+/*
+ * a tunnel nexthop carries in its nh_data, right after the l2 rewrite, a
+ * template of the outer headers that follow the l2 header (ip, the gre
+ * or the udp header and the mpls or the vxlan header), built when the
+ * nexthop is added. per packet, the template is copied in and only the
+ * fields that change from packet to packet are written
+ */
+#define NH_TUNNEL_TMPL_MAX                  36 /* ip + udp + vxlan */
+#define NH_TUNNEL_TMPL_OFF(encap_len)       (((encap_len) + 3) & ~3)
+
+/*
+ * an ecmp composite maps the flow hash of a packet to a member through a
+ * table of buckets, each of which holds the index of a member. when the
+ * members change, only the buckets of the members that went away (or the
+ * ones needed to balance the new members) move
+ */
+#define NH_ECMP_BUCKETS                     256
+#define NH_ECMP_MAX_MEMBERS                 128
+#define NH_ECMP_BUCKET_NONE                 0xff
+
 struct vr_packet;
 
 struct vr_forwarding_md;
@@ -66,6 +86,18 @@ struct vr_component_nh {
     struct vr_nexthop *cnh;
 };
 
+/*
+ * the members of a composite, and the ecmp buckets built from them, are
+ * one allocation that is published with a single pointer store. the
+ * datapath reads the pointer once and indexes only within the count of
+ * that list. an old list is freed only after a vr_delay_op
+ */
+struct vr_component_list {
+    unsigned short cl_cnt;
+    unsigned char *cl_ecmp_buckets;
+    struct vr_component_nh cl_component[0];
+};
+
 struct vr_nexthop {
     uint8_t         nh_type;
     /*
@@ -88,6 +120,7 @@ struct vr_nexthop {
             unsigned int    tun_sip;
             unsigned int    tun_dip;
             uint16_t        tun_encap_len;
+            uint16_t        tun_tmpl_len;
          } nh_gre_tun;
 
          struct {
@@ -96,11 +129,11 @@ struct vr_nexthop {
             unsigned short  tun_sport;
             unsigned short  tun_dport;
             uint16_t        tun_encap_len;
+            uint16_t        tun_tmpl_len;
          } nh_udp_tun;
 
          struct {
-            unsigned short cnt;
-            struct vr_component_nh *component;
+            struct vr_component_list *list;
          } nh_composite;
 
     } nh_u;
@@ -129,8 +162,9 @@ struct vr_nexthop {
 #define nh_udp_tun_dport        nh_u.nh_udp_tun.tun_dport
 #define nh_gre_tun_encap_len    nh_u.nh_gre_tun.tun_encap_len
 #define nh_udp_tun_encap_len    nh_u.nh_udp_tun.tun_encap_len
-#define nh_component_cnt        nh_u.nh_composite.cnt
-#define nh_component_nh         nh_u.nh_composite.component
+#define nh_gre_tun_tmpl_len     nh_u.nh_gre_tun.tun_tmpl_len
+#define nh_udp_tun_tmpl_len     nh_u.nh_udp_tun.tun_tmpl_len
+#define nh_component_list       nh_u.nh_composite.list
 
 static inline bool
 vr_nexthop_is_vcp(struct vr_nexthop *nh)
@@ -94,6 +94,13 @@ typedef unsigned int __u32;
 #endif
 #endif /* __FreeBSD__ */
 
+/*
+ * orders memory accesses for the compiler only. enough for data that only
+ * its own cpu writes, and which the writer can be interrupted in the
+ * middle of (per cpu caches written from process context, for eg.)
+ */
+#define vr_compiler_barrier()       __asm__ __volatile__("" : : : "memory")
+
 extern int vrouter_dbg;
 
 #endif /* __VR_OS_H__ */
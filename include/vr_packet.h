@@ -24,6 +24,12 @@
 #define VR_IP_PROTO_UDP         17
 #define	VR_IP_PROTO_GRE         47
 #define VR_IP_PROTO_ICMP6       58
+
+/* ipv6 extension headers that the flow key walks past */
+#define VR_IP6_PROTO_HOPOPTS    0
+#define VR_IP6_PROTO_ROUTING    43
+#define VR_IP6_PROTO_FRAG       44
+#define VR_IP6_PROTO_DSTOPTS    60
 #define VR_GRE_FLAG_CSUM        (ntohs(0x8000))
 #define VR_GRE_FLAG_KEY         (ntohs(0x2000)) 
 #define VR_DHCP_SRC_PORT        68
@@ -171,7 +177,9 @@
 #define VP_DROP_ARP_NO_ROUTE                42
 #define VP_DROP_L2_NO_ROUTE                 43
 #define VP_DROP_ARP_REPLY_NO_ROUTE          44
-#define VP_DROP_MAX                         45
+#define VP_DROP_FRAGMENT_QUEUE_FAIL         45
+#define VP_DROP_PKT_POOL_EXHAUSTED          46
+#define VP_DROP_MAX                         47
 
 
 struct vr_drop_stats {
@@ -220,7 +228,8 @@ struct vr_drop_stats {
     uint64_t vds_arp_no_route;
     uint64_t vds_l2_no_route;
     uint64_t vds_arp_reply_no_route;
-
+    uint64_t vds_fragment_queue_fail;
+    uint64_t vds_pkt_pool_exhausted;
 };
 
 /*
@@ -403,6 +412,32 @@ struct vr_ip6 {
     unsigned char ip6_dst[VR_IP6_ADDRESS_LEN];
 } __attribute__((packed));
 
+/* what the hop-by-hop, routing and destination option headers share */
+struct vr_ip6_ext {
+    unsigned char ip6_ext_nxt;
+    /* in units of 8 octets, not counting the first 8 */
+    unsigned char ip6_ext_len;
+} __attribute__((packed));
+
+#define VR_IP6_FRAG_OFFSET_MASK         0xFFF8
+
+struct vr_ip6_frag {
+    unsigned char ip6_frag_nxt;
+    unsigned char ip6_frag_res;
+    unsigned short ip6_frag_off;
+    unsigned int ip6_frag_id;
+} __attribute__((packed));
+
+static inline bool
+vr_ip6_ext_hdr(unsigned char nxt)
+{
+    if ((nxt == VR_IP6_PROTO_HOPOPTS) || (nxt == VR_IP6_PROTO_ROUTING) ||
+            (nxt == VR_IP6_PROTO_FRAG) || (nxt == VR_IP6_PROTO_DSTOPTS))
+        return true;
+
+    return false;
+}
+
 #define MCAST_IP                        (0xE0000000)
 #define MCAST_IP_MASK                   (0xF0000000)
 #define IS_BMCAST_IP(ip) \
@@ -581,12 +616,17 @@ struct vr_udp {
 #define VR_ICMP_TYPE_ECHO           8
 #define VR_ICMP_TYPE_TIME_EXCEEDED 11
 
+#define VR_ICMP6_TYPE_DEST_UNREACH 1
 #define VR_ICMP6_TYPE_PKT_TOO_BIG  2
+#define VR_ICMP6_TYPE_TIME_EXCEEDED 3
+#define VR_ICMP6_TYPE_PARAM_PROB   4
 #define VR_ICMP6_TYPE_ECHO_REQ     128
 #define VR_ICMP6_TYPE_ECHO_REPLY   129
 #define VR_ICMP6_TYPE_ROUTER_SOL   133
+#define VR_ICMP6_TYPE_ROUTER_AD    134
 #define VR_ICMP6_TYPE_NEIGH_SOL    135
 #define VR_ICMP6_TYPE_NEIGH_AD     136
+#define VR_ICMP6_TYPE_REDIRECT     137
 
 struct vr_icmp {
     uint8_t icmp_type;
@@ -610,6 +650,31 @@ vr_icmp_echo(struct vr_icmp *icmph)
     return false;
 }
 
+static inline bool
+vr_icmp6_echo(struct vr_icmp *icmph)
+{
+    uint8_t type = icmph->icmp_type;
+
+    if ((type == VR_ICMP6_TYPE_ECHO_REQ) ||
+            (type == VR_ICMP6_TYPE_ECHO_REPLY))
+        return true;
+
+    return false;
+}
+
+/* neighbor discovery. what arp is for ipv4 */
+static inline bool
+vr_icmp6_nd(struct vr_icmp *icmph)
+{
+    uint8_t type = icmph->icmp_type;
+
+    if ((type >= VR_ICMP6_TYPE_ROUTER_SOL) &&
+            (type <= VR_ICMP6_TYPE_REDIRECT))
+        return true;
+
+    return false;
+}
+
 static inline bool
 vr_icmp_error(struct vr_icmp *icmph)
 {
@@ -622,6 +687,18 @@ vr_icmp_error(struct vr_icmp *icmph)
     return false;
 }
 
+static inline bool
+vr_icmp6_error(struct vr_icmp *icmph)
+{
+    uint8_t type = icmph->icmp_type;
+
+    if ((type >= VR_ICMP6_TYPE_DEST_UNREACH) &&
+            (type <= VR_ICMP6_TYPE_PARAM_PROB))
+        return true;
+
+    return false;
+}
+
 struct vr_gre {
     unsigned short gre_flags;
     unsigned short gre_proto;
@@ -682,6 +759,12 @@ struct vr_vxlan {
                                       VR_VXLAN_HDR_LEN + \
                                         VR_L2_MCAST_CTRL_DATA_LEN)
 
+/*
+ * the header buffer of a replica that shares the data with the original
+ * carries whatever the l2 mcast replication would push
+ */
+#define VR_MCAST_REPLICA_HEAD_SPACE VR_L2_MCAST_PKT_HEAD_SPACE
+
 
 extern unsigned short vr_ip_csum(struct vr_ip *);
 extern unsigned short vr_generate_unique_ip_id(void);
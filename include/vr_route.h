@@ -75,6 +75,8 @@ struct vr_rtable {
     int (*algo_add)(struct vr_rtable *, struct vr_route_req *);
     int (*algo_del)(struct vr_rtable *, struct vr_route_req *);
     struct vr_nexthop *(*algo_lookup)(unsigned int, struct vr_route_req *);
+    struct vr_nexthop *(*algo_addr_lookup)(unsigned int, unsigned int,
+            uint8_t *, unsigned int *, unsigned short *);
     int (*algo_get)(unsigned int, struct vr_route_req *);
     int (*algo_dump)(struct vr_rtable *, struct vr_route_req *);
     struct vr_vrf_stats *(*algo_stats)(unsigned short, unsigned int);
@@ -85,6 +87,77 @@ struct vr_rtable {
     struct vr_vrf_stats **vrf_stats;
 };
 
+/*
+ * ptrie is a memory option only. it shrinks the inet and inet6 tables, but
+ * walks as many levels as mtrie does, at two accesses a level instead of
+ * one, and hence does not cut the lookup latency (vr_ip_ptrie.h)
+ */
+#define VR_INET_RTABLE_ALGO_MTRIE   0
+#define VR_INET_RTABLE_ALGO_PTRIE   1
+
+/*
+ * a flat, read only copy of the route requests (inet, inet6 and bridge)
+ * that the agent added, that the agent and the utilities can mmap from
+ * the flow memory device at VR_ROUTE_EXPORT_MMAP_OFFSET and read without
+ * sending any message. the first entry is the header. a route is in the
+ * slot that the hash of its key (the first VR_ROUTE_EXPORT_KEY_SIZE
+ * bytes) points to, or in one of the VR_ROUTE_EXPORT_PROBES slots that
+ * follow it.
+ *
+ * the export mirrors the requests, and is not the forwarding table. it is
+ * one table for all the vrfs, keyed by vrf, family and prefix, and holds
+ * each route the way it was added: there is no longest prefix match to
+ * be done in it, and the nexthop is the id the agent gave, not what the
+ * datapath resolved it to.
+ *
+ * readers go by the sequence counts. the header generation is odd while
+ * the export is being changed and so is the sequence of an entry while
+ * the entry is being written. a reader that sees a generation or a
+ * sequence change while it reads has to read again.
+ *
+ * routes that did not find a slot are counted in reh_overflows. the
+ * export then does not have all the routes, and stays so till the routes
+ * are reset: readers have to treat an export with a non zero
+ * reh_overflows as not valid, and get the routes with a dump instead.
+ * the default number of slots is for a few hundred thousand routes, and
+ * vr_route_export_entries has to be raised, to about twice the number of
+ * routes, for more
+ */
+#define VR_ROUTE_EXPORT_MAGIC           0x76727278 /* "vrrx" */
+#define VR_ROUTE_EXPORT_VERSION         1
+#define VR_ROUTE_EXPORT_MMAP_OFFSET     (1ULL << 36)
+#define VR_ROUTE_EXPORT_PROBES          32
+#define VR_DEF_ROUTE_EXPORT_ENTRIES     (256 * 1024)
+
+/* re_family of slots that do not have a route */
+#define VR_ROUTE_EXPORT_FREE            0
+#define VR_ROUTE_EXPORT_DELETED         0xff
+
+struct vr_route_export_header {
+    uint32_t reh_magic;
+    uint16_t reh_version;
+    uint16_t reh_entry_size;
+    uint32_t reh_entries;
+    uint32_t reh_gen;
+    uint32_t reh_overflows;
+    uint32_t reh_pad[3];
+};
+
+struct vr_route_export_entry {
+    uint16_t re_vrf;
+    uint8_t re_family;
+    uint8_t re_prefix_len;
+    /* the mac, for bridge entries */
+    uint8_t re_prefix[16];
+    int32_t re_nh_id;
+    uint32_t re_label;
+    uint16_t re_label_flags;
+    uint16_t re_seq;
+};
+
+/* re_vrf through re_prefix */
+#define VR_ROUTE_EXPORT_KEY_SIZE        20
+
 typedef int (*algo_init_decl)(struct vr_rtable *, struct rtable_fspec *);
 typedef void (*algo_deinit_decl)(struct vr_rtable *, struct rtable_fspec *, bool);
 
@@ -107,6 +180,16 @@ extern void vr_fib_exit(struct vrouter *, bool);
 extern int vr_route_add(vr_route_req *);
 extern struct vr_nexthop *(*vr_inet_route_lookup)(unsigned int,
                struct vr_route_req *);
+extern struct vr_nexthop *(*vr_inet_addr_lookup)(unsigned int, unsigned int,
+               uint8_t *, unsigned int *, unsigned short *);
+extern struct vr_nexthop *vr_inet4_lookup(unsigned int, uint32_t,
+               unsigned int *, unsigned short *);
+extern struct vr_nexthop *vr_inet6_lookup(unsigned int, uint8_t *,
+               unsigned int *, unsigned short *);
+extern void vr_inet_route_cache_invalidate(unsigned int);
+extern void vr_inet_route_cache_flush(void);
+extern unsigned int vr_route_export_size(struct vrouter *);
+extern void *vr_route_export_get_va(struct vrouter *, uint64_t);
 
 #ifdef __cplusplus
 }
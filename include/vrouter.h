@@ -19,6 +19,7 @@ extern "C" {
 #include "vr_response.h"
 #include "vr_mpls.h"
 #include "vr_index_table.h"
+#include "vr_hash.h"
 
 #define VR_NATIVE_VRF       0
 
@@ -28,12 +29,16 @@ extern unsigned int vr_num_cpus;
 extern int vr_perfr;
 extern int vr_mudp;
 extern int vr_perfs;
+extern int vr_mcast_split;
+extern int vr_ecmp_hash;
+extern int vr_ecmp_flow_record;
 extern int vr_perfp;
 extern int vr_perfr1, vr_perfr2, vr_perfr3;
 extern int vr_perfq1, vr_perfq2, vr_perfq3;
 extern int vr_from_vm_mss_adj;
 extern int vr_to_vm_mss_adj;
 extern int vr_udp_coff;
+extern int vr_tunnel_gso;
 extern int vr_use_linux_br;
 extern int hashrnd_inited;
 extern uint32_t vr_hashrnd;
@@ -46,6 +51,7 @@ extern uint32_t vr_hashrnd;
 typedef void(*vr_defer_cb)(struct vrouter *router, void *user_data);
 
 struct vr_ip;
+struct vr_burst;
 
 struct vr_timer {
     void (*vt_timer)(void *);
@@ -76,7 +82,9 @@ struct host_os {
     unsigned int (*hos_pgso_size)(struct vr_packet *);
 
     unsigned int (*hos_get_cpu)(void);
-    void (*hos_schedule_work)(unsigned int, void (*)(void *), void *);
+    int (*hos_schedule_work)(unsigned int, void (*)(void *), void *);
+    /* for work that sleeps, which the datapath's read side can not have */
+    int (*hos_schedule_process_work)(unsigned int, void (*)(void *), void *);
     void (*hos_delay_op)(void);
     void (*hos_defer)(struct vrouter *, vr_defer_cb, void *);
     void *(*hos_get_defer_data)(unsigned int);
@@ -127,6 +135,7 @@ struct host_os {
 #define vr_pset_data                    vrouter_host->hos_pset_data
 #define vr_get_cpu                      vrouter_host->hos_get_cpu
 #define vr_schedule_work                vrouter_host->hos_schedule_work
+#define vr_schedule_process_work        vrouter_host->hos_schedule_process_work
 #define vr_delay_op                     vrouter_host->hos_delay_op
 #define vr_defer                        vrouter_host->hos_defer
 #define vr_get_defer_data               vrouter_host->hos_get_defer_data
@@ -160,11 +169,24 @@ struct vrouter {
     struct vr_rtable *vr_inet6_rtable;
     struct vr_rtable *vr_inet_mcast_rtable;
     struct vr_rtable *vr_bridge_rtable;
+    struct vr_btable *vr_route_export;
 
+    struct vr_hash_fn vr_flow_hash;
     struct vr_btable *vr_flow_table;
     struct vr_btable *vr_oflow_table;
+    struct vr_btable *vr_flow_tags;
+    struct vr_btable *vr_flow6_addr_table;
+    struct vr_btable *vr_flow_miss_ring;
     struct vr_flow_table_info *vr_flow_table_info;
     unsigned int vr_flow_table_info_size;
+    struct vr_flow_cache **vr_flow_caches;
+    struct vr_btable *vr_flow_gens;
+    unsigned int vr_flow_cache_gen;
+    struct vr_flow_pcpu_stats **vr_flow_pcpu_stats;
+    struct vr_timer *vr_flow_stats_timer;
+    struct vr_btable *vr_flow_age_table;
+    struct vr_flow_ageing *vr_flow_ageing;
+    struct vr_timer *vr_flow_age_timer;
 
     unsigned int vr_max_labels;
     struct vr_nexthop **vr_ilm;
@@ -174,12 +196,15 @@ struct vrouter {
     vr_itable_t vr_mirror_md;
     vr_itable_t vr_vxlan_table;
 
+    struct vr_hash_fn vr_fragment_hash;
     struct vr_btable *vr_fragment_table;
-    struct vr_btable *vr_fragment_otable;
+    struct vr_fragment_partition *vr_fragment_partitions;
     struct vr_timer *vr_fragment_table_scanner;
-    struct vr_timer *vr_fragment_otable_scanner;
+    struct vr_fragment_queue *vr_fragment_queues;
+    unsigned int vr_fragment_queued;
 
     uint64_t **vr_pdrop_stats;
+    struct vr_burst *vr_rx_bursts;
 
     uint16_t vr_link_local_ports_size;
     unsigned char *vr_link_local_ports;
@@ -146,9 +146,26 @@ netlink_trans_request(struct sk_buff *in_skb, struct genl_info *info)
     return 0;
 }
 
+/* requests run under genl_mutex, since the family is not parallel_ops */
+static void
+netlink_trans_lock(void)
+{
+    genl_lock();
+    return;
+}
+
+static void
+netlink_trans_unlock(void)
+{
+    genl_unlock();
+    return;
+}
+
 static struct vr_mtransport netlink_transport = {
     .mtrans_alloc              =       netlink_trans_alloc,
     .mtrans_free               =       netlink_trans_free,
+    .mtrans_lock               =       netlink_trans_lock,
+    .mtrans_unlock             =       netlink_trans_unlock,
 };
 
 
@@ -522,6 +522,128 @@ linux_gso_xmit(struct vr_interface *vif, struct sk_buff *skb,
     return;
 }
 
+/*
+ * linux_tunnel_gso_xmit - send a tunneled gso packet as it is, with the
+ * inner packet marked as encapsulated, so that the NIC (or the gso of the
+ * stack, late and only if the NIC can not) segments the inner TCP stream
+ * and replicates the tunnel headers. the inner segment size is cut such
+ * that no segment needs fragmentation. returns 0 if the packet was sent,
+ * in which case the caller should not touch the skb anymore.
+ */
+static int
+linux_tunnel_gso_xmit(struct vr_interface *vif, struct sk_buff *skb,
+        unsigned short type)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,18,0))
+    struct net_device *ndev = skb->dev;
+    struct skb_shared_info *sinfo = skb_shinfo(skb);
+    struct vr_ip *iph;
+    struct udphdr *udph;
+    struct tcphdr *th;
+    unsigned int ethlen, iphlen, hdr_len, seg_size, gso_size, gso_type;
+    int inner_network_off, inner_transport_off;
+    __be16 inner_protocol;
+
+    if (!vr_tunnel_gso)
+        return -EOPNOTSUPP;
+
+    if (type == VP_TYPE_IPOIP)
+        inner_protocol = htons(ETH_P_IP);
+    else if (type == VP_TYPE_IP6OIP)
+        inner_protocol = htons(ETH_P_IPV6);
+    else
+        return -EOPNOTSUPP;
+
+    /* only tcp is segmented inside a tunnel */
+    if (!(sinfo->gso_type & (SKB_GSO_TCPV4 | SKB_GSO_TCPV6)) ||
+            (skb->ip_summed != CHECKSUM_PARTIAL) || skb->encapsulation)
+        return -EOPNOTSUPP;
+
+    ethlen = (ndev->type == ARPHRD_ETHER) ? ETH_HLEN : 0;
+    if (!pskb_may_pull(skb, ethlen + sizeof(struct vr_ip)))
+        return -EOPNOTSUPP;
+
+    iph = (struct vr_ip *)(skb->data + ethlen);
+    iphlen = iph->ip_hl * 4;
+    if (iph->ip_version != 4)
+        return -EOPNOTSUPP;
+
+    if (iph->ip_proto == VR_IP_PROTO_UDP)
+        gso_type = SKB_GSO_UDP_TUNNEL;
+    else if (iph->ip_proto == VR_IP_PROTO_GRE)
+        gso_type = SKB_GSO_GRE;
+    else
+        return -EOPNOTSUPP;
+
+    inner_network_off = skb_network_offset(skb);
+    inner_transport_off = skb_transport_offset(skb);
+    if (inner_network_off < (int)(ethlen + iphlen) ||
+            inner_transport_off <= inner_network_off)
+        return -EOPNOTSUPP;
+
+    if ((gso_type == SKB_GSO_UDP_TUNNEL) &&
+            !pskb_may_pull(skb, ethlen + iphlen + sizeof(struct udphdr)))
+        return -EOPNOTSUPP;
+
+    /* the inner segments, with all the headers, have to fit the mtu */
+    th = tcp_hdr(skb);
+    hdr_len = inner_transport_off + (th->doff * 4);
+    if (skb->len <= hdr_len)
+        return -EOPNOTSUPP;
+
+    gso_size = sinfo->gso_size;
+    seg_size = gso_size + hdr_len;
+    if (seg_size > ndev->mtu + ndev->hard_header_len) {
+        if (gso_size <= (seg_size - ndev->mtu - ndev->hard_header_len))
+            return -EOPNOTSUPP;
+        gso_size -= (seg_size - ndev->mtu - ndev->hard_header_len);
+    }
+
+    /*
+     * from here on, the headers and the shared info are written. a mirrored
+     * or a replicated packet shares them with its clones, which should not
+     * see any of it
+     */
+    if (skb_unclone(skb, GFP_ATOMIC))
+        return -EOPNOTSUPP;
+    sinfo = skb_shinfo(skb);
+
+    /*
+     * outer udp checksum is left 0, which is what the segments go out
+     * with. the segmentation fixes the lengths and the outer ip header
+     */
+    if (gso_type == SKB_GSO_UDP_TUNNEL) {
+        udph = (struct udphdr *)(skb->data + ethlen + iphlen);
+        udph->check = 0;
+    }
+
+    /* there is no inner mac header. the inner packet is l3 */
+    skb->encapsulation = 1;
+    skb_set_inner_protocol(skb, inner_protocol);
+    skb_set_inner_mac_header(skb, inner_network_off);
+    skb_set_inner_network_header(skb, inner_network_off);
+    skb_set_inner_transport_header(skb, inner_transport_off);
+
+    skb_set_network_header(skb, ethlen);
+    skb_set_transport_header(skb, ethlen + iphlen);
+    skb->mac_len = ethlen;
+    skb->protocol = htons(ETH_P_IP);
+
+    /* qdisc and driver (bql) accounting go by the count of segments */
+    sinfo->gso_size = gso_size;
+    sinfo->gso_type |= gso_type;
+    sinfo->gso_segs = DIV_ROUND_UP(skb->len - hdr_len, gso_size);
+
+    /* skb->cb is the vr_packet, which is of no use anymore */
+    memset(skb->cb, 0, sizeof(skb->cb));
+    dev_queue_xmit(skb);
+
+    return 0;
+#else
+    return -EOPNOTSUPP;
+#endif
+}
+
 #ifdef CONFIG_RPS
 
 /*
@@ -918,8 +1040,18 @@ linux_if_tx(struct vr_interface *vif, struct vr_packet *pkt)
                         sinfo->gso_type |= SKB_GSO_UDP;
                     }
                 }
+            }
+
+            if (skb_is_gso(skb) && (vif->vif_type == VIF_TYPE_PHYSICAL)) {
+                /*
+                 * segmentation of the inner packet, by the NIC if it can,
+                 * is what we want most, then segmentation in software.
+                 * fragmentation of the outer packet is the last resort
+                 */
+                if (!linux_tunnel_gso_xmit(vif, skb, pkt->vp_type))
+                    return 0;
 
-                if (vif->vif_type == VIF_TYPE_PHYSICAL) {
+                if (pkt->vp_flags & VP_FLAG_GSO) {
                     linux_gso_xmit(vif, skb, pkt->vp_type);
                     return 0;
                 }
@@ -18,6 +18,10 @@
 #define MEM_DEV_MINOR_START     0
 #define MEM_DEV_NUM_DEVS        1
 
+/* the route export is mapped at a fixed offset past the flow tables */
+#define MEM_DEV_ROUTE_EXPORT_PGOFF  \
+    (unsigned long)(VR_ROUTE_EXPORT_MMAP_OFFSET >> PAGE_SHIFT)
+
 short vr_flow_major = -1;
 static dev_t mem_dev;
 struct cdev *mem_cdev;
@@ -28,9 +32,18 @@ mem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
     struct vrouter *router = (struct vrouter *)vma->vm_private_data;
     struct page *page;
     pgoff_t offset;
+    void *va;
 
     offset = vmf->pgoff;
-    page = virt_to_page(vr_flow_get_va(router, offset << PAGE_SHIFT));
+    if (offset >= MEM_DEV_ROUTE_EXPORT_PGOFF)
+        va = vr_route_export_get_va(router,
+                (uint64_t)(offset - MEM_DEV_ROUTE_EXPORT_PGOFF) << PAGE_SHIFT);
+    else
+        va = vr_flow_get_va(router, offset << PAGE_SHIFT);
+    if (!va)
+        return VM_FAULT_SIGBUS;
+
+    page = virt_to_page(va);
     get_page(page);
     vmf->page = page;
     return 0;
@@ -44,19 +57,30 @@ static int
 mem_dev_mmap(struct file *fp, struct vm_area_struct *vma)
 {
     struct vrouter *router = (struct vrouter *)fp->private_data;
-    unsigned long size, flow_table_size;
+    unsigned long size, table_size, pgoff;
 
     if (!router)
         return -ENOMEM;
 
     size = vma->vm_end - vma->vm_start;
-    flow_table_size = vr_flow_table_size(router) +
-        vr_oflow_table_size(router);
-    if (size > flow_table_size)
+    if (vma->vm_pgoff >= MEM_DEV_ROUTE_EXPORT_PGOFF) {
+        /* the route export is for reading alone */
+        if (vma->vm_flags & VM_WRITE)
+            return -EACCES;
+        vma->vm_flags &= ~VM_MAYWRITE;
+
+        table_size = vr_route_export_size(router);
+        pgoff = vma->vm_pgoff - MEM_DEV_ROUTE_EXPORT_PGOFF;
+    } else {
+        table_size = vr_flow_table_size(router) +
+            vr_oflow_table_size(router) + vr_flow_miss_ring_size(router);
+        pgoff = vma->vm_pgoff;
+    }
+
+    if (size > table_size)
         return -EINVAL;
 
-    if (vma->vm_pgoff + (size >> PAGE_SHIFT) >
-            (flow_table_size >> PAGE_SHIFT))
+    if (pgoff + (size >> PAGE_SHIFT) > (table_size >> PAGE_SHIFT))
         return -EINVAL;
 
     vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
@@ -17,6 +17,9 @@
 #include <linux/version.h>
 #include <linux/if_vlan.h>
 #include <linux/icmp.h>
+#if defined(CONFIG_X86_64)
+#include <asm/cpufeature.h>
+#endif
 
 #include "vr_packet.h"
 #include "vr_interface.h"
@@ -35,6 +38,9 @@ unsigned int vr_num_cpus = 1;
 
 extern int vr_flow_entries;
 extern int vr_oflow_entries;
+extern unsigned int vr_flow_age_timeout;
+extern unsigned int vr_inet_rtable_algo;
+extern unsigned int vr_route_export_entries;
 
 extern unsigned int vr_bridge_entries;
 extern unsigned int vr_bridge_oentries;
@@ -376,20 +382,49 @@ lh_work(struct work_struct *work)
     return;
 }
 
+/*
+ * work that can sleep (take the request lock, wait for the datapath), and
+ * hence does not run inside a read side critical section
+ */
 static void
-lh_schedule_work(unsigned int cpu, void (*fn)(void *), void *arg)
+lh_process_work(struct work_struct *work)
+{
+    struct work_arg *wa = container_of(work, struct work_arg, wa_work);
+
+    wa->fn(wa->wa_arg);
+    kfree(wa);
+
+    return;
+}
+
+static int
+__lh_schedule_work(unsigned int cpu, void (*fn)(void *), void *arg,
+        work_func_t work_fn)
 {
-    struct work_arg *wa = kzalloc(sizeof(*wa), GFP_KERNEL);
+    /* timers (flow ageing, for eg.) schedule work from softirq context */
+    struct work_arg *wa = kzalloc(sizeof(*wa), GFP_ATOMIC);
 
     if (!wa)
-        return;
+        return -ENOMEM;
 
     wa->fn = fn;
     wa->wa_arg = arg;
-    INIT_WORK(&wa->wa_work, lh_work);
+    INIT_WORK(&wa->wa_work, work_fn);
     schedule_work_on(cpu, &wa->wa_work);
 
-    return;
+    return 0;
+}
+
+static int
+lh_schedule_work(unsigned int cpu, void (*fn)(void *), void *arg)
+{
+    return __lh_schedule_work(cpu, fn, arg, lh_work);
+}
+
+static int
+lh_schedule_process_work(unsigned int cpu, void (*fn)(void *), void *arg)
+{
+    return __lh_schedule_work(cpu, fn, arg, lh_process_work);
 }
 
 static void
@@ -639,7 +674,7 @@ lh_get_udp_src_port(struct vr_packet *pkt, struct vr_forwarding_md *fmd,
         hash_key[3] = sport;
         hash_key[4] = dport;
 
-        hashval = jhash(hash_key, 20, vr_hashrnd);
+        hashval = vr_hash2(hash_key, 5, vr_hashrnd);
         lh_reset_skb_fields(pkt);
     } else {
 
@@ -2334,6 +2369,7 @@ struct host_os linux_host = {
 
     .hos_get_cpu                    =       lh_get_cpu,
     .hos_schedule_work              =       lh_schedule_work,
+    .hos_schedule_process_work      =       lh_schedule_process_work,
     .hos_delay_op                   =       lh_delay_op,
     .hos_defer                      =       lh_defer,
     .hos_get_defer_data             =       lh_get_defer_data,
@@ -2429,6 +2465,34 @@ static struct ctl_table vrouter_table[] =
         .mode           = 0644,
         .proc_handler   = proc_dointvec,
     },
+    {
+        .procname       = "mcast_split",
+        .data           = &vr_mcast_split,
+        .maxlen         = sizeof(int),
+        .mode           = 0644,
+        .proc_handler   = proc_dointvec,
+    },
+    {
+        .procname       = "ecmp_hash",
+        .data           = &vr_ecmp_hash,
+        .maxlen         = sizeof(int),
+        .mode           = 0644,
+        .proc_handler   = proc_dointvec,
+    },
+    {
+        .procname       = "ecmp_flow_record",
+        .data           = &vr_ecmp_flow_record,
+        .maxlen         = sizeof(int),
+        .mode           = 0644,
+        .proc_handler   = proc_dointvec,
+    },
+    {
+        .procname       = "hash_crc32c",
+        .data           = &vr_hash_crc32c,
+        .maxlen         = sizeof(int),
+        .mode           = 0644,
+        .proc_handler   = proc_dointvec,
+    },
     {
         .procname       = "perfp",
         .data           = &vr_perfp,
@@ -2499,6 +2563,13 @@ static struct ctl_table vrouter_table[] =
         .mode           = 0644,
         .proc_handler   = proc_dointvec,
     },
+    {
+        .procname       = "tunnel_gso",
+        .data           = &vr_tunnel_gso,
+        .maxlen         = sizeof(int),
+        .mode           = 0644,
+        .proc_handler   = proc_dointvec,
+    },
     {}
 };
 
@@ -2554,6 +2625,11 @@ vrouter_linux_init(void)
         return -1;
     }
 
+#if defined(CONFIG_X86_64)
+    /* sse4.2 brings the crc32 instruction */
+    vr_hash_crc32c_supported = boot_cpu_has(X86_FEATURE_XMM4_2);
+#endif
+
     ret = vrouter_init();
     if (ret)
         return ret;
@@ -2577,6 +2653,9 @@ init_fail:
 
 module_param(vr_flow_entries, int, 0);
 module_param(vr_oflow_entries, int, 0);
+module_param(vr_flow_age_timeout, uint, 0);
+module_param(vr_inet_rtable_algo, uint, 0);
+module_param(vr_route_export_entries, uint, 0);
 
 module_param(vr_bridge_entries, int, 0);
 module_param(vr_bridge_oentries, int, 0);
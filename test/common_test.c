@@ -1,4 +1,11 @@
 #include "vr_types.h"
+#include "vr_os.h"
+#include "vr_defs.h"
+#include "vr_message.h"
+#include "vr_nexthop.h"
+#include "vr_route.h"
+
+#include "common_test.h"
 
 void
 get_random_bytes(void *buf, int nbytes)
@@ -18,3 +25,58 @@ jhash(void *key, uint32_t length, uint32_t interval)
     return ret;
 }
 
+int
+test_response_cb(void *arg, unsigned int object_type, void *object)
+{
+    if (arg && (object_type == VR_RESPONSE_OBJECT_ID))
+        *(int *)arg = ((vr_response *)object)->resp_code;
+
+    return 1;
+}
+
+int
+test_nexthop_add(int id, int type, int flags, int *nh_list,
+        unsigned int nh_list_size)
+{
+    int ret = -EFAULT;
+    vr_nexthop_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.h_op = SANDESH_OP_ADD;
+    req.nhr_id = id;
+    req.nhr_type = type;
+    req.nhr_family = AF_INET;
+    req.nhr_flags = NH_FLAG_VALID | flags;
+    req.nhr_nh_list = nh_list;
+    req.nhr_nh_list_size = nh_list_size;
+
+    vr_nexthop_req_process(&req);
+    vr_message_process_response(test_response_cb, &ret);
+
+    return ret;
+}
+
+int
+test_route_add(unsigned int vrf, int family, uint8_t *prefix,
+        unsigned int prefix_len, int nh_id, int label)
+{
+    int ret = -EFAULT;
+    vr_route_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.h_op = SANDESH_OP_ADD;
+    req.rtr_vrf_id = vrf;
+    req.rtr_family = family;
+    req.rtr_prefix = (int8_t *)prefix;
+    req.rtr_prefix_size = RT_IP_ADDR_SIZE(family);
+    req.rtr_prefix_len = prefix_len;
+    req.rtr_nh_id = nh_id;
+    req.rtr_label = label;
+    if (label >= 0)
+        req.rtr_label_flags = VR_RT_LABEL_VALID_FLAG;
+
+    vr_route_req_process(&req);
+    vr_message_process_response(test_response_cb, &ret);
+
+    return ret;
+}
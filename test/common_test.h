@@ -6,4 +6,11 @@
 void get_random_bytes(void *buf, int nbytes);
 uint32_t jhash(void *key, uint32_t length, uint32_t interval);
 
+/* picks the return code of a request out of its response ('arg') */
+int test_response_cb(void *arg, unsigned int object_type, void *object);
+int test_nexthop_add(int id, int type, int flags, int *nh_list,
+        unsigned int nh_list_size);
+int test_route_add(unsigned int vrf, int family, uint8_t *prefix,
+        unsigned int prefix_len, int nh_id, int label);
+
 #endif /* __COMMON_TEST_H__ */
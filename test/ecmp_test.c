@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "vr_types.h"
+#include "vr_os.h"
+#include "vr_defs.h"
+#include "vr_packet.h"
+#include "vr_message.h"
+#include "vr_nexthop.h"
+#include "vrouter.h"
+
+#include "host/vr_host.h"
+
+#include "common_test.h"
+
+#define TEST_MEMBERS        5
+#define TEST_ABSENT_NH      20
+#define TEST_ECMP_NH        30
+
+extern int vrouter_host_init(unsigned int);
+
+static int ecmp_add(int *members, unsigned int count) {
+    int ret = -EFAULT;
+    unsigned int i;
+    int labels[NH_ECMP_MAX_MEMBERS];
+    vr_nexthop_req req;
+
+    for (i = 0; i < count; i++)
+        labels[i] = 100 + members[i];
+
+    memset(&req, 0, sizeof(req));
+    req.h_op = SANDESH_OP_ADD;
+    req.nhr_id = TEST_ECMP_NH;
+    req.nhr_type = NH_COMPOSITE;
+    req.nhr_family = AF_INET;
+    req.nhr_flags = NH_FLAG_VALID | NH_FLAG_COMPOSITE_ECMP;
+    req.nhr_nh_list = members;
+    req.nhr_nh_list_size = count;
+    req.nhr_label_list = labels;
+    req.nhr_label_list_size = count;
+
+    vr_nexthop_req_process(&req);
+    vr_message_process_response(test_response_cb, &ret);
+
+    return ret;
+}
+
+static struct vr_nexthop *ecmp_nh(void) {
+    return __vrouter_get_nexthop(vrouter_get(0), TEST_ECMP_NH);
+}
+
+static struct vr_nexthop *member_nh(int id) {
+    return __vrouter_get_nexthop(vrouter_get(0), id);
+}
+
+/* what member nexthop each bucket goes to */
+static void ecmp_buckets(struct vr_nexthop **buckets) {
+    unsigned int i;
+    struct vr_component_list *cl = ecmp_nh()->nh_component_list;
+
+    assert_non_null(cl);
+    assert_non_null(cl->cl_ecmp_buckets);
+    for (i = 0; i < NH_ECMP_BUCKETS; i++) {
+        assert_true(cl->cl_ecmp_buckets[i] < cl->cl_cnt);
+        buckets[i] = cl->cl_component[cl->cl_ecmp_buckets[i]].cnh;
+        assert_non_null(buckets[i]);
+    }
+}
+
+static unsigned int bucket_count(struct vr_nexthop **buckets,
+        struct vr_nexthop *nh) {
+    unsigned int i, count = 0;
+
+    for (i = 0; i < NH_ECMP_BUCKETS; i++) {
+        if (buckets[i] == nh)
+            count++;
+    }
+
+    return count;
+}
+
+void ecmp_bucket_balance_test(void **state) {
+    int i;
+    int members[] = { 1, 2, 3, 4 };
+    int partial[] = { 1, TEST_ABSENT_NH, 2 };
+    struct vr_nexthop *buckets[NH_ECMP_BUCKETS];
+
+    /* every member has its share of the buckets */
+    assert_int_equal(ecmp_add(members, 4), 0);
+    ecmp_buckets(buckets);
+    for (i = 0; i < 4; i++)
+        assert_int_equal(bucket_count(buckets, member_nh(members[i])),
+                NH_ECMP_BUCKETS / 4);
+
+    /* and a member that is not there has none */
+    assert_int_equal(ecmp_add(partial, 3), 0);
+    ecmp_buckets(buckets);
+    assert_int_equal(bucket_count(buckets, member_nh(1)), NH_ECMP_BUCKETS / 2);
+    assert_int_equal(bucket_count(buckets, member_nh(2)), NH_ECMP_BUCKETS / 2);
+}
+
+void ecmp_bucket_resilience_test(void **state) {
+    unsigned int i, moved = 0, count;
+    int members[] = { 1, 2, 3, 4 };
+    int fewer[] = { 1, 2, 3 };
+    int other[] = { 1, 2, 3, 5 };
+    int reordered[] = { 5, 3, 2, 1 };
+    struct vr_nexthop *before[NH_ECMP_BUCKETS], *after[NH_ECMP_BUCKETS];
+
+    assert_int_equal(ecmp_add(members, 4), 0);
+    ecmp_buckets(before);
+
+    /* a member that goes away takes only its own buckets along */
+    assert_int_equal(ecmp_add(fewer, 3), 0);
+    ecmp_buckets(after);
+    for (i = 0; i < NH_ECMP_BUCKETS; i++) {
+        if (before[i] != member_nh(4))
+            assert_ptr_equal(after[i], before[i]);
+    }
+
+    for (i = 0; i < 3; i++) {
+        count = bucket_count(after, member_nh(fewer[i]));
+        assert_true(count == NH_ECMP_BUCKETS / 3 ||
+                count == NH_ECMP_BUCKETS / 3 + 1);
+    }
+
+    /* a member that comes in takes its share, and not a bucket more */
+    memcpy(before, after, sizeof(before));
+    assert_int_equal(ecmp_add(other, 4), 0);
+    ecmp_buckets(after);
+    for (i = 0; i < NH_ECMP_BUCKETS; i++) {
+        if (after[i] != before[i]) {
+            assert_ptr_equal(after[i], member_nh(5));
+            moved++;
+        }
+    }
+    assert_int_equal(moved, NH_ECMP_BUCKETS / 4);
+
+    /* the buckets follow the members, and not where they are in the list */
+    memcpy(before, after, sizeof(before));
+    assert_int_equal(ecmp_add(reordered, 4), 0);
+    ecmp_buckets(after);
+    assert_memory_equal(after, before, sizeof(before));
+}
+
+/* sends a udp packet to the composite, and returns the member picked */
+static int ecmp_pick(unsigned short sport, bool fragment) {
+    struct vr_ip *ip;
+    struct vr_packet *pkt;
+    struct vr_forwarding_md fmd;
+    struct vr_nexthop *nh = ecmp_nh();
+
+    pkt = vr_palloc(128);
+    assert_non_null(pkt);
+    ip = (struct vr_ip *)pkt_data(pkt);
+    assert_non_null(pkt_pull_tail(pkt, sizeof(*ip) + 8));
+    memset(ip, 0, sizeof(*ip) + 8);
+
+    ip->ip_version = 4;
+    ip->ip_hl = 5;
+    ip->ip_ttl = 64;
+    ip->ip_proto = VR_IP_PROTO_UDP;
+    ip->ip_saddr = htonl(0x0a000001);
+    ip->ip_daddr = htonl(0x0a000002);
+    if (fragment)
+        ip->ip_frag_off = htons(VR_IP_MF);
+    ((unsigned short *)(ip + 1))[0] = htons(sport);
+    ((unsigned short *)(ip + 1))[1] = htons(53);
+
+    /* as if out of a flow lookup that left the pick to the datapath */
+    pkt->vp_type = VP_TYPE_IP;
+    pkt->vp_ttl = 64;
+    pkt->vp_flags |= VP_FLAG_FLOW_SET;
+    pkt_set_network_header(pkt, pkt->vp_data);
+
+    vr_init_forwarding_md(&fmd);
+    fmd.fmd_dvrf = 0;
+
+    /* the members discard, and the packet with them */
+    nh->nh_reach_nh(pkt, nh, &fmd);
+
+    return fmd.fmd_ecmp_nh_index;
+}
+
+void ecmp_packet_hash_test(void **state) {
+    int index, seen = 0;
+    unsigned int sport;
+    int members[] = { 1, 2, 3, 4 };
+
+    assert_int_equal(ecmp_add(members, 4), 0);
+
+    /* a flow sticks to its member, and the flows spread over all of them */
+    for (sport = 1000; sport < 1000 + NH_ECMP_BUCKETS; sport++) {
+        index = ecmp_pick(sport, false);
+        assert_true(index >= 0 && index < 4);
+        assert_int_equal(ecmp_pick(sport, false), index);
+        seen |= (1 << index);
+    }
+    assert_int_equal(seen, 0xf);
+
+    /* the ports of a fragment are not looked at */
+    index = ecmp_pick(1000, true);
+    assert_true(index >= 0 && index < 4);
+    for (sport = 1001; sport < 1000 + NH_ECMP_BUCKETS; sport++)
+        assert_int_equal(ecmp_pick(sport, true), index);
+}
+
+int main(void) {
+    int i, ret;
+
+    /* test suite */
+    const UnitTest tests[] = {
+        unit_test(ecmp_bucket_balance_test),
+        unit_test(ecmp_bucket_resilience_test),
+        unit_test(ecmp_packet_hash_test),
+    };
+
+    vr_diet_message_proto_init();
+
+    /* init the vrouter */
+    ret = vrouter_host_init(VR_MPROTO_SANDESH);
+    if (ret)
+        return ret;
+
+    /* the members, which drop whatever comes to them */
+    for (i = 1; i <= TEST_MEMBERS; i++) {
+        if (test_nexthop_add(i, NH_DISCARD, 0, NULL, 0))
+            return -1;
+    }
+
+    /* let's run the test suite */
+    ret = run_tests(tests);
+
+    return ret;
+}
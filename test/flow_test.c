@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "vr_types.h"
+#include "vr_os.h"
+#include "vr_packet.h"
+#include "vr_message.h"
+#include "vr_flow.h"
+#include "vr_nexthop.h"
+#include "vrouter.h"
+
+#include "host/vr_host.h"
+
+#include "common_test.h"
+
+#define TEST_FLOW_ENTRIES       16
+#define TEST_OFLOW_ENTRIES      16
+#define TEST_FLOW_SIP           0x0a000001
+#define TEST_FLOW_DIP           0x0a000002
+
+extern int vrouter_host_init(unsigned int);
+extern unsigned int vr_flow_entries, vr_oflow_entries;
+extern struct vr_flow_entry *vr_find_flow(struct vrouter *, struct vr_flow *,
+        uint8_t, struct vr_inet6_flow_addr *, unsigned int *);
+
+static int flow_req(vr_flow_req *req) {
+    int ret = -EFAULT;
+
+    vr_flow_req_process(req);
+    vr_message_process_response(test_response_cb, &ret);
+
+    return ret;
+}
+
+static void flow_key(struct vr_flow *key, unsigned short sport) {
+    vr_inet_fill_flow(key, 0, TEST_FLOW_SIP, TEST_FLOW_DIP, VR_IP_PROTO_UDP,
+            htons(sport), htons(53));
+}
+
+/*
+ * sets up the flow of 'sport' at 'index' (-1 for a new flow) and returns
+ * its index, or -1
+ */
+static int flow_set(int index, unsigned short sport, short action) {
+    vr_flow_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.fr_op = FLOW_OP_FLOW_SET;
+    req.fr_index = index;
+    req.fr_rindex = -1;
+    req.fr_flags = VR_FLOW_FLAG_ACTIVE;
+    req.fr_action = action;
+    req.fr_flow_sip = TEST_FLOW_SIP;
+    req.fr_flow_dip = TEST_FLOW_DIP;
+    req.fr_flow_proto = VR_IP_PROTO_UDP;
+    req.fr_flow_sport = htons(sport);
+    req.fr_flow_dport = htons(53);
+    req.fr_src_nh_index = NH_DISCARD_ID;
+    req.fr_ecmp_nh_index = -1;
+    req.fr_mir_id = -1;
+    req.fr_sec_mir_id = -1;
+
+    if (flow_req(&req))
+        return -1;
+
+    return req.fr_index;
+}
+
+static int flow_add(unsigned short sport, short action) {
+    return flow_set(-1, sport, action);
+}
+
+static int flow_delete(int index, unsigned short sport) {
+    vr_flow_req req;
+
+    memset(&req, 0, sizeof(req));
+    req.fr_op = FLOW_OP_FLOW_SET;
+    req.fr_index = index;
+    req.fr_rindex = -1;
+    req.fr_flow_sip = TEST_FLOW_SIP;
+    req.fr_flow_dip = TEST_FLOW_DIP;
+    req.fr_flow_proto = VR_IP_PROTO_UDP;
+    req.fr_flow_sport = htons(sport);
+    req.fr_flow_dport = htons(53);
+    req.fr_mir_id = -1;
+    req.fr_sec_mir_id = -1;
+
+    return flow_req(&req);
+}
+
+static int flow_find(unsigned short sport) {
+    unsigned int index;
+    struct vr_flow key;
+
+    flow_key(&key, sport);
+    if (!vr_find_flow(vrouter_get(0), &key, VP_TYPE_IP, NULL, &index))
+        return -1;
+
+    return index;
+}
+
+void flow_tag_lookup_test(void **state) {
+    int i, index[8];
+    unsigned short sport;
+    struct vr_flow key;
+    struct vr_flow_entry *fe;
+
+    for (i = 0; i < 8; i++) {
+        sport = 1000 + i;
+        index[i] = flow_add(sport, VR_FLOW_ACTION_FORWARD);
+        assert_true(index[i] >= 0);
+
+        fe = vr_get_flow_entry(vrouter_get(0), index[i]);
+        assert_non_null(fe);
+        flow_key(&key, sport);
+        assert_memory_equal(&fe->fe_key, &key, key.key_len);
+    }
+
+    /* every flow is found where it was put, and nothing else is found */
+    for (i = 0; i < 8; i++)
+        assert_int_equal(flow_find(1000 + i), index[i]);
+    assert_int_equal(flow_find(2000), -1);
+
+    /* a deleted flow clears its tag, and is not found anymore */
+    for (i = 0; i < 8; i++) {
+        assert_int_equal(flow_delete(index[i], 1000 + i), 0);
+        assert_int_equal(flow_find(1000 + i), -1);
+    }
+}
+
+void flow_overflow_test(void **state) {
+    int i, added = 0, overflown = 0;
+    int index[4 * (TEST_FLOW_ENTRIES + TEST_OFLOW_ENTRIES)];
+    unsigned int count = sizeof(index) / sizeof(index[0]);
+
+    /* more flows than the tables can hold */
+    for (i = 0; i < count; i++) {
+        index[i] = flow_add(3000 + i, VR_FLOW_ACTION_FORWARD);
+        if (index[i] < 0)
+            continue;
+
+        added++;
+        if (index[i] >= TEST_FLOW_ENTRIES) {
+            assert_true(index[i] < TEST_FLOW_ENTRIES + TEST_OFLOW_ENTRIES);
+            overflown++;
+        }
+    }
+
+    /* full buckets spill to the overflow table, till that fills up too */
+    assert_true(overflown > 0);
+    assert_true(added <= TEST_FLOW_ENTRIES + TEST_OFLOW_ENTRIES);
+    assert_true(added < count);
+
+    /* the bounded probe finds every flow that went in, and only those */
+    for (i = 0; i < count; i++)
+        assert_int_equal(flow_find(3000 + i), index[i]);
+
+    /* and space that is freed is taken again */
+    for (i = 0; i < count; i++) {
+        if (index[i] >= 0)
+            assert_int_equal(flow_delete(index[i], 3000 + i), 0);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (index[i] < 0)
+            continue;
+        index[i] = flow_add(3000 + i, VR_FLOW_ACTION_FORWARD);
+        assert_true(index[i] >= 0);
+        assert_int_equal(flow_delete(index[i], 3000 + i), 0);
+    }
+}
+
+static int oflow_active(void) {
+    int i, active = 0;
+    struct vr_flow_entry *fe;
+
+    for (i = TEST_FLOW_ENTRIES; i < TEST_FLOW_ENTRIES + TEST_OFLOW_ENTRIES;
+            i++) {
+        fe = vr_get_flow_entry(vrouter_get(0), i);
+        if (fe->fe_flags & VR_FLOW_FLAG_ACTIVE)
+            active++;
+    }
+
+    return active;
+}
+
+void flow_overflow_window_test(void **state) {
+    int i, refused = 0;
+    int index[4 * (TEST_FLOW_ENTRIES + TEST_OFLOW_ENTRIES)];
+    unsigned int count = sizeof(index) / sizeof(index[0]);
+
+    /*
+     * the buckets a flow can choose from fill up long before the overflow
+     * table does. such a flow still goes in, as long as there is room
+     */
+    for (i = 0; i < count; i++) {
+        index[i] = flow_add(5000 + i, VR_FLOW_ACTION_FORWARD);
+        if (index[i] < 0) {
+            assert_int_equal(oflow_active(), TEST_OFLOW_ENTRIES);
+            refused++;
+        }
+    }
+    assert_true(refused > 0);
+
+    for (i = 0; i < count; i++) {
+        assert_int_equal(flow_find(5000 + i), index[i]);
+        if (index[i] >= 0)
+            assert_int_equal(flow_delete(index[i], 5000 + i), 0);
+    }
+    assert_int_equal(oflow_active(), 0);
+}
+
+/* runs a packet of the flow of 'sport' through the cached lookup */
+static flow_result_t flow_lookup(unsigned short sport, struct vr_nexthop *nh) {
+    flow_result_t result;
+    struct vr_flow key;
+    struct vr_packet *pkt;
+    struct vr_forwarding_md fmd;
+
+    pkt = vr_palloc(64);
+    assert_non_null(pkt);
+    pkt->vp_type = VP_TYPE_IP;
+    pkt->vp_nh = nh;
+
+    flow_key(&key, sport);
+    vr_init_forwarding_md(&fmd);
+    result = vr_flow_lookup(vrouter_get(0), &key, pkt, &fmd);
+    /* the packet is ours again, unless the flow took it */
+    if (result == FLOW_FORWARD)
+        vr_pfree(pkt, VP_DROP_DISCARD);
+
+    return result;
+}
+
+void flow_cache_test(void **state) {
+    int i, index, other = -1;
+    struct vr_nexthop relaxed_nh;
+
+    index = flow_add(4000, VR_FLOW_ACTION_FORWARD);
+    assert_true(index >= 0);
+
+    /* the first lookup fills the cache, and the second hits it */
+    assert_int_equal(flow_lookup(4000, NULL), FLOW_FORWARD);
+    assert_int_equal(flow_lookup(4000, NULL), FLOW_FORWARD);
+
+    /* a change of the flow is seen by cached lookups */
+    assert_int_equal(flow_set(index, 4000, VR_FLOW_ACTION_DROP), index);
+    assert_int_equal(flow_lookup(4000, NULL), FLOW_CONSUMED);
+
+    /* a cached flow that is deleted and taken by another key ... */
+    assert_int_equal(flow_set(index, 4000, VR_FLOW_ACTION_FORWARD), index);
+    assert_int_equal(flow_lookup(4000, NULL), FLOW_FORWARD);
+    assert_int_equal(flow_delete(index, 4000), 0);
+    for (i = 0; i < 64; i++) {
+        other = flow_add(4100 + i, VR_FLOW_ACTION_DROP);
+        assert_true(other >= 0);
+        if (other == index)
+            break;
+        assert_int_equal(flow_delete(other, 4100 + i), 0);
+    }
+    assert_int_equal(other, index);
+
+    /*
+     * ... is a miss for the old key. with a relaxed policy, a miss
+     * forwards, while a stale hit would drop
+     */
+    memset(&relaxed_nh, 0, sizeof(relaxed_nh));
+    relaxed_nh.nh_flags = NH_FLAG_RELAXED_POLICY;
+    assert_int_equal(flow_lookup(4000, &relaxed_nh), FLOW_FORWARD);
+    assert_int_equal(flow_lookup(4100 + i, NULL), FLOW_CONSUMED);
+
+    assert_int_equal(flow_delete(index, 4100 + i), 0);
+}
+
+int main(void) {
+    int ret;
+
+    /* test suite */
+    const UnitTest tests[] = {
+        unit_test(flow_tag_lookup_test),
+        unit_test(flow_overflow_test),
+        unit_test(flow_overflow_window_test),
+        unit_test(flow_cache_test),
+    };
+
+    vr_diet_message_proto_init();
+
+    /* a small table, so that buckets fill up quickly */
+    vr_flow_entries = TEST_FLOW_ENTRIES;
+    vr_oflow_entries = TEST_OFLOW_ENTRIES;
+
+    /* init the vrouter */
+    ret = vrouter_host_init(VR_MPROTO_SANDESH);
+    if (ret)
+        return ret;
+
+    /* let's run the test suite */
+    ret = run_tests(tests);
+
+    return ret;
+}
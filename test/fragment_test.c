@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "vr_types.h"
+#include "vr_os.h"
+#include "vr_packet.h"
+#include "vr_message.h"
+#include "vr_interface.h"
+#include "vr_nexthop.h"
+#include "vr_fragment.h"
+#include "vrouter.h"
+
+#include "host/vr_host.h"
+
+#include "common_test.h"
+
+#define TEST_FRAG_SIP       0x0a000001
+#define TEST_FRAG_DIP       0x0a000002
+#define TEST_FRAG_VRF       3
+#define TEST_VIF            2
+#define TEST_LABEL          20
+
+extern int vrouter_host_init(unsigned int);
+
+static void frag_ip(struct vr_ip *ip, unsigned short id, unsigned short offset) {
+    memset(ip, 0, sizeof(*ip));
+    ip->ip_version = 4;
+    ip->ip_hl = 5;
+    ip->ip_ttl = 64;
+    ip->ip_proto = VR_IP_PROTO_UDP;
+    ip->ip_id = htons(id);
+    ip->ip_frag_off = htons(VR_IP_MF | offset);
+    ip->ip_saddr = htonl(TEST_FRAG_SIP);
+    ip->ip_daddr = htonl(TEST_FRAG_DIP);
+}
+
+static void frag_key(struct vr_fragment_key *key, unsigned short id) {
+    struct vr_ip ip;
+
+    frag_ip(&ip, id, 0);
+    fragment_key(key, TEST_FRAG_VRF, &ip);
+}
+
+void fragment_table_test(void **state) {
+    struct vr_ip ip;
+    struct vr_fragment *fe;
+    struct vrouter *router = vrouter_get(0);
+
+    /* a head leaves its ports for the rest of its datagram */
+    frag_ip(&ip, 1, 0);
+    assert_int_equal(vr_fragment_add(router, TEST_FRAG_VRF, &ip, 1000, 53), 0);
+    fe = vr_fragment_get(router, TEST_FRAG_VRF, &ip);
+    assert_non_null(fe);
+    assert_int_equal(fe->f_sport, 1000);
+    assert_int_equal(fe->f_dport, 53);
+
+    /* a head that comes again takes the same entry */
+    assert_int_equal(vr_fragment_add(router, TEST_FRAG_VRF, &ip, 2000, 53), 0);
+    assert_ptr_equal(vr_fragment_get(router, TEST_FRAG_VRF, &ip), fe);
+    assert_int_equal(fe->f_sport, 2000);
+    assert_int_equal(router->vr_fragment_partitions[0].fp_used, 1);
+
+    /* another datagram, or the same one in another vrf, is not found */
+    assert_null(vr_fragment_get(router, TEST_FRAG_VRF + 1, &ip));
+    frag_ip(&ip, 2, 0);
+    assert_null(vr_fragment_get(router, TEST_FRAG_VRF, &ip));
+
+    vr_fragment_del(router, fe);
+    frag_ip(&ip, 1, 0);
+    assert_null(vr_fragment_get(router, TEST_FRAG_VRF, &ip));
+    assert_int_equal(router->vr_fragment_partitions[0].fp_used, 0);
+}
+
+void fragment_table_bound_test(void **state) {
+    int ret[4 * VR_FRAG_PARTITION_ENTRIES];
+    unsigned int i, added = 0, count = sizeof(ret) / sizeof(ret[0]);
+    struct vr_ip ip;
+    struct vr_fragment *fe;
+    struct vrouter *router = vrouter_get(0);
+
+    /* more heads than the partition can hold */
+    for (i = 0; i < count; i++) {
+        frag_ip(&ip, i, 0);
+        ret[i] = vr_fragment_add(router, TEST_FRAG_VRF, &ip, i, 53);
+        if (!ret[i])
+            added++;
+        else
+            assert_int_equal(ret[i], -ENOMEM);
+    }
+
+    assert_true(added < count);
+    assert_true(added <= VR_FRAG_PARTITION_ENTRIES);
+    assert_int_equal(router->vr_fragment_partitions[0].fp_used, added);
+
+    /* every head that went in is found, and only those */
+    for (i = 0; i < count; i++) {
+        frag_ip(&ip, i, 0);
+        fe = vr_fragment_get(router, TEST_FRAG_VRF, &ip);
+        if (ret[i]) {
+            assert_null(fe);
+            continue;
+        }
+
+        assert_non_null(fe);
+        assert_int_equal(fe->f_sport, i);
+        vr_fragment_del(router, fe);
+    }
+    assert_int_equal(router->vr_fragment_partitions[0].fp_used, 0);
+}
+
+/*
+ * a fabric interface that fragments come on, and a label whose nexthop
+ * notes down the fragments that come back to the datapath
+ */
+static struct vr_interface test_vif;
+static struct vr_nexthop test_label_nh;
+
+static unsigned int released;
+static unsigned short released_offsets[VR_FRAG_HOLD_ENTRIES];
+
+static int test_label_reach(struct vr_packet *pkt, struct vr_nexthop *nh,
+        struct vr_forwarding_md *fmd) {
+    struct vr_ip *ip = (struct vr_ip *)pkt_network_header(pkt);
+
+    assert_int_equal(fmd->fmd_dvrf, TEST_FRAG_VRF);
+    assert_int_equal(fmd->fmd_label, TEST_LABEL);
+    assert_true(released < VR_FRAG_HOLD_ENTRIES);
+    released_offsets[released++] =
+        ntohs(ip->ip_frag_off) & VR_IP_FRAG_OFFSET_MASK;
+
+    vr_pfree(pkt, VP_DROP_DISCARD);
+    return 0;
+}
+
+static int frag_enqueue(unsigned short id, unsigned short offset) {
+    struct vr_ip *ip;
+    struct vr_packet *pkt;
+    struct vr_forwarding_md fmd;
+
+    pkt = vr_palloc(128);
+    assert_non_null(pkt);
+    ip = (struct vr_ip *)pkt_data(pkt);
+    assert_non_null(pkt_pull_tail(pkt, sizeof(*ip)));
+    frag_ip(ip, id, offset);
+
+    pkt->vp_type = VP_TYPE_IP;
+    pkt->vp_if = &test_vif;
+    pkt->vp_nh = NULL;
+    pkt_set_network_header(pkt, pkt->vp_data);
+
+    vr_init_forwarding_md(&fmd);
+    fmd.fmd_dvrf = TEST_FRAG_VRF;
+    fmd.fmd_label = TEST_LABEL;
+
+    return vr_fragment_enqueue(vrouter_get(0), TEST_FRAG_VRF, pkt, &fmd);
+}
+
+static void frag_release(unsigned short id) {
+    struct vr_fragment_key key;
+
+    released = 0;
+    frag_key(&key, id);
+    vr_fragment_release(vrouter_get(0), &key);
+}
+
+void fragment_hold_release_test(void **state) {
+    struct vrouter *router = vrouter_get(0);
+
+    /* fragments of two datagrams, out of order, before their heads */
+    assert_int_equal(frag_enqueue(1, 300), 0);
+    assert_int_equal(frag_enqueue(2, 100), 0);
+    assert_int_equal(frag_enqueue(1, 100), 0);
+    assert_int_equal(frag_enqueue(1, 200), 0);
+    assert_int_equal(router->vr_fragment_queued, 4);
+
+    /* a datagram with nothing held releases nothing */
+    frag_release(3);
+    assert_int_equal(released, 0);
+
+    /* the fragments of a datagram come back, lowest offset first */
+    frag_release(1);
+    assert_int_equal(released, 3);
+    assert_int_equal(released_offsets[0], 100);
+    assert_int_equal(released_offsets[1], 200);
+    assert_int_equal(released_offsets[2], 300);
+    assert_int_equal(router->vr_fragment_queued, 1);
+
+    frag_release(1);
+    assert_int_equal(released, 0);
+
+    frag_release(2);
+    assert_int_equal(released, 1);
+    assert_int_equal(router->vr_fragment_queued, 0);
+}
+
+void fragment_hold_bound_test(void **state) {
+    unsigned int i;
+    struct vrouter *router = vrouter_get(0);
+
+    /* a queue holds as many fragments as it has slots, and drops the rest */
+    for (i = 0; i < VR_FRAG_HOLD_ENTRIES; i++)
+        assert_int_equal(frag_enqueue(1, VR_FRAG_HOLD_ENTRIES - i), 0);
+    assert_int_equal(frag_enqueue(1, 0), -ENOSPC);
+    assert_int_equal(router->vr_fragment_queued, VR_FRAG_HOLD_ENTRIES);
+
+    frag_release(1);
+    assert_int_equal(released, VR_FRAG_HOLD_ENTRIES);
+    for (i = 0; i < VR_FRAG_HOLD_ENTRIES; i++)
+        assert_int_equal(released_offsets[i], i + 1);
+    assert_int_equal(router->vr_fragment_queued, 0);
+
+    /* and slots that were let go take fragments again */
+    assert_int_equal(frag_enqueue(2, 1), 0);
+    frag_release(2);
+    assert_int_equal(released, 1);
+}
+
+int main(void) {
+    int ret;
+    struct vrouter *router;
+
+    /* test suite */
+    const UnitTest tests[] = {
+        unit_test(fragment_table_test),
+        unit_test(fragment_table_bound_test),
+        unit_test(fragment_hold_release_test),
+        unit_test(fragment_hold_bound_test),
+    };
+
+    vr_diet_message_proto_init();
+
+    /* init the vrouter */
+    ret = vrouter_host_init(VR_MPROTO_SANDESH);
+    if (ret)
+        return ret;
+
+    router = vrouter_get(0);
+    test_vif.vif_type = VIF_TYPE_PHYSICAL;
+    test_vif.vif_idx = TEST_VIF;
+    test_vif.vif_router = router;
+    router->vr_interfaces[TEST_VIF] = &test_vif;
+
+    test_label_nh.nh_flags = NH_FLAG_VALID;
+    test_label_nh.nh_reach_nh = test_label_reach;
+    router->vr_ilm[TEST_LABEL] = &test_label_nh;
+
+    /* let's run the test suite */
+    ret = run_tests(tests);
+
+    router->vr_ilm[TEST_LABEL] = NULL;
+    router->vr_interfaces[TEST_VIF] = NULL;
+
+    return ret;
+}
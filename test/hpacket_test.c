@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <cmocka.h>
+
+#include "vr_types.h"
+#include "vr_os.h"
+#include "vr_packet.h"
+#include "vr_message.h"
+
+#include "host/vr_host.h"
+#include "host/vr_host_packet.h"
+
+#include "common_test.h"
+
+#define TEST_POOL_SIZE      256
+#define TEST_PACKET_SIZE    2048
+#define TEST_THREADS        4
+#define TEST_ROUNDS         100000
+#define TEST_BATCH          8
+
+extern int vrouter_host_init(unsigned int);
+
+/* the index of a packet in its pool, to tell the packets apart */
+static int pool_index(struct vr_hpacket_pool *pool, struct vr_hpacket *hpkt) {
+    if (hpkt < pool->pool_pkts || hpkt >= pool->pool_pkts + pool->pool_size)
+        return -1;
+
+    return hpkt - pool->pool_pkts;
+}
+
+/* takes every packet out of the pool, and checks that each came once */
+static unsigned int pool_drain(struct vr_hpacket_pool *pool,
+        struct vr_hpacket **hpkts) {
+    int index;
+    unsigned int i, count;
+    unsigned char *seen;
+
+    seen = calloc(pool->pool_size, 1);
+    assert_non_null(seen);
+
+    count = vr_hpacket_pool_alloc_bulk(pool, hpkts, pool->pool_size + 1);
+    for (i = 0; i < count; i++) {
+        index = pool_index(pool, hpkts[i]);
+        assert_true(index >= 0);
+        assert_false(seen[index]);
+        seen[index] = 1;
+    }
+
+    free(seen);
+    return count;
+}
+
+void pool_alloc_free_test(void **state) {
+    unsigned int i, size;
+    struct vr_hpacket **hpkts;
+    struct vr_hpacket_pool *pool;
+
+    pool = vr_hpacket_pool_create(TEST_POOL_SIZE, TEST_PACKET_SIZE);
+    assert_non_null(pool);
+    size = vr_hpacket_pool_size(TEST_POOL_SIZE);
+    assert_int_equal(pool->pool_size, size);
+
+    hpkts = calloc(size + 1, sizeof(*hpkts));
+    assert_non_null(hpkts);
+
+    /* every packet, through the cache and the ring, and no more */
+    assert_int_equal(pool_drain(pool, hpkts), size);
+    assert_null(vr_hpacket_pool_alloc(pool));
+
+    /* one at a time, which spills the cache to the ring and back */
+    for (i = 0; i < size; i++)
+        vr_hpacket_pool_free(hpkts[i]);
+    assert_int_equal(pool_drain(pool, hpkts), size);
+
+    vr_hpacket_pool_free_bulk(hpkts, size);
+    assert_int_equal(pool_drain(pool, hpkts), size);
+    vr_hpacket_pool_free_bulk(hpkts, size);
+
+    free(hpkts);
+    vr_hpacket_pool_destroy(pool);
+}
+
+void pool_clone_test(void **state) {
+    unsigned int size;
+    struct vr_hpacket **hpkts;
+    struct vr_hpacket *hpkt, *clone;
+    struct vr_hpacket_pool *pool;
+
+    pool = vr_hpacket_pool_create(TEST_POOL_SIZE, TEST_PACKET_SIZE);
+    assert_non_null(pool);
+    size = pool->pool_size;
+
+    hpkts = calloc(size + 1, sizeof(*hpkts));
+    assert_non_null(hpkts);
+    assert_int_equal(pool_drain(pool, hpkts), size);
+
+    /* a clone comes from the clone pool, and shares the buffer */
+    hpkt = hpkts[0];
+    clone = vr_hpacket_clone(hpkt);
+    assert_non_null(clone);
+    assert_true(clone->hp_flags & VR_HPACKET_FLAGS_POOL_CLONE);
+    assert_ptr_equal(clone->hp_head, hpkt->hp_head);
+
+    /* the buffer is not free till its last user lets go */
+    vr_hpacket_free(hpkt);
+    assert_null(vr_hpacket_pool_alloc(pool));
+    vr_hpacket_free(clone);
+    hpkts[0] = vr_hpacket_pool_alloc(pool);
+    assert_ptr_equal(hpkts[0], hpkt);
+
+    vr_hpacket_pool_free_bulk(hpkts, size);
+    free(hpkts);
+    vr_hpacket_pool_destroy(pool);
+}
+
+struct ring_test_arg {
+    struct vr_hpacket_pool *rta_pool;
+    unsigned char *rta_owned;
+    unsigned int rta_seed;
+    unsigned int rta_errors;
+};
+
+static void *ring_test_worker(void *arg) {
+    int index;
+    unsigned int i, j, count;
+    struct vr_hpacket *hpkts[TEST_BATCH];
+    struct ring_test_arg *rta = (struct ring_test_arg *)arg;
+
+    for (i = 0; i < TEST_ROUNDS; i++) {
+        rta->rta_seed = rta->rta_seed * 1103515245 + 12345;
+        count = vr_hpacket_pool_alloc_bulk(rta->rta_pool, hpkts,
+                1 + ((rta->rta_seed >> 16) % TEST_BATCH));
+
+        /* no packet is ever given to two at a time */
+        for (j = 0; j < count; j++) {
+            index = pool_index(rta->rta_pool, hpkts[j]);
+            if ((index < 0) ||
+                    __sync_lock_test_and_set(&rta->rta_owned[index], 1))
+                rta->rta_errors++;
+        }
+
+        for (j = 0; j < count; j++) {
+            index = pool_index(rta->rta_pool, hpkts[j]);
+            if (index >= 0)
+                __sync_lock_release(&rta->rta_owned[index]);
+        }
+        vr_hpacket_pool_free_bulk(hpkts, count);
+    }
+
+    return NULL;
+}
+
+void pool_ring_mpmc_test(void **state) {
+    unsigned int i, size;
+    unsigned char *owned;
+    struct vr_hpacket **hpkts;
+    struct vr_hpacket_pool *pool;
+    pthread_t threads[TEST_THREADS];
+    struct ring_test_arg args[TEST_THREADS];
+
+    /*
+     * a small pool, so that the threads run it dry often. with no worker
+     * caches, every packet goes through the shared ring
+     */
+    pool = vr_hpacket_pool_create(TEST_THREADS * TEST_BATCH / 2,
+            TEST_PACKET_SIZE);
+    assert_non_null(pool);
+    size = pool->pool_size;
+
+    hpkts = calloc(size + 1, sizeof(*hpkts));
+    owned = calloc(size, 1);
+    assert_non_null(hpkts);
+    assert_non_null(owned);
+
+    assert_int_equal(pool_drain(pool, hpkts), size);
+    pool->pool_num_caches = 0;
+    vr_hpacket_pool_free_bulk(hpkts, size);
+
+    for (i = 0; i < TEST_THREADS; i++) {
+        args[i].rta_pool = pool;
+        args[i].rta_owned = owned;
+        args[i].rta_seed = i + 1;
+        args[i].rta_errors = 0;
+        assert_int_equal(pthread_create(&threads[i], NULL, ring_test_worker,
+                    &args[i]), 0);
+    }
+
+    for (i = 0; i < TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        assert_int_equal(args[i].rta_errors, 0);
+    }
+
+    /* and not one packet is lost */
+    assert_int_equal(pool_drain(pool, hpkts), size);
+    vr_hpacket_pool_free_bulk(hpkts, size);
+
+    free(owned);
+    free(hpkts);
+    vr_hpacket_pool_destroy(pool);
+}
+
+void pool_non_worker_test(void **state) {
+    struct vr_hpacket *hpkt;
+    struct vr_hpacket_pool *pool;
+
+    /* once there are workers, this thread is not one of them */
+    assert_int_equal(vr_host_io_worker_id(), 0);
+    assert_int_equal(vr_host_io_init(), 0);
+    assert_int_equal(vr_host_io_worker_id(), VR_HOST_IO_MAX_WORKERS);
+
+    /* and leaves the cache of the first worker alone */
+    pool = vr_hpacket_pool_create(TEST_POOL_SIZE, TEST_PACKET_SIZE);
+    assert_non_null(pool);
+    assert_true(pool->pool_num_caches > 0);
+
+    hpkt = vr_hpacket_pool_alloc(pool);
+    assert_non_null(hpkt);
+    vr_hpacket_pool_free(hpkt);
+    assert_int_equal(pool->pool_caches[0].vpc_count, 0);
+
+    vr_hpacket_pool_destroy(pool);
+}
+
+int main(void) {
+    int ret;
+
+    /* test suite */
+    const UnitTest tests[] = {
+        unit_test(pool_alloc_free_test),
+        unit_test(pool_clone_test),
+        unit_test(pool_ring_mpmc_test),
+        /* sets up the workers, and hence goes last */
+        unit_test(pool_non_worker_test),
+    };
+
+    vr_diet_message_proto_init();
+
+    /* init the vrouter */
+    ret = vrouter_host_init(VR_MPROTO_SANDESH);
+    if (ret)
+        return ret;
+
+    /* let's run the test suite */
+    ret = run_tests(tests);
+
+    return ret;
+}
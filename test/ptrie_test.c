@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "vr_types.h"
+#include "vr_os.h"
+#include "vr_defs.h"
+#include "vr_message.h"
+#include "vr_nexthop.h"
+#include "vr_route.h"
+#include "vrouter.h"
+
+#include "host/vr_host.h"
+
+#include "common_test.h"
+
+#define TEST_NEXTHOPS       8
+#define TEST_ROUTES         256
+#define TEST_LOOKUPS        4096
+
+extern int vrouter_host_init(unsigned int);
+extern unsigned int vr_inet_rtable_algo;
+
+/* what the table should have, to check the lookups against */
+struct test_route {
+    uint8_t tr_prefix[16];
+    unsigned int tr_len;
+    int tr_nh_id;
+};
+
+static struct test_route routes[TEST_ROUTES];
+static unsigned int num_routes;
+static uint32_t rand_state = 1;
+
+static uint32_t test_rand(void) {
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 8;
+}
+
+static void prefix_mask(uint8_t *addr, unsigned int len, unsigned int size) {
+    unsigned int i;
+
+    for (i = 0; i < size; i++) {
+        if (len >= 8)
+            len -= 8;
+        else {
+            addr[i] &= (uint8_t)(0xff << (8 - len));
+            len = 0;
+        }
+    }
+}
+
+static bool prefix_match(uint8_t *prefix, unsigned int len, uint8_t *addr) {
+    unsigned int i;
+
+    for (i = 0; len; i++) {
+        if (len >= 8) {
+            if (prefix[i] != addr[i])
+                return false;
+            len -= 8;
+        } else {
+            if ((prefix[i] ^ addr[i]) & (uint8_t)(0xff << (8 - len)))
+                return false;
+            len = 0;
+        }
+    }
+
+    return true;
+}
+
+/* the longest match, the slow way */
+static int route_match(uint8_t *addr) {
+    int nh_id = -1, best = -1;
+    unsigned int i;
+
+    for (i = 0; i < num_routes; i++) {
+        if ((int)routes[i].tr_len > best &&
+                prefix_match(routes[i].tr_prefix, routes[i].tr_len, addr)) {
+            best = routes[i].tr_len;
+            nh_id = routes[i].tr_nh_id;
+        }
+    }
+
+    return nh_id;
+}
+
+static void route_add(int family, uint8_t *prefix, unsigned int len,
+        int nh_id) {
+    unsigned int i, size = RT_IP_ADDR_SIZE(family);
+    uint8_t buf[16];
+
+    memcpy(buf, prefix, size);
+    assert_int_equal(test_route_add(0, family, buf, len, nh_id, -1), 0);
+
+    for (i = 0; i < num_routes; i++) {
+        if (routes[i].tr_len == len &&
+                !memcmp(routes[i].tr_prefix, prefix, size))
+            break;
+    }
+
+    if (i == num_routes) {
+        memcpy(routes[i].tr_prefix, prefix, size);
+        routes[i].tr_len = len;
+        num_routes++;
+    }
+    routes[i].tr_nh_id = nh_id;
+}
+
+/*
+ * adds random, nested routes and checks every lookup against a linear
+ * scan of what was added. 'step' is the granularity of prefix lengths
+ */
+static void ptrie_family_test(int family, unsigned int step) {
+    unsigned int i, j, len, size = RT_IP_ADDR_SIZE(family);
+    unsigned int label;
+    unsigned short label_flags;
+    uint8_t addr[16];
+    int nh_id;
+    struct vrouter *router = vrouter_get(0);
+    struct vr_nexthop *nh, *default_nh;
+
+    memset(addr, 0, sizeof(addr));
+    default_nh = vr_inet_addr_lookup(0, family, addr, &label, &label_flags);
+    num_routes = 0;
+
+    for (i = 0; i < TEST_ROUTES; i++) {
+        /* a few first bytes in common, so that the routes nest */
+        memset(addr, 0, sizeof(addr));
+        addr[0] = 10;
+        for (j = 1; j < size; j++)
+            addr[j] = (j < 3) ? (test_rand() & 0x3) : test_rand();
+
+        len = step * (1 + (test_rand() % (size * 8 / step)));
+        prefix_mask(addr, len, size);
+        route_add(family, addr, len, 1 + (test_rand() % TEST_NEXTHOPS));
+
+        /* and some checks after every add, to see the changes as well */
+        for (j = 0; j < TEST_LOOKUPS / TEST_ROUTES; j++) {
+            addr[size - 1 - (j % size)] ^= test_rand();
+            nh_id = route_match(addr);
+            nh = vr_inet_addr_lookup(0, family, addr, &label, &label_flags);
+            if (nh_id < 0)
+                assert_ptr_equal(nh, default_nh);
+            else
+                assert_ptr_equal(nh, __vrouter_get_nexthop(router, nh_id));
+        }
+    }
+
+    for (i = 0; i < num_routes; i++) {
+        nh = vr_inet_addr_lookup(0, family, routes[i].tr_prefix,
+                &label, &label_flags);
+        assert_ptr_equal(nh, __vrouter_get_nexthop(router,
+                    route_match(routes[i].tr_prefix)));
+    }
+}
+
+void ptrie_inet_test(void **state) {
+    ptrie_family_test(AF_INET, 1);
+}
+
+void ptrie_inet6_test(void **state) {
+    /* inet6 prefixes are added in whole bytes */
+    ptrie_family_test(AF_INET6, 8);
+}
+
+int main(void) {
+    int i, ret;
+
+    /* test suite */
+    const UnitTest tests[] = {
+        unit_test(ptrie_inet_test),
+        unit_test(ptrie_inet6_test),
+    };
+
+    vr_diet_message_proto_init();
+
+    /* the inet tables are ptries, rather than mtries */
+    vr_inet_rtable_algo = VR_INET_RTABLE_ALGO_PTRIE;
+
+    /* init the vrouter */
+    ret = vrouter_host_init(VR_MPROTO_SANDESH);
+    if (ret)
+        return ret;
+
+    for (i = 1; i <= TEST_NEXTHOPS; i++) {
+        if (test_nexthop_add(i, NH_RESOLVE, 0, NULL, 0))
+            return -1;
+    }
+
+    /* let's run the test suite */
+    ret = run_tests(tests);
+
+    return ret;
+}
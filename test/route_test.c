@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "vr_types.h"
+#include "vr_os.h"
+#include "vr_defs.h"
+#include "vr_message.h"
+#include "vr_nexthop.h"
+#include "vr_route.h"
+#include "vrouter.h"
+
+#include "host/vr_host.h"
+
+#include "common_test.h"
+
+#define TEST_NH_A           1
+#define TEST_NH_B           2
+
+extern int vrouter_host_init(unsigned int);
+
+static uint32_t ip4(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+    uint8_t addr[4] = { a, b, c, d };
+    uint32_t ip;
+
+    memcpy(&ip, addr, sizeof(ip));
+    return ip;
+}
+
+static struct vr_nexthop *lookup4(unsigned int vrf, uint32_t ip,
+        int *label) {
+    unsigned int rt_label = 0;
+    unsigned short rt_label_flags = 0;
+    struct vr_nexthop *nh;
+
+    nh = vr_inet4_lookup(vrf, ip, &rt_label, &rt_label_flags);
+    *label = (rt_label_flags & VR_RT_LABEL_VALID_FLAG) ? rt_label : -1;
+
+    return nh;
+}
+
+void route_cache_inet_test(void **state) {
+    int label;
+    uint32_t prefix;
+    struct vrouter *router = vrouter_get(0);
+    struct vr_nexthop *nh_a, *nh_b;
+
+    nh_a = __vrouter_get_nexthop(router, TEST_NH_A);
+    nh_b = __vrouter_get_nexthop(router, TEST_NH_B);
+
+    prefix = ip4(10, 1, 0, 0);
+    assert_int_equal(test_route_add(0, AF_INET, (uint8_t *)&prefix, 16,
+                TEST_NH_A, 100), 0);
+
+    /* the first lookup fills the cache, and the second hits it */
+    assert_ptr_equal(lookup4(0, ip4(10, 1, 2, 3), &label), nh_a);
+    assert_int_equal(label, 100);
+    assert_ptr_equal(lookup4(0, ip4(10, 1, 2, 3), &label), nh_a);
+    assert_int_equal(label, 100);
+
+    /* a more specific route hides what the cache has */
+    prefix = ip4(10, 1, 2, 0);
+    assert_int_equal(test_route_add(0, AF_INET, (uint8_t *)&prefix, 24,
+                TEST_NH_B, -1), 0);
+    assert_ptr_equal(lookup4(0, ip4(10, 1, 2, 3), &label), nh_b);
+    assert_int_equal(label, -1);
+    assert_ptr_equal(lookup4(0, ip4(10, 1, 3, 3), &label), nh_a);
+    assert_int_equal(label, 100);
+
+    /* a change of the route is seen too */
+    assert_int_equal(test_route_add(0, AF_INET, (uint8_t *)&prefix, 24,
+                TEST_NH_A, 200), 0);
+    assert_ptr_equal(lookup4(0, ip4(10, 1, 2, 3), &label), nh_a);
+    assert_int_equal(label, 200);
+
+    /* the same address in another vrf is another entry */
+    assert_ptr_not_equal(lookup4(1, ip4(10, 1, 2, 3), &label), nh_a);
+    assert_ptr_not_equal(lookup4(1, ip4(10, 1, 2, 3), &label), nh_b);
+    assert_ptr_equal(lookup4(0, ip4(10, 1, 2, 3), &label), nh_a);
+}
+
+void route_cache_inet6_test(void **state) {
+    int label;
+    unsigned int rt_label = 0;
+    unsigned short rt_label_flags = 0;
+    uint8_t prefix[16] = { 0xfd, 0x00, 0x00, 0x01 };
+    uint8_t addr[16] = { 0xfd, 0x00, 0x00, 0x01, [15] = 0x05 };
+    struct vrouter *router = vrouter_get(0);
+    struct vr_nexthop *nh_a, *nh_b;
+
+    nh_a = __vrouter_get_nexthop(router, TEST_NH_A);
+    nh_b = __vrouter_get_nexthop(router, TEST_NH_B);
+
+    assert_int_equal(test_route_add(0, AF_INET6, prefix, 32,
+                TEST_NH_A, -1), 0);
+    assert_ptr_equal(vr_inet6_lookup(0, addr, &rt_label, &rt_label_flags),
+            nh_a);
+    assert_ptr_equal(vr_inet6_lookup(0, addr, &rt_label, &rt_label_flags),
+            nh_a);
+
+    assert_int_equal(test_route_add(0, AF_INET6, prefix, 32,
+                TEST_NH_B, 300), 0);
+    assert_ptr_equal(vr_inet6_lookup(0, addr, &rt_label, &rt_label_flags),
+            nh_b);
+    assert_true(rt_label_flags & VR_RT_LABEL_VALID_FLAG);
+    assert_int_equal(rt_label, 300);
+
+    /* an inet lookup of the same first word is another entry */
+    assert_ptr_not_equal(lookup4(0, ip4(0xfd, 0x00, 0x00, 0x01), &label),
+            nh_b);
+}
+
+int main(void) {
+    int ret;
+
+    /* test suite */
+    const UnitTest tests[] = {
+        unit_test(route_cache_inet_test),
+        unit_test(route_cache_inet6_test),
+    };
+
+    vr_diet_message_proto_init();
+
+    /* init the vrouter */
+    ret = vrouter_host_init(VR_MPROTO_SANDESH);
+    if (ret)
+        return ret;
+
+    /* two nexthops that routes can point to */
+    if (test_nexthop_add(TEST_NH_A, NH_RESOLVE, 0, NULL, 0) ||
+            test_nexthop_add(TEST_NH_B, NH_DISCARD, 0, NULL, 0))
+        return -1;
+
+    /* let's run the test suite */
+    ret = run_tests(tests);
+
+    return ret;
+}
@@ -135,6 +135,10 @@ vr_drop_stats_req_process(void *s_req)
             stats->vds_invalid_vnid);
     printf("Fragment errors               %" PRIu64 "\n",
             stats->vds_frag_err);
+    printf("Fragment Queue Fail           %" PRIu64 "\n",
+            stats->vds_fragment_queue_fail);
+    printf("Packet Pool Exhausted         %" PRIu64 "\n",
+            stats->vds_pkt_pool_exhausted);
     printf("Invalid Source                %" PRIu64 "\n",
             stats->vds_invalid_source);
     printf("Jumbo Mcast Pkt with DF Bit   %" PRIu64 "\n",
@@ -172,6 +172,15 @@ dump_table(struct flow_table *ft)
                         ntohs(fe->fe_key.flow4_dport),
                         fe->fe_key.flow4_proto,
                         fe->fe_vrf);
+            } else if (fe->fe_type == VP_TYPE_IP6) {
+                /* ipv6 addresses are not part of the mapped table */
+                printf("   %12s:%-5d    ", "(ipv6)",
+                        ntohs(fe->fe_key.flow6_sport));
+                printf("%16s:%-5d    %d (%d",
+                        "(ipv6)",
+                        ntohs(fe->fe_key.flow6_dport),
+                        fe->fe_key.flow6_proto,
+                        fe->fe_vrf);
             }
 
             if (fe->fe_flags & VR_FLOW_FLAG_VRFT)
@@ -228,6 +237,8 @@ dump_table(struct flow_table *ft)
             printf("\t(");
             if (fe->fe_type == VP_TYPE_IP)
                 printf("K(nh):%u, ", fe->fe_key.flow4_nh_id);
+            else if (fe->fe_type == VP_TYPE_IP6)
+                printf("K(nh):%u, ", fe->fe_key.flow6_nh_id);
 
             printf("Action:%c", action);
             if (need_flag_print)
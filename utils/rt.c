@@ -12,9 +12,12 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <fcntl.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #if defined(__linux__)
 #include <asm/types.h>
 
@@ -47,7 +50,7 @@ static bool cmd_proxy_set = false;
 static bool cmd_trap_set = false;
 static bool cmd_flood_set = false;
 
-static int cmd_set, dump_set;
+static int cmd_set, dump_set, snapshot_set;
 static int family_set, help_set;
 
 static int cmd_prefix_set;
@@ -69,6 +72,10 @@ static void usage_internal(void);
 #define BRIDGE_FAMILY_STRING    "bridge"
 #define INET6_FAMILY_STRING     "inet6"
 
+#define MEM_DEV                 "/dev/flow"
+/* times a snapshot is tried before it settles for consistent entries */
+#define RT_SNAPSHOT_RETRIES     16
+
 struct vr_util_flags inet_flags[] = {
     {VR_RT_LABEL_VALID_FLAG,    "L",    "Label Valid"   },
     {VR_RT_ARP_PROXY_FLAG,      "P",    "Proxy ARP"     },
@@ -161,6 +168,8 @@ vr_route_req_process(void *s_req)
         }
         memcpy(rt_req.rtr_mac, rt->rtr_mac, 6);
     }
+    /* lets the bridge dump resume right after the last entry */
+    rt_req.rtr_index = rt->rtr_index;
     rt_req.rtr_vrf_id = rt->rtr_vrf_id;
 
     if ((rt->rtr_family == AF_INET) ||
@@ -457,6 +466,235 @@ vr_route_op(void)
     return 0;
 }
 
+#if defined(__linux__)
+/* the major of the flow memory device, which the route export is part of */
+static int
+mem_dev_major(void)
+{
+    int major = -1, num;
+    char line[128], name[64];
+    FILE *fp;
+
+    fp = fopen("/proc/devices", "r");
+    if (!fp)
+        return -1;
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%d %63s", &num, name) == 2 &&
+                !strcmp(name, "flow")) {
+            major = num;
+            break;
+        }
+    }
+
+    fclose(fp);
+    return major;
+}
+#endif
+
+static struct vr_route_export_header *
+route_export_map(size_t *span)
+{
+    int fd;
+    size_t size;
+    long page_size;
+    struct vr_route_export_header *hdr;
+
+#if defined(__linux__)
+    int major;
+
+    major = mem_dev_major();
+    if (major < 0) {
+        printf("%s: vrouter is not loaded\n", MEM_DEV);
+        exit(ENODEV);
+    }
+
+    if (mknod(MEM_DEV, S_IFCHR | O_RDWR, makedev(major, 0)) &&
+            errno != EEXIST) {
+        perror(MEM_DEV);
+        exit(errno);
+    }
+#endif
+
+    fd = open(MEM_DEV, O_RDONLY);
+    if (fd < 0) {
+        perror(MEM_DEV);
+        exit(errno);
+    }
+
+    page_size = sysconf(_SC_PAGESIZE);
+    hdr = mmap(NULL, page_size, PROT_READ, MAP_SHARED, fd,
+            VR_ROUTE_EXPORT_MMAP_OFFSET);
+    if (hdr == MAP_FAILED) {
+        printf("route export: %s\n", strerror(errno));
+        exit(errno);
+    }
+
+    if (hdr->reh_magic != VR_ROUTE_EXPORT_MAGIC ||
+            hdr->reh_version != VR_ROUTE_EXPORT_VERSION ||
+            hdr->reh_entry_size != sizeof(struct vr_route_export_entry)) {
+        printf("route export: unknown format\n");
+        exit(EINVAL);
+    }
+
+    size = ((size_t)hdr->reh_entries + 1) * hdr->reh_entry_size;
+    munmap(hdr, page_size);
+
+    hdr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd,
+            VR_ROUTE_EXPORT_MMAP_OFFSET);
+    if (hdr == MAP_FAILED) {
+        printf("route export: %s\n", strerror(errno));
+        exit(errno);
+    }
+
+    close(fd);
+    *span = size;
+
+    return hdr;
+}
+
+/* an entry as it was between two writes to it */
+static void
+route_export_read_entry(volatile struct vr_route_export_entry *ent,
+        struct vr_route_export_entry *copy)
+{
+    uint16_t seq;
+
+    do {
+        seq = ent->re_seq;
+        __sync_synchronize();
+        memcpy(copy, (void *)ent, sizeof(*copy));
+        __sync_synchronize();
+    } while ((seq & 1) || seq != ent->re_seq);
+
+    return;
+}
+
+static void
+route_export_print(struct vr_route_export_entry *ent)
+{
+    int ret = 0, i;
+    char addr[INET6_ADDRSTRLEN + 1];
+    char flags[32];
+
+    bzero(flags, sizeof(flags));
+    if (ent->re_family == AF_BRIDGE) {
+        if (ent->re_label_flags & VR_BE_LABEL_VALID_FLAG)
+            strcat(flags, "L");
+        if (ent->re_label_flags & VR_BE_FLOOD_DHCP_FLAG)
+            strcat(flags, "Df");
+
+        ret = printf("%s", ether_ntoa((struct ether_addr *)(ent->re_prefix)));
+    } else {
+        if (ent->re_label_flags & VR_RT_LABEL_VALID_FLAG)
+            strcat(flags, "L");
+        if (ent->re_label_flags & VR_RT_ARP_PROXY_FLAG)
+            strcat(flags, "P");
+        if (ent->re_label_flags & VR_RT_ARP_TRAP_FLAG)
+            strcat(flags, "T");
+        if (ent->re_label_flags & VR_RT_ARP_FLOOD_FLAG)
+            strcat(flags, "F");
+
+        inet_ntop(ent->re_family, ent->re_prefix, addr, sizeof(addr));
+        ret = printf("%s/%-2d", addr, ent->re_prefix_len);
+    }
+
+    for (i = ret; i < 44; i++)
+        printf(" ");
+
+    printf("%5s", flags);
+
+    /* the bridge and the inet label valid flags are the same */
+    if (ent->re_label_flags & VR_RT_LABEL_VALID_FLAG)
+        printf(" %12u", ent->re_label);
+    else
+        printf(" %12c", '-');
+
+    printf(" %10d\n", ent->re_nh_id);
+
+    return;
+}
+
+/*
+ * prints the routes of the vrf from the route export, without sending
+ * any message to vrouter
+ */
+static int
+vr_route_snapshot(void)
+{
+    unsigned int i, try, count = 0;
+    uint32_t gen, overflows;
+    size_t span;
+    struct vr_route_export_header *hdr;
+    struct vr_route_export_entry *table, *copy, *ent;
+
+    hdr = route_export_map(&span);
+    table = (struct vr_route_export_entry *)hdr;
+
+    copy = malloc(span);
+    if (!copy) {
+        printf("route export: %s\n", strerror(ENOMEM));
+        exit(ENOMEM);
+    }
+
+    for (try = 0; try < RT_SNAPSHOT_RETRIES; try++) {
+        gen = *(volatile uint32_t *)&hdr->reh_gen;
+        if (gen & 1) {
+            usleep(1000);
+            continue;
+        }
+
+        __sync_synchronize();
+        memcpy(copy, table, span);
+        __sync_synchronize();
+        if (*(volatile uint32_t *)&hdr->reh_gen == gen)
+            break;
+    }
+
+    /*
+     * the export kept changing. the routes are still what they were at
+     * some point, though not all at the same point
+     */
+    if (try == RT_SNAPSHOT_RETRIES) {
+        for (i = 1; i <= hdr->reh_entries; i++)
+            route_export_read_entry(&table[i], &copy[i]);
+    }
+
+    /* an export that some routes did not fit in is of no use */
+    overflows = ((struct vr_route_export_header *)copy)->reh_overflows;
+    if (overflows) {
+        printf("route export: %u routes did not fit in the export, "
+                "use --dump instead\n", overflows);
+        free(copy);
+        munmap(hdr, span);
+        return EOVERFLOW;
+    }
+
+    printf("Vrouter %s route export %d/%d\n\n",
+            (cmd_family_id == AF_BRIDGE) ? "bridge" :
+            ((cmd_family_id == AF_INET) ? "inet4" : "inet6"),
+            0, cmd_vrf_id);
+    dump_legend(cmd_family_id);
+    printf("Destination                                 Flags        Label    Nexthop\n");
+
+    for (i = 1; i <= hdr->reh_entries; i++) {
+        ent = &copy[i];
+        if (ent->re_family != cmd_family_id || ent->re_vrf != cmd_vrf_id)
+            continue;
+
+        route_export_print(ent);
+        count++;
+    }
+
+    printf("\n%u routes%s\n", count,
+            (try == RT_SNAPSHOT_RETRIES) ? " (export changed while reading)" : "");
+
+    free(copy);
+    munmap(hdr, span);
+
+    return 0;
+}
+
 static void
 usage_internal()
 {
@@ -481,7 +719,8 @@ usage_internal()
 static void
 validate_options(void)
 {
-    unsigned int set = dump_set + family_set + cmd_set + help_set;
+    unsigned int set = dump_set + snapshot_set + family_set + cmd_set +
+        help_set;
 
     if (cmd_op < 0)
         goto usage;
@@ -541,6 +780,7 @@ usage_internal:
 enum opt_flow_index {
     COMMAND_OPT_INDEX,
     DUMP_OPT_INDEX,
+    SNAPSHOT_OPT_INDEX,
     FAMILY_OPT_INDEX,
     HELP_OPT_INDEX,
     MAX_OPT_INDEX,
@@ -549,6 +789,7 @@ enum opt_flow_index {
 static struct option long_options[] = {
     [COMMAND_OPT_INDEX]   = {"cmd",    no_argument,       &cmd_set,    1},
     [DUMP_OPT_INDEX]      = {"dump",   required_argument, &dump_set,   1},
+    [SNAPSHOT_OPT_INDEX]  = {"snapshot", required_argument, &snapshot_set, 1},
     [FAMILY_OPT_INDEX]    = {"family", required_argument, &family_set, 1},
     [HELP_OPT_INDEX]      = {"help",   no_argument,       &help_set,   1},
     [MAX_OPT_INDEX]       = { NULL,    0,                 0,           0},
@@ -558,12 +799,15 @@ static void
 Usage(void)
 {
     printf("Usage:   rt --dump <vrf_id> [--family <inet|bridge>]>\n");
+    printf("         rt --snapshot <vrf_id> [--family <inet|inet6|bridge>]>\n");
     printf("         rt --help\n");
     printf("\n");
-    printf("--dump   Dumps the routing table corresponding to vrf_id\n");
-    printf("--family Optional family specification to --dump command\n");
-    printf("         Specification should be one of \"inet\" or \"bridge\"\n");
-    printf("--help   Prints this help message\n");
+    printf("--dump     Dumps the routing table corresponding to vrf_id\n");
+    printf("--snapshot Prints the routes of vrf_id from the mmap-ed route export\n");
+    printf("           of vrouter, without any message to vrouter\n");
+    printf("--family   Optional family specification to --dump command\n");
+    printf("           Specification should be one of \"inet\" or \"bridge\"\n");
+    printf("--help     Prints this help message\n");
 
     exit(1);
 }
@@ -578,6 +822,7 @@ parse_long_opts(int opt_flow_index, char *opt_arg)
         break;
 
     case DUMP_OPT_INDEX:
+    case SNAPSHOT_OPT_INDEX:
         cmd_op = SANDESH_OP_DUMP;
         cmd_vrf_id = strtoul(opt_arg, NULL, 0);
         if (errno)
@@ -717,6 +962,9 @@ main(int argc, char *argv[])
 
     validate_options();
 
+    if (snapshot_set)
+        return vr_route_snapshot();
+
     cl = nl_register_client();
     if (!cl) {
         printf("nl_register_client failed\n");
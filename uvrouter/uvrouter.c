@@ -24,6 +24,8 @@ extern int vrouter_host_init(unsigned int);
 
 static char *uvr_agent_buffer;
 static int uvr_agent_fd = -1;
+/* device to which the physical interface is bound through a packet ring */
+static const char *uvr_physical_dev;
 
 void
 get_random_bytes(void *buf, int nbytes)
@@ -95,8 +97,12 @@ uvrouter_interface_init(void)
     if (!agent_hif)
         return -1;
 
-    eth_hif = vr_hinterface_create(HIF_PHYSICAL_INTERFACE_INDEX, HIF_TYPE_UDP,
-            VIF_TYPE_PHYSICAL);
+    if (uvr_physical_dev)
+        eth_hif = vr_hinterface_create_dev(HIF_PHYSICAL_INTERFACE_INDEX,
+                HIF_TYPE_PACKET, VIF_TYPE_PHYSICAL, uvr_physical_dev);
+    else
+        eth_hif = vr_hinterface_create(HIF_PHYSICAL_INTERFACE_INDEX,
+                HIF_TYPE_UDP, VIF_TYPE_PHYSICAL);
     if (!eth_hif)
         goto cleanup;
 
@@ -163,13 +169,35 @@ cleanup:
 int
 main(int argc, const char *argv[])
 {
-    int ret;
+    int ret, opt;
+
+    /*
+     * -w <n>: number of io worker threads, each of which is a cpu
+     * -p <dev>: bind the physical interface to dev through a packet ring
+     */
+    while ((opt = getopt(argc, (char *const *)argv, "w:p:")) != -1) {
+        switch (opt) {
+        case 'w':
+            vr_host_io_num_workers = strtoul(optarg, NULL, 0);
+            break;
+
+        case 'p':
+            uvr_physical_dev = optarg;
+            break;
+
+        default:
+            return -1;
+        }
+    }
 
     /* daemonize... */
     if (daemon(0, 0) < 0) {
         return -1;
 	}
-    vr_host_io_init();
+
+    ret = vr_host_io_init();
+    if (ret)
+        return ret;
 
     /* init the vrouter */
     ret = vrouter_host_init(VR_MPROTO_SANDESH);